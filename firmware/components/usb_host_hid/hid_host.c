@@ -12,6 +12,7 @@
 #include <sys/param.h>
 #include "esp_log.h"
 #include "esp_check.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
@@ -69,6 +70,41 @@ static const char *TAG = "hid-host";
 
 #define DEFAULT_TIMEOUT_MS  (5000)
 
+// The control transfer holds the setup packet and up to a whole report descriptor
+#define CTRL_XFER_SIZE      (USB_SETUP_PACKET_SIZE + CONFIG_USB_HOST_HID_REPORT_DESC_SIZE)
+// Max. packet size of a full-speed interrupt endpoint
+#define IN_XFER_SIZE        (64)
+
+// External HID Device handles hold the interface slot index in the low bits
+#define HID_HANDLE_INDEX_BITS   (8)
+#define HID_HANDLE_INDEX_MASK   ((1U << HID_HANDLE_INDEX_BITS) - 1)
+_Static_assert(CONFIG_USB_HOST_HID_MAX_INTERFACES <= HID_HANDLE_INDEX_MASK, "Too many HID interfaces");
+
+/**
+ * @brief HID class specific request
+*/
+typedef struct hid_class_request {
+    uint8_t bRequest;               /**< bRequest  */
+    uint16_t wValue;                /**< wValue: Report Type and Report ID */
+    uint16_t wIndex;                /**< wIndex: Interface */
+    uint16_t wLength;               /**< wLength: Report Length */
+    uint8_t *data;                  /**< Pointer to data */
+} hid_class_request_t;
+
+/**
+ * @brief Request in the control transfer pipeline of a HID Device
+ */
+typedef struct {
+    uint8_t bmRequestType;                  /**< bmRequestType, the direction selects copy in or out */
+    hid_class_request_t req;                /**< Request, data stays owned by the submitter */
+    size_t *out_length;                     /**< Length of IN data received, may be NULL */
+    struct hid_interface *iface;            /**< Interface the request was submitted for */
+    hid_host_device_handle_t iface_handle;  /**< Handle of iface at submission */
+    bool report_desc;                       /**< Request reads the report descriptor of iface */
+    hid_host_request_cb_t callback;         /**< Completion callback */
+    void *arg;                              /**< Completion callback argument */
+} hid_request_t;
+
 /**
  * @brief HID Device structure.
  *
@@ -80,6 +116,15 @@ typedef struct hid_host_device {
     usb_transfer_t *ctrl_xfer;                  /**< Pointer to control transfer buffer */
     usb_device_handle_t dev_hdl;                /**< USB device handle */
     uint8_t dev_addr;                           /**< USB device address */
+    bool in_use;                                /**< Device slot is taken */
+    StaticSemaphore_t device_busy_buf;          /**< Storage of device_busy */
+    StaticSemaphore_t ctrl_xfer_done_buf;       /**< Storage of ctrl_xfer_done */
+    hid_request_t requests[CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE]; /**< Request ring, the first one is on EP0 */
+    uint8_t request_first;                      /**< Index of the first request */
+    uint8_t request_count;                      /**< Number of queued requests */
+    int64_t request_deadline_us;                /**< Time the first request gets canceled */
+    bool request_timed_out;                     /**< First request is being canceled */
+    esp_err_t request_start_err;                /**< First request could not be submitted, see hid_request_retire() */
 } hid_device_t;
 
 /**
@@ -111,6 +156,13 @@ typedef struct hid_interface {
     hid_host_interface_event_cb_t user_cb;  /**< Interface application callback */
     void *user_cb_arg;                      /**< Interface application callback arg */
     hid_iface_state_t state;                /**< Interface state */
+    bool in_xfer_failed;                    /**< IN transfer stopped on an error, see hid_host_device_recover_async() */
+    hid_host_request_cb_t recover_cb;       /**< Completion callback of a recovery */
+    void *recover_cb_arg;                   /**< Completion callback argument of a recovery */
+    bool in_use;                            /**< Interface slot is taken */
+    uint32_t generation;                    /**< Number of times the slot was taken, wraps in the handle */
+    hid_host_device_handle_t handle;        /**< External handle while the slot is taken, else NULL */
+    uint8_t report_desc_buf[CONFIG_USB_HOST_HID_REPORT_DESC_SIZE]; /**< Storage of report_desc */
 } hid_iface_t;
 
 /**
@@ -131,6 +183,16 @@ typedef struct {
 
 static hid_driver_t *s_hid_driver;                              /**< Internal pointer to HID driver */
 
+/**
+ * @brief Preallocated HID device and interface slots
+ *
+ * Transfers and semaphores of all slots are created in hid_host_install() and kept until
+ * hid_host_uninstall(). Enumeration only takes and returns slots, so repeated attach and
+ * detach does not allocate from the heap.
+ */
+static hid_device_t s_hid_devices[CONFIG_USB_HOST_HID_MAX_DEVICES];
+static hid_iface_t s_hid_ifaces[CONFIG_USB_HOST_HID_MAX_INTERFACES];
+
 
 // ----------------------- Private Prototypes ----------------------------------
 
@@ -142,17 +204,6 @@ static esp_err_t hid_host_install_device(uint8_t dev_addr,
 static esp_err_t hid_host_uninstall_device(hid_device_t *hid_device);
 
 // --------------------------- Internal Logic ----------------------------------
-/**
- * @brief HID class specific request
-*/
-typedef struct hid_class_request {
-    uint8_t bRequest;               /**< bRequest  */
-    uint16_t wValue;                /**< wValue: Report Type and Report ID */
-    uint16_t wIndex;                /**< wIndex: Interface */
-    uint16_t wLength;               /**< wLength: Report Length */
-    uint8_t *data;                  /**< Pointer to data */
-} hid_class_request_t;
-
 
 // ----------------- USB Event Handler - Internal Task -------------------------
 
@@ -165,9 +216,12 @@ typedef struct hid_class_request {
  */
 static void event_handler_task(void *arg)
 {
+    (void)arg;
     ESP_LOGD(TAG, "USB HID handling start");
-    while (hid_host_handle_events(portMAX_DELAY) == ESP_OK) {
-    }
+    esp_err_t ret;
+    do {
+        ret = hid_host_handle_events(portMAX_DELAY);
+    } while (ESP_OK == ret || ESP_ERR_TIMEOUT == ret);
     ESP_LOGD(TAG, "USB HID handling stop");
     vTaskDelete(NULL);
 }
@@ -180,16 +234,13 @@ static void event_handler_task(void *arg)
  */
 static hid_device_t *get_hid_device_by_handle(usb_device_handle_t usb_handle)
 {
-    hid_device_t *device = NULL;
-
-    HID_ENTER_CRITICAL();
-    STAILQ_FOREACH(device, &s_hid_driver->hid_devices_tailq, tailq_entry) {
-        if (usb_handle == device->dev_hdl) {
-            HID_EXIT_CRITICAL();
-            return device;
+    // Device slots are only taken and returned from the client event callback,
+    // which is also the only caller
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_DEVICES; i++) {
+        if (s_hid_devices[i].in_use && usb_handle == s_hid_devices[i].dev_hdl) {
+            return &s_hid_devices[i];
         }
     }
-    HID_EXIT_CRITICAL();
     return NULL;
 }
 
@@ -205,44 +256,40 @@ static inline hid_device_t *get_hid_device_from_context(usb_transfer_t *xfer)
 }
 
 /**
- * @brief Verify presence of Interface in the RAM list
+ * @brief Create the external HID Device handle of an Interface slot
+ *
+ * The handle is not a pointer. It encodes the slot index plus one in the low byte and the
+ * generation of the slot above it, so it is never NULL and stops matching once the slot
+ * is returned, even if the slot is taken again later.
  *
  * @param[in] iface         Pointer to an Interface structure
- * @return true             Interface is in the list
- * @return false            Interface is not in the list
+ * @return hid_host_device_handle_t HID Device handle
  */
-static inline bool is_interface_in_list(hid_iface_t *iface)
+static inline hid_host_device_handle_t iface_make_handle(const hid_iface_t *iface)
 {
-    hid_iface_t *interface = NULL;
-
-    HID_ENTER_CRITICAL();
-    STAILQ_FOREACH(interface, &s_hid_driver->hid_ifaces_tailq, tailq_entry) {
-        if (iface == interface) {
-            HID_EXIT_CRITICAL();
-            return true;
-        }
-    }
-
-    HID_EXIT_CRITICAL();
-    return false;
+    const uintptr_t index = iface - s_hid_ifaces;
+    return (hid_host_device_handle_t)((uintptr_t)iface->generation << HID_HANDLE_INDEX_BITS | (index + 1));
 }
 
 /**
- * @brief Get HID Interface pointer by external HID Device handle with verification in RAM list
+ * @brief Get HID Interface pointer by external HID Device handle
+ *
+ * A bounds check and a compare with the handle of the slot, no list walk and no lock.
  *
  * @param[in] hid_dev_handle HID Device handle
- * @return hid_iface_t       Pointer to an Interface structure
+ * @return hid_iface_t       Pointer to an Interface structure, NULL if the handle is stale or invalid
  */
 static hid_iface_t *get_iface_by_handle(hid_host_device_handle_t hid_dev_handle)
 {
-    hid_iface_t *hid_iface = (hid_iface_t *) hid_dev_handle;
+    const uintptr_t index = ((uintptr_t)hid_dev_handle & HID_HANDLE_INDEX_MASK) - 1;
 
-    if (!is_interface_in_list(hid_iface)) {
+    if (index >= CONFIG_USB_HOST_HID_MAX_INTERFACES ||
+            s_hid_ifaces[index].handle != hid_dev_handle) {
         ESP_LOGE(TAG, "HID interface handle not found");
         return NULL;
     }
 
-    return hid_iface;
+    return &s_hid_ifaces[index];
 }
 
 /**
@@ -301,12 +348,8 @@ static inline void hid_host_user_interface_callback(hid_iface_t *hid_iface,
 {
     assert(hid_iface);
 
-    hid_host_dev_params_t *dev_params = &hid_iface->dev_params;
-
-    assert(dev_params);
-
     if (hid_iface->user_cb) {
-        hid_iface->user_cb(hid_iface, event, hid_iface->user_cb_arg);
+        hid_iface->user_cb(hid_iface->handle, event, hid_iface->user_cb_arg);
     }
 }
 
@@ -321,12 +364,8 @@ static inline void hid_host_user_device_callback(hid_iface_t *hid_iface,
 {
     assert(hid_iface);
 
-    hid_host_dev_params_t *dev_params = &hid_iface->dev_params;
-
-    assert(dev_params);
-
     if (s_hid_driver && s_hid_driver->user_cb) {
-        s_hid_driver->user_cb(hid_iface, event, s_hid_driver->user_arg);
+        s_hid_driver->user_cb(hid_iface->handle, event, s_hid_driver->user_arg);
     }
 }
 
@@ -344,16 +383,33 @@ static esp_err_t hid_host_add_interface(hid_device_t *hid_device,
                                         const hid_descriptor_t *hid_desc,
                                         const usb_ep_desc_t *ep_in_desc)
 {
-    hid_iface_t *hid_iface = calloc(1, sizeof(hid_iface_t));
-
-    HID_RETURN_ON_FALSE(hid_iface,
-                        ESP_ERR_NO_MEM,
-                        "Unable to allocate memory");
+    hid_iface_t *hid_iface = NULL;
 
     HID_ENTER_CRITICAL();
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_INTERFACES; i++) {
+        if (!s_hid_ifaces[i].in_use) {
+            hid_iface = &s_hid_ifaces[i];
+            break;
+        }
+    }
+    HID_RETURN_ON_FALSE_CRITICAL(hid_iface, ESP_ERR_NO_MEM);
+
+    hid_iface->in_use = true;
+    hid_iface->generation++;
+    hid_iface->handle = iface_make_handle(hid_iface);
     hid_iface->parent = hid_device;
     hid_iface->state = HID_INTERFACE_STATE_NOT_INITIALIZED;
-    hid_iface->dev_params.addr = hid_device->dev_addr;
+    hid_iface->dev_params = (hid_host_dev_params_t) {
+        .addr = hid_device->dev_addr
+    };
+    hid_iface->ep_in = 0;
+    hid_iface->ep_in_mps = 0;
+    hid_iface->country_code = 0;
+    hid_iface->report_desc_size = 0;
+    hid_iface->report_desc = NULL;
+    hid_iface->user_cb = NULL;
+    hid_iface->user_cb_arg = NULL;
+    hid_iface->in_xfer_failed = false;
 
     if (iface_desc) {
         hid_iface->dev_params.iface_num = iface_desc->bInterfaceNumber;
@@ -400,7 +456,8 @@ static esp_err_t _hid_host_remove_interface(hid_iface_t *hid_iface)
 {
     hid_iface->state = HID_INTERFACE_STATE_NOT_INITIALIZED;
     STAILQ_REMOVE(&s_hid_driver->hid_ifaces_tailq, hid_iface, hid_interface, tailq_entry);
-    free(hid_iface);
+    hid_iface->handle = NULL;
+    hid_iface->in_use = false;
     return ESP_OK;
 }
 
@@ -464,11 +521,16 @@ static esp_err_t hid_host_interface_list_create(hid_device_t *hid_device,
             if (hid_desc) {
                 ep_in_desc = get_iface_ep_in(iface_desc, total_length);
                 if (ep_in_desc) {
-                    HID_RETURN_ON_ERROR( hid_host_add_interface(hid_device,
-                                         iface_desc,
-                                         hid_desc,
-                                         ep_in_desc),
-                                         "Unable to add HID Interface to the RAM list");
+                    esp_err_t ret = hid_host_add_interface(hid_device,
+                                                           iface_desc,
+                                                           hid_desc,
+                                                           ep_in_desc);
+                    if (ESP_ERR_NO_MEM == ret) {
+                        ESP_LOGW(TAG, "No free interface slot, ignoring bInterfaceNumber=%d",
+                                 iface_desc->bInterfaceNumber);
+                    } else {
+                        HID_RETURN_ON_ERROR(ret, "Unable to add HID Interface to the RAM list");
+                    }
                 }
             }
         } // HID Interface
@@ -503,7 +565,11 @@ static bool hid_host_device_init_attempt(uint8_t dev_addr)
     // Create HID interfaces list in RAM, connected to the particular USB dev
     if (is_hid_device) {
         // Proceed, add HID device to the list, get handle if necessary
-        ESP_ERROR_CHECK( hid_host_install_device(dev_addr, dev_hdl, &hid_device) );
+        if (hid_host_install_device(dev_addr, dev_hdl, &hid_device) != ESP_OK) {
+            usb_host_device_close(s_hid_driver->client_handle, dev_hdl);
+            ESP_LOGW(TAG, "No free HID device slot for USB port %d", dev_addr);
+            return false;
+        }
         // Create Interfaces list for a possibility to claim Interface
         ESP_ERROR_CHECK( hid_host_interface_list_create(hid_device, config_desc) );
     } else {
@@ -535,7 +601,7 @@ static esp_err_t hid_host_device_disconnected(usb_device_handle_t dev_hdl)
         HID_EXIT_CRITICAL();
 
         if (hid_iface_curr->parent && (hid_iface_curr->parent->dev_addr == hid_device->dev_addr)) {
-            HID_RETURN_ON_ERROR( hid_host_device_close(hid_iface_curr),
+            HID_RETURN_ON_ERROR( hid_host_device_close(hid_iface_curr->handle),
                                  "Unable to close device");
         }
         HID_ENTER_CRITICAL();
@@ -558,6 +624,7 @@ static esp_err_t hid_host_device_disconnected(usb_device_handle_t dev_hdl)
  */
 static void client_event_cb(const usb_host_client_event_msg_t *event, void *arg)
 {
+    (void)arg;
     if (event->event == USB_HOST_CLIENT_EVENT_NEW_DEV) {
         hid_host_device_init_attempt(event->new_dev.address);
     } else if (event->event == USB_HOST_CLIENT_EVENT_DEV_GONE) {
@@ -566,28 +633,29 @@ static void client_event_cb(const usb_host_client_event_msg_t *event, void *arg)
 }
 
 /**
- * @brief HID Host claim Interface and prepare transfer, change state to READY
+ * @brief HID Host claim Interface and check its transfer, change state to READY
  *
  * @param[in] iface       Pointer to Interface structure,
  * @return esp_err_t
  */
 static esp_err_t hid_host_interface_claim_and_prepare_transfer(hid_iface_t *iface)
 {
+    HID_RETURN_ON_FALSE(iface->ep_in_mps <= iface->in_xfer->data_buffer_size,
+                        ESP_ERR_INVALID_SIZE,
+                        "EP IN max. packet size too large");
+
     HID_RETURN_ON_ERROR( usb_host_interface_claim( s_hid_driver->client_handle,
                          iface->parent->dev_hdl,
                          iface->dev_params.iface_num, 0),
                          "Unable to claim Interface");
 
-    HID_RETURN_ON_ERROR( usb_host_transfer_alloc(iface->ep_in_mps, 0, &iface->in_xfer),
-                         "Unable to allocate transfer buffer for EP IN");
-
     // Change state
     iface->state = HID_INTERFACE_STATE_READY;
     return ESP_OK;
 }
 
 /**
- * @brief HID Host release Interface and free transfer, change state to IDLE
+ * @brief HID Host release Interface, change state to IDLE
  *
  * @param[in] iface       Pointer to Interface structure,
  * @return esp_err_t
@@ -597,7 +665,7 @@ static esp_err_t hid_host_interface_release_and_free_transfer(hid_iface_t *iface
     HID_RETURN_ON_INVALID_ARG(iface);
     HID_RETURN_ON_INVALID_ARG(iface->parent);
 
-    HID_RETURN_ON_FALSE(is_interface_in_list(iface),
+    HID_RETURN_ON_FALSE(iface->in_use,
                         ESP_ERR_NOT_FOUND,
                         "Interface handle not found");
 
@@ -606,8 +674,6 @@ static esp_err_t hid_host_interface_release_and_free_transfer(hid_iface_t *iface
                          iface->dev_params.iface_num),
                          "Unable to release HID Interface");
 
-    ESP_ERROR_CHECK( usb_host_transfer_free(iface->in_xfer) );
-
     // Change state
     iface->state = HID_INTERFACE_STATE_IDLE;
     return ESP_OK;
@@ -624,7 +690,7 @@ static esp_err_t hid_host_disable_interface(hid_iface_t *iface)
     HID_RETURN_ON_INVALID_ARG(iface);
     HID_RETURN_ON_INVALID_ARG(iface->parent);
 
-    HID_RETURN_ON_FALSE(is_interface_in_list(iface),
+    HID_RETURN_ON_FALSE(iface->in_use,
                         ESP_ERR_NOT_FOUND,
                         "Interface handle not found");
 
@@ -660,8 +726,11 @@ static void in_xfer_done(usb_transfer_t *in_xfer)
         // Notify user
         hid_host_user_interface_callback(iface, HID_HOST_INTERFACE_EVENT_INPUT_REPORT);
         // Relaunch transfer
-        usb_host_transfer_submit(in_xfer);
-        return;
+        if (ESP_OK == usb_host_transfer_submit(in_xfer)) {
+            return;
+        }
+        ESP_LOGE(TAG, "Unable to resubmit transfer");
+        break;
     case USB_TRANSFER_STATUS_NO_DEVICE:
     case USB_TRANSFER_STATUS_CANCELED:
         // User is notified about device disconnection from usb_event_cb
@@ -669,10 +738,12 @@ static void in_xfer_done(usb_transfer_t *in_xfer)
         return;
     default:
         // Any other error
+        ESP_LOGE(TAG, "Transfer failed, status %d", in_xfer->status);
         break;
     }
 
-    ESP_LOGE(TAG, "Transfer failed, status %d", in_xfer->status);
+    // The transfer stays idle until the user recovers the interface
+    iface->in_xfer_failed = true;
     // Notify user about transfer or any other error
     hid_host_user_interface_callback(iface, HID_HOST_INTERFACE_EVENT_TRANSFER_ERROR);
 }
@@ -702,122 +773,340 @@ static inline void hid_device_unlock(hid_device_t *hid_device)
 }
 
 /**
- * @brief HID Control transfer complete callback
+ * @brief Remove the request on EP0 from the device queue and notify its submitter
  *
- * @param[in] ctrl_xfer  Pointer to transfer data structure
+ * @param[in] hid_device  Pointer to HID device structure
+ * @param[in] status      Result of the request
+ * @return true           More requests are pending, the next one has to be started
  */
-static void ctrl_xfer_done(usb_transfer_t *ctrl_xfer)
+static bool hid_request_finish(hid_device_t *hid_device, esp_err_t status)
 {
-    assert(ctrl_xfer);
-    hid_device_t *hid_device = (hid_device_t *)ctrl_xfer->context;
-    xSemaphoreGive(hid_device->ctrl_xfer_done);
+    HID_ENTER_CRITICAL();
+    const hid_request_t request = hid_device->requests[hid_device->request_first];
+    hid_device->request_start_err = ESP_OK;
+    hid_device->request_first = (hid_device->request_first + 1) % CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE;
+    const bool pending = --hid_device->request_count > 0;
+    if (pending) {
+        hid_device->request_deadline_us = esp_timer_get_time() + DEFAULT_TIMEOUT_MS * 1000;
+        hid_device->request_timed_out = false;
+    }
+    HID_EXIT_CRITICAL();
+
+    // Requests submitted from the callback queue up behind the pending ones
+    if (request.callback) {
+        request.callback(request.iface_handle, status, request.arg);
+    }
+    return pending;
 }
 
 /**
- * @brief HID control transfer synchronous.
+ * @brief HID Control transfer complete callback
  *
- * @note  Passes interface and endpoint descriptors to obtain:
+ * @param[in] ctrl_xfer  Pointer to transfer data structure
+ */
+static void ctrl_xfer_done(usb_transfer_t *ctrl_xfer);
 
- *        - interface number, IN endpoint, OUT endpoint, max. packet size
+/**
+ * @brief Put the first pending request of a device on EP0
+ *
+ * A request that cannot be submitted is completed with the error by the HID Host event handler,
+ * so its callback never runs in the context of the submitter.
  *
  * @param[in] hid_device  Pointer to HID device structure
- * @param[in] ctrl_xfer   Pointer to the Transfer structure
- * @param[in] len         Number of bytes to transfer
- * @param[in] timeout_ms  Timeout in ms
- * @return esp_err_t
  */
-static esp_err_t hid_control_transfer(hid_device_t *hid_device,
-                                      size_t len,
-                                      uint32_t timeout_ms)
+static void hid_request_start(hid_device_t *hid_device)
 {
-
+    const hid_request_t *request = &hid_device->requests[hid_device->request_first];
     usb_transfer_t *ctrl_xfer = hid_device->ctrl_xfer;
+    usb_setup_packet_t *setup = (usb_setup_packet_t *)ctrl_xfer->data_buffer;
+
+    setup->bmRequestType = request->bmRequestType;
+    setup->bRequest = request->req.bRequest;
+    setup->wValue = request->req.wValue;
+    setup->wIndex = request->req.wIndex;
+    setup->wLength = request->req.wLength;
+
+    if (!(request->bmRequestType & USB_BM_REQUEST_TYPE_DIR_IN) &&
+            request->req.wLength && request->req.data) {
+        memcpy(ctrl_xfer->data_buffer + USB_SETUP_PACKET_SIZE, request->req.data, request->req.wLength);
+    }
 
     ctrl_xfer->device_handle = hid_device->dev_hdl;
     ctrl_xfer->callback = ctrl_xfer_done;
     ctrl_xfer->context = hid_device;
     ctrl_xfer->bEndpointAddress = 0;
-    ctrl_xfer->timeout_ms = timeout_ms;
-    ctrl_xfer->num_bytes = len;
+    ctrl_xfer->timeout_ms = DEFAULT_TIMEOUT_MS;
+    ctrl_xfer->num_bytes = USB_SETUP_PACKET_SIZE + request->req.wLength;
 
-    HID_RETURN_ON_ERROR( usb_host_transfer_submit_control(s_hid_driver->client_handle, ctrl_xfer),
-                         "Unable to submit control transfer");
+    const esp_err_t ret = usb_host_transfer_submit_control(s_hid_driver->client_handle, ctrl_xfer);
+    if (ESP_OK != ret) {
+        ESP_LOGE(TAG, "Unable to submit control transfer: %s", esp_err_to_name(ret));
+        HID_ENTER_CRITICAL();
+        hid_device->request_start_err = ret;
+        HID_EXIT_CRITICAL();
+        usb_host_client_unblock(s_hid_driver->client_handle);
+    }
+}
+
+/**
+ * @brief Complete requests that could not be submitted, in the HID Host event handler
+ */
+static void hid_request_retire(void)
+{
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_DEVICES; i++) {
+        hid_device_t *hid_device = &s_hid_devices[i];
+
+        HID_ENTER_CRITICAL();
+        const esp_err_t err = hid_device->in_use && hid_device->request_count
+                              ? hid_device->request_start_err
+                              : ESP_OK;
+        HID_EXIT_CRITICAL();
+
+        if (ESP_OK != err && hid_request_finish(hid_device, err)) {
+            hid_request_start(hid_device);
+        }
+    }
+}
 
-    BaseType_t received = xSemaphoreTake(hid_device->ctrl_xfer_done, pdMS_TO_TICKS(ctrl_xfer->timeout_ms));
+static void ctrl_xfer_done(usb_transfer_t *ctrl_xfer)
+{
+    assert(ctrl_xfer);
+    hid_device_t *hid_device = (hid_device_t *)ctrl_xfer->context;
+    const hid_request_t *request = &hid_device->requests[hid_device->request_first];
+    esp_err_t status = ESP_OK;
 
-    if (received != pdTRUE) {
-        // Transfer was not finished, error in USB LIB. Reset the endpoint
-        ESP_LOGE(TAG, "Control Transfer Timeout");
+    if (!hid_device->request_count) {
+        // The request was already completed when its device was uninstalled
+        return;
+    }
 
-        HID_RETURN_ON_ERROR( usb_host_endpoint_halt(hid_device->dev_hdl, ctrl_xfer->bEndpointAddress),
-                             "Unable to HALT EP");
-        HID_RETURN_ON_ERROR( usb_host_endpoint_flush(hid_device->dev_hdl, ctrl_xfer->bEndpointAddress),
-                             "Unable to FLUSH EP");
+    if (hid_device->request_timed_out) {
         usb_host_endpoint_clear(hid_device->dev_hdl, ctrl_xfer->bEndpointAddress);
-        return ESP_ERR_TIMEOUT;
+        status = ESP_ERR_TIMEOUT;
+    } else if (USB_TRANSFER_STATUS_COMPLETED != ctrl_xfer->status) {
+        ESP_LOGE(TAG, "Control Transfer failed, status %d", ctrl_xfer->status);
+        status = ESP_FAIL;
+    } else if (request->report_desc && request->iface->handle != request->iface_handle) {
+        // The interface is gone, its slot may already belong to another one
+        status = ESP_ERR_INVALID_STATE;
+    } else if (request->bmRequestType & USB_BM_REQUEST_TYPE_DIR_IN) {
+        // We do not need the setup data, which is still in the transfer data buffer
+        const size_t length = ctrl_xfer->actual_num_bytes - USB_SETUP_PACKET_SIZE;
+        ESP_LOG_BUFFER_HEXDUMP(TAG, ctrl_xfer->data_buffer + USB_SETUP_PACKET_SIZE, length, ESP_LOG_DEBUG);
+        // Copy data if the size is ok
+        if (length <= request->req.wLength) {
+            memcpy(request->req.data, ctrl_xfer->data_buffer + USB_SETUP_PACKET_SIZE, length);
+            if (request->out_length) {
+                *request->out_length = length;
+            }
+            if (request->report_desc) {
+                request->iface->report_desc = request->iface->report_desc_buf;
+            }
+        } else {
+            status = ESP_ERR_INVALID_SIZE;
+        }
     }
 
-    ESP_LOG_BUFFER_HEXDUMP(TAG, ctrl_xfer->data_buffer, ctrl_xfer->actual_num_bytes, ESP_LOG_DEBUG);
+    if (hid_request_finish(hid_device, status)) {
+        hid_request_start(hid_device);
+    }
+}
 
+/**
+ * @brief Queue a request on the pipeline of the interface's device
+ *
+ * Each device has its own queue, so a slow device only delays its own requests.
+ *
+ * @param[in] iface      Pointer to Interface structure
+ * @param[in] request    Request to copy into the queue, iface and iface_handle are filled in
+ * @return esp_err_t
+ */
+static esp_err_t hid_request_submit(hid_iface_t *iface, hid_request_t *request)
+{
+    HID_RETURN_ON_INVALID_ARG(iface);
+    HID_RETURN_ON_INVALID_ARG(iface->parent);
+
+    hid_device_t *hid_device = iface->parent;
+
+    HID_RETURN_ON_FALSE(hid_device->ctrl_xfer->data_buffer_size >= (size_t)(USB_SETUP_PACKET_SIZE + request->req.wLength),
+                        ESP_ERR_INVALID_SIZE,
+                        "Request does not fit into the control transfer");
+
+    request->iface = iface;
+    request->iface_handle = iface->handle;
+
+    HID_ENTER_CRITICAL();
+    HID_RETURN_ON_FALSE_CRITICAL(hid_device->request_count < CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE,
+                                 ESP_ERR_NO_MEM);
+    const uint8_t index = (hid_device->request_first + hid_device->request_count) % CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE;
+    hid_device->requests[index] = *request;
+    const bool idle = hid_device->request_count++ == 0;
+    if (idle) {
+        hid_device->request_deadline_us = esp_timer_get_time() + DEFAULT_TIMEOUT_MS * 1000;
+        hid_device->request_timed_out = false;
+    }
+    HID_EXIT_CRITICAL();
+
+    if (idle) {
+        hid_request_start(hid_device);
+        // Let the event handler pick up the deadline of the new request
+        usb_host_client_unblock(s_hid_driver->client_handle);
+    }
     return ESP_OK;
 }
 
 /**
- * @brief USB class standard request get descriptor
+ * @brief Ticks until the first request deadline, at most timeout
  *
- * @param[in] hidh_device Pointer to HID device structure
- * @param[in] req         Pointer to a class specific request structure
- * @return esp_err_t
+ * @param[in] timeout   Timeout in ticks
+ * @return TickType_t
  */
-static esp_err_t usb_class_request_get_descriptor(hid_device_t *hid_device, const hid_class_request_t *req)
+static TickType_t hid_request_wait_ticks(TickType_t timeout)
 {
-    esp_err_t ret;
-    usb_transfer_t *ctrl_xfer = hid_device->ctrl_xfer;
-    const size_t ctrl_size = hid_device->ctrl_xfer->data_buffer_size;
+    const int64_t now = esp_timer_get_time();
 
-    HID_RETURN_ON_INVALID_ARG(hid_device);
-    HID_RETURN_ON_INVALID_ARG(hid_device->ctrl_xfer);
-    HID_RETURN_ON_INVALID_ARG(req);
-    HID_RETURN_ON_INVALID_ARG(req->data);
+    HID_ENTER_CRITICAL();
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_DEVICES; i++) {
+        const hid_device_t *hid_device = &s_hid_devices[i];
+        if (hid_device->in_use && hid_device->request_count && ESP_OK != hid_device->request_start_err) {
+            timeout = 0;
+        } else if (hid_device->in_use && hid_device->request_count && !hid_device->request_timed_out) {
+            const int64_t remaining_us = hid_device->request_deadline_us - now;
+            const TickType_t ticks = remaining_us > 0 ? pdMS_TO_TICKS(remaining_us / 1000) + 1 : 0;
+            timeout = MIN(timeout, ticks);
+        }
+    }
+    HID_EXIT_CRITICAL();
+    return timeout;
+}
 
-    HID_RETURN_ON_ERROR( hid_device_try_lock(hid_device, DEFAULT_TIMEOUT_MS),
-                         "HID Device is busy by other task");
+/**
+ * @brief Cancel requests that are on EP0 for longer than DEFAULT_TIMEOUT_MS
+ *
+ * The canceled transfer completes through ctrl_xfer_done() with ESP_ERR_TIMEOUT.
+ */
+static void hid_request_expire(void)
+{
+    const int64_t now = esp_timer_get_time();
+
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_DEVICES; i++) {
+        hid_device_t *hid_device = &s_hid_devices[i];
+
+        HID_ENTER_CRITICAL();
+        const bool expired = hid_device->in_use && hid_device->request_count &&
+                             ESP_OK == hid_device->request_start_err &&
+                             !hid_device->request_timed_out && now >= hid_device->request_deadline_us;
+        if (expired) {
+            hid_device->request_timed_out = true;
+        }
+        HID_EXIT_CRITICAL();
 
-    if (ctrl_size < (USB_SETUP_PACKET_SIZE + req->wLength)) {
-        usb_device_info_t dev_info;
-        ESP_ERROR_CHECK(usb_host_device_info(hid_device->dev_hdl, &dev_info));
-        // reallocate the ctrl xfer buffer for new length
-        ESP_LOGD(TAG, "Change HID ctrl xfer size from %d to %d",
-                 ctrl_size,
-                 (int) (USB_SETUP_PACKET_SIZE + req->wLength));
-
-        usb_host_transfer_free(hid_device->ctrl_xfer);
-        HID_RETURN_ON_ERROR( usb_host_transfer_alloc(USB_SETUP_PACKET_SIZE + req->wLength,
-                             0,
-                             &hid_device->ctrl_xfer),
-                             "Unable to allocate transfer buffer for EP0");
+        if (expired) {
+            // Transfer was not finished, error in USB LIB. Reset the endpoint
+            ESP_LOGE(TAG, "Control Transfer Timeout");
+            usb_host_endpoint_halt(hid_device->dev_hdl, 0);
+            usb_host_endpoint_flush(hid_device->dev_hdl, 0);
+        }
     }
+}
 
-    usb_setup_packet_t *setup = (usb_setup_packet_t *)ctrl_xfer->data_buffer;
+/**
+ * @brief Completion of a synchronous request
+ */
+typedef struct {
+    hid_device_t *hid_device;       /**< Device of the request */
+    esp_err_t status;               /**< Result of the request */
+} hid_request_sync_t;
+
+static void hid_request_sync_done(hid_host_device_handle_t hid_dev_handle, esp_err_t status, void *arg)
+{
+    (void)hid_dev_handle;
+    hid_request_sync_t *sync = (hid_request_sync_t *)arg;
+    sync->status = status;
+    xSemaphoreGive(sync->hid_device->ctrl_xfer_done);
+}
+
+/**
+ * @brief Take a synchronous request that timed out out of the device queue
+ *
+ * A request on EP0 cannot be taken out, its transfer is canceled right away instead.
+ *
+ * @param[in] hid_device  Pointer to HID device structure
+ * @param[in] sync        Completion of the request
+ * @return true           The request was taken out and will not complete
+ * @return false          The request is on EP0 or completing, its callback follows
+ */
+static bool hid_request_cancel(hid_device_t *hid_device, const hid_request_sync_t *sync)
+{
+    bool removed = false;
+    bool on_ep0 = false;
+
+    HID_ENTER_CRITICAL();
+    for (uint8_t i = 0; i < hid_device->request_count; i++) {
+        const uint8_t index = (hid_device->request_first + i) % CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE;
+        if (hid_device->requests[index].arg != sync) {
+            continue;
+        }
+        if (i == 0) {
+            hid_device->request_deadline_us = 0;
+            on_ep0 = true;
+        } else {
+            for (uint8_t j = i; j + 1 < hid_device->request_count; j++) {
+                hid_device->requests[(hid_device->request_first + j) % CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE] =
+                    hid_device->requests[(hid_device->request_first + j + 1) % CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE];
+            }
+            hid_device->request_count--;
+            removed = true;
+        }
+        break;
+    }
+    HID_EXIT_CRITICAL();
 
-    setup->bmRequestType = USB_BM_REQUEST_TYPE_DIR_IN |
-                           USB_BM_REQUEST_TYPE_TYPE_STANDARD |
-                           USB_BM_REQUEST_TYPE_RECIP_INTERFACE;
-    setup->bRequest = req->bRequest;
-    setup->wValue = req->wValue;
-    setup->wIndex = req->wIndex;
-    setup->wLength = req->wLength;
+    if (on_ep0) {
+        // Let the event handler cancel it now instead of at its deadline
+        usb_host_client_unblock(s_hid_driver->client_handle);
+    }
+    return removed;
+}
 
-    ret = hid_control_transfer(hid_device,
-                               USB_SETUP_PACKET_SIZE + req->wLength,
-                               DEFAULT_TIMEOUT_MS);
+/**
+ * @brief Queue a request and wait for its completion
+ *
+ * Waits DEFAULT_TIMEOUT_MS for the request, queued requests of other submitters included. Must not
+ * be called from a request callback or from the task that handles the HID Host events.
+ *
+ * @param[in] iface      Pointer to Interface structure
+ * @param[in] request    Request, callback and arg are filled in
+ * @return esp_err_t
+ */
+static esp_err_t hid_request_sync(hid_iface_t *iface, hid_request_t *request)
+{
+    HID_RETURN_ON_INVALID_ARG(iface);
+    HID_RETURN_ON_INVALID_ARG(iface->parent);
+
+    hid_device_t *hid_device = iface->parent;
+    hid_request_sync_t sync = {
+        .hid_device = hid_device,
+        .status = ESP_FAIL
+    };
 
+    HID_RETURN_ON_ERROR( hid_device_try_lock(hid_device, DEFAULT_TIMEOUT_MS),
+                         "HID Device is busy by other task");
+
+    request->callback = hid_request_sync_done;
+    request->arg = &sync;
+    esp_err_t ret = hid_request_submit(iface, request);
     if (ESP_OK == ret) {
-        ctrl_xfer->actual_num_bytes -= USB_SETUP_PACKET_SIZE;
-        if (ctrl_xfer->actual_num_bytes <= req->wLength) {
-            memcpy(req->data, ctrl_xfer->data_buffer + USB_SETUP_PACKET_SIZE, ctrl_xfer->actual_num_bytes);
+        if (xSemaphoreTake(hid_device->ctrl_xfer_done, pdMS_TO_TICKS(DEFAULT_TIMEOUT_MS))) {
+            ret = sync.status;
+        } else if (hid_request_cancel(hid_device, &sync)) {
+            ESP_LOGE(TAG, "Request not started within %d ms", DEFAULT_TIMEOUT_MS);
+            ret = ESP_ERR_TIMEOUT;
         } else {
-            ret = ESP_ERR_INVALID_SIZE;
+            // The event handler cancels the transfer on EP0 right away, and sync must
+            // outlive the callback
+            xSemaphoreTake(hid_device->ctrl_xfer_done, portMAX_DELAY);
+            ret = sync.status;
         }
     }
 
@@ -827,12 +1116,13 @@ static esp_err_t usb_class_request_get_descriptor(hid_device_t *hid_device, cons
 }
 
 /**
- * @brief HID Host Request Report Descriptor
+ * @brief Build the request for the report descriptor of an interface
  *
- * @param[in] hidh_iface      Pointer to HID Interface configuration structure
+ * @param[in] iface      Pointer to Interface structure
+ * @param[out] request   Request to fill
  * @return esp_err_t
  */
-static esp_err_t hid_class_request_report_descriptor(hid_iface_t *iface)
+static esp_err_t hid_request_report_descriptor(hid_iface_t *iface, hid_request_t *request)
 {
     HID_RETURN_ON_INVALID_ARG(iface);
 
@@ -842,115 +1132,95 @@ static esp_err_t hid_class_request_report_descriptor(hid_iface_t *iface)
                         ESP_ERR_INVALID_STATE,
                         "Unable to request report descriptor. Interface is not ready");
 
-    iface->report_desc = malloc(iface->report_desc_size);
-    HID_RETURN_ON_FALSE(iface->report_desc,
-                        ESP_ERR_NO_MEM,
-                        "Unable to allocate memory");
-
-    const hid_class_request_t get_desc = {
-        .bRequest = USB_B_REQUEST_GET_DESCRIPTOR,
-        .wValue = (HID_CLASS_DESCRIPTOR_TYPE_REPORT << 8),
-        .wIndex = iface->dev_params.iface_num,
-        .wLength = iface->report_desc_size,
-        .data = iface->report_desc
+    HID_RETURN_ON_FALSE(iface->report_desc_size <= sizeof(iface->report_desc_buf),
+                        ESP_ERR_INVALID_SIZE,
+                        "Report descriptor too large");
+
+    *request = (hid_request_t) {
+        .bmRequestType = USB_BM_REQUEST_TYPE_DIR_IN |
+        USB_BM_REQUEST_TYPE_TYPE_STANDARD |
+        USB_BM_REQUEST_TYPE_RECIP_INTERFACE,
+        .req = {
+            .bRequest = USB_B_REQUEST_GET_DESCRIPTOR,
+            .wValue = (HID_CLASS_DESCRIPTOR_TYPE_REPORT << 8),
+            .wIndex = iface->dev_params.iface_num,
+            .wLength = iface->report_desc_size,
+            .data = iface->report_desc_buf
+        },
+        .report_desc = true
     };
-
-    return usb_class_request_get_descriptor(iface->parent, &get_desc);
+    return ESP_OK;
 }
 
 /**
- * @brief HID class specific request Set
+ * @brief HID Host Request Report Descriptor
  *
- * @param[in] hid_device Pointer to HID device structure
- * @param[in] req        Pointer to a class specific request structure
+ * @param[in] hidh_iface      Pointer to HID Interface configuration structure
  * @return esp_err_t
  */
-static esp_err_t hid_class_request_set(hid_device_t *hid_device,
-                                       const hid_class_request_t *req)
+static esp_err_t hid_class_request_report_descriptor(hid_iface_t *iface)
 {
-    esp_err_t ret;
-    usb_transfer_t *ctrl_xfer = hid_device->ctrl_xfer;
-    HID_RETURN_ON_INVALID_ARG(hid_device);
-    HID_RETURN_ON_INVALID_ARG(hid_device->ctrl_xfer);
+    hid_request_t request;
 
-    HID_RETURN_ON_ERROR( hid_device_try_lock(hid_device, DEFAULT_TIMEOUT_MS),
-                         "HID Device is busy by other task");
-
-    usb_setup_packet_t *setup = (usb_setup_packet_t *)ctrl_xfer->data_buffer;
-    setup->bmRequestType = USB_BM_REQUEST_TYPE_DIR_OUT |
-                           USB_BM_REQUEST_TYPE_TYPE_CLASS |
-                           USB_BM_REQUEST_TYPE_RECIP_INTERFACE;
-    setup->bRequest = req->bRequest;
-    setup->wValue = req->wValue;
-    setup->wIndex = req->wIndex;
-    setup->wLength = req->wLength;
-
-    if (req->wLength && req->data) {
-        memcpy(ctrl_xfer->data_buffer + USB_SETUP_PACKET_SIZE, req->data, req->wLength);
-    }
+    HID_RETURN_ON_ERROR( hid_request_report_descriptor(iface, &request),
+                         "Unable to request report descriptor");
 
-    ret = hid_control_transfer(hid_device,
-                               USB_SETUP_PACKET_SIZE + setup->wLength,
-                               DEFAULT_TIMEOUT_MS);
+    return hid_request_sync(iface, &request);
+}
 
-    hid_device_unlock(hid_device);
+/**
+ * @brief HID class specific request Set
+ *
+ * @param[in] iface      Pointer to Interface structure
+ * @param[in] req        Pointer to a class specific request structure
+ * @param[in] callback   Completion callback, NULL to wait for completion
+ * @param[in] arg        Completion callback argument
+ * @return esp_err_t
+ */
+static esp_err_t hid_class_request_set(hid_iface_t *iface,
+                                       const hid_class_request_t *req,
+                                       hid_host_request_cb_t callback,
+                                       void *arg)
+{
+    hid_request_t request = {
+        .bmRequestType = USB_BM_REQUEST_TYPE_DIR_OUT |
+        USB_BM_REQUEST_TYPE_TYPE_CLASS |
+        USB_BM_REQUEST_TYPE_RECIP_INTERFACE,
+        .req = *req,
+        .callback = callback,
+        .arg = arg
+    };
 
-    return ret;
+    return callback ? hid_request_submit(iface, &request) : hid_request_sync(iface, &request);
 }
 
 /**
  * @brief HID class specific request Get
  *
- * @param[in] hid_device    Pointer to HID device structure
+ * @param[in] iface         Pointer to Interface structure
  * @param[in] req           Pointer to a class specific request structure
  * @param[out] out_length   Length of the response in data buffer of req struct
+ * @param[in] callback      Completion callback, NULL to wait for completion
+ * @param[in] arg           Completion callback argument
  * @return esp_err_t
  */
-static esp_err_t hid_class_request_get(hid_device_t *hid_device,
+static esp_err_t hid_class_request_get(hid_iface_t *iface,
                                        const hid_class_request_t *req,
-                                       size_t *out_length)
+                                       size_t *out_length,
+                                       hid_host_request_cb_t callback,
+                                       void *arg)
 {
-    esp_err_t ret;
-    HID_RETURN_ON_INVALID_ARG(hid_device);
-    HID_RETURN_ON_INVALID_ARG(hid_device->ctrl_xfer);
-
-    usb_transfer_t *ctrl_xfer = hid_device->ctrl_xfer;
-
-    HID_RETURN_ON_ERROR( hid_device_try_lock(hid_device, DEFAULT_TIMEOUT_MS),
-                         "HID Device is busy by other task");
-
-    usb_setup_packet_t *setup = (usb_setup_packet_t *)ctrl_xfer->data_buffer;
-
-    setup->bmRequestType = USB_BM_REQUEST_TYPE_DIR_IN |
-                           USB_BM_REQUEST_TYPE_TYPE_CLASS |
-                           USB_BM_REQUEST_TYPE_RECIP_INTERFACE;
-    setup->bRequest = req->bRequest;
-    setup->wValue = req->wValue;
-    setup->wIndex = req->wIndex;
-    setup->wLength = req->wLength;
-
-    ret = hid_control_transfer(hid_device,
-                               USB_SETUP_PACKET_SIZE + setup->wLength,
-                               DEFAULT_TIMEOUT_MS);
-
-    if (ESP_OK == ret) {
-        // We do not need the setup data, which is still in the transfer data buffer
-        ctrl_xfer->actual_num_bytes -= USB_SETUP_PACKET_SIZE;
-        // Copy data if the size is ok
-        if (ctrl_xfer->actual_num_bytes <= req->wLength) {
-            memcpy(req->data, ctrl_xfer->data_buffer + USB_SETUP_PACKET_SIZE, ctrl_xfer->actual_num_bytes);
-            // return actual num bytes of response
-            if (out_length) {
-                *out_length = ctrl_xfer->actual_num_bytes;
-            }
-        } else {
-            ret = ESP_ERR_INVALID_SIZE;
-        }
-    }
-
-    hid_device_unlock(hid_device);
+    hid_request_t request = {
+        .bmRequestType = USB_BM_REQUEST_TYPE_DIR_IN |
+        USB_BM_REQUEST_TYPE_TYPE_CLASS |
+        USB_BM_REQUEST_TYPE_RECIP_INTERFACE,
+        .req = *req,
+        .out_length = out_length,
+        .callback = callback,
+        .arg = arg
+    };
 
-    return ret;
+    return callback ? hid_request_submit(iface, &request) : hid_request_sync(iface, &request);
 }
 
 // ---------------------------- Private ---------------------------------------
@@ -962,7 +1232,7 @@ static esp_err_t hid_host_string_descriptor_copy(wchar_t *dest,
     }
     if (src != NULL) {
         size_t len = MIN((src->bLength - USB_STANDARD_DESC_SIZE) / 2, HID_STR_DESC_MAX_LENGTH - 1);
-        for (int i = 0; i < len; i++) {
+        for (size_t i = 0; i < len; i++) {
             dest[i] = (wchar_t) src->wData[i];
         }
         // This should be always true, we just check to avoid LoadProhibited exception
@@ -979,34 +1249,25 @@ esp_err_t hid_host_install_device(uint8_t dev_addr,
                                   usb_device_handle_t dev_hdl,
                                   hid_device_t **hid_device_handle)
 {
-    esp_err_t ret;
-    hid_device_t *hid_device;
-
-    HID_GOTO_ON_FALSE( hid_device = calloc(1, sizeof(hid_device_t)),
-                       ESP_ERR_NO_MEM,
-                       "Unable to allocate memory for HID Device");
+    hid_device_t *hid_device = NULL;
 
+    HID_ENTER_CRITICAL();
+    HID_RETURN_ON_FALSE_CRITICAL( s_hid_driver, ESP_ERR_INVALID_STATE );
+    HID_RETURN_ON_FALSE_CRITICAL( s_hid_driver->client_handle, ESP_ERR_INVALID_STATE );
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_DEVICES; i++) {
+        if (!s_hid_devices[i].in_use) {
+            hid_device = &s_hid_devices[i];
+            break;
+        }
+    }
+    HID_RETURN_ON_FALSE_CRITICAL( hid_device, ESP_ERR_NO_MEM );
+    hid_device->in_use = true;
     hid_device->dev_addr = dev_addr;
     hid_device->dev_hdl = dev_hdl;
-
-    HID_GOTO_ON_FALSE( hid_device->ctrl_xfer_done = xSemaphoreCreateBinary(),
-                       ESP_ERR_NO_MEM,
-                       "Unable to create semaphore");
-    HID_GOTO_ON_FALSE( hid_device->device_busy =  xSemaphoreCreateMutex(),
-                       ESP_ERR_NO_MEM,
-                       "Unable to create semaphore");
-
-    /*
-    * TIP: Usually, we need to allocate 'EP bMaxPacketSize0 + 1' here.
-    * To take the size of a report descriptor into a consideration,
-    * we need to allocate more here, e.g. 512 bytes.
-    */
-    HID_GOTO_ON_ERROR(usb_host_transfer_alloc(512, 0, &hid_device->ctrl_xfer),
-                      "Unable to allocate transfer buffer");
-
-    HID_ENTER_CRITICAL();
-    HID_GOTO_ON_FALSE_CRITICAL( s_hid_driver, ESP_ERR_INVALID_STATE );
-    HID_GOTO_ON_FALSE_CRITICAL( s_hid_driver->client_handle, ESP_ERR_INVALID_STATE );
+    hid_device->request_first = 0;
+    hid_device->request_count = 0;
+    hid_device->request_timed_out = false;
+    hid_device->request_start_err = ESP_OK;
     STAILQ_INSERT_TAIL(&s_hid_driver->hid_devices_tailq, hid_device, tailq_entry);
     HID_EXIT_CRITICAL();
 
@@ -1015,28 +1276,18 @@ esp_err_t hid_host_install_device(uint8_t dev_addr,
     }
 
     return ESP_OK;
-
-fail:
-    hid_host_uninstall_device(hid_device);
-    return ret;
 }
 
 esp_err_t hid_host_uninstall_device(hid_device_t *hid_device)
 {
     HID_RETURN_ON_INVALID_ARG(hid_device);
 
-    HID_RETURN_ON_ERROR( usb_host_transfer_free(hid_device->ctrl_xfer),
-                         "Unable to free transfer buffer for EP0");
     HID_RETURN_ON_ERROR( usb_host_device_close(s_hid_driver->client_handle,
                          hid_device->dev_hdl),
                          "Unable to close USB host");
 
-    if (hid_device->ctrl_xfer_done) {
-        vSemaphoreDelete(hid_device->ctrl_xfer_done);
-    }
-
-    if (hid_device->device_busy) {
-        vSemaphoreDelete(hid_device->device_busy);
+    // The device is gone, complete what is still queued so no submitter waits forever
+    while (hid_device->request_count && hid_request_finish(hid_device, ESP_ERR_INVALID_STATE)) {
     }
 
     ESP_LOGD(TAG, "Remove addr %d device from list",
@@ -1044,12 +1295,233 @@ esp_err_t hid_host_uninstall_device(hid_device_t *hid_device)
 
     HID_ENTER_CRITICAL();
     STAILQ_REMOVE(&s_hid_driver->hid_devices_tailq, hid_device, hid_host_device, tailq_entry);
+    hid_device->in_use = false;
     HID_EXIT_CRITICAL();
 
-    free(hid_device);
     return ESP_OK;
 }
 
+/**
+ * @brief Free transfers and delete semaphores of all device and interface slots
+ */
+static void hid_host_slots_free(void)
+{
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_DEVICES; i++) {
+        hid_device_t *hid_device = &s_hid_devices[i];
+        if (hid_device->ctrl_xfer) {
+            usb_host_transfer_free(hid_device->ctrl_xfer);
+            hid_device->ctrl_xfer = NULL;
+        }
+        if (hid_device->ctrl_xfer_done) {
+            vSemaphoreDelete(hid_device->ctrl_xfer_done);
+            hid_device->ctrl_xfer_done = NULL;
+        }
+        if (hid_device->device_busy) {
+            vSemaphoreDelete(hid_device->device_busy);
+            hid_device->device_busy = NULL;
+        }
+    }
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_INTERFACES; i++) {
+        if (s_hid_ifaces[i].in_xfer) {
+            usb_host_transfer_free(s_hid_ifaces[i].in_xfer);
+            s_hid_ifaces[i].in_xfer = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Allocate transfers and create semaphores of all device and interface slots
+ *
+ * @return esp_err_t
+ */
+static esp_err_t hid_host_slots_alloc(void)
+{
+    esp_err_t ret;
+
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_DEVICES; i++) {
+        hid_device_t *hid_device = &s_hid_devices[i];
+        hid_device->in_use = false;
+        hid_device->ctrl_xfer_done = xSemaphoreCreateBinaryStatic(&hid_device->ctrl_xfer_done_buf);
+        hid_device->device_busy = xSemaphoreCreateMutexStatic(&hid_device->device_busy_buf);
+        HID_GOTO_ON_ERROR( usb_host_transfer_alloc(CTRL_XFER_SIZE, 0, &hid_device->ctrl_xfer),
+                           "Unable to allocate transfer buffer for EP0");
+    }
+    for (int i = 0; i < CONFIG_USB_HOST_HID_MAX_INTERFACES; i++) {
+        s_hid_ifaces[i].in_use = false;
+        HID_GOTO_ON_ERROR( usb_host_transfer_alloc(IN_XFER_SIZE, 0, &s_hid_ifaces[i].in_xfer),
+                           "Unable to allocate transfer buffer for EP IN");
+    }
+    return ESP_OK;
+
+fail:
+    hid_host_slots_free();
+    return ret;
+}
+
+/**
+ * @brief HID class specific request GET REPORT
+ *
+ * @param[in] hid_dev_handle    HID Device handle
+ * @param[in] report_type       Report type
+ * @param[in] report_id         Report ID
+ * @param[out] report           Pointer to buffer for a report data
+ * @param[in/out] report_length Report data length
+ * @param[in] callback          Completion callback, NULL to wait for completion
+ * @param[in] arg               Completion callback argument
+ * @return esp_err_t
+ */
+static esp_err_t hid_host_get_report(hid_host_device_handle_t hid_dev_handle,
+                                     uint8_t report_type,
+                                     uint8_t report_id,
+                                     uint8_t *report,
+                                     size_t *report_length,
+                                     hid_host_request_cb_t callback,
+                                     void *arg)
+{
+    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
+
+    HID_RETURN_ON_INVALID_ARG(iface);
+    HID_RETURN_ON_INVALID_ARG(report);
+    HID_RETURN_ON_INVALID_ARG(report_length);
+
+    const hid_class_request_t get_report = {
+        .bRequest = HID_CLASS_SPECIFIC_REQ_GET_REPORT,
+        .wValue = (report_type << 8) | report_id,
+        .wIndex = iface->dev_params.iface_num,
+        .wLength = *report_length,
+        .data = report
+    };
+
+    return hid_class_request_get(iface, &get_report, report_length, callback, arg);
+}
+
+/**
+ * @brief HID class specific request SET REPORT
+ *
+ * @param[in] hid_dev_handle    HID Device handle
+ * @param[in] report_type       Report type
+ * @param[in] report_id         Report ID
+ * @param[in] report            Pointer to a buffer with report data
+ * @param[in] report_length     Report data length
+ * @param[in] callback          Completion callback, NULL to wait for completion
+ * @param[in] arg               Completion callback argument
+ * @return esp_err_t
+ */
+static esp_err_t hid_host_set_report(hid_host_device_handle_t hid_dev_handle,
+                                     uint8_t report_type,
+                                     uint8_t report_id,
+                                     uint8_t *report,
+                                     size_t report_length,
+                                     hid_host_request_cb_t callback,
+                                     void *arg)
+{
+    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
+
+    HID_RETURN_ON_INVALID_ARG(iface);
+
+    const hid_class_request_t set_report = {
+        .bRequest = HID_CLASS_SPECIFIC_REQ_SET_REPORT,
+        .wValue = (report_type << 8) | report_id,
+        .wIndex = iface->dev_params.iface_num,
+        .wLength = report_length,
+        .data = report
+    };
+
+    return hid_class_request_set(iface, &set_report, callback, arg);
+}
+
+/**
+ * @brief HID class specific request SET IDLE
+ *
+ * @param[in] hid_dev_handle    HID Device handle
+ * @param[in] duration          Idle duration, 0 for indefinite
+ * @param[in] report_id         Report ID, 0 for all input reports
+ * @param[in] callback          Completion callback, NULL to wait for completion
+ * @param[in] arg               Completion callback argument
+ * @return esp_err_t
+ */
+static esp_err_t hid_host_set_idle(hid_host_device_handle_t hid_dev_handle,
+                                   uint8_t duration,
+                                   uint8_t report_id,
+                                   hid_host_request_cb_t callback,
+                                   void *arg)
+{
+    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
+
+    HID_RETURN_ON_INVALID_ARG(iface);
+
+    const hid_class_request_t set_idle = {
+        .bRequest = HID_CLASS_SPECIFIC_REQ_SET_IDLE,
+        .wValue = (duration << 8) | report_id,
+        .wIndex = iface->dev_params.iface_num,
+        .wLength = 0,
+        .data = NULL
+    };
+
+    return hid_class_request_set(iface, &set_idle, callback, arg);
+}
+
+/**
+ * @brief HID class specific request SET PROTOCOL
+ *
+ * @param[in] hid_dev_handle    HID Device handle
+ * @param[in] protocol          HID report protocol (boot or report)
+ * @param[in] callback          Completion callback, NULL to wait for completion
+ * @param[in] arg               Completion callback argument
+ * @return esp_err_t
+ */
+static esp_err_t hid_host_set_protocol(hid_host_device_handle_t hid_dev_handle,
+                                       hid_report_protocol_t protocol,
+                                       hid_host_request_cb_t callback,
+                                       void *arg)
+{
+    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
+
+    HID_RETURN_ON_INVALID_ARG(iface);
+
+    const hid_class_request_t set_proto = {
+        .bRequest = HID_CLASS_SPECIFIC_REQ_SET_PROTOCOL,
+        .wValue = protocol,
+        .wIndex = iface->dev_params.iface_num,
+        .wLength = 0,
+        .data = NULL
+    };
+
+    return hid_class_request_set(iface, &set_proto, callback, arg);
+}
+
+/**
+ * @brief Completion of CLEAR_FEATURE(ENDPOINT_HALT) during a recovery, resubmits the IN transfer
+ *
+ * @param[in] hid_dev_handle    HID Device handle at submission
+ * @param[in] status            Result of CLEAR_FEATURE
+ * @param[in] arg               Pointer to the Interface slot
+ */
+static void hid_host_recover_done(hid_host_device_handle_t hid_dev_handle, esp_err_t status, void *arg)
+{
+    hid_iface_t *iface = (hid_iface_t *)arg;
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    if (ESP_OK != status) {
+        // Not every device supports it, the endpoint may deliver data anyway
+        ESP_LOGW(TAG, "Unable to clear endpoint halt: %s", esp_err_to_name(status));
+    }
+
+    // Slots are static, but the interface may have been removed meanwhile
+    if ((iface->handle == hid_dev_handle) &&
+            (HID_INTERFACE_STATE_ACTIVE == iface->state) &&
+            iface->in_xfer_failed) {
+        ret = usb_host_transfer_submit(iface->in_xfer);
+        if (ESP_OK == ret) {
+            iface->in_xfer_failed = false;
+        }
+    }
+
+    if (iface->recover_cb) {
+        iface->recover_cb(hid_dev_handle, ret, iface->recover_cb_arg);
+    }
+}
+
 // ----------------------------- Public ----------------------------------------
 
 esp_err_t hid_host_install(const hid_host_driver_config_t *config)
@@ -1088,6 +1560,9 @@ esp_err_t hid_host_install(const hid_host_driver_config_t *config)
         .max_num_event_msg = 10,
     };
 
+    HID_GOTO_ON_ERROR( hid_host_slots_alloc(),
+                       "Unable to allocate HID device and interface slots");
+
     driver->end_client_event_handling = false;
     driver->all_events_handled = xSemaphoreCreateBinary();
     HID_GOTO_ON_FALSE(driver->all_events_handled,
@@ -1129,6 +1604,7 @@ fail:
     if (driver->all_events_handled) {
         vSemaphoreDelete(driver->all_events_handled);
     }
+    hid_host_slots_free();
     free(driver);
     return ret;
 }
@@ -1157,6 +1633,7 @@ esp_err_t hid_host_uninstall(void)
     }
     vSemaphoreDelete(s_hid_driver->all_events_handled);
     ESP_ERROR_CHECK( usb_host_client_deregister(s_hid_driver->client_handle) );
+    hid_host_slots_free();
     free(s_hid_driver);
     s_hid_driver = NULL;
     return ESP_OK;
@@ -1214,7 +1691,6 @@ esp_err_t hid_host_device_close(hid_host_device_handle_t hid_dev_handle)
                              "Unable to release HID Interface");
 
         // If the device is closing by user before device detached we need to flush user callback here
-        free(hid_iface->report_desc);
         hid_iface->report_desc = NULL;
     }
 
@@ -1247,7 +1723,11 @@ esp_err_t hid_host_handle_events(uint32_t timeout)
 
     ESP_LOGD(TAG, "USB HID handling");
     s_hid_driver->event_handling_started = true;
-    esp_err_t ret = usb_host_client_handle_events(s_hid_driver->client_handle, timeout);
+    // Wake up in time to cancel a control transfer that is stuck on EP0
+    esp_err_t ret = usb_host_client_handle_events(s_hid_driver->client_handle,
+                    hid_request_wait_ticks(timeout));
+    hid_request_retire();
+    hid_request_expire();
     if (s_hid_driver->end_client_event_handling) {
         xSemaphoreGive(s_hid_driver->all_events_handled);
         return ESP_FAIL;
@@ -1291,9 +1771,8 @@ esp_err_t hid_host_device_get_raw_input_report_data(hid_host_device_handle_t hid
                         ESP_ERR_INVALID_ARG,
                         "Wrong argument");
 
-    size_t copied = (data_length_max >= iface->in_xfer->actual_num_bytes)
-                    ? iface->in_xfer->actual_num_bytes
-                    : data_length_max;
+    size_t actual = (size_t)iface->in_xfer->actual_num_bytes;
+    size_t copied = (data_length_max >= actual) ? actual : data_length_max;
     memcpy(data, iface->in_xfer->data_buffer, copied);
     *data_length = copied;
     return ESP_OK;
@@ -1309,10 +1788,6 @@ esp_err_t hid_host_device_start(hid_host_device_handle_t hid_dev_handle)
     HID_RETURN_ON_INVALID_ARG(iface->in_xfer);
     HID_RETURN_ON_INVALID_ARG(iface->parent);
 
-    HID_RETURN_ON_FALSE(is_interface_in_list(iface),
-                        ESP_ERR_NOT_FOUND,
-                        "Interface handle not found");
-
     HID_RETURN_ON_FALSE ((HID_INTERFACE_STATE_READY == iface->state),
                          ESP_ERR_INVALID_STATE,
                          "Interface wrong state");
@@ -1326,11 +1801,52 @@ esp_err_t hid_host_device_start(hid_host_device_handle_t hid_dev_handle)
     iface->in_xfer->num_bytes = iface->ep_in_mps;
 
     iface->state = HID_INTERFACE_STATE_ACTIVE;
+    iface->in_xfer_failed = false;
 
     // start data transfer
     return usb_host_transfer_submit(iface->in_xfer);
 }
 
+esp_err_t hid_host_device_recover_async(hid_host_device_handle_t hid_dev_handle,
+                                        hid_host_request_cb_t callback,
+                                        void *arg)
+{
+    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
+
+    HID_RETURN_ON_INVALID_ARG(iface);
+    HID_RETURN_ON_INVALID_ARG(callback);
+
+    HID_RETURN_ON_FALSE((HID_INTERFACE_STATE_ACTIVE == iface->state) && iface->in_xfer_failed,
+                        ESP_ERR_INVALID_STATE,
+                        "Interface has no failed transfer");
+
+    // Reset the endpoint on the host side, the transfer is not in flight
+    usb_host_endpoint_halt(iface->parent->dev_hdl, iface->ep_in);
+    usb_host_endpoint_flush(iface->parent->dev_hdl, iface->ep_in);
+    HID_RETURN_ON_ERROR( usb_host_endpoint_clear(iface->parent->dev_hdl, iface->ep_in),
+                         "Unable to clear EP");
+
+    // and on the device side, where a STALL is sticky until cleared
+    hid_request_t request = {
+        .bmRequestType = USB_BM_REQUEST_TYPE_DIR_OUT |
+        USB_BM_REQUEST_TYPE_TYPE_STANDARD |
+        USB_BM_REQUEST_TYPE_RECIP_ENDPOINT,
+        .req = {
+            .bRequest = USB_B_REQUEST_CLEAR_FEATURE,
+            .wValue = USB_W_VALUE_FEATURE_ENDPOINT_HALT,
+            .wIndex = iface->ep_in,
+            .wLength = 0,
+            .data = NULL
+        },
+        .callback = hid_host_recover_done,
+        .arg = iface
+    };
+
+    iface->recover_cb = callback;
+    iface->recover_cb_arg = arg;
+    return hid_request_submit(iface, &request);
+}
+
 esp_err_t hid_host_device_stop(hid_host_device_handle_t hid_dev_handle)
 {
     hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
@@ -1364,6 +1880,30 @@ uint8_t *hid_host_get_report_descriptor(hid_host_device_handle_t hid_dev_handle,
     return NULL;
 }
 
+esp_err_t hid_host_get_report_descriptor_async(hid_host_device_handle_t hid_dev_handle,
+        hid_host_request_cb_t callback,
+        void *arg)
+{
+    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
+    hid_request_t request;
+
+    HID_RETURN_ON_INVALID_ARG(iface);
+    HID_RETURN_ON_INVALID_ARG(callback);
+
+    // Report Descriptor was already requested, complete right away
+    if (iface->report_desc) {
+        callback(hid_dev_handle, ESP_OK, arg);
+        return ESP_OK;
+    }
+
+    HID_RETURN_ON_ERROR( hid_request_report_descriptor(iface, &request),
+                         "Unable to request report descriptor");
+
+    request.callback = callback;
+    request.arg = arg;
+    return hid_request_submit(iface, &request);
+}
+
 esp_err_t hid_host_get_device_info(hid_host_device_handle_t hid_dev_handle,
                                    hid_host_dev_info_t *hid_dev_info)
 {
@@ -1384,6 +1924,7 @@ esp_err_t hid_host_get_device_info(hid_host_device_handle_t hid_dev_handle,
     // VID, PID
     hid_dev_info->VID = desc->idVendor;
     hid_dev_info->PID = desc->idProduct;
+    hid_dev_info->bcdDevice = desc->bcdDevice;
     // Strings
     hid_host_string_descriptor_copy(hid_dev_info->iManufacturer,
                                     dev_info.str_desc_manufacturer);
@@ -1400,20 +1941,22 @@ esp_err_t hid_class_request_get_report(hid_host_device_handle_t hid_dev_handle,
                                        uint8_t *report,
                                        size_t *report_length)
 {
-    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
-
-    HID_RETURN_ON_INVALID_ARG(iface);
-    HID_RETURN_ON_INVALID_ARG(report);
+    return hid_host_get_report(hid_dev_handle, report_type, report_id,
+                               report, report_length, NULL, NULL);
+}
 
-    const hid_class_request_t get_report = {
-        .bRequest = HID_CLASS_SPECIFIC_REQ_GET_REPORT,
-        .wValue = (report_type << 8) | report_id,
-        .wIndex = iface->dev_params.iface_num,
-        .wLength = *report_length,
-        .data = report
-    };
+esp_err_t hid_class_request_get_report_async(hid_host_device_handle_t hid_dev_handle,
+        uint8_t report_type,
+        uint8_t report_id,
+        uint8_t *report,
+        size_t *report_length,
+        hid_host_request_cb_t callback,
+        void *arg)
+{
+    HID_RETURN_ON_INVALID_ARG(callback);
 
-    return hid_class_request_get(iface->parent, &get_report, report_length);
+    return hid_host_get_report(hid_dev_handle, report_type, report_id,
+                               report, report_length, callback, arg);
 }
 
 esp_err_t hid_class_request_get_idle(hid_host_device_handle_t hid_dev_handle,
@@ -1435,7 +1978,7 @@ esp_err_t hid_class_request_get_idle(hid_host_device_handle_t hid_dev_handle,
         .data = tmp
     };
 
-    HID_RETURN_ON_ERROR( hid_class_request_get(iface->parent, &get_idle, NULL),
+    HID_RETURN_ON_ERROR( hid_class_request_get(iface, &get_idle, NULL, NULL, NULL),
                          "HID class request transfer failure");
 
     *idle_rate = tmp[0];
@@ -1461,7 +2004,7 @@ esp_err_t hid_class_request_get_protocol(hid_host_device_handle_t hid_dev_handle
         .data = tmp
     };
 
-    HID_RETURN_ON_ERROR( hid_class_request_get(iface->parent, &get_proto, NULL),
+    HID_RETURN_ON_ERROR( hid_class_request_get(iface, &get_proto, NULL, NULL, NULL),
                          "HID class request failure");
 
     *protocol = (hid_report_protocol_t) tmp[0];
@@ -1474,54 +2017,54 @@ esp_err_t hid_class_request_set_report(hid_host_device_handle_t hid_dev_handle,
                                        uint8_t *report,
                                        size_t report_length)
 {
-    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
-
-    HID_RETURN_ON_INVALID_ARG(iface);
+    return hid_host_set_report(hid_dev_handle, report_type, report_id,
+                               report, report_length, NULL, NULL);
+}
 
-    const hid_class_request_t set_report = {
-        .bRequest = HID_CLASS_SPECIFIC_REQ_SET_REPORT,
-        .wValue = (report_type << 8) | report_id,
-        .wIndex = iface->dev_params.iface_num,
-        .wLength = report_length,
-        .data = report
-    };
+esp_err_t hid_class_request_set_report_async(hid_host_device_handle_t hid_dev_handle,
+        uint8_t report_type,
+        uint8_t report_id,
+        uint8_t *report,
+        size_t report_length,
+        hid_host_request_cb_t callback,
+        void *arg)
+{
+    HID_RETURN_ON_INVALID_ARG(callback);
 
-    return hid_class_request_set(iface->parent, &set_report);
+    return hid_host_set_report(hid_dev_handle, report_type, report_id,
+                               report, report_length, callback, arg);
 }
 
 esp_err_t hid_class_request_set_idle(hid_host_device_handle_t hid_dev_handle,
                                      uint8_t duration,
                                      uint8_t report_id)
 {
-    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
-
-    HID_RETURN_ON_INVALID_ARG(iface);
+    return hid_host_set_idle(hid_dev_handle, duration, report_id, NULL, NULL);
+}
 
-    const hid_class_request_t set_idle = {
-        .bRequest = HID_CLASS_SPECIFIC_REQ_SET_IDLE,
-        .wValue = (duration << 8) | report_id,
-        .wIndex = iface->dev_params.iface_num,
-        .wLength = 0,
-        .data = NULL
-    };
+esp_err_t hid_class_request_set_idle_async(hid_host_device_handle_t hid_dev_handle,
+        uint8_t duration,
+        uint8_t report_id,
+        hid_host_request_cb_t callback,
+        void *arg)
+{
+    HID_RETURN_ON_INVALID_ARG(callback);
 
-    return hid_class_request_set(iface->parent, &set_idle);
+    return hid_host_set_idle(hid_dev_handle, duration, report_id, callback, arg);
 }
 
 esp_err_t hid_class_request_set_protocol(hid_host_device_handle_t hid_dev_handle,
         hid_report_protocol_t protocol)
 {
-    hid_iface_t *iface = get_iface_by_handle(hid_dev_handle);
-
-    HID_RETURN_ON_INVALID_ARG(iface);
+    return hid_host_set_protocol(hid_dev_handle, protocol, NULL, NULL);
+}
 
-    const hid_class_request_t set_proto = {
-        .bRequest = HID_CLASS_SPECIFIC_REQ_SET_PROTOCOL,
-        .wValue = protocol,
-        .wIndex = iface->dev_params.iface_num,
-        .wLength = 0,
-        .data = NULL
-    };
+esp_err_t hid_class_request_set_protocol_async(hid_host_device_handle_t hid_dev_handle,
+        hid_report_protocol_t protocol,
+        hid_host_request_cb_t callback,
+        void *arg)
+{
+    HID_RETURN_ON_INVALID_ARG(callback);
 
-    return hid_class_request_set(iface->parent, &set_proto);
+    return hid_host_set_protocol(hid_dev_handle, protocol, callback, arg);
 }
@@ -29,7 +29,13 @@ extern "C" {
 */
 #define HID_STR_DESC_MAX_LENGTH           32
 
-typedef struct hid_interface *hid_host_device_handle_t;    /**< Device Handle. Handle to a particular HID interface */
+/**
+ * @brief Device Handle. Handle to a particular HID interface
+ *
+ * The handle identifies an interface slot and its generation, it is not a pointer. Once the
+ * interface is removed, all API calls with its handle fail, even if the slot is used again.
+ */
+typedef struct hid_interface *hid_host_device_handle_t;
 
 // ------------------------ USB HID Host events --------------------------------
 /**
@@ -54,6 +60,7 @@ typedef enum {
 typedef struct {
     uint16_t VID;
     uint16_t PID;
+    uint16_t bcdDevice;
     wchar_t iManufacturer[HID_STR_DESC_MAX_LENGTH];
     wchar_t iProduct[HID_STR_DESC_MAX_LENGTH];
     wchar_t iSerialNumber[HID_STR_DESC_MAX_LENGTH];
@@ -93,6 +100,21 @@ typedef void (*hid_host_interface_event_cb_t)(hid_host_device_handle_t hid_devic
         const hid_host_interface_event_t event,
         void *arg);
 
+/**
+ * @brief USB HID class request completion callback.
+ *
+ * Called from the context that handles the HID Host events (see hid_host_handle_events()).
+ * It may submit further requests, but must not call the blocking request functions.
+ *
+ * @param[in] hid_device_handle     HID device handle (HID Interface)
+ * @param[in] status                ESP_OK, or the reason the request failed. ESP_ERR_TIMEOUT
+ *                                  when the device did not complete the request in time.
+ * @param[in] arg                   User argument
+*/
+typedef void (*hid_host_request_cb_t)(hid_host_device_handle_t hid_device_handle,
+                                      esp_err_t status,
+                                      void *arg);
+
 // ----------------------------- Public ---------------------------------------
 /**
  * @brief HID configuration structure.
@@ -154,6 +176,9 @@ esp_err_t hid_host_device_close(hid_host_device_handle_t hid_dev_handle);
  * application needs to handle USB Host events itself.
  * Do not used if HID host install was made with create_background_task=true configuration
  *
+ * While a class request is pending, the call returns ESP_ERR_TIMEOUT early enough to cancel
+ * the request when it runs into its timeout.
+ *
  * @param[in]  timeout  Timeout in ticks. For milliseconds, please use 'pdMS_TO_TICKS()' macros
  * @return esp_err_t
  */
@@ -208,6 +233,24 @@ esp_err_t hid_host_device_start(hid_host_device_handle_t hid_dev_handle);
  */
 esp_err_t hid_host_device_stop(hid_host_device_handle_t hid_dev_handle);
 
+/**
+ * @brief HID Host resume a device after HID_HOST_INTERFACE_EVENT_TRANSFER_ERROR
+ *
+ * After a transfer error the device is no longer polled. This clears the halt of the
+ * interrupt IN endpoint on the host and on the device (CLEAR_FEATURE ENDPOINT_HALT) and
+ * resubmits the transfer. The callback reports whether polling resumed, a failing
+ * CLEAR_FEATURE alone does not fail the recovery.
+ *
+ * @param[in] hid_dev_handle  HID Device handle
+ * @param[in] callback        Completion callback
+ * @param[in] arg             Completion callback argument
+ *
+ * @return esp_err_t ESP_ERR_INVALID_STATE if the device is not stopped by a transfer error
+ */
+esp_err_t hid_host_device_recover_async(hid_host_device_handle_t hid_dev_handle,
+                                        hid_host_request_cb_t callback,
+                                        void *arg);
+
 /**
  * @brief HID Host Get Report Descriptor
  *
@@ -219,6 +262,22 @@ esp_err_t hid_host_device_stop(hid_host_device_handle_t hid_dev_handle);
 uint8_t *hid_host_get_report_descriptor(hid_host_device_handle_t hid_dev_handle,
                                         size_t *report_desc_len);
 
+/**
+ * @brief HID Host request Report Descriptor without blocking
+ *
+ * Once the callback reports ESP_OK, hid_host_get_report_descriptor() returns the descriptor
+ * without a transfer. If it was read before, the callback is called before this returns.
+ *
+ * @param[in] hid_dev_handle   HID Device handle
+ * @param[in] callback         Completion callback
+ * @param[in] arg              Completion callback argument
+ *
+ * @return esp_err_t
+ */
+esp_err_t hid_host_get_report_descriptor_async(hid_host_device_handle_t hid_dev_handle,
+        hid_host_request_cb_t callback,
+        void *arg);
+
 
 /**
  * @brief HID Host Get device information
@@ -245,6 +304,30 @@ esp_err_t hid_class_request_get_report(hid_host_device_handle_t hid_dev_handle,
                                        uint8_t *report,
                                        size_t *report_length);
 
+/**
+ * @brief HID class specific request GET REPORT without blocking
+ *
+ * Requests of one device are queued and run in order, see CONFIG_USB_HOST_HID_REQUEST_QUEUE_SIZE.
+ * The report buffer and report_length must stay valid until the callback.
+ *
+ * @param[in] hid_dev_handle    HID Device handle
+ * @param[in] report_type       Report type
+ * @param[in] report_id         Report ID
+ * @param[out] report           Pointer to buffer for a report data
+ * @param[in/out] report_length Report data length, as for hid_class_request_get_report()
+ * @param[in] callback          Completion callback
+ * @param[in] arg               Completion callback argument
+ *
+ * @return esp_err_t ESP_ERR_NO_MEM if the request queue of the device is full
+ */
+esp_err_t hid_class_request_get_report_async(hid_host_device_handle_t hid_dev_handle,
+        uint8_t report_type,
+        uint8_t report_id,
+        uint8_t *report,
+        size_t *report_length,
+        hid_host_request_cb_t callback,
+        void *arg);
+
 /**
  * @brief HID class specific request GET IDLE
  *
@@ -286,6 +369,30 @@ esp_err_t hid_class_request_set_report(hid_host_device_handle_t hid_dev_handle,
                                        uint8_t *report,
                                        size_t report_length);
 
+/**
+* @brief HID class specific request SET REPORT without blocking
+*
+* The report is copied into the control transfer when the request reaches EP0, the buffer
+* must stay valid until the callback.
+*
+* @param[in] hid_dev_handle     HID Device handle
+* @param[in] report_type        Report type
+* @param[in] report_id          Report ID
+* @param[in] report             Pointer to a buffer with report data
+* @param[in] report_length      Report data length
+* @param[in] callback           Completion callback
+* @param[in] arg                Completion callback argument
+*
+* @return esp_err_t ESP_ERR_NO_MEM if the request queue of the device is full
+*/
+esp_err_t hid_class_request_set_report_async(hid_host_device_handle_t hid_dev_handle,
+        uint8_t report_type,
+        uint8_t report_id,
+        uint8_t *report,
+        size_t report_length,
+        hid_host_request_cb_t callback,
+        void *arg);
+
 /**
  * @brief HID class specific request SET IDLE
  *
@@ -298,6 +405,22 @@ esp_err_t hid_class_request_set_idle(hid_host_device_handle_t hid_dev_handle,
                                      uint8_t duration,
                                      uint8_t report_id);
 
+/**
+ * @brief HID class specific request SET IDLE without blocking
+ *
+ * @param[in] hid_dev_handle    HID Device handle
+ * @param[in] duration          0 (zero) for the indefinite duration, non-zero, then a fixed duration used.
+ * @param[in] report_id         If 0 (zero) the idle rate applies to all input reports generated by the device, otherwise ReportID
+ * @param[in] callback          Completion callback
+ * @param[in] arg               Completion callback argument
+ * @return esp_err_t
+ */
+esp_err_t hid_class_request_set_idle_async(hid_host_device_handle_t hid_dev_handle,
+        uint8_t duration,
+        uint8_t report_id,
+        hid_host_request_cb_t callback,
+        void *arg);
+
 /**
  * @brief HID class specific request SET PROTOCOL
  *
@@ -308,6 +431,20 @@ esp_err_t hid_class_request_set_idle(hid_host_device_handle_t hid_dev_handle,
 esp_err_t hid_class_request_set_protocol(hid_host_device_handle_t hid_dev_handle,
         hid_report_protocol_t protocol);
 
+/**
+ * @brief HID class specific request SET PROTOCOL without blocking
+ *
+ * @param[in] hid_dev_handle    HID Device handle
+ * @param[in] protocol          HID report protocol (boot or report)
+ * @param[in] callback          Completion callback
+ * @param[in] arg               Completion callback argument
+ * @return esp_err_t
+ */
+esp_err_t hid_class_request_set_protocol_async(hid_host_device_handle_t hid_dev_handle,
+        hid_report_protocol_t protocol,
+        hid_host_request_cb_t callback,
+        void *arg);
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
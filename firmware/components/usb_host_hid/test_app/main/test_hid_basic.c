@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "unity.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -39,6 +40,11 @@ TaskHandle_t hid_test_task_handle;
 static hid_host_device_handle_t global_hdl;
 static int test_num_passed;
 
+// Asynchronous requests testing, completed requests per interface number
+#define TEST_ASYNC_REQUESTS_NUM     3
+#define TEST_ASYNC_IFACES_MAX       4
+static int test_async_completed[TEST_ASYNC_IFACES_MAX];
+
 static const char *test_hid_sub_class_names[] = {
     "NO_SUBCLASS",
     "BOOT_INTERFACE",
@@ -319,6 +325,57 @@ void hid_host_test_requests_callback(hid_host_device_handle_t hid_device_handle,
     }
 }
 
+static void hid_host_test_async_request_done(hid_host_device_handle_t hid_device_handle,
+        esp_err_t status,
+        void *arg)
+{
+    hid_host_dev_params_t dev_params;
+    TEST_ASSERT_EQUAL(ESP_OK, hid_host_device_get_params(hid_device_handle, &dev_params));
+
+    // Requests of one device complete in the order they were submitted
+    int *completed = &test_async_completed[dev_params.iface_num];
+    TEST_ASSERT_EQUAL(*completed, (int)(intptr_t) arg);
+    printf("HID async request %d: %s\n", *completed, esp_err_to_name(status));
+
+    if (++(*completed) == TEST_ASYNC_REQUESTS_NUM) {
+        TEST_ASSERT_EQUAL(ESP_OK,  hid_host_device_start(hid_device_handle) );
+    }
+}
+
+void hid_host_test_async_requests_callback(hid_host_device_handle_t hid_device_handle,
+        const hid_host_driver_event_t event,
+        void *arg)
+{
+    hid_host_dev_params_t dev_params;
+    TEST_ASSERT_EQUAL(ESP_OK, hid_host_device_get_params(hid_device_handle, &dev_params));
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(&user_arg_value, arg, "User argument has lost");
+    TEST_ASSERT_LESS_THAN(TEST_ASYNC_IFACES_MAX, dev_params.iface_num);
+
+    switch (event) {
+    case HID_HOST_DRIVER_EVENT_CONNECTED: {
+        const hid_host_device_config_t dev_config = {
+            .callback = hid_host_test_interface_callback,
+            .callback_arg = &user_arg_value
+        };
+
+        TEST_ASSERT_EQUAL(ESP_OK,  hid_host_device_open(hid_device_handle, &dev_config) );
+
+        // Unlike the blocking requests, these are allowed in the driver callback
+        TEST_ASSERT_EQUAL(ESP_OK, hid_host_get_report_descriptor_async(hid_device_handle,
+                          hid_host_test_async_request_done, (void *) 0));
+        TEST_ASSERT_EQUAL(ESP_OK, hid_class_request_set_idle_async(hid_device_handle, 0, 0,
+                          hid_host_test_async_request_done, (void *) 1));
+        TEST_ASSERT_EQUAL(ESP_OK, hid_class_request_set_protocol_async(hid_device_handle,
+                          HID_REPORT_PROTOCOL_BOOT,
+                          hid_host_test_async_request_done, (void *) 2));
+        break;
+    }
+    default:
+        TEST_FAIL_MESSAGE("HID Driver unhandled event");
+        break;
+    }
+}
+
 void hid_host_test_task(void *pvParameters)
 {
     hid_host_test_event_queue_t evt_queue;
@@ -655,6 +712,20 @@ TEST_CASE("class_specific_requests_with_external_polling_without_polling", "[hid
     // Verify the memory leackage during test environment tearDown()
 }
 
+TEST_CASE("class_specific_requests_async", "[hid_host]")
+{
+    memset(test_async_completed, 0, sizeof(test_async_completed));
+    // Install USB and HID driver with 'hid_host_test_async_requests_callback'
+    test_hid_setup(hid_host_test_async_requests_callback, HID_TEST_EVENT_HANDLE_IN_DRIVER);
+    // All requests are submitted during device connection and complete in the background
+    // Wait for test completed for 250 ms
+    vTaskDelay(250);
+    // Tear down test
+    test_hid_teardown();
+    // The first interface completed all of its requests
+    TEST_ASSERT_EQUAL(TEST_ASYNC_REQUESTS_NUM, test_async_completed[0]);
+}
+
 TEST_CASE("sudden_disconnect", "[hid_host]")
 {
     // Install USB and HID driver with 'hid_host_test_concurrent'
@@ -0,0 +1,105 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * Parses every payload of a corpus file (one QR code per line) repeatedly and
+ * reports the time per payload, both for qr_fields and for the strdup/strtok
+ * tokenizer it replaced.
+ *
+ *   bench_qr_fields corpus/qr_payloads.txt [iterations]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "qr_fields.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PAYLOADS 4096
+
+static char *payloads[MAX_PAYLOADS];
+static size_t payload_count;
+static size_t payload_bytes;
+static volatile size_t sink;
+
+static void load_corpus(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    char line[1024];
+    while (payload_count < MAX_PAYLOADS && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        const char *colon = strchr(line, ':');
+        if (!colon)
+            continue;
+        payloads[payload_count] = strdup(colon + 1);
+        payload_bytes += strlen(colon + 1);
+        ++payload_count;
+    }
+    fclose(f);
+}
+
+static void parse_qr_fields(const char *payload) {
+    char value[128];
+    qr_fields_t fields;
+    qr_field_t field;
+    qr_fields_init(&fields, payload);
+    while (qr_fields_next(&fields, &field)) {
+        if (qr_field_copy(&field, value, sizeof(value)))
+            sink += value[0];
+    }
+}
+
+/* The previous implementation, which did not handle escapes */
+static void parse_strtok(const char *payload) {
+    char value[128];
+    char *copy = strdup(payload);
+    for (char *token = strtok(copy, ";"); token; token = strtok(NULL, ";")) {
+        strncpy(value, token + 2, sizeof(value) - 1);
+        value[sizeof(value) - 1] = 0;
+        sink += value[0];
+    }
+    free(copy);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(const char *name, void (*parse)(const char *), long iterations) {
+    const double start = now();
+    for (long i = 0; i < iterations; ++i)
+        for (size_t j = 0; j < payload_count; ++j)
+            parse(payloads[j]);
+    const double elapsed = now() - start;
+    const double n = (double)iterations * payload_count;
+    printf("%-10s %8.1f ns/payload %8.1f MB/s\n", name, elapsed * 1e9 / n,
+           n / payload_count * payload_bytes / elapsed / 1e6);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s CORPUS [ITERATIONS]\n", argv[0]);
+        return 2;
+    }
+    load_corpus(argv[1]);
+    const long iterations = argc > 2 ? atol(argv[2]) : 20000;
+    if (!payload_count) {
+        fprintf(stderr, "%s: no payloads\n", argv[1]);
+        return 1;
+    }
+
+    printf("%zu payloads, %zu bytes, %ld iterations\n", payload_count,
+           payload_bytes, iterations);
+    run("qr_fields", parse_qr_fields, iterations);
+    run("strtok", parse_strtok, iterations);
+    return 0;
+}
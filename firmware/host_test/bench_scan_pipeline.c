@@ -0,0 +1,262 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * Replays a recorded keyboard report stream through keyboard_decoder and
+ * scan_assembler, the same way the main loop does, and reports throughput,
+ * heap allocations and per-scan latency. Recorded timestamps drive the scan
+ * timeout, but the replay itself runs as fast as possible.
+ *
+ *   bench_scan_pipeline corpus/scanner_reports.h2mc [iterations]
+ *
+ * The stream is either a capture uploaded by the firmware, see
+ * src/hid_capture_format.h, or text with one "<time in us> <hex report>"
+ * line per report, lines starting with '#' are ignored.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "hid_capture_format.h"
+#include "keyboard_decoder.h"
+#include "scan_assembler.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_REPORT_LEN 64
+
+typedef struct {
+    int64_t time_us;
+    size_t len;
+    uint8_t data[MAX_REPORT_LEN];
+} recorded_report_t;
+
+static recorded_report_t *reports;
+static size_t report_count;
+
+static keyboard_decoder_t decoder;
+static scan_arena_t arena;
+static scan_assembler_t assembler;
+static int64_t replay_time_us;
+
+static size_t scan_count;
+static size_t scan_bytes;
+static uint64_t scan_start_ns;
+static uint64_t *latencies; // ns from first character to submit, per scan
+static size_t latency_count;
+static size_t latency_capacity;
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+/* Linked with -Wl,--wrap, every heap allocation of the process lands here */
+static size_t allocations;
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size) {
+    ++allocations;
+    return __real_malloc(size);
+}
+void *__wrap_calloc(size_t n, size_t size) {
+    ++allocations;
+    return __real_calloc(n, size);
+}
+void *__wrap_realloc(void *ptr, size_t size) {
+    ++allocations;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static recorded_report_t *append_report(void) {
+    static size_t capacity;
+    if (report_count == capacity) {
+        capacity = capacity ? 2 * capacity : 4096;
+        reports = realloc(reports, capacity * sizeof(*reports));
+        if (!reports) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    return &reports[report_count++];
+}
+
+static void load_capture(const uint8_t *data, size_t size) {
+    hid_capture_reader_t reader;
+    hid_capture_reader_init(&reader, data, size);
+    int64_t time_us = 0;
+    uint32_t delta_us;
+    const uint8_t *report;
+    size_t length;
+    while (hid_capture_next(&reader, &delta_us, &report, &length)) {
+        recorded_report_t *r = append_report();
+        // The first delta refers to a record dropped from the ring
+        time_us += report_count > 1 ? delta_us : 0;
+        r->time_us = time_us;
+        r->len = length < MAX_REPORT_LEN ? length : MAX_REPORT_LEN;
+        memcpy(r->data, report, r->len);
+    }
+}
+
+static void load_text(FILE *f) {
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+        char *hex;
+        const int64_t time_us = strtoll(line, &hex, 10);
+        if (hex == line)
+            continue;
+        recorded_report_t *r = append_report();
+        r->time_us = time_us;
+        r->len = 0;
+        while (*hex == ' ')
+            ++hex;
+        while (r->len < MAX_REPORT_LEN && hex_value(hex[0]) >= 0 &&
+               hex_value(hex[1]) >= 0) {
+            r->data[r->len++] = hex_value(hex[0]) << 4 | hex_value(hex[1]);
+            hex += 2;
+        }
+    }
+}
+
+static void load_reports(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    uint8_t header[HID_CAPTURE_HEADER_SIZE];
+    hid_capture_reader_t reader;
+    const size_t n = fread(header, 1, sizeof(header), f);
+    if (hid_capture_reader_init(&reader, header, n)) {
+        fseek(f, 0, SEEK_END);
+        const long size = ftell(f);
+        uint8_t *data = malloc(size);
+        fseek(f, 0, SEEK_SET);
+        if (!data || fread(data, 1, size, f) != (size_t)size) {
+            perror(path);
+            exit(1);
+        }
+        load_capture(data, size);
+        free(data);
+    } else {
+        rewind(f);
+        load_text(f);
+    }
+    fclose(f);
+}
+
+static void on_scan(const char *scan, size_t length, void *arg) {
+    (void)scan;
+    (void)arg;
+    ++scan_count;
+    scan_bytes += length;
+    if (latency_count < latency_capacity)
+        latencies[latency_count++] = now_ns() - scan_start_ns;
+}
+
+static void on_text(const char *text, size_t length, void *arg) {
+    (void)arg;
+    if (length && !assembler.length)
+        scan_start_ns = now_ns();
+    scan_assembler_put_text(&assembler, text, length, replay_time_us);
+}
+
+static void replay(void) {
+    keyboard_decoder_init(&decoder, on_text, NULL);
+    scan_arena_init(&arena);
+    scan_assembler_init(&assembler, &arena, on_scan, NULL);
+    for (size_t i = 0; i < report_count; ++i) {
+        replay_time_us = reports[i].time_us;
+        scan_assembler_poll(&assembler, replay_time_us);
+        keyboard_decoder_feed(&decoder, reports[i].data, reports[i].len);
+    }
+    scan_assembler_poll(&assembler,
+                        replay_time_us + SCAN_ASSEMBLER_TIMEOUT_US + 1);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s REPORTS [ITERATIONS]\n", argv[0]);
+        return 2;
+    }
+    load_reports(argv[1]);
+    const long iterations = argc > 2 ? atol(argv[2]) : 1000;
+    if (!report_count) {
+        fprintf(stderr, "%s: no reports\n", argv[1]);
+        return 1;
+    }
+
+    // One warm-up pass sizes the latency buffer
+    replay();
+    const size_t scans_per_pass = scan_count;
+    latency_capacity = scans_per_pass * iterations;
+    latencies = malloc(latency_capacity * sizeof(*latencies));
+    if (!latencies) {
+        perror("malloc");
+        return 1;
+    }
+    scan_count = scan_bytes = 0;
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+    const size_t allocations_before = allocations;
+#endif
+    const uint64_t start = now_ns();
+    for (long i = 0; i < iterations; ++i)
+        replay();
+    const double elapsed = (now_ns() - start) * 1e-9;
+
+    qsort(latencies, latency_count, sizeof(*latencies), compare_u64);
+    uint64_t latency_sum = 0;
+    for (size_t i = 0; i < latency_count; ++i)
+        latency_sum += latencies[i];
+
+    printf("%zu reports, %zu scans per pass, %ld iterations\n", report_count,
+           scans_per_pass, iterations);
+    printf("throughput  %10.0f reports/s %8.1f ns/report %8.2f MB/s scanned\n",
+           report_count * iterations / elapsed,
+           elapsed * 1e9 / (report_count * iterations),
+           scan_bytes / elapsed / 1e6);
+#ifdef BENCH_COUNT_ALLOCATIONS
+    printf("allocations %10zu total %11.3f per report\n",
+           allocations - allocations_before,
+           (double)(allocations - allocations_before) /
+               (report_count * iterations));
+#else
+    printf("allocations not counted, needs GNU ld --wrap\n");
+#endif
+    if (latency_count)
+        printf("scan latency mean %.0f ns, p50 %" PRIu64 " ns, p99 %" PRIu64
+               " ns, max %" PRIu64 " ns\n",
+               (double)latency_sum / latency_count,
+               latencies[latency_count / 2],
+               latencies[latency_count * 99 / 100],
+               latencies[latency_count - 1]);
+    free(latencies);
+    free(reports);
+    return 0;
+}
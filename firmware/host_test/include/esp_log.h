@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+/*
+ * Host replacement for the ESP-IDF logging macros. Logging is compiled out
+ * so it does not distort the benchmarks; arguments are still type checked.
+ */
+
+#include <stdio.h>
+
+#define ESP_LOG_HOST(tag, format, ...)                                         \
+    do {                                                                       \
+        if (0)                                                                 \
+            printf("%s: " format, tag, ##__VA_ARGS__);                         \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+"""Generate a keyboard report stream as a barcode scanner would send it.
+
+Writes a binary capture in the format uploaded by the firmware (see
+src/hid_capture_format.h), or with --text one report per line as
+"<time in us> <hex report>". Each scan is typed with a key press and
+release per character and ends with a tab, except for every fourth scan
+which ends by timeout.
+
+  make_report_corpus.py corpus/scanner_reports.h2mc
+"""
+
+import argparse
+import random
+
+SHIFT = 0x02
+ALT = 0x04
+TAB = 0x2B
+
+KEYS = {" ": 0x2C, "\n": 0x28}
+for i, c in enumerate("abcdefghijklmnopqrstuvwxyz"):
+    KEYS[c] = 0x04 + i
+    KEYS[c.upper()] = (0x04 + i, SHIFT)
+for i, c in enumerate("1234567890"):
+    KEYS[c] = 0x1E + i
+for i, c in enumerate("!@#$%^&*()"):
+    KEYS[c] = (0x1E + i, SHIFT)
+for plain, shifted, code in [
+    ("-", "_", 0x2D), ("=", "+", 0x2E), ("[", "{", 0x2F), ("]", "}", 0x30),
+    ("\\", "|", 0x31), (";", ":", 0x33), ("'", '"', 0x34), ("`", "~", 0x35),
+    (",", "<", 0x36), (".", ">", 0x37), ("/", "?", 0x38),
+]:
+    KEYS[plain] = code
+    KEYS[shifted] = (code, SHIFT)
+KEYPAD = [0x62, 0x59, 0x5A, 0x5B, 0x5C, 0x5D, 0x5E, 0x5F, 0x60, 0x61]
+
+SAMPLES = [
+    "4006381333931",
+    "]Q1https://example.com/product/12345?ref=scan",
+    "]C1010950110153000317100101",
+    "WIFI:T:WPA;S:example;P:correct horse battery staple;;",
+    "MQTT:U:mqtt://broker.example.com:1883;T:hid2mqtt/warehouse;;",
+    "Grüße aus Köln – 20 €",
+]
+
+
+def report(modifier=0, key=0):
+    return bytes([modifier, 0, key, 0, 0, 0, 0, 0])
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        out.append(value & 0x7F | (0x80 if value > 0x7F else 0))
+        value >>= 7
+        if not value:
+            return bytes(out)
+
+
+def type_char(c):
+    """Yield the reports for one character, alt codes for non-ASCII."""
+    if c in KEYS:
+        key = KEYS[c]
+        key, modifier = key if isinstance(key, tuple) else (key, 0)
+        yield report(modifier, key)
+        yield report()
+        return
+    for digit in str(ord(c)):
+        yield report(ALT, KEYPAD[int(digit)])
+        yield report(ALT)
+    yield report()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("output", type=argparse.FileType("wb"))
+    parser.add_argument("--scans", type=int, default=50)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--interval", type=int, default=1000, help="us per report")
+    parser.add_argument("--text", action="store_true", help="write the text format")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    stream = []  # (time in us, report)
+    t = 0
+    for n in range(args.scans):
+        scan = rng.choice(SAMPLES)
+        reports = [r for c in scan for r in type_char(c)]
+        if n % 4 != 3:
+            reports += [report(0, TAB), report()]
+        for r in reports:
+            stream.append((t, r))
+            t += args.interval
+        t += rng.randint(100, 500) * 1000  # pause between scans
+
+    if args.text:
+        lines = [f"{t} {r.hex()}\n" for t, r in stream]
+        args.output.write(("# generated by make_report_corpus.py\n" + "".join(lines)).encode())
+        return
+    out = bytearray(b"H2MC\x01\x00\x00\x00")
+    previous = 0
+    for t, r in stream:
+        out += varint(t - previous) + bytes([len(r)]) + r
+        previous = t
+    args.output.write(out)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,163 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * Feeds a capture uploaded by the firmware (see src/hid_capture.c) through
+ * keyboard_decoder and scan_assembler and prints the resulting scans. The
+ * scan timeout follows the recorded timestamps, so the output is the same at
+ * any speed.
+ *
+ *   replay_capture [-s SPEED] [-k KEYBOARD] CAPTURE
+ *                                       replay, SPEED 0 for no delays,
+ *                                       KEYBOARD as the "keyboard" setting
+ *   replay_capture -t CAPTURE           convert to the text report stream
+ *                                       read by bench_scan_pipeline
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "hid_capture_format.h"
+#include "keyboard_decoder.h"
+#include "scan_assembler.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static keyboard_decoder_t decoder;
+static scan_arena_t arena;
+static scan_assembler_t assembler;
+static int64_t replay_time_us;
+
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    size_t capacity = 64 * 1024;
+    uint8_t *data = malloc(capacity);
+    *size = 0;
+    size_t n;
+    while (data && (n = fread(data + *size, 1, capacity - *size, f)) > 0) {
+        *size += n;
+        if (*size == capacity)
+            data = realloc(data, capacity *= 2);
+    }
+    if (!data) {
+        perror("malloc");
+        exit(1);
+    }
+    fclose(f);
+    return data;
+}
+
+static void on_scan(const char *scan, size_t length, void *arg) {
+    (void)length;
+    (void)arg;
+    printf("%10.6f %s\n", replay_time_us * 1e-6, scan);
+    fflush(stdout);
+}
+
+static void on_text(const char *text, size_t length, void *arg) {
+    (void)arg;
+    scan_assembler_put_text(&assembler, text, length, replay_time_us);
+}
+
+/* Advance the replay clock, sleeping for the scaled difference */
+static void wait_until(int64_t time_us, double speed) {
+    if (time_us <= replay_time_us)
+        return;
+    const double us = speed > 0 ? (time_us - replay_time_us) / speed : 0;
+    replay_time_us = time_us;
+    if (us <= 0)
+        return;
+    const struct timespec ts = {(time_t)(us / 1e6),
+                                (long)(us * 1e3) % 1000000000};
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char **argv) {
+    double speed = 1;
+    int text = 0;
+    text_decoder_config_t keyboard;
+    text_decoder_parse_config("", &keyboard);
+    int opt;
+    while ((opt = getopt(argc, argv, "s:k:t")) != -1) {
+        switch (opt) {
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'k':
+            if (!text_decoder_parse_config(optarg, &keyboard))
+                goto usage;
+            break;
+        case 't':
+            text = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1)
+        goto usage;
+
+    size_t size;
+    uint8_t *data = read_file(argv[optind], &size);
+    hid_capture_reader_t reader;
+    if (!hid_capture_reader_init(&reader, data, size)) {
+        fprintf(stderr, "%s: not a capture\n", argv[optind]);
+        return 1;
+    }
+
+    keyboard_decoder_init(&decoder, on_text, NULL);
+    keyboard_decoder_configure(&decoder, &keyboard);
+    scan_arena_init(&arena);
+    scan_assembler_init(&assembler, &arena, on_scan, NULL);
+    uint32_t delta_us;
+    const uint8_t *report;
+    size_t length;
+    size_t count = 0;
+    while (hid_capture_next(&reader, &delta_us, &report, &length)) {
+        // The first delta refers to a record dropped from the ring
+        const int64_t report_us = count++ ? replay_time_us + delta_us : 0;
+        if (text) {
+            replay_time_us = report_us;
+            printf("%" PRId64 " ", report_us);
+            for (size_t i = 0; i < length; ++i)
+                printf("%02x", report[i]);
+            printf("\n");
+            continue;
+        }
+        // Submit a scan that times out in the pause when the device would
+        const int64_t timeout_us =
+            assembler.last_key_us + SCAN_ASSEMBLER_TIMEOUT_US + 1;
+        if (assembler.length && timeout_us < report_us) {
+            wait_until(timeout_us, speed);
+            scan_assembler_poll(&assembler, timeout_us);
+        }
+        wait_until(report_us, speed);
+        scan_assembler_poll(&assembler, report_us);
+        keyboard_decoder_feed(&decoder, report, length);
+    }
+    if (reader.pos != reader.end)
+        fprintf(stderr, "%s: truncated record at offset %td\n", argv[optind],
+                reader.pos - data);
+    if (!text) {
+        wait_until(assembler.last_key_us + SCAN_ASSEMBLER_TIMEOUT_US + 1, speed);
+        scan_assembler_poll(&assembler, replay_time_us);
+    }
+    free(data);
+    return 0;
+
+usage:
+    fprintf(stderr,
+            "usage: %s [-s SPEED] [-k <unicode|windows>,<us|intl>] CAPTURE\n"
+            "       %s -t CAPTURE\n",
+            argv[0], argv[0]);
+    return 2;
+}
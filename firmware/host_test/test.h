@@ -0,0 +1,40 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+/* Minimal test helpers, a failed check is reported and the test continues */
+
+static int test_failures;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #cond);                                                    \
+            ++test_failures;                                                   \
+        }                                                                      \
+    } while (0)
+
+#define CHECK_STR(actual, expected)                                            \
+    do {                                                                       \
+        const char *a_ = (actual), *e_ = (expected);                           \
+        if (strcmp(a_, e_) != 0) {                                             \
+            fprintf(stderr, "%s:%d: expected \"%s\", got \"%s\"\n", __FILE__,  \
+                    __LINE__, e_, a_);                                         \
+            ++test_failures;                                                   \
+        }                                                                      \
+    } while (0)
+
+#define RUN_TEST(fn)                                                           \
+    do {                                                                       \
+        const int failures_ = test_failures;                                   \
+        fn();                                                                  \
+        printf("%s %s\n", test_failures == failures_ ? "PASS" : "FAIL", #fn);  \
+    } while (0)
+
+#define TEST_EXIT_CODE() (test_failures ? 1 : 0)
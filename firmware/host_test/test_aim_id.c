@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "aim_id.h"
+#include "test.h"
+
+static void test_parse(void) {
+    aim_id_t id;
+    CHECK(aim_id_parse("]C10104012345678901", &id) == AIM_ID_LENGTH);
+    CHECK(id.code == 'C' && id.modifier == '1');
+    CHECK_STR(id.symbology, "code128");
+    CHECK(aim_id_parse("]E04006381333931", &id) == AIM_ID_LENGTH);
+    CHECK_STR(id.symbology, "ean");
+    CHECK(aim_id_parse("]d2010401234567890", &id) == AIM_ID_LENGTH);
+    CHECK_STR(id.symbology, "datamatrix");
+    CHECK(aim_id_parse("]Q3https://example.com", &id) == AIM_ID_LENGTH);
+    CHECK(id.code == 'Q' && id.modifier == '3');
+    CHECK_STR(id.symbology, "qr");
+}
+
+static void test_unknown_symbology(void) {
+    aim_id_t id;
+    CHECK(aim_id_parse("]Y0data", &id) == AIM_ID_LENGTH);
+    CHECK_STR(id.symbology, "other");
+}
+
+static void test_no_identifier(void) {
+    aim_id_t id;
+    CHECK(aim_id_parse("4006381333931", &id) == 0);
+    CHECK(id.code == 0);
+    CHECK(aim_id_parse("]", &id) == 0);
+    CHECK(aim_id_parse("]Q", &id) == 0);
+    CHECK(aim_id_parse("]1Q", &id) == 0);
+    CHECK(aim_id_parse("]Q-", &id) == 0);
+    CHECK(aim_id_parse("", &id) == 0);
+}
+
+static void test_route(void) {
+    aim_id_t id;
+    char route[16];
+    aim_id_parse("]d2data", &id);
+    CHECK(aim_id_route(&id, route, sizeof(route)));
+    CHECK_STR(route, "datamatrix/d2");
+    CHECK(!aim_id_route(&id, route, 8));
+    aim_id_parse("no identifier", &id);
+    CHECK(!aim_id_route(&id, route, sizeof(route)));
+}
+
+int main(void) {
+    RUN_TEST(test_parse);
+    RUN_TEST(test_unknown_symbology);
+    RUN_TEST(test_no_identifier);
+    RUN_TEST(test_route);
+    return TEST_EXIT_CODE();
+}
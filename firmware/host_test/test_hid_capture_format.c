@@ -0,0 +1,86 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "hid_capture_format.h"
+#include "test.h"
+
+static uint8_t capture[1024];
+static size_t capture_size;
+
+static void append(uint32_t delta_us, const uint8_t *report, size_t length) {
+    capture_size +=
+        hid_capture_encode(capture + capture_size, delta_us, report, length);
+}
+
+static void setup(void) {
+    hid_capture_write_header(capture);
+    capture_size = HID_CAPTURE_HEADER_SIZE;
+}
+
+static void test_round_trip(void) {
+    const uint8_t key_a[8] = {0, 0, 0x04};
+    const uint8_t release[8] = {0};
+    const uint32_t deltas[] = {0, 127, 128, 1000, 300000, UINT32_MAX};
+    setup();
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(deltas[0]); ++i)
+        append(deltas[i], i % 2 ? release : key_a, 8);
+
+    hid_capture_reader_t reader;
+    CHECK(hid_capture_reader_init(&reader, capture, capture_size));
+    uint32_t delta_us;
+    const uint8_t *report;
+    size_t length;
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(deltas[0]); ++i) {
+        CHECK(hid_capture_next(&reader, &delta_us, &report, &length));
+        CHECK(delta_us == deltas[i]);
+        CHECK(length == 8);
+        CHECK(memcmp(report, i % 2 ? release : key_a, 8) == 0);
+    }
+    CHECK(!hid_capture_next(&reader, &delta_us, &report, &length));
+    CHECK(reader.pos == reader.end);
+}
+
+static void test_compact_encoding(void) {
+    uint8_t record[HID_CAPTURE_MAX_RECORD];
+    const uint8_t report[8] = {0};
+    // A report every millisecond costs two bytes of time stamp
+    CHECK(hid_capture_encode(record, 1000, report, 8) == 2 + 1 + 8);
+    CHECK(hid_capture_encode(record, 100, report, 8) == 1 + 1 + 8);
+    CHECK(hid_capture_encode(record, UINT32_MAX, report, 8) == 5 + 1 + 8);
+    CHECK(hid_capture_record_size(record, sizeof(record)) == 5 + 1 + 8);
+}
+
+static void test_truncated(void) {
+    const uint8_t report[8] = {0, 0, 0x05};
+    setup();
+    append(1000, report, 8);
+    append(1000, report, 8);
+
+    hid_capture_reader_t reader;
+    CHECK(hid_capture_reader_init(&reader, capture, capture_size - 1));
+    uint32_t delta_us;
+    const uint8_t *data;
+    size_t length;
+    CHECK(hid_capture_next(&reader, &delta_us, &data, &length));
+    CHECK(!hid_capture_next(&reader, &delta_us, &data, &length));
+    CHECK(reader.pos != reader.end);
+    CHECK(hid_capture_record_size(capture + HID_CAPTURE_HEADER_SIZE, 2) == 0);
+}
+
+static void test_bad_header(void) {
+    hid_capture_reader_t reader;
+    setup();
+    CHECK(!hid_capture_reader_init(&reader, capture, 4));
+    capture[4] = HID_CAPTURE_VERSION + 1;
+    CHECK(!hid_capture_reader_init(&reader, capture, capture_size));
+    CHECK(!hid_capture_reader_init(&reader, (const uint8_t *)"0 00000000", 10));
+}
+
+int main(void) {
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_compact_encoding);
+    RUN_TEST(test_truncated);
+    RUN_TEST(test_bad_header);
+    return TEST_EXIT_CODE();
+}
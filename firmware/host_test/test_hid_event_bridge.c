@@ -0,0 +1,253 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "hid_event_bridge.h"
+#include "hid_report_parser.h"
+#include "test.h"
+
+// HID 1.11 appendix B.2 with a wheel, as sent in report protocol
+static const uint8_t mouse_desc[] = {
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00, 0x05,
+    0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03,
+    0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05,
+    0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7f,
+    0x75, 0x08, 0x95, 0x03, 0x81, 0x06, 0xc0, 0xc0,
+};
+
+// Consumer control keys as report 1, a pedal with four buttons as report 2
+static const uint8_t pedal_desc[] = {
+    0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x01, 0x19, 0x00, 0x2a,
+    0x3c, 0x02, 0x15, 0x00, 0x26, 0x3c, 0x02, 0x75, 0x10, 0x95, 0x02,
+    0x81, 0x00, 0xc0, 0x05, 0x01, 0x09, 0x04, 0xa1, 0x01, 0x85, 0x02,
+    0x09, 0x32, 0x15, 0x00, 0x26, 0xff, 0x03, 0x75, 0x10, 0x95, 0x01,
+    0x81, 0x02, 0x05, 0x09, 0x19, 0x01, 0x29, 0x04, 0x25, 0x01, 0x75,
+    0x01, 0x95, 0x04, 0x81, 0x02, 0x95, 0x04, 0x81, 0x03, 0xc0,
+};
+
+static char published[HID_EVENT_BATCH_SIZE];
+static int publish_count;
+
+static void publish(const char *batch, size_t length, void *arg) {
+    (void)arg;
+    CHECK(length == strlen(batch));
+    snprintf(published, sizeof(published), "%s", batch);
+    ++publish_count;
+}
+
+static void bridge_init(hid_event_bridge_t *bridge, const uint8_t *desc,
+                        size_t length, uint32_t interval_ms,
+                        uint32_t deadband) {
+    const hid_event_bridge_config_t config = {.interval_ms = interval_ms,
+                                              .deadband = deadband};
+    CHECK(hid_event_bridge_init(bridge, &config, desc, length, "1209:0002",
+                                publish, NULL));
+    published[0] = '\0';
+    publish_count = 0;
+}
+
+static void test_parse_mouse(void) {
+    hid_report_layout_t layout;
+    CHECK(hid_report_parse(mouse_desc, sizeof(mouse_desc), &layout));
+    CHECK(!layout.report_ids);
+    CHECK(layout.field_count == 6);
+    CHECK(layout.fields[0].usage_page == 0x09);
+    CHECK(layout.fields[0].usage == 1);
+    CHECK(layout.fields[2].usage == 3);
+    CHECK(layout.fields[2].bit_offset == 2);
+    CHECK(layout.fields[2].bit_size == 1);
+    CHECK(layout.fields[3].usage_page == 0x01);
+    CHECK(layout.fields[3].usage == 0x30);
+    CHECK(layout.fields[3].bit_offset == 8);
+    CHECK(layout.fields[3].flags ==
+          (HID_REPORT_FIELD_RELATIVE | HID_REPORT_FIELD_SIGNED));
+    CHECK(layout.fields[5].usage == 0x38);
+    CHECK(layout.fields[5].bit_offset == 24);
+    CHECK(layout.fields[5].logical_min == -127);
+}
+
+static void test_parse_report_ids(void) {
+    hid_report_layout_t layout;
+    CHECK(hid_report_parse(pedal_desc, sizeof(pedal_desc), &layout));
+    CHECK(layout.report_ids);
+    CHECK(layout.field_count == 6);
+    const hid_report_field_t *keys = &layout.fields[0];
+    CHECK(keys->report_id == 1);
+    CHECK(keys->flags == HID_REPORT_FIELD_ARRAY);
+    CHECK(keys->count == 2);
+    CHECK(keys->usage_page == 0x0c);
+    CHECK(keys->usage == 0);
+    CHECK(keys->usage_max == 0x23c);
+    // Bit offsets count separately for each report
+    CHECK(layout.fields[1].report_id == 2);
+    CHECK(layout.fields[1].bit_offset == 0);
+    CHECK(layout.fields[1].logical_max == 1023);
+    CHECK(layout.fields[2].usage == 1);
+    CHECK(layout.fields[2].bit_offset == 16);
+    CHECK(layout.fields[5].usage == 4);
+}
+
+static void test_parse_malformed(void) {
+    hid_report_layout_t layout;
+    // Truncated item data
+    CHECK(!hid_report_parse(mouse_desc, 41, &layout));
+    // Pop without push
+    const uint8_t pop[] = {0xb4};
+    CHECK(!hid_report_parse(pop, sizeof(pop), &layout));
+    // Logical Maximum 0xff with a minimum of 0 is 255, not -1
+    const uint8_t slider[] = {0x05, 0x01, 0x09, 0x36, 0x15, 0x00, 0x25,
+                              0xff, 0x75, 0x08, 0x95, 0x01, 0x81, 0x02};
+    CHECK(hid_report_parse(slider, sizeof(slider), &layout));
+    CHECK(layout.field_count == 1);
+    CHECK(layout.fields[0].logical_max == 255);
+    CHECK(!(layout.fields[0].flags & HID_REPORT_FIELD_SIGNED));
+}
+
+static void test_field_get(void) {
+    const hid_report_field_t wheel = {
+        .bit_offset = 24, .bit_size = 8, .count = 1,
+        .flags = HID_REPORT_FIELD_SIGNED};
+    const hid_report_field_t across = {
+        .bit_offset = 6, .bit_size = 10, .count = 1};
+    const uint8_t report[] = {0xc0, 0xff, 0x00, 0xfb};
+    int32_t value;
+    CHECK(hid_report_field_get(&wheel, report, sizeof(report), 0, &value));
+    CHECK(value == -5);
+    CHECK(hid_report_field_get(&across, report, sizeof(report), 0, &value));
+    CHECK(value == 0x3ff);
+    CHECK(!hid_report_field_get(&wheel, report, 3, 0, &value));
+    CHECK(!hid_report_field_get(&wheel, report, sizeof(report), 1, &value));
+}
+
+static void test_parse_config(void) {
+    hid_event_bridge_config_t config;
+    CHECK(hid_event_bridge_parse_config("50,2", &config));
+    CHECK(config.interval_ms == 50 && config.deadband == 2);
+    CHECK(!hid_event_bridge_parse_config("", &config));
+    CHECK(!hid_event_bridge_parse_config("50", &config));
+    CHECK(!hid_event_bridge_parse_config("-1,2", &config));
+    CHECK(!hid_event_bridge_parse_config("50,2x", &config));
+}
+
+static void test_relative_coalesced(void) {
+    static hid_event_bridge_t bridge;
+    bridge_init(&bridge, mouse_desc, sizeof(mouse_desc), 50, 0);
+    const uint8_t move[] = {0x00, 0x01, 0xff, 0x00};
+
+    // An idle device publishes right away
+    hid_event_bridge_feed(&bridge, move, sizeof(move), 0);
+    hid_event_bridge_poll(&bridge, 0);
+    CHECK(publish_count == 1);
+    CHECK_STR(published,
+              "{\"dev\":\"1209:0002\",\"ev\":[[1,48,1],[1,49,-1]]}");
+
+    // 1 kHz reports end up in one batch per interval
+    for (int ms = 1; ms < 50; ++ms) {
+        hid_event_bridge_feed(&bridge, move, sizeof(move), ms * 1000);
+        hid_event_bridge_poll(&bridge, ms * 1000);
+    }
+    CHECK(publish_count == 1);
+    hid_event_bridge_poll(&bridge, 50 * 1000);
+    CHECK(publish_count == 2);
+    CHECK_STR(published,
+              "{\"dev\":\"1209:0002\",\"ev\":[[1,48,49],[1,49,-49]]}");
+
+    // Nothing changed, nothing published
+    hid_event_bridge_poll(&bridge, 200 * 1000);
+    CHECK(publish_count == 2);
+}
+
+static void test_button_not_lost(void) {
+    static hid_event_bridge_t bridge;
+    bridge_init(&bridge, mouse_desc, sizeof(mouse_desc), 50, 0);
+    const uint8_t press[] = {0x01, 0x00, 0x00, 0x00};
+    const uint8_t release[] = {0x00, 0x00, 0x00, 0x00};
+    hid_event_bridge_feed(&bridge, press, sizeof(press), 0);
+    hid_event_bridge_poll(&bridge, 0);
+    hid_event_bridge_feed(&bridge, release, sizeof(release), 1000);
+    hid_event_bridge_feed(&bridge, press, sizeof(press), 2000);
+    hid_event_bridge_feed(&bridge, release, sizeof(release), 3000);
+    hid_event_bridge_poll(&bridge, 3000);
+    CHECK(publish_count == 1);
+    hid_event_bridge_poll(&bridge, 50 * 1000);
+    CHECK(publish_count == 2);
+    CHECK_STR(published,
+              "{\"dev\":\"1209:0002\",\"ev\":[[9,1,0],[9,1,1],[9,1,0]]}");
+}
+
+static void test_absolute_deadband(void) {
+    static hid_event_bridge_t bridge;
+    bridge_init(&bridge, pedal_desc, sizeof(pedal_desc), 0, 4);
+    const uint8_t levels[][4] = {
+        {0x02, 100, 0x00, 0x00}, {0x02, 102, 0x00, 0x00},
+        {0x02, 105, 0x00, 0x00}, {0x02, 102, 0x00, 0x00},
+        {0x02, 101, 0x00, 0x00}};
+    static const int expected_count[] = {1, 1, 2, 2, 3};
+    for (int i = 0; i < 5; ++i) {
+        hid_event_bridge_feed(&bridge, levels[i], sizeof(levels[i]), i * 1000);
+        hid_event_bridge_poll(&bridge, i * 1000);
+        CHECK(publish_count == expected_count[i]);
+    }
+    CHECK_STR(published, "{\"dev\":\"1209:0002\",\"ev\":[[1,50,101]]}");
+
+    // A pedal button on the same report
+    const uint8_t button[] = {0x02, 101, 0x00, 0x04};
+    hid_event_bridge_feed(&bridge, button, sizeof(button), 5000);
+    hid_event_bridge_poll(&bridge, 5000);
+    CHECK_STR(published, "{\"dev\":\"1209:0002\",\"ev\":[[9,3,1]]}");
+}
+
+static void test_array_usages(void) {
+    static hid_event_bridge_t bridge;
+    bridge_init(&bridge, pedal_desc, sizeof(pedal_desc), 0, 0);
+    const uint8_t volume_up[] = {0x01, 0xe9, 0x00, 0x00, 0x00};
+    const uint8_t both[] = {0x01, 0xea, 0x00, 0xe9, 0x00};
+    const uint8_t none[] = {0x01, 0x00, 0x00, 0x00, 0x00};
+    hid_event_bridge_feed(&bridge, volume_up, sizeof(volume_up), 0);
+    hid_event_bridge_poll(&bridge, 0);
+    CHECK_STR(published, "{\"dev\":\"1209:0002\",\"ev\":[[12,233,1]]}");
+    // Moving to another slot is no change
+    hid_event_bridge_feed(&bridge, both, sizeof(both), 1000);
+    hid_event_bridge_poll(&bridge, 1000);
+    CHECK_STR(published, "{\"dev\":\"1209:0002\",\"ev\":[[12,234,1]]}");
+    hid_event_bridge_feed(&bridge, none, sizeof(none), 2000);
+    hid_event_bridge_poll(&bridge, 2000);
+    CHECK_STR(published,
+              "{\"dev\":\"1209:0002\",\"ev\":[[12,234,0],[12,233,0]]}");
+    // A report of another ID leaves the keys alone
+    const uint8_t pedal[] = {0x02, 0x00, 0x00, 0x00};
+    hid_event_bridge_feed(&bridge, pedal, sizeof(pedal), 3000);
+    hid_event_bridge_poll(&bridge, 3000);
+    CHECK(publish_count == 3);
+}
+
+static void test_full_batch_published_early(void) {
+    static hid_event_bridge_t bridge;
+    bridge_init(&bridge, mouse_desc, sizeof(mouse_desc), 1000, 0);
+    const uint8_t press[] = {0x07, 0x00, 0x00, 0x00};
+    const uint8_t release[] = {0x00, 0x00, 0x00, 0x00};
+    hid_event_bridge_feed(&bridge, press, sizeof(press), 0);
+    hid_event_bridge_poll(&bridge, 0);
+    CHECK(publish_count == 1);
+    // 60 events do not fit into a batch
+    for (int i = 0; i < 10; ++i) {
+        hid_event_bridge_feed(&bridge, release, sizeof(release), 1000);
+        hid_event_bridge_feed(&bridge, press, sizeof(press), 1000);
+    }
+    CHECK(publish_count == 2);
+    CHECK(strlen(published) < HID_EVENT_BATCH_SIZE);
+}
+
+int main(void) {
+    RUN_TEST(test_parse_mouse);
+    RUN_TEST(test_parse_report_ids);
+    RUN_TEST(test_parse_malformed);
+    RUN_TEST(test_field_get);
+    RUN_TEST(test_parse_config);
+    RUN_TEST(test_relative_coalesced);
+    RUN_TEST(test_button_not_lost);
+    RUN_TEST(test_absolute_deadband);
+    RUN_TEST(test_array_usages);
+    RUN_TEST(test_full_batch_published_early);
+    return TEST_EXIT_CODE();
+}
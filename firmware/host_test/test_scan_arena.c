@@ -0,0 +1,74 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "scan_arena.h"
+#include "test.h"
+
+static scan_arena_t arena;
+
+static void test_alloc_rounds_up_to_chunks(void) {
+    scan_arena_init(&arena);
+    char *run = scan_arena_alloc(&arena, SCAN_ARENA_CHUNK_SIZE + 1);
+    CHECK(run != NULL);
+    CHECK(scan_arena_capacity(&arena, run) == 2 * SCAN_ARENA_CHUNK_SIZE);
+    CHECK(scan_arena_free_chunks(&arena) == SCAN_ARENA_CHUNK_COUNT - 2);
+    scan_arena_release(&arena, run);
+    CHECK(scan_arena_free_chunks(&arena) == SCAN_ARENA_CHUNK_COUNT);
+}
+
+static void test_grow_in_place(void) {
+    scan_arena_init(&arena);
+    char *run = scan_arena_alloc(&arena, 1);
+    CHECK(scan_arena_grow(&arena, run, 0, 3 * SCAN_ARENA_CHUNK_SIZE) == run);
+    CHECK(scan_arena_capacity(&arena, run) == 3 * SCAN_ARENA_CHUNK_SIZE);
+    // Runs follow each other
+    char *next = scan_arena_alloc(&arena, 1);
+    CHECK(next == run + 3 * SCAN_ARENA_CHUNK_SIZE);
+}
+
+static void test_grow_moves_when_blocked(void) {
+    scan_arena_init(&arena);
+    char *run = scan_arena_alloc(&arena, 1);
+    char *blocker = scan_arena_alloc(&arena, 1);
+    memcpy(run, "scan", 5);
+    char *moved = scan_arena_grow(&arena, run, 5, 2 * SCAN_ARENA_CHUNK_SIZE);
+    CHECK(moved != NULL && moved != run);
+    CHECK_STR(moved, "scan");
+    CHECK(scan_arena_free_chunks(&arena) == SCAN_ARENA_CHUNK_COUNT - 3);
+    scan_arena_release(&arena, blocker);
+    scan_arena_release(&arena, moved);
+    CHECK(scan_arena_free_chunks(&arena) == SCAN_ARENA_CHUNK_COUNT);
+}
+
+static void test_alloc_wraps_around(void) {
+    scan_arena_init(&arena);
+    char *first = scan_arena_alloc(&arena, SCAN_ARENA_CHUNK_SIZE);
+    char *rest = scan_arena_alloc(
+        &arena, (SCAN_ARENA_CHUNK_COUNT - 1) * SCAN_ARENA_CHUNK_SIZE);
+    CHECK(rest != NULL);
+    CHECK(scan_arena_alloc(&arena, 1) == NULL);
+    scan_arena_release(&arena, first);
+    CHECK(scan_arena_alloc(&arena, 1) == first);
+}
+
+static void test_grow_fails_without_room(void) {
+    scan_arena_init(&arena);
+    char *run = scan_arena_alloc(&arena, 1);
+    char *rest = scan_arena_alloc(
+        &arena, (SCAN_ARENA_CHUNK_COUNT - 1) * SCAN_ARENA_CHUNK_SIZE);
+    CHECK(rest != NULL);
+    CHECK(scan_arena_grow(&arena, run, 0, 2 * SCAN_ARENA_CHUNK_SIZE) == NULL);
+    CHECK(scan_arena_capacity(&arena, run) == SCAN_ARENA_CHUNK_SIZE);
+    CHECK(scan_arena_alloc(&arena, (SCAN_ARENA_CHUNK_COUNT + 1) *
+                                       SCAN_ARENA_CHUNK_SIZE) == NULL);
+}
+
+int main(void) {
+    RUN_TEST(test_alloc_rounds_up_to_chunks);
+    RUN_TEST(test_grow_in_place);
+    RUN_TEST(test_grow_moves_when_blocked);
+    RUN_TEST(test_alloc_wraps_around);
+    RUN_TEST(test_grow_fails_without_room);
+    return TEST_EXIT_CODE();
+}
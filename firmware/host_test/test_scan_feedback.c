@@ -0,0 +1,108 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "scan_feedback.h"
+#include "test.h"
+
+#include <stdint.h>
+
+#define LED SCAN_FEEDBACK_LED_SCROLL_LOCK
+
+static uint8_t leds[64];
+static int led_count;
+
+static void set_leds(uint8_t value, void *arg) {
+    (void)arg;
+    if (led_count < (int)sizeof(leds))
+        leds[led_count] = value;
+    ++led_count;
+}
+
+static void feedback_init(scan_feedback_t *feedback) {
+    scan_feedback_init(feedback, set_leds, NULL);
+    led_count = 0;
+}
+
+/* Poll every millisecond from start for ms, returns the time reached */
+static int64_t run(scan_feedback_t *feedback, int64_t start_us, int ms) {
+    int64_t now_us = start_us;
+    for (int i = 0; i < ms; ++i, now_us += 1000)
+        scan_feedback_poll(feedback, now_us);
+    return now_us;
+}
+
+static void test_idle(void) {
+    scan_feedback_t feedback;
+    feedback_init(&feedback);
+    run(&feedback, 0, 1000);
+    CHECK(led_count == 0);
+}
+
+static void test_acked(void) {
+    scan_feedback_t feedback;
+    feedback_init(&feedback);
+    scan_feedback_signal(&feedback, SCAN_FEEDBACK_ACKED);
+    scan_feedback_poll(&feedback, 0);
+    CHECK(led_count == 1 && leds[0] == LED);
+    // Still on just before the step ends
+    run(&feedback, 1000, 148);
+    CHECK(led_count == 1);
+    run(&feedback, 150000, 2000);
+    CHECK(led_count == 2 && leds[1] == 0);
+}
+
+static void test_patterns_distinct(void) {
+    static const int blinks[] = {
+        [SCAN_FEEDBACK_ACKED] = 1,
+        [SCAN_FEEDBACK_BUFFERED] = 2,
+        [SCAN_FEEDBACK_FAILED] = 4,
+    };
+    for (int outcome = SCAN_FEEDBACK_ACKED; outcome <= SCAN_FEEDBACK_FAILED;
+         ++outcome) {
+        scan_feedback_t feedback;
+        feedback_init(&feedback);
+        scan_feedback_signal(&feedback, outcome);
+        run(&feedback, 0, 5000);
+        int on = 0;
+        for (int i = 0; i < led_count; ++i)
+            on += leds[i] == LED;
+        CHECK(on == blinks[outcome]);
+        CHECK(led_count == 2 * blinks[outcome]);
+        CHECK(leds[led_count - 1] == 0);
+    }
+}
+
+static void test_most_severe_first(void) {
+    scan_feedback_t feedback;
+    feedback_init(&feedback);
+    scan_feedback_signal(&feedback, SCAN_FEEDBACK_ACKED);
+    scan_feedback_signal(&feedback, SCAN_FEEDBACK_FAILED);
+    // The failure shows alone first
+    int64_t now_us = run(&feedback, 0, 1000);
+    CHECK(led_count == 8);
+    // Then the ack
+    run(&feedback, now_us, 1000);
+    CHECK(led_count == 10);
+}
+
+static void test_coalesced(void) {
+    scan_feedback_t feedback;
+    feedback_init(&feedback);
+    scan_feedback_signal(&feedback, SCAN_FEEDBACK_ACKED);
+    scan_feedback_poll(&feedback, 0);
+    // Acks while the pattern is shown are shown once after it
+    for (int i = 0; i < 5; ++i)
+        scan_feedback_signal(&feedback, SCAN_FEEDBACK_ACKED);
+    run(&feedback, 1000, 5000);
+    CHECK(led_count == 4);
+}
+
+int main(void) {
+    RUN_TEST(test_idle);
+    RUN_TEST(test_acked);
+    RUN_TEST(test_patterns_distinct);
+    RUN_TEST(test_most_severe_first);
+    RUN_TEST(test_coalesced);
+    return TEST_EXIT_CODE();
+}
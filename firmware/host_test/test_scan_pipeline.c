@@ -0,0 +1,388 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "keyboard_decoder.h"
+#include "scan_assembler.h"
+#include "test.h"
+
+static keyboard_decoder_t decoder;
+static scan_arena_t arena;
+static scan_assembler_t assembler;
+static int64_t now_us;
+static char scans[4][SCAN_ASSEMBLER_MAX_SCAN_SIZE];
+static int scan_count;
+
+static void on_scan(const char *scan, size_t length, void *arg) {
+    (void)arg;
+    CHECK(strlen(scan) == length);
+    if (scan_count < 4)
+        snprintf(scans[scan_count], sizeof(scans[0]), "%s", scan);
+    ++scan_count;
+}
+
+static int text_calls;
+
+static void on_text(const char *text, size_t length, void *arg) {
+    ++text_calls;
+    scan_assembler_put_text(arg, text, length, now_us);
+}
+
+static void flush_keyboard(void *arg) {
+    keyboard_decoder_flush(arg);
+}
+
+static void setup_keyboard(const char *spec) {
+    text_decoder_config_t config;
+    CHECK(text_decoder_parse_config(spec, &config));
+    scan_arena_init(&arena);
+    scan_assembler_init(&assembler, &arena, on_scan, NULL);
+    keyboard_decoder_init(&decoder, on_text, &assembler);
+    scan_assembler_set_flush(&assembler, flush_keyboard, &decoder);
+    keyboard_decoder_configure(&decoder, &config);
+    text_calls = 0;
+    memset(scans, 0, sizeof(scans));
+    scan_count = 0;
+    now_us = 0;
+}
+
+static void setup(void) {
+    setup_keyboard("");
+}
+
+static void report(uint8_t modifier, uint8_t key) {
+    const uint8_t data[8] = {modifier, 0, key};
+    keyboard_decoder_feed(&decoder, data, sizeof(data));
+    now_us += 1000;
+}
+
+/* Press and release a key */
+static void type(uint8_t modifier, uint8_t key) {
+    report(modifier, key);
+    report(0, 0);
+}
+
+static void test_keys_and_shift(void) {
+    setup();
+    type(0, HID_KEY_A);
+    type(HID_LEFT_SHIFT, HID_KEY_B);
+    type(HID_RIGHT_SHIFT, HID_KEY_1);
+    type(0, HID_KEY_KEYPAD_7);
+    type(0, HID_KEY_TAB);
+    CHECK(scan_count == 1);
+    CHECK_STR(scans[0], "aB!7");
+}
+
+static void test_held_key_repeats_once(void) {
+    setup();
+    report(0, HID_KEY_A);
+    report(0, HID_KEY_A);
+    report(0, HID_KEY_A);
+    report(0, 0);
+    report(0, HID_KEY_A);
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "aa");
+}
+
+static void test_rollover(void) {
+    setup();
+    const uint8_t both[8] = {0, 0, HID_KEY_X, HID_KEY_Y};
+    const uint8_t y_only[8] = {0, 0, HID_KEY_Y};
+    const uint8_t rollover[8] = {0, 0, HID_KEY_ROLLOVER, HID_KEY_ROLLOVER};
+    keyboard_decoder_feed(&decoder, both, sizeof(both));
+    keyboard_decoder_feed(&decoder, y_only, sizeof(y_only));
+    keyboard_decoder_feed(&decoder, rollover, sizeof(rollover));
+    type(0, HID_KEY_Z);
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "xyz");
+}
+
+static void test_short_report_ignored(void) {
+    setup();
+    const uint8_t data[4] = {0, 0, HID_KEY_A};
+    keyboard_decoder_feed(&decoder, data, sizeof(data));
+    type(0, HID_KEY_TAB);
+    CHECK(scan_count == 0);
+}
+
+static void alt_code(const uint8_t *digits, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        report(HID_LEFT_ALT, digits[i]);
+        report(HID_LEFT_ALT, 0);
+    }
+    report(0, 0);
+}
+
+static void test_alt_codes(void) {
+    setup();
+    const uint8_t code_65[] = {HID_KEY_KEYPAD_6, HID_KEY_KEYPAD_5};
+    const uint8_t code_228[] = {HID_KEY_KEYPAD_2, HID_KEY_KEYPAD_2,
+                                HID_KEY_KEYPAD_8};
+    const uint8_t code_8364[] = {HID_KEY_KEYPAD_8, HID_KEY_KEYPAD_3,
+                                 HID_KEY_KEYPAD_6, HID_KEY_KEYPAD_4};
+    alt_code(code_65, sizeof(code_65));
+    alt_code(code_228, sizeof(code_228));
+    alt_code(code_8364, sizeof(code_8364));
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "A\xc3\xa4\xe2\x82\xac");
+}
+
+static void test_windows_alt_codes(void) {
+    setup_keyboard("windows,us");
+    // OEM code page 437 without, ANSI code page 1252 with a leading zero
+    const uint8_t code_132[] = {HID_KEY_KEYPAD_1, HID_KEY_KEYPAD_3,
+                                HID_KEY_KEYPAD_2};
+    const uint8_t code_0128[] = {HID_KEY_KEYPAD_0, HID_KEY_KEYPAD_1,
+                                 HID_KEY_KEYPAD_2, HID_KEY_KEYPAD_8};
+    const uint8_t code_0228[] = {HID_KEY_KEYPAD_0, HID_KEY_KEYPAD_2,
+                                 HID_KEY_KEYPAD_2, HID_KEY_KEYPAD_8};
+    const uint8_t code_29[] = {HID_KEY_KEYPAD_2, HID_KEY_KEYPAD_9};
+    alt_code(code_132, sizeof(code_132));
+    alt_code(code_0128, sizeof(code_0128));
+    alt_code(code_0228, sizeof(code_0228));
+    alt_code(code_29, sizeof(code_29));
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "\xc3\xa4\xe2\x82\xac\xc3\xa4\x1d");
+}
+
+static void test_ctrl_shift_u(void) {
+    setup();
+    const uint8_t ctrl_shift = HID_LEFT_CONTROL | HID_LEFT_SHIFT;
+    // Committed by Space
+    type(ctrl_shift, HID_KEY_U);
+    type(0, HID_KEY_2);
+    type(0, HID_KEY_0);
+    type(0, HID_KEY_A);
+    type(0, HID_KEY_C);
+    type(0, HID_KEY_SPACE);
+    // Committed by releasing Ctrl+Shift
+    type(ctrl_shift, HID_KEY_U);
+    const uint8_t digits[] = {HID_KEY_1, HID_KEY_F, HID_KEY_6, HID_KEY_0,
+                              HID_KEY_0};
+    for (size_t i = 0; i < sizeof(digits); ++i) {
+        report(ctrl_shift, digits[i]);
+        report(ctrl_shift, 0);
+    }
+    report(0, 0);
+    // Cancelled by Escape
+    type(ctrl_shift, HID_KEY_U);
+    type(0, HID_KEY_4);
+    type(0, HID_KEY_ESC);
+    type(0, HID_KEY_B);
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "\xe2\x82\xac\xf0\x9f\x98\x80" "b");
+}
+
+static void test_dead_keys(void) {
+    setup_keyboard("unicode,intl");
+    type(0, HID_KEY_QUOTE);
+    type(0, HID_KEY_E);
+    type(HID_LEFT_SHIFT, HID_KEY_QUOTE);
+    type(HID_LEFT_SHIFT, HID_KEY_U);
+    type(HID_LEFT_SHIFT, HID_KEY_6);
+    type(0, HID_KEY_SPACE);
+    type(0, HID_KEY_TILDE);
+    type(0, HID_KEY_X);
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "\xc3\xa9\xc3\x9c^`x");
+}
+
+static void test_us_layout_has_no_dead_keys(void) {
+    setup();
+    type(0, HID_KEY_QUOTE);
+    type(0, HID_KEY_E);
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "'e");
+}
+
+static void test_one_callback_per_report(void) {
+    setup();
+    const uint8_t keys[8] = {0, 0, HID_KEY_A, HID_KEY_B, HID_KEY_TAB,
+                             HID_KEY_C};
+    keyboard_decoder_feed(&decoder, keys, sizeof(keys));
+    CHECK(text_calls == 1);
+    CHECK(scan_count == 1);
+    CHECK_STR(scans[0], "ab");
+    report(0, 0);
+    CHECK(text_calls == 1);
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[1], "c");
+}
+
+static void test_parse_config(void) {
+    text_decoder_config_t config;
+    CHECK(text_decoder_parse_config("windows,intl", &config));
+    CHECK(config.alt_codes == TEXT_ALT_CODES_WINDOWS);
+    CHECK(config.layout == TEXT_LAYOUT_US_INTL);
+    CHECK(text_decoder_parse_config("", &config));
+    CHECK(config.alt_codes == TEXT_ALT_CODES_UNICODE);
+    CHECK(config.layout == TEXT_LAYOUT_US);
+    CHECK(!text_decoder_parse_config("windows", &config));
+    CHECK(!text_decoder_parse_config("unicode,de", &config));
+}
+
+static void test_utf8_validation(void) {
+    CHECK(utf8_valid("plain ascii text", 16));
+    CHECK(utf8_valid("\xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80", 9));
+    CHECK(!utf8_valid("\xc3", 1));
+    CHECK(!utf8_valid("\xc0\xaf", 2));         // overlong
+    CHECK(!utf8_valid("\xed\xa0\x80", 3));     // surrogate
+    CHECK(!utf8_valid("\xf4\x90\x80\x80", 4)); // above U+10FFFF
+    CHECK(utf8_truncate("a\xe2\x82\xac", 4, 3) == 1);
+    CHECK(utf8_truncate("a\xe2\x82\xac", 4, 4) == 4);
+
+    setup();
+    scan_assembler_put_text(&assembler, "a\xff", 2, 0);
+    scan_assembler_put(&assembler, '\t', 0);
+    CHECK_STR(scans[0], "\xef\xbf\xbd");
+}
+
+static void test_timeout_submits(void) {
+    setup();
+    type(0, HID_KEY_A);
+    scan_assembler_poll(&assembler, now_us);
+    CHECK(scan_count == 0);
+    scan_assembler_poll(&assembler, now_us + SCAN_ASSEMBLER_TIMEOUT_US);
+    CHECK(scan_count == 1);
+    CHECK_STR(scans[0], "a");
+    // Nothing pending, polling again must not submit an empty scan
+    scan_assembler_poll(&assembler, now_us + 2 * SCAN_ASSEMBLER_TIMEOUT_US);
+    CHECK(scan_count == 1);
+}
+
+static void test_timeout_flushes_pending_keys(void) {
+    setup_keyboard("unicode,intl");
+    type(0, HID_KEY_A);
+    type(0, HID_KEY_QUOTE);
+    scan_assembler_poll(&assembler, now_us + SCAN_ASSEMBLER_TIMEOUT_US);
+    CHECK_STR(scans[0], "a'");
+
+    // Alt still held, the code is complete all the same
+    report(HID_LEFT_ALT, HID_KEY_KEYPAD_6);
+    report(HID_LEFT_ALT, 0);
+    report(HID_LEFT_ALT, HID_KEY_KEYPAD_5);
+    scan_assembler_poll(&assembler, now_us + SCAN_ASSEMBLER_TIMEOUT_US);
+    CHECK_STR(scans[1], "A");
+
+    // A hex entry without Space or Enter is dropped
+    type(0, HID_KEY_B);
+    type(HID_LEFT_CONTROL | HID_LEFT_SHIFT, HID_KEY_U);
+    type(0, HID_KEY_4);
+    scan_assembler_poll(&assembler, now_us + SCAN_ASSEMBLER_TIMEOUT_US);
+    CHECK_STR(scans[2], "b");
+    CHECK(scan_count == 3);
+}
+
+static void test_tab_flushes_pending_keys(void) {
+    setup_keyboard("unicode,intl");
+    type(0, HID_KEY_TILDE);
+    type(0, HID_KEY_TAB);
+    type(HID_LEFT_SHIFT, HID_KEY_QUOTE);
+    type(0, HID_KEY_A);
+    type(0, HID_KEY_TAB);
+    CHECK_STR(scans[0], "`");
+    CHECK_STR(scans[1], "\xc3\xa4");
+}
+
+static void test_alt_code_keeps_scan_alive(void) {
+    setup();
+    type(0, HID_KEY_A);
+    // Digits of an alt code produce no character, but count as activity
+    now_us += SCAN_ASSEMBLER_TIMEOUT_US - 5000;
+    type(HID_LEFT_ALT, HID_KEY_KEYPAD_6);
+    scan_assembler_poll(&assembler, now_us);
+    CHECK(scan_count == 0);
+}
+
+static void test_overflow_splits(void) {
+    setup();
+    for (int i = 0; i < SCAN_ASSEMBLER_MAX_SCAN_SIZE + 10; ++i)
+        scan_assembler_put(&assembler, 'x', 0);
+    CHECK(scan_count == 1);
+    CHECK(strlen(scans[0]) == SCAN_ASSEMBLER_MAX_SCAN_SIZE - 1);
+    scan_assembler_put(&assembler, '\t', 0);
+    CHECK(scan_count == 2);
+    CHECK(strlen(scans[1]) == 11);
+}
+
+static void test_overflow_keeps_characters_whole(void) {
+    setup();
+    for (int i = 0; i < SCAN_ASSEMBLER_MAX_SCAN_SIZE - 2; ++i)
+        scan_assembler_put(&assembler, 'x', 0);
+    scan_assembler_put_text(&assembler, "\xe2\x82\xac", 3, 0);
+    CHECK(scan_count == 1);
+    CHECK(strlen(scans[0]) == SCAN_ASSEMBLER_MAX_SCAN_SIZE - 2);
+    scan_assembler_put(&assembler, '\t', 0);
+    CHECK_STR(scans[1], "\xe2\x82\xac");
+}
+
+static void put_repeated(char c, int count) {
+    for (int i = 0; i < count; ++i)
+        scan_assembler_put(&assembler, c, 0);
+}
+
+static void test_long_scan_stays_whole(void) {
+    setup();
+    // Longer than the buffer of old, as with large PDF417 or DataMatrix
+    put_repeated('x', 5000);
+    scan_assembler_put(&assembler, '\t', 0);
+    CHECK(scan_count == 1);
+    CHECK(strlen(scans[0]) == 5000);
+    CHECK(scan_arena_free_chunks(&arena) == SCAN_ARENA_CHUNK_COUNT);
+}
+
+static void test_full_arena_splits_scans(void) {
+    setup();
+    // Other runs leave room for one more chunk only
+    char *held[SCAN_ARENA_CHUNK_COUNT - 1];
+    for (int i = 0; i < SCAN_ARENA_CHUNK_COUNT - 1; ++i)
+        CHECK((held[i] = scan_arena_alloc(&arena, 10)) != NULL);
+    // What fits is submitted and released, the rest follows in that chunk
+    put_repeated('y', SCAN_ARENA_CHUNK_SIZE + 10);
+    scan_assembler_put(&assembler, '\t', 0);
+    CHECK(scan_count == 2);
+    CHECK(strlen(scans[0]) == SCAN_ARENA_CHUNK_SIZE - 1);
+    CHECK(strlen(scans[1]) == 11);
+    CHECK(scan_arena_free_chunks(&arena) == 1);
+}
+
+static void test_no_room_drops_keys(void) {
+    setup();
+    char *held[SCAN_ARENA_CHUNK_COUNT];
+    for (int i = 0; i < SCAN_ARENA_CHUNK_COUNT; ++i)
+        CHECK((held[i] = scan_arena_alloc(&arena, 10)) != NULL);
+    put_repeated('q', 10);
+    scan_assembler_put(&assembler, '\t', 0);
+    CHECK(scan_count == 0);
+    // Collecting resumes once a run is released
+    scan_arena_release(&arena, held[0]);
+    put_repeated('z', 10);
+    scan_assembler_put(&assembler, '\t', 0);
+    CHECK(scan_count == 1);
+    CHECK_STR(scans[0], "zzzzzzzzzz");
+}
+
+int main(void) {
+    RUN_TEST(test_keys_and_shift);
+    RUN_TEST(test_held_key_repeats_once);
+    RUN_TEST(test_rollover);
+    RUN_TEST(test_short_report_ignored);
+    RUN_TEST(test_alt_codes);
+    RUN_TEST(test_windows_alt_codes);
+    RUN_TEST(test_ctrl_shift_u);
+    RUN_TEST(test_dead_keys);
+    RUN_TEST(test_us_layout_has_no_dead_keys);
+    RUN_TEST(test_one_callback_per_report);
+    RUN_TEST(test_parse_config);
+    RUN_TEST(test_utf8_validation);
+    RUN_TEST(test_timeout_submits);
+    RUN_TEST(test_timeout_flushes_pending_keys);
+    RUN_TEST(test_tab_flushes_pending_keys);
+    RUN_TEST(test_alt_code_keeps_scan_alive);
+    RUN_TEST(test_overflow_splits);
+    RUN_TEST(test_overflow_keeps_characters_whole);
+    RUN_TEST(test_long_scan_stays_whole);
+    RUN_TEST(test_full_arena_splits_scans);
+    RUN_TEST(test_no_room_drops_keys);
+    return TEST_EXIT_CODE();
+}
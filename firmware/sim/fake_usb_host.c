@@ -0,0 +1,761 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <usb/hid.h>
+#include <usb/usb_host.h>
+
+static const char *TAG = "fake_usb_host";
+
+/*
+ * A USB host library with a hub of SIM_USB_MAX_DEVICES ports, to each of
+ * which a virtual boot protocol keyboard can be attached. Transfer completions and client events are
+ * delivered from usb_host_client_handle_events(), as with the real library,
+ * so hid_host.c runs unmodified on top of it. Interrupt IN reports are only
+ * handed over while the host has a transfer submitted, like a device would
+ * NAK until it is polled, and no more often than once per bInterval.
+ * Switching off the root port power detaches all devices, they come back
+ * reset when it is switched on again.
+ */
+#define SIM_EP_IN 0x81
+#define SIM_CLIENT_QUEUE_LEN 32
+
+typedef enum {
+    CLIENT_EVENT_MSG,
+    CLIENT_EVENT_TRANSFER,
+    CLIENT_EVENT_UNBLOCK,
+} client_event_kind_t;
+
+typedef struct {
+    client_event_kind_t kind;
+    usb_host_client_event_msg_t msg;
+    usb_transfer_t *transfer;
+} client_event_t;
+
+struct usb_host_client_handle_s {
+    usb_host_client_config_t config;
+    QueueHandle_t events;
+};
+
+struct usb_device_handle_s {
+    int open_count;
+    bool attached;
+    usb_transfer_t *in_transfer; // submitted interrupt IN transfer
+    bool in_halted;
+    bool in_stall; // device answers IN with STALL
+    bool wedged;   // and ignores CLEAR_FEATURE(ENDPOINT_HALT)
+    bool powered_off;
+    uint8_t protocol;
+    uint8_t idle_rate;
+    uint8_t leds_lit; // since sim_usb_take_leds()
+    int64_t last_report_us;
+};
+
+// Boot protocol keyboard, HID 1.11 appendix B.1
+static const uint8_t report_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29,
+    0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01, 0x05,
+    0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03,
+    0x91, 0x01, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05,
+    0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xc0,
+};
+
+static const usb_device_desc_t device_descriptor = {
+    .bLength = sizeof(usb_device_desc_t),
+    .bDescriptorType = USB_B_DESCRIPTOR_TYPE_DEVICE,
+    .bcdUSB = 0x0200,
+    .bMaxPacketSize0 = 64,
+    .idVendor = 0x1209, // pid.codes test VID
+    .idProduct = 0x0001,
+    .bcdDevice = 0x0100,
+    .iManufacturer = 1,
+    .iProduct = 2,
+    .iSerialNumber = 3,
+    .bNumConfigurations = 1,
+};
+
+static const struct __attribute__((packed)) {
+    usb_config_desc_t config;
+    usb_intf_desc_t intf;
+    hid_descriptor_t hid;
+    usb_ep_desc_t ep_in;
+} config_descriptor = {
+    .config =
+        {
+            .bLength = sizeof(usb_config_desc_t),
+            .bDescriptorType = USB_B_DESCRIPTOR_TYPE_CONFIGURATION,
+            .wTotalLength = sizeof(config_descriptor),
+            .bNumInterfaces = 1,
+            .bConfigurationValue = 1,
+            .bmAttributes = 0xa0,
+            .bMaxPower = 50,
+        },
+    .intf =
+        {
+            .bLength = sizeof(usb_intf_desc_t),
+            .bDescriptorType = USB_B_DESCRIPTOR_TYPE_INTERFACE,
+            .bNumEndpoints = 1,
+            .bInterfaceClass = USB_CLASS_HID,
+            .bInterfaceSubClass = HID_SUBCLASS_BOOT_INTERFACE,
+            .bInterfaceProtocol = HID_PROTOCOL_KEYBOARD,
+        },
+    .hid =
+        {
+            .bLength = sizeof(hid_descriptor_t),
+            .bDescriptorType = HID_CLASS_DESCRIPTOR_TYPE_HID,
+            .bcdHID = 0x0111,
+            .bNumDescriptors = 1,
+            .bReportDescriptorType = HID_CLASS_DESCRIPTOR_TYPE_REPORT,
+            .wReportDescriptorLength = sizeof(report_descriptor),
+        },
+    .ep_in =
+        {
+            .bLength = sizeof(usb_ep_desc_t),
+            .bDescriptorType = USB_B_DESCRIPTOR_TYPE_ENDPOINT,
+            .bEndpointAddress = SIM_EP_IN,
+            .bmAttributes = 0x03, // interrupt
+            .wMaxPacketSize = 8,
+            .bInterval = 1,
+        },
+};
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t wData[24];
+} string_descriptor_t;
+
+static string_descriptor_t strings[2 + SIM_USB_MAX_DEVICES];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static struct usb_host_client_handle_s *client;
+static struct usb_device_handle_s devices[SIM_USB_MAX_DEVICES];
+
+/* Device at a port, NULL if the port is out of range */
+static struct usb_device_handle_s *port_device(int port) {
+    return port >= 0 && port < SIM_USB_MAX_DEVICES ? &devices[port] : NULL;
+}
+
+/* Addresses are assigned by port, starting at 1 */
+static uint8_t device_address(const struct usb_device_handle_s *device) {
+    return device - devices + 1;
+}
+
+static bool is_device(usb_device_handle_t dev_hdl) {
+    return dev_hdl >= devices && dev_hdl < devices + SIM_USB_MAX_DEVICES;
+}
+
+static void string_descriptor_init(string_descriptor_t *desc,
+                                   const char *text) {
+    size_t len = strlen(text);
+    if (len > sizeof(desc->wData) / sizeof(desc->wData[0]))
+        len = sizeof(desc->wData) / sizeof(desc->wData[0]);
+    desc->bLength = USB_STANDARD_DESC_SIZE + 2 * len;
+    desc->bDescriptorType = USB_B_DESCRIPTOR_TYPE_STRING;
+    for (size_t i = 0; i < len; ++i)
+        desc->wData[i] = (uint8_t)text[i];
+}
+
+/* Called with lock held */
+static void client_post(const client_event_t *event) {
+    if (client && xQueueSend(client->events, event, 0) != pdPASS)
+        ESP_LOGE(TAG, "Client event queue full, event lost");
+}
+
+static void transfer_complete(usb_transfer_t *transfer,
+                              usb_transfer_status_t status, int length) {
+    transfer->status = status;
+    transfer->actual_num_bytes = length;
+    const client_event_t event = {.kind = CLIENT_EVENT_TRANSFER,
+                                  .transfer = transfer};
+    client_post(&event);
+}
+
+/* Called with lock held */
+static void device_attach(struct usb_device_handle_s *device) {
+    device->attached = true;
+    device->in_halted = false;
+    device->in_stall = false;
+    device->wedged = false;
+    device->protocol = 1; // report protocol after reset
+    device->idle_rate = 0;
+    const client_event_t event = {
+        .kind = CLIENT_EVENT_MSG,
+        .msg = {.event = USB_HOST_CLIENT_EVENT_NEW_DEV,
+                .new_dev = {.address = device_address(device)}}};
+    client_post(&event);
+}
+
+/* Called with lock held */
+static void device_detach(struct usb_device_handle_s *device) {
+    device->attached = false;
+    if (device->in_transfer) {
+        transfer_complete(device->in_transfer, USB_TRANSFER_STATUS_NO_DEVICE,
+                          0);
+        device->in_transfer = NULL;
+    }
+    const client_event_t event = {
+        .kind = CLIENT_EVENT_MSG,
+        .msg = {.event = USB_HOST_CLIENT_EVENT_DEV_GONE,
+                .dev_gone = {.dev_hdl = device}}};
+    client_post(&event);
+    pthread_cond_broadcast(&changed);
+}
+
+// ------------------------------- Simulator -----------------------------------
+
+esp_err_t sim_usb_plug(int port, uint32_t timeout_ms) {
+    struct usb_device_handle_s *device = port_device(port);
+    if (!device)
+        return ESP_ERR_INVALID_ARG;
+    const int64_t until = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    // Wait for the firmware to install the HID host driver
+    while (true) {
+        pthread_mutex_lock(&lock);
+        if (client)
+            break;
+        pthread_mutex_unlock(&lock);
+        if (esp_timer_get_time() > until)
+            return ESP_ERR_TIMEOUT;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    if (device->attached) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    device_attach(device);
+    pthread_mutex_unlock(&lock);
+
+    // Connected once the firmware polls the interrupt endpoint
+    while (!sim_usb_is_polled(port)) {
+        if (esp_timer_get_time() > until)
+            return ESP_ERR_TIMEOUT;
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    return ESP_OK;
+}
+
+void sim_usb_unplug(int port) {
+    struct usb_device_handle_s *device = port_device(port);
+    if (!device)
+        return;
+    pthread_mutex_lock(&lock);
+    device->powered_off = false;
+    if (device->attached)
+        device_detach(device);
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_usb_stall(int port, bool wedged) {
+    struct usb_device_handle_s *device = port_device(port);
+    if (!device)
+        return;
+    pthread_mutex_lock(&lock);
+    if (device->attached) {
+        device->in_stall = true;
+        device->wedged = wedged;
+        // A halted endpoint is not polled until the host clears it
+        if (device->in_transfer) {
+            transfer_complete(device->in_transfer, USB_TRANSFER_STATUS_STALL,
+                              0);
+            device->in_transfer = NULL;
+            device->in_halted = true;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+uint8_t sim_usb_take_leds(int port) {
+    struct usb_device_handle_s *device = port_device(port);
+    if (!device)
+        return 0;
+    pthread_mutex_lock(&lock);
+    const uint8_t leds = device->leds_lit;
+    device->leds_lit = 0;
+    pthread_mutex_unlock(&lock);
+    return leds;
+}
+
+bool sim_usb_is_polled(int port) {
+    const struct usb_device_handle_s *device = port_device(port);
+    if (!device)
+        return false;
+    pthread_mutex_lock(&lock);
+    const bool polled =
+        device->attached && device->in_transfer && !device->in_halted;
+    pthread_mutex_unlock(&lock);
+    return polled;
+}
+
+esp_err_t sim_usb_send_report(int port, const uint8_t *report, size_t length,
+                              uint32_t timeout_ms) {
+    struct usb_device_handle_s *device = port_device(port);
+    if (!device)
+        return ESP_ERR_INVALID_ARG;
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_nsec -= 1000000000L;
+        ++until.tv_sec;
+    }
+
+    // Full speed interrupt endpoints are polled every bInterval frames
+    const int64_t next_frame_us =
+        device->last_report_us + config_descriptor.ep_in.bInterval * 1000;
+    const int64_t now_us = esp_timer_get_time();
+    if (now_us < next_frame_us)
+        usleep(next_frame_us - now_us);
+
+    pthread_mutex_lock(&lock);
+    while (device->attached && (!device->in_transfer || device->in_halted)) {
+        if (pthread_cond_timedwait(&changed, &lock, &until)) {
+            pthread_mutex_unlock(&lock);
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    if (!device->attached) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    usb_transfer_t *transfer = device->in_transfer;
+    device->in_transfer = NULL;
+    if (length > (size_t)transfer->num_bytes)
+        length = transfer->num_bytes;
+    memcpy(transfer->data_buffer, report, length);
+    transfer_complete(transfer, USB_TRANSFER_STATUS_COMPLETED, length);
+    device->last_report_us = esp_timer_get_time();
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+// ---------------------------------- Host -------------------------------------
+
+esp_err_t usb_host_install(const usb_host_config_t *config) {
+    (void)config;
+    string_descriptor_init(&strings[0], "hid2mqtt");
+    string_descriptor_init(&strings[1], "Virtual Keyboard");
+    for (int i = 0; i < SIM_USB_MAX_DEVICES; ++i) {
+        char serial[16];
+        snprintf(serial, sizeof(serial), "SIM%04d", i + 1);
+        string_descriptor_init(&strings[2 + i], serial);
+    }
+    return ESP_OK;
+}
+
+esp_err_t usb_host_lib_set_root_port_power(bool enable) {
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < SIM_USB_MAX_DEVICES; ++i) {
+        struct usb_device_handle_s *device = &devices[i];
+        if (!enable && device->attached) {
+            device_detach(device);
+            device->powered_off = true;
+        } else if (enable && device->powered_off) {
+            device->powered_off = false;
+            device_attach(device);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t usb_host_lib_handle_events(TickType_t timeout_ticks,
+                                     uint32_t *event_flags_ret) {
+    // Enumeration is instantaneous, there is nothing to handle here
+    vTaskDelay(timeout_ticks < pdMS_TO_TICKS(1000) ? timeout_ticks
+                                                   : pdMS_TO_TICKS(1000));
+    if (event_flags_ret)
+        *event_flags_ret = 0;
+    return timeout_ticks == portMAX_DELAY ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t usb_host_client_register(const usb_host_client_config_t *config,
+                                   usb_host_client_handle_t *client_hdl_ret) {
+    if (config->is_synchronous)
+        return ESP_ERR_NOT_SUPPORTED;
+    struct usb_host_client_handle_s *new_client = calloc(1, sizeof(*new_client));
+    if (!new_client)
+        return ESP_ERR_NO_MEM;
+    new_client->config = *config;
+    new_client->events =
+        xQueueCreate(SIM_CLIENT_QUEUE_LEN, sizeof(client_event_t));
+
+    pthread_mutex_lock(&lock);
+    if (client) {
+        pthread_mutex_unlock(&lock);
+        vQueueDelete(new_client->events);
+        free(new_client);
+        ESP_LOGE(TAG, "Only one client is supported");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    client = new_client;
+    pthread_mutex_unlock(&lock);
+    *client_hdl_ret = new_client;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_client_deregister(usb_host_client_handle_t client_hdl) {
+    pthread_mutex_lock(&lock);
+    if (client == client_hdl)
+        client = NULL;
+    pthread_mutex_unlock(&lock);
+    vQueueDelete(client_hdl->events);
+    free(client_hdl);
+    return ESP_OK;
+}
+
+static void client_dispatch(usb_host_client_handle_t client_hdl,
+                            const client_event_t *event) {
+    switch (event->kind) {
+    case CLIENT_EVENT_MSG:
+        client_hdl->config.async.client_event_callback(
+            &event->msg, client_hdl->config.async.callback_arg);
+        break;
+    case CLIENT_EVENT_TRANSFER:
+        event->transfer->callback(event->transfer);
+        break;
+    case CLIENT_EVENT_UNBLOCK:
+        break;
+    }
+}
+
+esp_err_t usb_host_client_handle_events(usb_host_client_handle_t client_hdl,
+                                        TickType_t timeout_ticks) {
+    client_event_t event;
+    if (xQueueReceive(client_hdl->events, &event, timeout_ticks) != pdPASS)
+        return ESP_ERR_TIMEOUT;
+    do {
+        client_dispatch(client_hdl, &event);
+    } while (xQueueReceive(client_hdl->events, &event, 0) == pdPASS);
+    return ESP_OK;
+}
+
+esp_err_t usb_host_client_unblock(usb_host_client_handle_t client_hdl) {
+    const client_event_t event = {.kind = CLIENT_EVENT_UNBLOCK};
+    return xQueueSend(client_hdl->events, &event, portMAX_DELAY) == pdPASS
+               ? ESP_OK
+               : ESP_FAIL;
+}
+
+// --------------------------------- Device ------------------------------------
+
+esp_err_t usb_host_device_open(usb_host_client_handle_t client_hdl,
+                               uint8_t dev_addr,
+                               usb_device_handle_t *dev_hdl_ret) {
+    (void)client_hdl;
+    struct usb_device_handle_s *device = port_device(dev_addr - 1);
+    pthread_mutex_lock(&lock);
+    const bool found = device && device->attached;
+    if (found)
+        ++device->open_count;
+    pthread_mutex_unlock(&lock);
+    if (!found)
+        return ESP_ERR_NOT_FOUND;
+    *dev_hdl_ret = device;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_device_close(usb_host_client_handle_t client_hdl,
+                                usb_device_handle_t dev_hdl) {
+    (void)client_hdl;
+    pthread_mutex_lock(&lock);
+    const bool open = is_device(dev_hdl) && dev_hdl->open_count > 0;
+    if (open)
+        --dev_hdl->open_count;
+    pthread_mutex_unlock(&lock);
+    return open ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t usb_host_device_info(usb_device_handle_t dev_hdl,
+                               usb_device_info_t *dev_info) {
+    if (!is_device(dev_hdl))
+        return ESP_ERR_INVALID_ARG;
+    *dev_info = (usb_device_info_t){
+        .speed = USB_SPEED_FULL,
+        .dev_addr = device_address(dev_hdl),
+        .bMaxPacketSize0 = device_descriptor.bMaxPacketSize0,
+        .bConfigurationValue = 1,
+        .str_desc_manufacturer = (const usb_str_desc_t *)&strings[0],
+        .str_desc_product = (const usb_str_desc_t *)&strings[1],
+        .str_desc_serial_num =
+            (const usb_str_desc_t *)&strings[1 + device_address(dev_hdl)],
+    };
+    return ESP_OK;
+}
+
+esp_err_t usb_host_get_device_descriptor(usb_device_handle_t dev_hdl,
+                                         const usb_device_desc_t **device_desc) {
+    if (!is_device(dev_hdl))
+        return ESP_ERR_INVALID_ARG;
+    *device_desc = &device_descriptor;
+    return ESP_OK;
+}
+
+esp_err_t
+usb_host_get_active_config_descriptor(usb_device_handle_t dev_hdl,
+                                      const usb_config_desc_t **config_desc) {
+    if (!is_device(dev_hdl))
+        return ESP_ERR_INVALID_ARG;
+    *config_desc = &config_descriptor.config;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_interface_claim(usb_host_client_handle_t client_hdl,
+                                   usb_device_handle_t dev_hdl,
+                                   uint8_t bInterfaceNumber,
+                                   uint8_t bAlternateSetting) {
+    (void)client_hdl, (void)bAlternateSetting;
+    return is_device(dev_hdl) && bInterfaceNumber == 0 ? ESP_OK
+                                                       : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t usb_host_interface_release(usb_host_client_handle_t client_hdl,
+                                     usb_device_handle_t dev_hdl,
+                                     uint8_t bInterfaceNumber) {
+    (void)client_hdl;
+    return is_device(dev_hdl) && bInterfaceNumber == 0 ? ESP_OK
+                                                       : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t usb_host_endpoint_halt(usb_device_handle_t dev_hdl,
+                                 uint8_t bEndpointAddress) {
+    if (!is_device(dev_hdl))
+        return ESP_ERR_INVALID_ARG;
+    if (bEndpointAddress == SIM_EP_IN) {
+        pthread_mutex_lock(&lock);
+        dev_hdl->in_halted = true;
+        pthread_mutex_unlock(&lock);
+    }
+    return ESP_OK;
+}
+
+esp_err_t usb_host_endpoint_flush(usb_device_handle_t dev_hdl,
+                                  uint8_t bEndpointAddress) {
+    if (!is_device(dev_hdl))
+        return ESP_ERR_INVALID_ARG;
+    // The canceled transfer is dropped instead of completed, hid_host.c
+    // does not expect a callback after flushing
+    if (bEndpointAddress == SIM_EP_IN) {
+        pthread_mutex_lock(&lock);
+        dev_hdl->in_transfer = NULL;
+        pthread_mutex_unlock(&lock);
+    }
+    return ESP_OK;
+}
+
+esp_err_t usb_host_endpoint_clear(usb_device_handle_t dev_hdl,
+                                  uint8_t bEndpointAddress) {
+    if (!is_device(dev_hdl))
+        return ESP_ERR_INVALID_ARG;
+    if (bEndpointAddress == SIM_EP_IN) {
+        pthread_mutex_lock(&lock);
+        dev_hdl->in_halted = false;
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+    }
+    return ESP_OK;
+}
+
+// -------------------------------- Transfers ----------------------------------
+
+esp_err_t usb_host_transfer_alloc(size_t data_buffer_size, int num_isoc_packets,
+                                  usb_transfer_t **transfer) {
+    if (num_isoc_packets)
+        return ESP_ERR_NOT_SUPPORTED;
+    usb_transfer_t *t = calloc(1, sizeof(usb_transfer_t) + data_buffer_size);
+    if (!t)
+        return ESP_ERR_NO_MEM;
+    *(uint8_t **)&t->data_buffer = (uint8_t *)(t + 1);
+    *(size_t *)&t->data_buffer_size = data_buffer_size;
+    *transfer = t;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_transfer_free(usb_transfer_t *transfer) {
+    pthread_mutex_lock(&lock);
+    bool in_flight = false;
+    for (int i = 0; transfer && i < SIM_USB_MAX_DEVICES; ++i)
+        in_flight |= transfer == devices[i].in_transfer;
+    pthread_mutex_unlock(&lock);
+    if (in_flight)
+        return ESP_ERR_NOT_FINISHED;
+    free(transfer);
+    return ESP_OK;
+}
+
+esp_err_t usb_host_transfer_submit(usb_transfer_t *transfer) {
+    if (transfer->bEndpointAddress != SIM_EP_IN ||
+        transfer->num_bytes > (int)transfer->data_buffer_size)
+        return ESP_ERR_INVALID_ARG;
+    usb_device_handle_t device = transfer->device_handle;
+    if (!is_device(device))
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&lock);
+    esp_err_t ret = ESP_OK;
+    if (!device->attached)
+        ret = ESP_ERR_INVALID_STATE;
+    else if (device->in_transfer)
+        ret = ESP_ERR_NOT_FINISHED;
+    else if (device->in_stall && !device->in_halted) {
+        transfer_complete(transfer, USB_TRANSFER_STATUS_STALL, 0);
+        device->in_halted = true;
+    } else
+        device->in_transfer = transfer;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+/* Answer a control request, returns the data stage length or -1 to stall */
+static int control_request(struct usb_device_handle_s *device,
+                           const usb_setup_packet_t *setup, uint8_t *data,
+                           size_t size) {
+    const bool class_request = (setup->bmRequestType &
+                                USB_BM_REQUEST_TYPE_TYPE_MASK) ==
+                               USB_BM_REQUEST_TYPE_TYPE_CLASS;
+    size_t length = setup->wLength < size ? setup->wLength : size;
+
+    if (!class_request) {
+        if (setup->bRequest == USB_B_REQUEST_CLEAR_FEATURE &&
+            (setup->bmRequestType & USB_BM_REQUEST_TYPE_RECIP_MASK) ==
+                USB_BM_REQUEST_TYPE_RECIP_ENDPOINT &&
+            setup->wValue == USB_W_VALUE_FEATURE_ENDPOINT_HALT &&
+            setup->wIndex == SIM_EP_IN) {
+            device->in_stall = device->wedged;
+            return 0;
+        }
+        if (setup->bRequest != USB_B_REQUEST_GET_DESCRIPTOR)
+            return 0;
+        const void *desc;
+        size_t desc_size;
+        switch (setup->wValue >> 8) {
+        case USB_B_DESCRIPTOR_TYPE_DEVICE:
+            desc = &device_descriptor, desc_size = sizeof(device_descriptor);
+            break;
+        case USB_B_DESCRIPTOR_TYPE_CONFIGURATION:
+            desc = &config_descriptor, desc_size = sizeof(config_descriptor);
+            break;
+        case HID_CLASS_DESCRIPTOR_TYPE_REPORT:
+            desc = report_descriptor, desc_size = sizeof(report_descriptor);
+            break;
+        default:
+            return -1;
+        }
+        length = length < desc_size ? length : desc_size;
+        memcpy(data, desc, length);
+        return length;
+    }
+
+    switch (setup->bRequest) {
+    case HID_CLASS_SPECIFIC_REQ_SET_PROTOCOL:
+        device->protocol = setup->wValue;
+        return 0;
+    case HID_CLASS_SPECIFIC_REQ_SET_IDLE:
+        device->idle_rate = setup->wValue >> 8;
+        return 0;
+    case HID_CLASS_SPECIFIC_REQ_SET_REPORT:
+        if (setup->wValue >> 8 == HID_REPORT_TYPE_OUTPUT && length)
+            device->leds_lit |= data[0];
+        return 0;
+    case HID_CLASS_SPECIFIC_REQ_GET_PROTOCOL:
+        if (length)
+            data[0] = device->protocol;
+        return length ? 1 : 0;
+    case HID_CLASS_SPECIFIC_REQ_GET_IDLE:
+        if (length)
+            data[0] = device->idle_rate;
+        return length ? 1 : 0;
+    case HID_CLASS_SPECIFIC_REQ_GET_REPORT:
+        memset(data, 0, length);
+        return length;
+    default:
+        return -1;
+    }
+}
+
+esp_err_t usb_host_transfer_submit_control(usb_host_client_handle_t client_hdl,
+                                           usb_transfer_t *transfer) {
+    (void)client_hdl;
+    if (transfer->num_bytes < USB_SETUP_PACKET_SIZE ||
+        transfer->num_bytes > (int)transfer->data_buffer_size)
+        return ESP_ERR_INVALID_ARG;
+
+    usb_device_handle_t device = transfer->device_handle;
+    if (!is_device(device))
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&lock);
+    if (!device->attached) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    const usb_setup_packet_t *setup =
+        (const usb_setup_packet_t *)transfer->data_buffer;
+    const int length = control_request(
+        device, setup, transfer->data_buffer + USB_SETUP_PACKET_SIZE,
+        transfer->num_bytes - USB_SETUP_PACKET_SIZE);
+    if (length < 0)
+        transfer_complete(transfer, USB_TRANSFER_STATUS_STALL, 0);
+    else
+        transfer_complete(transfer, USB_TRANSFER_STATUS_COMPLETED,
+                          USB_SETUP_PACKET_SIZE + length);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+// --------------------------------- Helpers -----------------------------------
+
+const usb_standard_desc_t *
+usb_parse_next_descriptor(const usb_standard_desc_t *cur_desc,
+                          uint16_t wTotalLength, int *offset) {
+    if (*offset >= wTotalLength || *offset + cur_desc->bLength >= wTotalLength)
+        return NULL;
+    *offset += cur_desc->bLength;
+    return (const usb_standard_desc_t *)((const uint8_t *)cur_desc +
+                                         cur_desc->bLength);
+}
+
+const usb_standard_desc_t *
+usb_parse_next_descriptor_of_type(const usb_standard_desc_t *cur_desc,
+                                  uint16_t wTotalLength,
+                                  uint8_t bDescriptorType, int *offset) {
+    int offset_temp = *offset;
+    const usb_standard_desc_t *desc =
+        usb_parse_next_descriptor(cur_desc, wTotalLength, &offset_temp);
+    while (desc && desc->bDescriptorType != bDescriptorType)
+        desc = usb_parse_next_descriptor(desc, wTotalLength, &offset_temp);
+    if (desc)
+        *offset = offset_temp;
+    return desc;
+}
+
+const usb_ep_desc_t *
+usb_parse_endpoint_descriptor_by_index(const usb_intf_desc_t *intf_desc,
+                                       int index, uint16_t wTotalLength,
+                                       int *offset) {
+    if (index >= intf_desc->bNumEndpoints)
+        return NULL;
+    int offset_temp = *offset;
+    const usb_standard_desc_t *desc = (const usb_standard_desc_t *)intf_desc;
+    for (int i = 0; i <= index; ++i) {
+        desc = usb_parse_next_descriptor_of_type(
+            desc, wTotalLength, USB_B_DESCRIPTOR_TYPE_ENDPOINT, &offset_temp);
+        if (!desc)
+            return NULL;
+    }
+    *offset = offset_temp;
+    return (const usb_ep_desc_t *)desc;
+}
@@ -0,0 +1,292 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <freertos/FreeRTOS.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+struct sim_task {
+    TaskFunction_t fn;
+    void *arg;
+    char name[16];
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t notifications;
+};
+
+struct sim_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t items[];
+};
+
+esp_log_level_t sim_log_level = ESP_LOG_WARN;
+
+static __thread struct sim_task *current_task;
+static struct timespec start_time;
+
+static void monotonic_now(struct timespec *ts) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec now;
+    monotonic_now(&now);
+    return (int64_t)(now.tv_sec - start_time.tv_sec) * 1000000 +
+           (now.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+uint32_t esp_log_timestamp(void) {
+    return esp_timer_get_time() / 1000;
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+/* Absolute CLOCK_MONOTONIC deadline ticks from now */
+static void deadline(struct timespec *ts, TickType_t ticks) {
+    monotonic_now(ts);
+    const uint64_t ms = pdTICKS_TO_MS((uint64_t)ticks);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ++ts->tv_sec;
+    }
+}
+
+static void cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Wait on cond, false once the deadline has passed */
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                      TickType_t ticks, const struct timespec *until) {
+    if (ticks == portMAX_DELAY)
+        return pthread_cond_wait(cond, mutex) == 0;
+    if (!ticks)
+        return false;
+    return pthread_cond_timedwait(cond, mutex, until) != ETIMEDOUT;
+}
+
+// ---------------------------------- Tasks ------------------------------------
+
+static struct sim_task *task_new(TaskFunction_t fn, const char *name,
+                                 void *arg) {
+    struct sim_task *task = calloc(1, sizeof(*task));
+    if (!task)
+        return NULL;
+    task->fn = fn;
+    task->arg = arg;
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    pthread_mutex_init(&task->mutex, NULL);
+    cond_init(&task->cond);
+    return task;
+}
+
+static void *task_main(void *arg) {
+    current_task = arg;
+    current_task->fn(current_task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core_id) {
+    (void)stack_depth, (void)priority, (void)core_id;
+    struct sim_task *task = task_new(fn, name, arg);
+    pthread_t thread;
+    if (!task || pthread_create(&thread, NULL, task_main, task)) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (handle)
+        *handle = task;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task && task != current_task) {
+        fprintf(stderr, "vTaskDelete: only a task can delete itself\n");
+        abort();
+    }
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    const uint64_t ms = pdTICKS_TO_MS((uint64_t)ticks);
+    const struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+    while (nanosleep(&ts, NULL) && errno == EINTR) {
+    }
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment) {
+    *previous_wake += increment;
+    const TickType_t remaining = *previous_wake - xTaskGetTickCount();
+    if (remaining <= increment)
+        vTaskDelay(remaining);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return current_task;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return pdMS_TO_TICKS(esp_timer_get_time() / 1000);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->mutex);
+    ++task->notifications;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    struct sim_task *task = current_task;
+    struct timespec until;
+    deadline(&until, ticks);
+    pthread_mutex_lock(&task->mutex);
+    while (!task->notifications &&
+           cond_wait(&task->cond, &task->mutex, ticks, &until)) {
+    }
+    const uint32_t value = task->notifications;
+    if (value)
+        task->notifications = clear_on_exit ? 0 : value - 1;
+    pthread_mutex_unlock(&task->mutex);
+    return value;
+}
+
+void sim_freertos_start(TaskFunction_t fn, void *arg) {
+    monotonic_now(&start_time);
+    current_task = task_new(NULL, "main", NULL);
+    if (xTaskCreate(fn, "app_main", 0, arg, 1, NULL) != pdPASS) {
+        fprintf(stderr, "Failed to start app_main\n");
+        exit(1);
+    }
+}
+
+// --------------------------------- Queues ------------------------------------
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct sim_queue *queue = calloc(1, sizeof(*queue) + length * item_size);
+    if (!queue)
+        return NULL;
+    pthread_mutex_init(&queue->mutex, NULL);
+    cond_init(&queue->changed);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->changed);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    struct timespec until;
+    deadline(&until, ticks);
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (!cond_wait(&queue->changed, &queue->mutex, ticks, &until)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFAIL;
+        }
+    }
+    const UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    if (queue->item_size)
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    ++queue->count;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    struct timespec until;
+    deadline(&until, ticks);
+    pthread_mutex_lock(&queue->mutex);
+    while (!queue->count) {
+        if (!cond_wait(&queue->changed, &queue->mutex, ticks, &until)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size)
+        memcpy(item, queue->items + queue->head * queue->item_size,
+               queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    --queue->count;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->mutex);
+    const UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->mutex);
+    const UBaseType_t spaces = queue->length - queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return spaces;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+    if (sem)
+        xSemaphoreGive(sem);
+    return sem;
+}
@@ -0,0 +1,23 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A cycle counter derived from the clock, wrapping like the real one */
+static inline uint32_t esp_cpu_get_cycle_count(void) {
+    return (uint32_t)esp_timer_get_time() * esp_rom_get_cpu_ticks_per_us();
+}
+
+#ifdef __cplusplus
+}
+#endif
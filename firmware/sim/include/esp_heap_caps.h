@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_DEFAULT (1 << 12)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps) {
+    (void)caps;
+    return malloc(size);
+}
+
+/* The host heap is not measured, metrics report it as empty */
+static inline size_t heap_caps_get_free_size(uint32_t caps) {
+    (void)caps;
+    return 0;
+}
+
+static inline size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    (void)caps;
+    return 0;
+}
+
+static inline size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    (void)caps;
+    return 0;
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    (void)caps;
+    return calloc(n, size);
+}
@@ -0,0 +1,8 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+/* Partitions are not simulated, ota.h only passes pointers around */
+typedef struct esp_partition esp_partition_t;
@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The ESP32-S2 default of 240 MHz */
+static inline uint32_t esp_rom_get_cpu_ticks_per_us(void) {
+    return 240;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,10 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+/** Microseconds since the simulator started */
+int64_t esp_timer_get_time(void);
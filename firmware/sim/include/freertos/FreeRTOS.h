@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+/*
+ * The subset of the FreeRTOS API used by the firmware, implemented on top of
+ * POSIX threads in freertos_shim.c. Tasks are threads, critical sections are
+ * recursive mutexes, and there is no scheduler, so priorities and core
+ * affinity are ignored.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_heap_caps.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
+#define pdTICKS_TO_MS(ticks) ((TickType_t)(ticks) * 1000 / configTICK_RATE_HZ)
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define tskNO_AFFINITY 0x7fffffff
+
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP}
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
+
+typedef void (*TaskFunction_t)(void *);
+typedef struct sim_task *TaskHandle_t;
+typedef struct sim_queue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core_id);
+#define xTaskCreate(fn, name, stack_depth, arg, priority, handle)              \
+    xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle,      \
+                            tskNO_AFFINITY)
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+#define xQueueSendToBack xQueueSend
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+/* The buffer is not used, static semaphores live on the heap as well */
+typedef struct {
+    int unused;
+} StaticSemaphore_t;
+#define xSemaphoreCreateBinaryStatic(buffer) xSemaphoreCreateBinary()
+#define xSemaphoreCreateMutexStatic(buffer) xSemaphoreCreateMutex()
+#define vSemaphoreDelete(sem) vQueueDelete(sem)
+#define xSemaphoreTake(sem, ticks) xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem) xQueueSend(sem, NULL, 0)
+
+/** Run fn as the first task, like the IDF startup code runs app_main */
+void sim_freertos_start(TaskFunction_t fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <esp_err.h>
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+/* The configuration is kept in RAM, see sim_stubs.c */
+static inline esp_err_t nvs_flash_init(void) { return ESP_OK; }
+static inline esp_err_t nvs_flash_erase(void) { return ESP_OK; }
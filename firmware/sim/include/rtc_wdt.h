@@ -0,0 +1,31 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+/* There is no watchdog in the simulator */
+typedef enum { RTC_WDT_STAGE0 } rtc_wdt_stage_t;
+typedef enum { RTC_WDT_STAGE_ACTION_RESET_SYSTEM } rtc_wdt_stage_action_t;
+typedef enum { RTC_WDT_SYS_RESET_SIG } rtc_wdt_reset_sig_t;
+typedef enum { RTC_WDT_LENGTH_3_2us } rtc_wdt_length_sig_t;
+
+static inline void rtc_wdt_protect_off(void) {}
+static inline void rtc_wdt_protect_on(void) {}
+static inline void rtc_wdt_enable(void) {}
+static inline void rtc_wdt_disable(void) {}
+static inline void rtc_wdt_feed(void) {}
+static inline void rtc_wdt_set_length_of_reset_signal(rtc_wdt_reset_sig_t sig,
+                                                      rtc_wdt_length_sig_t len) {
+    (void)sig, (void)len;
+}
+static inline void rtc_wdt_set_stage(rtc_wdt_stage_t stage,
+                                     rtc_wdt_stage_action_t action) {
+    (void)stage, (void)action;
+}
+static inline void rtc_wdt_set_time(rtc_wdt_stage_t stage,
+                                    unsigned int timeout_ms) {
+    (void)stage, (void)timeout_ms;
+}
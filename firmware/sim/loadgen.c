@@ -0,0 +1,388 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "sim.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "usb_hid.h"
+
+/*
+ * Finds the highest scan rate the firmware sustains. The rate starts low
+ * and grows by a factor each step until a step saturates: scans are lost,
+ * published corrupted, HID events are dropped, the p99 latency exceeds the
+ * limit, or fewer scans than offered arrive. The keyboards themselves are
+ * limited by the USB polling interval, a backlog on their side shows up as
+ * a lower achieved rate.
+ *
+ * Every scan starts with an 8 digit sequence number, followed by filler
+ * derived from it, so each publish can be checked and matched to the time
+ * its tab was sent.
+ */
+#define LOADGEN_SEQ_DIGITS 8
+#define LOADGEN_MAX_LENGTH 1024
+#define LOADGEN_DRAIN_MS 500
+#define LOADGEN_PLUG_TIMEOUT_MS 15000
+
+extern void app_main(void);
+
+typedef struct {
+    int devices;
+    int length;
+    uint32_t gap_us;
+    int burst;
+    double start_rate;
+    double factor;
+    double step_s;
+    int max_steps;
+    double latency_limit_ms;
+} loadgen_config_t;
+
+typedef struct {
+    double offered_rate;
+    uint32_t offered;
+    uint32_t delivered;
+    uint32_t corrupted;
+    uint32_t lost;
+    uint32_t dropped_events;
+    uint32_t max_backlog;
+    size_t outbox_peak_bytes;
+    size_t outbox_peak_messages;
+    double achieved_rate;
+    int64_t p50_us, p99_us, max_us;
+} loadgen_step_t;
+
+static loadgen_config_t config = {
+    .devices = 1,
+    .length = 13,
+    .burst = 1,
+    .start_rate = 5,
+    .factor = 1.25,
+    .step_s = 2,
+    .max_steps = 20,
+    .latency_limit_ms = 100,
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_changed = PTHREAD_COND_INITIALIZER;
+
+// Scans [typed_seq, next_seq) wait to be typed, any free device takes one
+static uint32_t next_seq;
+static uint32_t typed_seq;
+static uint32_t busy_devices;
+// Per sequence number, indexed from the first scan of the current step
+static uint32_t step_first_seq;
+static int64_t *sent_us;      // when the host took the tab
+static int64_t *published_us; // 0 until published
+static size_t step_capacity;
+static uint32_t corrupted;
+
+static void app_main_task(void *arg) {
+    (void)arg;
+    app_main();
+}
+
+static void scan_text(uint32_t seq, char *text) {
+    static const char filler[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    snprintf(text, LOADGEN_SEQ_DIGITS + 1, "%0*" PRIu32, LOADGEN_SEQ_DIGITS,
+             seq % 100000000);
+    uint32_t state = seq * 2654435761u + 1;
+    for (int i = LOADGEN_SEQ_DIGITS; i < config.length; ++i) {
+        state = state * 1103515245u + 12345u;
+        text[i] = filler[(state >> 16) % (sizeof(filler) - 1)];
+    }
+    text[config.length] = '\0';
+}
+
+static void *device_thread(void *arg) {
+    const int port = (intptr_t)arg;
+    char text[LOADGEN_MAX_LENGTH + 2];
+    while (true) {
+        pthread_mutex_lock(&lock);
+        while (typed_seq == next_seq)
+            pthread_cond_wait(&work_changed, &lock);
+        const uint32_t seq = typed_seq++;
+        ++busy_devices;
+        pthread_mutex_unlock(&lock);
+
+        scan_text(seq, text);
+        strcat(text, "\t");
+        int64_t tab_us = 0;
+        if (sim_keyboard_type(port, text, config.gap_us, &tab_us) != ESP_OK)
+            fprintf(stderr, "device %d: typing scan %" PRIu32 " failed\n",
+                    port, seq);
+
+        pthread_mutex_lock(&lock);
+        if (seq >= step_first_seq && seq - step_first_seq < step_capacity)
+            sent_us[seq - step_first_seq] = tab_us;
+        --busy_devices;
+        pthread_cond_broadcast(&work_changed);
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static void *collector_thread(void *arg) {
+    (void)arg;
+    char payload[LOADGEN_MAX_LENGTH + 1];
+    char expected[LOADGEN_MAX_LENGTH + 1];
+    int64_t time_us;
+    while (true) {
+        if (!sim_mqtt_next_scan(payload, sizeof(payload), 100, &time_us))
+            continue;
+        char digits[LOADGEN_SEQ_DIGITS + 1], *end;
+        memcpy(digits, payload, LOADGEN_SEQ_DIGITS);
+        digits[LOADGEN_SEQ_DIGITS] = '\0';
+        const uint32_t seq = strtoul(digits, &end, 10);
+        bool valid = end == digits + LOADGEN_SEQ_DIGITS;
+        if (valid) {
+            scan_text(seq, expected);
+            valid = strcmp(payload, expected) == 0;
+        }
+
+        pthread_mutex_lock(&lock);
+        const uint32_t index = seq - step_first_seq;
+        if (valid && seq >= step_first_seq && index < step_capacity &&
+            !published_us[index])
+            published_us[index] = time_us;
+        else
+            ++corrupted;
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_step(double rate, loadgen_step_t *step) {
+    const uint32_t count = rate * config.step_s < 1 ? 1 : rate * config.step_s;
+    const int64_t burst_period_us = 1e6 * config.burst / rate;
+
+    pthread_mutex_lock(&lock);
+    step_first_seq = next_seq;
+    step_capacity = count;
+    sent_us = calloc(count, sizeof(*sent_us));
+    published_us = calloc(count, sizeof(*published_us));
+    if (!sent_us || !published_us) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    corrupted = 0;
+    pthread_mutex_unlock(&lock);
+
+    sim_mqtt_outbox_t outbox;
+    sim_mqtt_get_outbox(&outbox, true);
+    const uint32_t dropped_before = usb_hid_dropped_events();
+    *step = (loadgen_step_t){.offered_rate = rate, .offered = count};
+
+    const int64_t start_us = esp_timer_get_time();
+    for (uint32_t queued = 0, burst = 0; queued < count; ++burst) {
+        const int64_t due_us = start_us + burst * burst_period_us;
+        const int64_t now_us = esp_timer_get_time();
+        if (due_us > now_us)
+            usleep(due_us - now_us);
+        pthread_mutex_lock(&lock);
+        const uint32_t backlog = next_seq - typed_seq;
+        if (backlog > step->max_backlog)
+            step->max_backlog = backlog;
+        for (int i = 0; i < config.burst && queued < count; ++i, ++queued)
+            ++next_seq;
+        pthread_cond_broadcast(&work_changed);
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Wait for the keyboards, then give the last publishes time to arrive
+    pthread_mutex_lock(&lock);
+    while (typed_seq != next_seq || busy_devices)
+        pthread_cond_wait(&work_changed, &lock);
+    pthread_mutex_unlock(&lock);
+    const int64_t typed_us = esp_timer_get_time();
+    usleep(LOADGEN_DRAIN_MS * 1000);
+
+    pthread_mutex_lock(&lock);
+    int64_t *samples = malloc(count * sizeof(*samples));
+    size_t n = 0;
+    int64_t last_publish_us = start_us;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!published_us[i])
+            continue;
+        samples[n++] = published_us[i] - sent_us[i];
+        if (published_us[i] > last_publish_us)
+            last_publish_us = published_us[i];
+    }
+    step->delivered = n;
+    step->lost = count - n;
+    step->corrupted = corrupted;
+    step_capacity = 0; // late publishes count as corrupted from now on
+    free(sent_us);
+    free(published_us);
+    sent_us = published_us = NULL;
+    pthread_mutex_unlock(&lock);
+
+    step->dropped_events = usb_hid_dropped_events() - dropped_before;
+    sim_mqtt_get_outbox(&outbox, false);
+    step->outbox_peak_bytes = outbox.peak_bytes;
+    step->outbox_peak_messages = outbox.peak_messages;
+    // Not less than the step was meant to take, scans come in bursts
+    int64_t elapsed_us =
+        (last_publish_us > typed_us ? last_publish_us : typed_us) - start_us;
+    if (elapsed_us < 1e6 * count / rate)
+        elapsed_us = 1e6 * count / rate;
+    step->achieved_rate = n / (elapsed_us / 1e6);
+    if (n) {
+        qsort(samples, n, sizeof(*samples), compare_int64);
+        step->p50_us = samples[n / 2];
+        step->p99_us = samples[n * 99 / 100];
+        step->max_us = samples[n - 1];
+    }
+    free(samples);
+}
+
+/* Reason the step counts as saturated, NULL if it does not */
+static const char *saturation(const loadgen_step_t *step) {
+    if (step->lost)
+        return "scans lost";
+    if (step->corrupted)
+        return "scans corrupted";
+    if (step->dropped_events)
+        return "HID events dropped";
+    if (step->p99_us > config.latency_limit_ms * 1000)
+        return "latency limit exceeded";
+    if (step->achieved_rate < 0.95 * step->offered_rate)
+        return step->max_backlog > (uint32_t)config.burst
+                   ? "keyboards cannot type faster"
+                   : "throughput below offered rate";
+    return NULL;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n DEVICES  keyboards typing in parallel (1..%d, default 1)\n"
+            "  -l LENGTH   barcode length (%d..%d, default 13)\n"
+            "  -g US       gap between reports, on top of USB polling\n"
+            "  -b SCANS    scans per burst (default 1)\n"
+            "  -r RATE     first offered rate in scans/s (default 5)\n"
+            "  -f FACTOR   rate increase per step (default 1.25)\n"
+            "  -s SECONDS  step duration (default 2)\n"
+            "  -m STEPS    maximum number of steps (default 20)\n"
+            "  -L MS       p99 latency limit (default 100)\n"
+            "  -R MS       round trip to the broker (default 0)\n"
+            "  -B KBPS     link rate to the broker, 0 = unlimited\n"
+            "  -d          print firmware debug logs\n",
+            argv0, SIM_USB_MAX_DEVICES, LOADGEN_SEQ_DIGITS,
+            LOADGEN_MAX_LENGTH);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t rtt_us = 0, bytes_per_s = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:g:b:r:f:s:m:L:R:B:d")) != -1) {
+        switch (opt) {
+        case 'n':
+            config.devices = atoi(optarg);
+            break;
+        case 'l':
+            config.length = atoi(optarg);
+            break;
+        case 'g':
+            config.gap_us = atol(optarg);
+            break;
+        case 'b':
+            config.burst = atoi(optarg);
+            break;
+        case 'r':
+            config.start_rate = atof(optarg);
+            break;
+        case 'f':
+            config.factor = atof(optarg);
+            break;
+        case 's':
+            config.step_s = atof(optarg);
+            break;
+        case 'm':
+            config.max_steps = atoi(optarg);
+            break;
+        case 'L':
+            config.latency_limit_ms = atof(optarg);
+            break;
+        case 'R':
+            rtt_us = atof(optarg) * 1000;
+            break;
+        case 'B':
+            bytes_per_s = atof(optarg) * 1000 / 8;
+            break;
+        case 'd':
+            sim_log_level = ESP_LOG_DEBUG;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || config.devices < 1 ||
+        config.devices > SIM_USB_MAX_DEVICES ||
+        config.length < LOADGEN_SEQ_DIGITS ||
+        config.length > LOADGEN_MAX_LENGTH || config.burst < 1 ||
+        config.start_rate <= 0 || config.factor <= 1 || config.step_s <= 0)
+        usage(argv[0]);
+
+    sim_mqtt_set_link(rtt_us, bytes_per_s);
+    sim_freertos_start(app_main_task, NULL);
+    for (int port = 0; port < config.devices; ++port) {
+        if (sim_usb_plug(port, LOADGEN_PLUG_TIMEOUT_MS) != ESP_OK) {
+            fprintf(stderr, "keyboard %d not connected\n", port);
+            return 2;
+        }
+        pthread_t thread;
+        pthread_create(&thread, NULL, device_thread, (void *)(intptr_t)port);
+    }
+    pthread_t collector;
+    pthread_create(&collector, NULL, collector_thread, NULL);
+
+    printf("%d keyboard(s), %d characters per scan, bursts of %d\n",
+           config.devices, config.length, config.burst);
+    printf("%8s %8s %6s %6s %7s %6s %7s %8s %7s %7s %7s  %s\n", "offered",
+           "achieved", "scans", "lost", "corrupt", "drops", "backlog",
+           "outbox", "p50 ms", "p99 ms", "max ms", "result");
+    double rate = config.start_rate, sustained = 0;
+    const char *reason = NULL;
+    for (int i = 0; i < config.max_steps && !reason; ++i, rate *= config.factor) {
+        loadgen_step_t step;
+        run_step(rate, &step);
+        reason = saturation(&step);
+        printf("%8.1f %8.1f %6" PRIu32 " %6" PRIu32 " %7" PRIu32 " %6" PRIu32
+               " %7" PRIu32 " %8zu %7.2f %7.2f %7.2f  %s\n",
+               step.offered_rate, step.achieved_rate, step.offered,
+               step.lost, step.corrupted, step.dropped_events,
+               step.max_backlog, step.outbox_peak_bytes, step.p50_us / 1e3,
+               step.p99_us / 1e3, step.max_us / 1e3, reason ? reason : "ok");
+        fflush(stdout);
+        if (!reason)
+            sustained = step.achieved_rate;
+    }
+
+    if (reason)
+        printf("saturated: %s, highest sustained rate %.1f scans/s\n", reason,
+               sustained);
+    else
+        printf("not saturated, highest sustained rate %.1f scans/s\n",
+               sustained);
+    fflush(stdout);
+    // The firmware tasks never return, leave without joining them
+    _exit(sustained > 0 ? 0 : 1);
+}
@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_USB_MAX_DEVICES 4
+
+/* Virtual USB devices behind a hub, see fake_usb_host.c */
+esp_err_t sim_usb_plug(int port, uint32_t timeout_ms);
+void sim_usb_unplug(int port);
+/** Hand a report to the host once it polls the endpoint */
+esp_err_t sim_usb_send_report(int port, const uint8_t *report, size_t length,
+                              uint32_t timeout_ms);
+/** Whether the firmware started the device and is polling for reports */
+bool sim_usb_is_polled(int port);
+/**
+ * STALL the interrupt endpoint, as after a glitch. The device recovers on
+ * CLEAR_FEATURE(ENDPOINT_HALT), or if wedged only on a port power cycle.
+ */
+void sim_usb_stall(int port, bool wedged);
+/** Keyboard LEDs lit by output reports since the last call */
+uint8_t sim_usb_take_leds(int port);
+
+/* Virtual keyboard, see virtual_keyboard.c */
+/**
+ * Type text on the keyboard at a port. If last_press_us is given, it
+ * receives the time the host took the last report with a key pressed.
+ */
+esp_err_t sim_keyboard_type(int port, const char *text, uint32_t interval_us,
+                            int64_t *last_press_us);
+esp_err_t sim_keyboard_replay(int port, const char *path, double speed);
+uint64_t sim_keyboard_reports_sent(void);
+
+/* Broker stand-in, see sim_mqtt.c */
+void sim_mqtt_inject(const char *topic, const char *data, int len);
+/**
+ * Wait for the next scan published, to the scan topic or a route below
+ * it. Other messages are skipped. Returns false on timeout.
+ */
+bool sim_mqtt_next_scan(char *payload, size_t size, uint32_t timeout_ms,
+                        int64_t *published_us);
+void sim_mqtt_set_verbose(bool verbose);
+/** Write the next message published to <topic>/<subtopic> to a file */
+void sim_mqtt_save_next(const char *subtopic, const char *path);
+
+typedef struct {
+    size_t bytes;
+    size_t messages;
+    size_t peak_bytes;
+    size_t peak_messages;
+} sim_mqtt_outbox_t;
+
+/** Round trip to the broker and link rate, 0 for no delay */
+void sim_mqtt_set_link(uint32_t rtt_us, uint32_t bytes_per_s);
+/** Messages waiting for an ack, optionally restarting the peak tracking */
+void sim_mqtt_get_outbox(sim_mqtt_outbox_t *stats, bool reset_peak);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,300 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "sim.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "usb_hid.h"
+
+/*
+ * Runs app_main() on the host against the fake USB host, the virtual
+ * keyboard and the MQTT stand-in, driven by a script read from a file or
+ * stdin. One command per line, '#' starts a comment:
+ *
+ *   plug                    attach the keyboard and wait until it is polled
+ *   unplug                  detach the keyboard
+ *   stall                   STALL the keyboard's endpoint once
+ *   wedge                   STALL it until the port is power cycled
+ *   scan TEXT               type TEXT and a tab, expect TEXT to be published
+ *   type TEXT               type TEXT
+ *   expect TEXT             expect TEXT to be the next published scan
+ *   leds MASK               expect the keyboard LEDs in MASK to light up,
+ *                           counting from the previous leds command
+ *   replay FILE [SPEED]     send the reports of a capture, SPEED 0 = no delays
+ *   mqtt TOPIC PAYLOAD      deliver a message to the firmware
+ *   save SUBTOPIC FILE      write the next message on <topic>/SUBTOPIC to FILE
+ *   wait MS                 sleep
+ *   interval US             time between reports while typing
+ *   repeat N ... end        run the enclosed commands N times
+ *
+ * TEXT runs to the end of the line and may contain \t, \n and \\. The
+ * latency of a scan is measured from the host taking the tab report to the
+ * publish.
+ */
+
+#define SIM_MAX_LINES 1024
+#define SIM_MAX_DEPTH 8
+#define SIM_PLUG_TIMEOUT_MS 15000
+#define SIM_EXPECT_TIMEOUT_MS 2000
+#define SIM_MAX_SAMPLES (1 << 20)
+
+extern void app_main(void);
+
+typedef struct {
+    char *lines[SIM_MAX_LINES];
+    int count;
+} script_t;
+
+static uint32_t interval_us = 1000;
+static int64_t *latencies;
+static size_t latency_count;
+static unsigned failures;
+static int64_t first_input_us; // throughput excludes booting the firmware
+
+static void app_main_task(void *arg) {
+    (void)arg;
+    app_main();
+}
+
+static void unescape(char *s) {
+    char *out = s;
+    for (; *s; ++s) {
+        if (*s == '\\' && s[1]) {
+            ++s;
+            *out++ = *s == 't' ? '\t' : *s == 'n' ? '\n' : *s;
+        } else {
+            *out++ = *s;
+        }
+    }
+    *out = '\0';
+}
+
+static bool expect_scan(const char *expected, int64_t sent_us) {
+    char payload[4096];
+    int64_t published_us;
+    if (!sim_mqtt_next_scan(payload, sizeof(payload), SIM_EXPECT_TIMEOUT_MS,
+                            &published_us)) {
+        fprintf(stderr, "expected '%s', nothing was published\n", expected);
+        return false;
+    }
+    if (strcmp(payload, expected) != 0) {
+        fprintf(stderr, "expected '%s', got '%s'\n", expected, payload);
+        return false;
+    }
+    if (sent_us && latency_count < SIM_MAX_SAMPLES)
+        latencies[latency_count++] = published_us - sent_us;
+    return true;
+}
+
+static bool expect_leds(uint8_t mask) {
+    static uint8_t lit;
+    const int64_t until = esp_timer_get_time() + SIM_EXPECT_TIMEOUT_MS * 1000;
+    for (lit |= sim_usb_take_leds(0); (lit & mask) != mask;
+         lit |= sim_usb_take_leds(0)) {
+        if (esp_timer_get_time() >= until) {
+            fprintf(stderr, "expected LEDs 0x%02x, got 0x%02x\n", mask, lit);
+            lit = 0;
+            return false;
+        }
+        usleep(1000);
+    }
+    lit = 0;
+    return true;
+}
+
+static bool run_command(char *line) {
+    char *arg = line + strcspn(line, " ");
+    if (*arg)
+        *arg++ = '\0';
+    if (!first_input_us && (strcmp(line, "scan") == 0 ||
+                            strcmp(line, "type") == 0 ||
+                            strcmp(line, "replay") == 0))
+        first_input_us = esp_timer_get_time();
+
+    if (strcmp(line, "plug") == 0) {
+        if (sim_usb_plug(0, SIM_PLUG_TIMEOUT_MS) != ESP_OK ||
+            !usb_hid_is_connected()) {
+            fprintf(stderr, "keyboard not connected\n");
+            return false;
+        }
+    } else if (strcmp(line, "unplug") == 0) {
+        sim_usb_unplug(0);
+        vTaskDelay(pdMS_TO_TICKS(10));
+    } else if (strcmp(line, "stall") == 0 || strcmp(line, "wedge") == 0) {
+        sim_usb_stall(0, strcmp(line, "wedge") == 0);
+    } else if (strcmp(line, "scan") == 0) {
+        unescape(arg);
+        int64_t sent_us;
+        if (sim_keyboard_type(0, arg, interval_us, NULL) != ESP_OK ||
+            sim_keyboard_type(0, "\t", interval_us, &sent_us) != ESP_OK)
+            return false;
+        return expect_scan(arg, sent_us);
+    } else if (strcmp(line, "type") == 0) {
+        unescape(arg);
+        return sim_keyboard_type(0, arg, interval_us, NULL) == ESP_OK;
+    } else if (strcmp(line, "expect") == 0) {
+        unescape(arg);
+        return expect_scan(arg, 0);
+    } else if (strcmp(line, "leds") == 0) {
+        return expect_leds(strtoul(arg, NULL, 0));
+    } else if (strcmp(line, "replay") == 0) {
+        char *speed = arg + strcspn(arg, " ");
+        if (*speed)
+            *speed++ = '\0';
+        return sim_keyboard_replay(0, arg, *speed ? atof(speed) : 1.0) ==
+               ESP_OK;
+    } else if (strcmp(line, "mqtt") == 0) {
+        char *payload = arg + strcspn(arg, " ");
+        if (*payload)
+            *payload++ = '\0';
+        sim_mqtt_inject(arg, payload, strlen(payload));
+    } else if (strcmp(line, "save") == 0) {
+        char *path = arg + strcspn(arg, " ");
+        if (*path)
+            *path++ = '\0';
+        if (!*arg || !*path)
+            return false;
+        sim_mqtt_save_next(arg, path);
+    } else if (strcmp(line, "wait") == 0) {
+        usleep(atol(arg) * 1000);
+    } else if (strcmp(line, "interval") == 0) {
+        interval_us = atol(arg);
+    } else {
+        fprintf(stderr, "unknown command '%s'\n", line);
+        return false;
+    }
+    return true;
+}
+
+/* Run lines [first, last), returns the index after the block or -1 */
+static int run_block(const script_t *script, int first, int last, int depth) {
+    for (int i = first; i < last; ++i) {
+        char *line = script->lines[i];
+        if (strncmp(line, "repeat ", 7) == 0) {
+            // Find the matching end
+            int nested = 0, end = i + 1;
+            for (; end < last; ++end) {
+                if (strncmp(script->lines[end], "repeat ", 7) == 0)
+                    ++nested;
+                else if (strcmp(script->lines[end], "end") == 0 && !nested--)
+                    break;
+            }
+            if (end == last || depth == SIM_MAX_DEPTH) {
+                fprintf(stderr, "line %d: unbalanced repeat\n", i + 1);
+                return -1;
+            }
+            for (long n = atol(line + 7); n > 0; --n)
+                if (run_block(script, i + 1, end, depth + 1) < 0)
+                    return -1;
+            i = end;
+            continue;
+        }
+
+        char command[4096];
+        snprintf(command, sizeof(command), "%s", line);
+        if (!run_command(command)) {
+            fprintf(stderr, "line %d: '%s' failed\n", i + 1, line);
+            ++failures;
+        }
+    }
+    return last;
+}
+
+static bool script_load(script_t *script, FILE *file) {
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), file)) {
+        buf[strcspn(buf, "\r\n")] = '\0';
+        const char *line = buf + strspn(buf, " \t");
+        if (!*line || *line == '#')
+            continue;
+        if (script->count == SIM_MAX_LINES) {
+            fprintf(stderr, "script too long\n");
+            return false;
+        }
+        script->lines[script->count++] = strdup(line);
+    }
+    return true;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_summary(int64_t elapsed_us) {
+    printf("%zu scans, %" PRIu64 " reports in %.2f s", latency_count,
+           sim_keyboard_reports_sent(), elapsed_us / 1e6);
+    if (latency_count && elapsed_us) {
+        qsort(latencies, latency_count, sizeof(*latencies), compare_int64);
+        printf(", %.1f scans/s, latency p50 %" PRId64 " us p99 %" PRId64
+               " us max %" PRId64 " us",
+               latency_count / (elapsed_us / 1e6),
+               latencies[latency_count / 2],
+               latencies[latency_count * 99 / 100],
+               latencies[latency_count - 1]);
+    }
+    printf(", %u failures\n", failures);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-v] [-d] [-i INTERVAL_US] [SCRIPT]\n"
+            "  -v  print MQTT traffic\n"
+            "  -d  print firmware debug logs\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "vdi:")) != -1) {
+        switch (opt) {
+        case 'v':
+            sim_mqtt_set_verbose(true);
+            break;
+        case 'd':
+            sim_log_level = ESP_LOG_DEBUG;
+            break;
+        case 'i':
+            interval_us = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1)
+        usage(argv[0]);
+
+    FILE *file = optind < argc ? fopen(argv[optind], "r") : stdin;
+    if (!file) {
+        perror(argv[optind]);
+        return 2;
+    }
+    static script_t script;
+    if (!script_load(&script, file))
+        return 2;
+    if (file != stdin)
+        fclose(file);
+    latencies = malloc(SIM_MAX_SAMPLES * sizeof(*latencies));
+    if (!latencies)
+        return 2;
+
+    sim_freertos_start(app_main_task, NULL);
+    if (run_block(&script, 0, script.count, 0) < 0)
+        return 2;
+    print_summary(first_input_us ? esp_timer_get_time() - first_input_us : 0);
+    // The firmware tasks never return, leave without joining them
+    fflush(stdout);
+    _exit(failures ? 1 : 0);
+}
@@ -0,0 +1,395 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "mqtt.h"
+#include "sim.h"
+
+#include "app_config.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG = "sim_mqtt";
+
+/*
+ * Stand-in for the broker and mqtt.c in one: subscriptions are kept in a
+ * list and served by sim_mqtt_inject(), scans published with
+ * mqtt_publish(), to the scan topic or a route below it, are queued for
+ * sim_mqtt_next_scan(). The client is always connected.
+ *
+ * sim_mqtt_set_link() models the connection to the broker: a publish
+ * blocks the caller while its bytes are written at the link rate, and then
+ * stays in the outbox for one round trip per QoS level until acknowledged.
+ * Acks of scans are reported to the delivery callback by a thread standing
+ * in for the MQTT task, started along with the callback.
+ */
+typedef struct subscription {
+    SLIST_ENTRY(subscription) next;
+    mqtt_data_cb_t callback;
+    bool subtopic; // topic is below base_topic
+    char topic[];
+} subscription_t;
+
+typedef struct published {
+    STAILQ_ENTRY(published) next;
+    int64_t time_us;
+    char payload[];
+} published_t;
+
+typedef struct outbox_entry {
+    STAILQ_ENTRY(outbox_entry) next;
+    int64_t acked_us;
+    size_t bytes;
+    int msg_id;
+    bool scan; // reported to the delivery callback
+} outbox_entry_t;
+
+static SLIST_HEAD(, subscription) subscriptions =
+    SLIST_HEAD_INITIALIZER(subscriptions);
+static STAILQ_HEAD(, published) scans = STAILQ_HEAD_INITIALIZER(scans);
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_published = PTHREAD_COND_INITIALIZER;
+static char base_topic[sizeof(((app_config_t *)0)->mqtt_topic)] = "hid2mqtt";
+static bool verbose;
+
+static STAILQ_HEAD(, outbox_entry) outbox = STAILQ_HEAD_INITIALIZER(outbox);
+static sim_mqtt_outbox_t outbox_stats;
+static uint32_t link_rtt_us;
+static uint32_t link_bytes_per_s;
+static int next_msg_id = 1;
+static mqtt_delivery_cb_t delivery_cb;
+static char save_subtopic[64];
+static char save_path[256];
+
+void sim_mqtt_set_verbose(bool enable) {
+    verbose = enable;
+}
+
+void sim_mqtt_set_link(uint32_t rtt_us, uint32_t bytes_per_s) {
+    link_rtt_us = rtt_us;
+    link_bytes_per_s = bytes_per_s;
+}
+
+typedef STAILQ_HEAD(outbox_list, outbox_entry) outbox_list_t;
+
+/*
+ * Drop acknowledged messages from the outbox, called with lock held. The
+ * scans among them are moved to acked, to be reported once the lock is
+ * released.
+ */
+static void outbox_expire(int64_t now_us, outbox_list_t *acked) {
+    outbox_entry_t *entry;
+    while ((entry = STAILQ_FIRST(&outbox)) && entry->acked_us <= now_us) {
+        STAILQ_REMOVE_HEAD(&outbox, next);
+        trace_record(TRACE_PUBLISH_ACK, 0, entry->msg_id);
+        outbox_stats.bytes -= entry->bytes;
+        --outbox_stats.messages;
+        if (entry->scan)
+            STAILQ_INSERT_TAIL(acked, entry, next);
+        else
+            free(entry);
+    }
+}
+
+static void delivery_report(outbox_list_t *acked) {
+    outbox_entry_t *entry;
+    while ((entry = STAILQ_FIRST(acked))) {
+        STAILQ_REMOVE_HEAD(acked, next);
+        if (delivery_cb)
+            delivery_cb(MQTT_DELIVERY_ACKED);
+        free(entry);
+    }
+}
+
+static void outbox_add(size_t bytes, int qos, bool scan) {
+    if (link_bytes_per_s)
+        usleep((uint64_t)bytes * 1000000 / link_bytes_per_s);
+    const int64_t now_us = esp_timer_get_time();
+    const int msg_id = __atomic_fetch_add(&next_msg_id, 1, __ATOMIC_RELAXED);
+    trace_record(TRACE_PUBLISH, bytes, msg_id);
+    outbox_entry_t *entry = NULL;
+    if (qos && link_rtt_us && (entry = malloc(sizeof(outbox_entry_t)))) {
+        entry->acked_us = now_us + (int64_t)qos * link_rtt_us;
+        entry->bytes = bytes;
+        entry->msg_id = msg_id;
+        entry->scan = scan;
+    } else if (qos) {
+        trace_record(TRACE_PUBLISH_ACK, 0, msg_id);
+    }
+
+    outbox_list_t acked = STAILQ_HEAD_INITIALIZER(acked);
+    pthread_mutex_lock(&lock);
+    outbox_expire(now_us, &acked);
+    if (entry) {
+        // Acks arrive in order, the round trip is the same for all
+        STAILQ_INSERT_TAIL(&outbox, entry, next);
+        outbox_stats.bytes += bytes;
+        ++outbox_stats.messages;
+        if (outbox_stats.bytes > outbox_stats.peak_bytes)
+            outbox_stats.peak_bytes = outbox_stats.bytes;
+        if (outbox_stats.messages > outbox_stats.peak_messages)
+            outbox_stats.peak_messages = outbox_stats.messages;
+    }
+    pthread_mutex_unlock(&lock);
+    delivery_report(&acked);
+    if (scan && !entry && delivery_cb)
+        delivery_cb(MQTT_DELIVERY_ACKED);
+}
+
+static void *ack_thread(void *arg) {
+    (void)arg;
+    while (true) {
+        outbox_list_t acked = STAILQ_HEAD_INITIALIZER(acked);
+        pthread_mutex_lock(&lock);
+        const int64_t now_us = esp_timer_get_time();
+        outbox_expire(now_us, &acked);
+        const outbox_entry_t *entry = STAILQ_FIRST(&outbox);
+        int64_t wait_us = entry ? entry->acked_us - now_us : 10000;
+        pthread_mutex_unlock(&lock);
+        delivery_report(&acked);
+        usleep(wait_us < 1000 ? 1000 : wait_us < 10000 ? wait_us : 10000);
+    }
+    return NULL;
+}
+
+static void ack_thread_start(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ack_thread, NULL))
+        ESP_LOGE(TAG, "Unable to start the ack thread");
+    else
+        pthread_detach(thread);
+}
+
+void sim_mqtt_get_outbox(sim_mqtt_outbox_t *stats, bool reset_peak) {
+    outbox_list_t acked = STAILQ_HEAD_INITIALIZER(acked);
+    pthread_mutex_lock(&lock);
+    outbox_expire(esp_timer_get_time(), &acked);
+    *stats = outbox_stats;
+    if (reset_peak) {
+        outbox_stats.peak_bytes = outbox_stats.bytes;
+        outbox_stats.peak_messages = outbox_stats.messages;
+    }
+    pthread_mutex_unlock(&lock);
+    delivery_report(&acked);
+}
+
+void sim_mqtt_save_next(const char *subtopic, const char *path) {
+    pthread_mutex_lock(&lock);
+    snprintf(save_subtopic, sizeof(save_subtopic), "%s", subtopic);
+    snprintf(save_path, sizeof(save_path), "%s", path);
+    pthread_mutex_unlock(&lock);
+}
+
+static void save(const char *topic, const char *data, int len) {
+    const size_t base_len = strlen(base_topic);
+    pthread_mutex_lock(&lock);
+    if (*save_subtopic && strncmp(topic, base_topic, base_len) == 0 &&
+        topic[base_len] == '/' &&
+        strcmp(topic + base_len + 1, save_subtopic) == 0) {
+        FILE *file = fopen(save_path, "wb");
+        if (!file || fwrite(data, 1, len, file) != (size_t)len)
+            ESP_LOGE(TAG, "Failed to save %s to %s", topic, save_path);
+        if (file)
+            fclose(file);
+        *save_subtopic = '\0';
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void publish(const char *topic, const char *data, int len, int qos,
+                    bool scan) {
+    if (verbose)
+        printf("mqtt %s %.*s\n", topic, len, data);
+    outbox_add(strlen(topic) + len, qos, scan);
+    save(topic, data, len);
+    if (!scan)
+        return;
+
+    published_t *msg = malloc(sizeof(published_t) + len + 1);
+    if (!msg) {
+        ESP_LOGE(TAG, "Out of memory, message dropped");
+        return;
+    }
+    msg->time_us = esp_timer_get_time();
+    memcpy(msg->payload, data, len);
+    msg->payload[len] = '\0';
+    pthread_mutex_lock(&lock);
+    STAILQ_INSERT_TAIL(&scans, msg, next);
+    pthread_cond_signal(&scan_published);
+    pthread_mutex_unlock(&lock);
+}
+
+bool sim_mqtt_next_scan(char *payload, size_t size, uint32_t timeout_ms,
+                        int64_t *published_us) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_nsec -= 1000000000L;
+        ++until.tv_sec;
+    }
+
+    pthread_mutex_lock(&lock);
+    while (STAILQ_EMPTY(&scans)) {
+        if (pthread_cond_timedwait(&scan_published, &lock, &until)) {
+            pthread_mutex_unlock(&lock);
+            return false;
+        }
+    }
+    published_t *msg = STAILQ_FIRST(&scans);
+    STAILQ_REMOVE_HEAD(&scans, next);
+    pthread_mutex_unlock(&lock);
+
+    snprintf(payload, size, "%s", msg->payload);
+    if (published_us)
+        *published_us = msg->time_us;
+    free(msg);
+    return true;
+}
+
+void sim_mqtt_inject(const char *topic, const char *data, int len) {
+    if (verbose)
+        printf("inject %s %.*s\n", topic, len, data);
+    pthread_mutex_lock(&lock);
+    subscription_t *sub;
+    mqtt_data_cb_t callback = NULL;
+    const size_t base_len = strlen(base_topic);
+    SLIST_FOREACH(sub, &subscriptions, next) {
+        const char *match = topic;
+        if (sub->subtopic) {
+            if (strncmp(topic, base_topic, base_len) != 0 ||
+                topic[base_len] != '/')
+                continue;
+            match += base_len + 1;
+        }
+        if (strcmp(sub->topic, match) == 0) {
+            callback = sub->callback;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    // Called without the lock, handlers may (un)subscribe
+    if (callback)
+        callback(topic, data, len, 0, len);
+    else
+        ESP_LOGW(TAG, "No subscriber for %s", topic);
+}
+
+// ---------------------------------- mqtt.h -----------------------------------
+
+esp_err_t mqtt_publish(const char *subtopic, const char *msg) {
+    char topic[sizeof(base_topic) + 64];
+    snprintf(topic, sizeof(topic), "%s%s%s", base_topic, subtopic ? "/" : "",
+             subtopic ? subtopic : "");
+    publish(topic, msg, strlen(msg), 2, true);
+    return ESP_OK;
+}
+
+void mqtt_set_delivery_callback(mqtt_delivery_cb_t cb) {
+    static pthread_once_t ack_thread_once = PTHREAD_ONCE_INIT;
+    delivery_cb = cb;
+    pthread_once(&ack_thread_once, ack_thread_start);
+}
+
+esp_err_t mqtt_publish_subtopic(const char *subtopic, const char *data,
+                                int len) {
+    char topic[sizeof(base_topic) + 64];
+    snprintf(topic, sizeof(topic), "%s/%s", base_topic, subtopic);
+    publish(topic, data, len, 1, false);
+    return ESP_OK;
+}
+
+static void subscription_remove(const char *topic, bool subtopic) {
+    pthread_mutex_lock(&lock);
+    subscription_t *sub;
+    SLIST_FOREACH(sub, &subscriptions, next) {
+        if (sub->subtopic == subtopic && strcmp(sub->topic, topic) == 0) {
+            SLIST_REMOVE(&subscriptions, sub, subscription, next);
+            free(sub);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static esp_err_t subscription_add(const char *topic, bool subtopic,
+                                  mqtt_data_cb_t cb) {
+    subscription_t *sub = malloc(sizeof(subscription_t) + strlen(topic) + 1);
+    if (!sub)
+        return ESP_ERR_NO_MEM;
+    sub->callback = cb;
+    sub->subtopic = subtopic;
+    strcpy(sub->topic, topic);
+    subscription_remove(topic, subtopic);
+    pthread_mutex_lock(&lock);
+    SLIST_INSERT_HEAD(&subscriptions, sub, next);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_subscribe(const char *topic, mqtt_data_cb_t cb) {
+    return subscription_add(topic, false, cb);
+}
+
+esp_err_t mqtt_subscribe_subtopic(const char *subtopic, mqtt_data_cb_t cb) {
+    return subscription_add(subtopic, true, cb);
+}
+
+esp_err_t mqtt_unsubscribe(const char *topic) {
+    subscription_remove(topic, false);
+    return ESP_OK;
+}
+
+bool mqtt_is_connected(void) {
+    return true;
+}
+
+const char *mqtt_get_topic(void) {
+    return base_topic;
+}
+
+int mqtt_get_outbox_size(void) {
+    sim_mqtt_outbox_t stats;
+    sim_mqtt_get_outbox(&stats, false);
+    return stats.bytes;
+}
+
+esp_err_t mqtt_wait_outbox_empty(uint32_t timeout_ms) {
+    const int64_t until = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    sim_mqtt_outbox_t stats;
+    for (sim_mqtt_get_outbox(&stats, false); stats.messages;
+         sim_mqtt_get_outbox(&stats, false)) {
+        if (esp_timer_get_time() >= until)
+            return ESP_ERR_TIMEOUT;
+        usleep(1000);
+    }
+    return ESP_OK;
+}
+
+esp_err_t mqtt_set_config(const char *uri, const char *topic) {
+    (void)uri;
+    if (topic && *topic)
+        snprintf(base_topic, sizeof(base_topic), "%s", topic);
+    return ESP_OK;
+}
+
+void mqtt_reload_config(void) {}
+
+void mqtt_reconnect(void) {}
+
+void mqtt_app_start(void) {
+    mqtt_set_config(NULL, app_config_get()->mqtt_topic);
+    ESP_LOGI(TAG, "Publishing to %s", base_topic);
+}
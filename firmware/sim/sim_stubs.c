@@ -0,0 +1,167 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * The parts of the firmware that need Wi-Fi, flash or NVS. The
+ * configuration and the device cache live in RAM and start out empty or
+ * with the firmware defaults, updates and provisioning are refused.
+ */
+
+#include "app_config.h"
+#include "device_cache.h"
+#include "ota.h"
+#include "ota_mqtt.h"
+#include "ota_self_test.h"
+#include "qr_provisioning.h"
+#include "wifi.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+static const char *TAG = "sim_stubs";
+
+static app_config_t config = {.mqtt_topic = "hid2mqtt"};
+
+void app_config_start(void) {}
+
+const app_config_t *app_config_get(void) {
+    return &config;
+}
+
+esp_err_t app_config_set_str(app_config_field_t field, const char *value) {
+    char *dest;
+    size_t size;
+    switch (field) {
+    case APP_CONFIG_MQTT_URI:
+        dest = config.mqtt_uri, size = sizeof(config.mqtt_uri);
+        break;
+    case APP_CONFIG_MQTT_TOPIC:
+        dest = config.mqtt_topic, size = sizeof(config.mqtt_topic);
+        break;
+    case APP_CONFIG_LOCK_KEY:
+        dest = config.lock_key, size = sizeof(config.lock_key);
+        break;
+    case APP_CONFIG_HID_EVENTS:
+        dest = config.hid_events, size = sizeof(config.hid_events);
+        break;
+    case APP_CONFIG_KEYBOARD:
+        dest = config.keyboard, size = sizeof(config.keyboard);
+        break;
+    case APP_CONFIG_AIM_ROUTING:
+        dest = config.aim_routing, size = sizeof(config.aim_routing);
+        break;
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(value) >= size)
+        return ESP_ERR_INVALID_SIZE;
+    strcpy(dest, value);
+    return ESP_OK;
+}
+
+esp_err_t app_config_commit(void) {
+    return ESP_OK;
+}
+
+#define SIM_DEVICE_CACHE_SIZE 4
+
+static struct {
+    bool used;
+    device_cache_key_t key;
+    uint8_t flags;
+    uint16_t length;
+    uint8_t report_desc[CONFIG_USB_HOST_HID_REPORT_DESC_SIZE];
+} device_cache[SIM_DEVICE_CACHE_SIZE];
+
+static int device_cache_find(const device_cache_key_t *key) {
+    for (int i = 0; i < SIM_DEVICE_CACHE_SIZE; ++i)
+        if (device_cache[i].used &&
+            memcmp(&device_cache[i].key, key, sizeof(*key)) == 0)
+            return i;
+    return -1;
+}
+
+void device_cache_start(void) {}
+
+esp_err_t device_cache_lookup(const device_cache_key_t *key,
+                              device_profile_t *profile) {
+    const int i = device_cache_find(key);
+    if (i < 0)
+        return ESP_ERR_NOT_FOUND;
+    *profile = (device_profile_t){.report_desc_length = device_cache[i].length,
+                                  .flags = device_cache[i].flags};
+    return ESP_OK;
+}
+
+bool device_cache_update(const device_cache_key_t *key,
+                         const uint8_t *report_desc, size_t length,
+                         uint8_t flags) {
+    int i = device_cache_find(key);
+    if (i >= 0 && device_cache[i].flags == flags &&
+        device_cache[i].length == length &&
+        memcmp(device_cache[i].report_desc, report_desc, length) == 0)
+        return false;
+    for (int j = 0; i < 0 && j < SIM_DEVICE_CACHE_SIZE; ++j)
+        if (!device_cache[j].used)
+            i = j;
+    if (i < 0 || length > sizeof(device_cache[i].report_desc))
+        return true;
+    device_cache[i].used = true;
+    device_cache[i].key = *key;
+    device_cache[i].flags = flags;
+    device_cache[i].length = length;
+    memcpy(device_cache[i].report_desc, report_desc, length);
+    return true;
+}
+
+void wifi_init_sta(void) {}
+
+void ota_start(void) {}
+
+void ota_mqtt_start(void) {}
+
+void ota_self_test_start(void) {}
+
+esp_err_t update_firmware(const char *url) {
+    ESP_LOGW(TAG, "Ignoring update from %s", url);
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t provision_wifi_qr(const char *qr) {
+    (void)qr;
+    ESP_LOGW(TAG, "Ignoring provisioning");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t provision_mqtt_qr(const char *qr) {
+    (void)qr;
+    ESP_LOGW(TAG, "Ignoring provisioning");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t provision_combined_qr(const char *qr) {
+    (void)qr;
+    ESP_LOGW(TAG, "Ignoring provisioning");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t provision_hid_qr(const char *qr) {
+    (void)qr;
+    ESP_LOGW(TAG, "Ignoring provisioning");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t provision_keyboard_qr(const char *qr) {
+    (void)qr;
+    ESP_LOGW(TAG, "Ignoring provisioning");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t provision_aim_qr(const char *qr) {
+    (void)qr;
+    ESP_LOGW(TAG, "Ignoring provisioning");
+    return ESP_ERR_NOT_SUPPORTED;
+}
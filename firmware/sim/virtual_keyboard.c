@@ -0,0 +1,191 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "sim.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "hid_capture_format.h"
+
+static const char *TAG = "virtual_keyboard";
+
+/*
+ * Types text on the virtual device the way a barcode scanner in keyboard
+ * mode does, with a press and a release report per character. Characters
+ * outside ASCII are entered as Alt + keypad decimal codes. The key map is
+ * the one used by host_test/make_report_corpus.py.
+ */
+#define MOD_SHIFT 0x02
+#define MOD_ALT 0x04
+#define REPORT_TIMEOUT_MS 2000
+
+static const uint8_t keypad_digits[10] = {0x62, 0x59, 0x5a, 0x5b, 0x5c,
+                                          0x5d, 0x5e, 0x5f, 0x60, 0x61};
+
+static uint64_t reports_sent; // updated atomically, ports type in parallel
+
+static bool ascii_key(char c, uint8_t *key, uint8_t *modifier) {
+    static const char shifted_digits[] = "!@#$%^&*()";
+    static const char punct[] = "-=[]\\;'`,./";
+    static const char shifted_punct[] = "_+{}|:\"~<>?";
+    static const uint8_t punct_keys[] = {0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x33,
+                                         0x34, 0x35, 0x36, 0x37, 0x38};
+    const char *p;
+
+    *modifier = 0;
+    if (c >= 'a' && c <= 'z') {
+        *key = 0x04 + c - 'a';
+    } else if (c >= 'A' && c <= 'Z') {
+        *key = 0x04 + c - 'A';
+        *modifier = MOD_SHIFT;
+    } else if (c >= '1' && c <= '9') {
+        *key = 0x1e + c - '1';
+    } else if (c == '0') {
+        *key = 0x27;
+    } else if (c == ' ') {
+        *key = 0x2c;
+    } else if (c == '\n') {
+        *key = 0x28;
+    } else if (c == '\t') {
+        *key = 0x2b;
+    } else if (c && (p = strchr(shifted_digits, c))) {
+        *key = 0x1e + (p - shifted_digits);
+        *modifier = MOD_SHIFT;
+    } else if (c && (p = strchr(punct, c))) {
+        *key = punct_keys[p - punct];
+    } else if (c && (p = strchr(shifted_punct, c))) {
+        *key = punct_keys[p - shifted_punct];
+        *modifier = MOD_SHIFT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static esp_err_t send_report(int port, uint8_t modifier, uint8_t key,
+                             uint32_t interval_us, int64_t *last_press_us) {
+    const uint8_t report[8] = {modifier, 0, key};
+    esp_err_t ret = sim_usb_send_report(port, report, sizeof(report),
+                                        REPORT_TIMEOUT_MS);
+    if (ret != ESP_OK)
+        return ret;
+    __atomic_fetch_add(&reports_sent, 1, __ATOMIC_RELAXED);
+    if (key && last_press_us)
+        *last_press_us = esp_timer_get_time();
+    if (interval_us)
+        usleep(interval_us);
+    return ESP_OK;
+}
+
+/* Decode one UTF-8 sequence, returns its length or 0 if invalid */
+static size_t utf8_decode(const unsigned char *s, uint32_t *codepoint) {
+    size_t len;
+    if (s[0] < 0x80)
+        return *codepoint = s[0], 1;
+    else if ((s[0] & 0xe0) == 0xc0)
+        *codepoint = s[0] & 0x1f, len = 2;
+    else if ((s[0] & 0xf0) == 0xe0)
+        *codepoint = s[0] & 0x0f, len = 3;
+    else if ((s[0] & 0xf8) == 0xf0)
+        *codepoint = s[0] & 0x07, len = 4;
+    else
+        return 0;
+    for (size_t i = 1; i < len; ++i) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+        *codepoint = *codepoint << 6 | (s[i] & 0x3f);
+    }
+    return len;
+}
+
+esp_err_t sim_keyboard_type(int port, const char *text, uint32_t interval_us,
+                            int64_t *last_press_us) {
+    const unsigned char *s = (const unsigned char *)text;
+    while (*s) {
+        uint32_t codepoint;
+        const size_t len = utf8_decode(s, &codepoint);
+        if (!len) {
+            ESP_LOGE(TAG, "Invalid UTF-8 in '%s'", text);
+            return ESP_ERR_INVALID_ARG;
+        }
+        s += len;
+
+        esp_err_t ret;
+        uint8_t key, modifier;
+        if (codepoint < 0x80 && ascii_key(codepoint, &key, &modifier)) {
+            ret = send_report(port, modifier, key, interval_us,
+                              last_press_us);
+        } else {
+            char digits[12];
+            snprintf(digits, sizeof(digits), "%" PRIu32, codepoint);
+            ret = ESP_OK;
+            for (const char *d = digits; *d && ret == ESP_OK; ++d) {
+                ret = send_report(port, MOD_ALT, keypad_digits[*d - '0'],
+                                  interval_us, last_press_us);
+                if (ret == ESP_OK)
+                    ret = send_report(port, MOD_ALT, 0, interval_us, NULL);
+            }
+        }
+        if (ret == ESP_OK)
+            ret = send_report(port, 0, 0, interval_us, NULL);
+        if (ret != ESP_OK)
+            return ret;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sim_keyboard_replay(int port, const char *path, double speed) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        ESP_LOGE(TAG, "Cannot open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t *data = NULL;
+    size_t size = 0;
+    for (size_t n = 1; n;) {
+        uint8_t *grown = realloc(data, size + 4096);
+        if (!grown) {
+            free(data);
+            fclose(file);
+            return ESP_ERR_NO_MEM;
+        }
+        data = grown;
+        size += n = fread(data + size, 1, 4096, file);
+    }
+    fclose(file);
+
+    hid_capture_reader_t reader;
+    if (!hid_capture_reader_init(&reader, data, size)) {
+        ESP_LOGE(TAG, "%s is not a capture", path);
+        free(data);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t delta_us;
+    const uint8_t *report;
+    size_t length;
+    esp_err_t ret = ESP_OK;
+    while (ret == ESP_OK &&
+           hid_capture_next(&reader, &delta_us, &report, &length)) {
+        if (speed > 0)
+            usleep(delta_us / speed);
+        ret = sim_usb_send_report(port, report, length, REPORT_TIMEOUT_MS);
+        if (ret == ESP_OK)
+            __atomic_fetch_add(&reports_sent, 1, __ATOMIC_RELAXED);
+    }
+    free(data);
+    return ret;
+}
+
+uint64_t sim_keyboard_reports_sent(void) {
+    return __atomic_load_n(&reports_sent, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "aim_id.h"
+
+#include <stdio.h>
+
+/*
+ * Routing table from symbology letter to the name used as topic suffix,
+ * built by the compiler so a scan is routed with a single load. Letters
+ * not listed here are routed to "other".
+ */
+static const char *const symbologies[128] = {
+    ['A'] = "code39",
+    ['C'] = "code128",
+    ['E'] = "ean",
+    ['F'] = "codabar",
+    ['G'] = "code93",
+    ['H'] = "code11",
+    ['I'] = "itf",
+    ['L'] = "pdf417",
+    ['M'] = "msi",
+    ['Q'] = "qr",
+    ['U'] = "maxicode",
+    ['X'] = "other",
+    ['d'] = "datamatrix",
+    ['e'] = "databar",
+    ['z'] = "aztec",
+};
+
+static bool is_letter(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+static bool is_modifier(char c) {
+    return (c >= '0' && c <= '9') || is_letter(c);
+}
+
+size_t aim_id_parse(const char *scan, aim_id_t *id) {
+    if (scan[0] != ']' || !is_letter(scan[1]) || !is_modifier(scan[2])) {
+        *id = (aim_id_t){0};
+        return 0;
+    }
+    const char *symbology = symbologies[(unsigned char)scan[1]];
+    *id = (aim_id_t){.code = scan[1],
+                     .modifier = scan[2],
+                     .symbology = symbology ? symbology : "other"};
+    return AIM_ID_LENGTH;
+}
+
+bool aim_id_route(const aim_id_t *id, char *suffix, size_t size) {
+    if (!id->code)
+        return false;
+    const int length = snprintf(suffix, size, "%s/%c%c", id->symbology,
+                                id->code, id->modifier);
+    return length >= 0 && (size_t)length < size;
+}
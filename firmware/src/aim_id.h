@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Symbology identifiers as defined by AIM (ISO/IEC 15424), which scanners
+ * can prepend to every scan: "]" followed by a letter for the symbology and
+ * a modifier, for instance "]C1" for GS1-128, "]E0" for EAN-13, "]d2" for
+ * GS1 DataMatrix or "]Q3" for a QR code with GS1 data.
+ */
+#define AIM_ID_LENGTH 3
+
+typedef struct {
+    char code;     // symbology letter, 0 if the scan has no identifier
+    char modifier; // options of the symbology, such as GS1 data
+    const char *symbology; // short name, "other" for unknown letters
+} aim_id_t;
+
+/**
+ * Parse the identifier at the start of a scan. Returns its length, to be
+ * skipped to get at the data, or 0 if the scan does not start with one.
+ */
+size_t aim_id_parse(const char *scan, aim_id_t *id);
+/**
+ * The topic suffix a scan with this identifier is routed to,
+ * "<symbology>/<code><modifier>", such as "qr/Q1". Returns false if it does
+ * not fit.
+ */
+bool aim_id_route(const aim_id_t *id, char *suffix, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
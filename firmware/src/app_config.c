@@ -0,0 +1,190 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "app_config.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <nvs_flash.h>
+
+static const char *TAG = "app_config";
+
+/*
+ * All settings live in app_config_t, which is loaded once at boot and kept in
+ * RAM. Setters only mark fields dirty; app_config_commit() writes the dirty
+ * fields and commits them at once, so a provisioning action costs a single
+ * NVS commit, and none at all if nothing changed. A copy of what was last
+ * saved is kept, so a failed commit puts the RAM config back as well and no
+ * half-applied change is saved by a later one.
+ *
+ * The layout is versioned with the "version" key. Version 0 is the layout
+ * before this module, with one namespace per module; it is migrated on the
+ * first boot. The key is only written along with a migration or the first
+ * initialisation, so a newer version written by a newer image is kept.
+ */
+#define APP_CONFIG_VERSION 1
+
+typedef struct {
+    const char *key;
+    size_t offset;
+    size_t size;
+    const char *default_value;
+} app_config_field_desc_t;
+
+#define APP_CONFIG_STR(member, key, default_value)                             \
+    {key, offsetof(app_config_t, member),                                      \
+     sizeof(((app_config_t *)0)->member), default_value}
+
+static const app_config_field_desc_t fields[APP_CONFIG_FIELD_COUNT] = {
+    [APP_CONFIG_MQTT_URI] = APP_CONFIG_STR(mqtt_uri, "mqtt_uri",
+                                           "mqtt://127.0.0.1"),
+    [APP_CONFIG_MQTT_TOPIC] = APP_CONFIG_STR(mqtt_topic, "mqtt_topic",
+                                             "hid2mqtt"),
+    [APP_CONFIG_LOCK_KEY] = APP_CONFIG_STR(lock_key, "lock_key", ""),
+    [APP_CONFIG_HID_EVENTS] = APP_CONFIG_STR(hid_events, "hid_events", ""),
+    [APP_CONFIG_KEYBOARD] = APP_CONFIG_STR(keyboard, "keyboard", ""),
+    [APP_CONFIG_AIM_ROUTING] = APP_CONFIG_STR(aim_routing, "aim_routing", ""),
+};
+
+static app_config_t config;
+static app_config_t saved;
+static uint32_t dirty;
+static bool version_outdated; // "version" is written by the next commit
+static nvs_handle_t nvs;
+
+static inline char *app_config_field(app_config_field_t field) {
+    return (char *)&config + fields[field].offset;
+}
+
+esp_err_t app_config_set_str(app_config_field_t field, const char *value) {
+    if (field >= APP_CONFIG_FIELD_COUNT)
+        return ESP_ERR_INVALID_ARG;
+    if (strlen(value) >= fields[field].size) {
+        ESP_LOGE(TAG, "Value for %s too long", fields[field].key);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    char *dest = app_config_field(field);
+    if (strcmp(dest, value) != 0) {
+        strcpy(dest, value);
+        dirty |= 1u << field;
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_config_commit(void) {
+    if (!dirty && !version_outdated)
+        return ESP_OK;
+
+    esp_err_t ret = ESP_OK;
+    for (int i = 0; i < APP_CONFIG_FIELD_COUNT && ret == ESP_OK; ++i) {
+        if (dirty & (1u << i))
+            ret = nvs_set_str(nvs, fields[i].key, app_config_field(i));
+    }
+    if (ret == ESP_OK && version_outdated)
+        ret = nvs_set_u8(nvs, "version", APP_CONFIG_VERSION);
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save config: %s", esp_err_to_name(ret));
+        app_config_revert();
+        return ret;
+    }
+    ESP_LOGI(TAG, "Saved config, changed fields 0x%" PRIx32, dirty);
+    saved = config;
+    dirty = 0;
+    version_outdated = false;
+    return ESP_OK;
+}
+
+void app_config_revert(void) {
+    config = saved;
+    dirty = 0;
+}
+
+const app_config_t *app_config_get(void) {
+    return &config;
+}
+
+/* Returns false if the value exists but could not be read */
+static bool app_config_load_legacy(nvs_handle_t legacy, const char *key,
+                                   app_config_field_t field) {
+    size_t size = fields[field].size;
+    const esp_err_t err =
+        nvs_get_str(legacy, key, app_config_field(field), &size);
+    if (err == ESP_OK)
+        dirty |= 1u << field;
+    else if (err != ESP_ERR_NVS_NOT_FOUND)
+        ESP_LOGW(TAG, "Skipped legacy value \"%s\": %s", key,
+                 esp_err_to_name(err));
+    return err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND;
+}
+
+static void app_config_erase_legacy(const char *namespace) {
+    nvs_handle_t legacy;
+    if (nvs_open(namespace, NVS_READWRITE, &legacy) != ESP_OK)
+        return;
+    nvs_erase_all(legacy);
+    nvs_commit(legacy);
+    nvs_close(legacy);
+}
+
+/*
+ * The legacy namespaces are only read here. Returns true if every value in
+ * them was migrated, so they may be erased once the migrated values are
+ * committed.
+ */
+static bool app_config_migrate_v0(void) {
+    bool complete = true;
+    nvs_handle_t legacy;
+    if (nvs_open("mqtt", NVS_READONLY, &legacy) == ESP_OK) {
+        complete &= app_config_load_legacy(legacy, "uri", APP_CONFIG_MQTT_URI);
+        complete &=
+            app_config_load_legacy(legacy, "topic", APP_CONFIG_MQTT_TOPIC);
+        nvs_close(legacy);
+    }
+    if (nvs_open("config_lock", NVS_READONLY, &legacy) == ESP_OK) {
+        complete &=
+            app_config_load_legacy(legacy, "lock_key", APP_CONFIG_LOCK_KEY);
+        nvs_close(legacy);
+    }
+    return complete;
+}
+
+void app_config_start(void) {
+    ESP_ERROR_CHECK(nvs_open("config", NVS_READWRITE, &nvs));
+
+    for (int i = 0; i < APP_CONFIG_FIELD_COUNT; ++i) {
+        size_t size = fields[i].size;
+        if (nvs_get_str(nvs, fields[i].key, app_config_field(i), &size) !=
+            ESP_OK) {
+            strcpy(app_config_field(i), fields[i].default_value);
+            dirty |= 1u << i;
+        }
+    }
+
+    uint8_t version = 0;
+    bool migrated = false;
+    nvs_get_u8(nvs, "version", &version);
+    if (version > APP_CONFIG_VERSION) {
+        ESP_LOGW(TAG, "Config version %d is newer than supported version %d",
+                 version, APP_CONFIG_VERSION);
+    } else if (version < 1) {
+        ESP_LOGW(TAG, "Migrating config from per-module namespaces");
+        version_outdated = true;
+        migrated = app_config_migrate_v0();
+        if (!migrated)
+            ESP_LOGW(TAG, "Keeping the legacy namespaces");
+    }
+
+    ESP_ERROR_CHECK(app_config_commit());
+    saved = config;
+    if (migrated) {
+        app_config_erase_legacy("mqtt");
+        app_config_erase_legacy("config_lock");
+    }
+}
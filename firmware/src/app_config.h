@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    char mqtt_uri[256];
+    char mqtt_topic[64];
+    char lock_key[64];
+    char hid_events[24]; // "<interval ms>,<deadband>", empty if disabled
+    char keyboard[16];   // "<unicode|windows>,<us|intl>", empty for defaults
+    char aim_routing[4]; // "on" to route scans by symbology, empty if off
+} app_config_t;
+
+typedef enum {
+    APP_CONFIG_MQTT_URI,
+    APP_CONFIG_MQTT_TOPIC,
+    APP_CONFIG_LOCK_KEY,
+    APP_CONFIG_HID_EVENTS,
+    APP_CONFIG_KEYBOARD,
+    APP_CONFIG_AIM_ROUTING,
+    APP_CONFIG_FIELD_COUNT,
+} app_config_field_t;
+
+/** Load the configuration from NVS, migrating older layouts. */
+void app_config_start(void);
+const app_config_t *app_config_get(void);
+/** Change a field in RAM only, persisted by the next app_config_commit(). */
+esp_err_t app_config_set_str(app_config_field_t field, const char *value);
+/**
+ * Write all changed fields to NVS with a single commit. If that fails, the
+ * changes are reverted.
+ */
+esp_err_t app_config_commit(void);
+/** Drop all changes made since the last commit. */
+void app_config_revert(void);
+
+#ifdef __cplusplus
+}
+#endif
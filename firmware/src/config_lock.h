@@ -15,7 +15,6 @@ extern "C" {
 bool is_config_locked();
 esp_err_t config_lock(const char *key);
 esp_err_t config_unlock(const char *key);
-void config_lock_start(void);
 
 #ifdef __cplusplus
 }
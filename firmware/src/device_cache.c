@@ -0,0 +1,150 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "device_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <nvs_flash.h>
+
+static const char *TAG = "device_cache";
+
+/*
+ * Cradles that re-enumerate after every wake would otherwise fetch the report
+ * descriptor and set protocol and idle before each first scan. A device model
+ * that was brought up once is started right away on the next connect, and
+ * the usual bring-up runs afterwards to validate the cached entry.
+ *
+ * Each model, keyed by VID, PID and bcdDevice, has its profile ("p" + key) in
+ * the "hid_cache" namespace. The report descriptor is not kept, the CRC in
+ * the profile is enough to tell whether it changed, and bring-up requests it
+ * anyway as some scanners only report keys after that request.
+ *
+ * Entries are only written when bring-up finds them missing or different, so
+ * a known device costs no flash writes. The "lru" index lists the models by
+ * the time their entry was written, newest first. Beyond
+ * DEVICE_CACHE_MAX_ENTRIES the oldest entry is evicted. Lookups leave the
+ * order alone, as that would cost a write per connect.
+ */
+#define DEVICE_CACHE_VERSION 2
+#define DEVICE_CACHE_KEY_SIZE 16
+#define DEVICE_CACHE_MAX_ENTRIES 16
+
+typedef struct {
+    uint8_t version;
+    device_profile_t profile;
+} device_cache_entry_t;
+
+static nvs_handle_t nvs;
+static bool nvs_open_ok;
+static device_cache_key_t lru[DEVICE_CACHE_MAX_ENTRIES];
+static size_t lru_count;
+
+static void device_cache_key(char *buffer, char prefix,
+                             const device_cache_key_t *key) {
+    snprintf(buffer, DEVICE_CACHE_KEY_SIZE, "%c%04x%04x%04x", prefix, key->vid,
+             key->pid, key->bcd_device);
+}
+
+void device_cache_start(void) {
+    const esp_err_t ret = nvs_open("hid_cache", NVS_READWRITE, &nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to open cache: %s", esp_err_to_name(ret));
+        return;
+    }
+    nvs_open_ok = true;
+
+    uint8_t version = 0;
+    nvs_get_u8(nvs, "version", &version);
+    if (version != DEVICE_CACHE_VERSION) {
+        // Version 1 kept the report descriptors as well, and had no index
+        if (version)
+            ESP_LOGI(TAG, "Clearing cache of version %d", version);
+        nvs_erase_all(nvs);
+        nvs_set_u8(nvs, "version", DEVICE_CACHE_VERSION);
+        nvs_commit(nvs);
+        return;
+    }
+    size_t size = sizeof(lru);
+    if (nvs_get_blob(nvs, "lru", lru, &size) == ESP_OK)
+        lru_count = size / sizeof(lru[0]);
+}
+
+static bool device_cache_key_equal(const device_cache_key_t *a,
+                                   const device_cache_key_t *b) {
+    return a->vid == b->vid && a->pid == b->pid &&
+           a->bcd_device == b->bcd_device;
+}
+
+/* Move a model to the front of the index, evicting the oldest if full */
+static esp_err_t device_cache_touch(const device_cache_key_t *key) {
+    size_t i = 0;
+    while (i < lru_count && !device_cache_key_equal(&lru[i], key))
+        ++i;
+    if (i == DEVICE_CACHE_MAX_ENTRIES) {
+        char name[DEVICE_CACHE_KEY_SIZE];
+        device_cache_key(name, 'p', &lru[--i]);
+        ESP_LOGI(TAG, "Evicting %04x:%04x", lru[i].vid, lru[i].pid);
+        nvs_erase_key(nvs, name);
+    } else if (i == lru_count) {
+        ++lru_count;
+    }
+    memmove(&lru[1], &lru[0], i * sizeof(lru[0]));
+    lru[0] = *key;
+    return nvs_set_blob(nvs, "lru", lru, lru_count * sizeof(lru[0]));
+}
+
+esp_err_t device_cache_lookup(const device_cache_key_t *key,
+                              device_profile_t *profile) {
+    if (!nvs_open_ok)
+        return ESP_ERR_NOT_FOUND;
+
+    char name[DEVICE_CACHE_KEY_SIZE];
+    device_cache_entry_t entry;
+    size_t size = sizeof(entry);
+    device_cache_key(name, 'p', key);
+    if (nvs_get_blob(nvs, name, &entry, &size) != ESP_OK ||
+        size != sizeof(entry) || entry.version != DEVICE_CACHE_VERSION)
+        return ESP_ERR_NOT_FOUND;
+
+    *profile = entry.profile;
+    return ESP_OK;
+}
+
+bool device_cache_update(const device_cache_key_t *key,
+                         const uint8_t *report_desc, size_t length,
+                         uint8_t flags) {
+    const device_cache_entry_t entry = {
+        .version = DEVICE_CACHE_VERSION,
+        .profile = {.report_desc_crc = esp_rom_crc32_le(0, report_desc, length),
+                    .report_desc_length = length,
+                    .flags = flags}};
+
+    device_profile_t cached;
+    if (device_cache_lookup(key, &cached) == ESP_OK &&
+        cached.report_desc_crc == entry.profile.report_desc_crc &&
+        cached.report_desc_length == entry.profile.report_desc_length &&
+        cached.flags == entry.profile.flags)
+        return false;
+    if (!nvs_open_ok)
+        return true;
+
+    char name[DEVICE_CACHE_KEY_SIZE];
+    device_cache_key(name, 'p', key);
+    esp_err_t ret = nvs_set_blob(nvs, name, &entry, sizeof(entry));
+    if (ret == ESP_OK)
+        ret = device_cache_touch(key);
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "Failed to save %04x:%04x: %s", key->vid, key->pid,
+                 esp_err_to_name(ret));
+    else
+        ESP_LOGI(TAG, "Saved %04x:%04x, report descriptor %zu bytes",
+                 key->vid, key->pid, length);
+    return true;
+}
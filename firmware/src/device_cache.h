@@ -0,0 +1,49 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t bcd_device;
+} device_cache_key_t;
+
+/** The device accepted SET_IDLE */
+#define DEVICE_PROFILE_IDLE (1u << 0)
+
+/** What bring-up learned about a device model */
+typedef struct {
+    uint32_t report_desc_crc;
+    uint16_t report_desc_length;
+    uint8_t flags;
+} device_profile_t;
+
+/** Open the cache in NVS. */
+void device_cache_start(void);
+/** ESP_ERR_NOT_FOUND if the device model was never brought up. */
+esp_err_t device_cache_lookup(const device_cache_key_t *key,
+                              device_profile_t *profile);
+/**
+ * Store the profile of a device model that was brought up, derived from its
+ * report descriptor. Returns true if the cache did not hold it yet, i.e. for
+ * a new model or one whose cached entry no longer matches.
+ */
+bool device_cache_update(const device_cache_key_t *key,
+                         const uint8_t *report_desc, size_t length,
+                         uint8_t flags);
+
+#ifdef __cplusplus
+}
+#endif
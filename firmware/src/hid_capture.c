@@ -0,0 +1,105 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "hid_capture.h"
+#include "hid_capture_format.h"
+#include "mqtt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG = "hid_capture";
+
+/*
+ * The most recent input reports are kept in a RAM ring, encoded as described
+ * in hid_capture_format.h. A message on <topic>/capture/get publishes the
+ * ring as a capture to <topic>/capture and empties it; see
+ * host_test/replay_capture.c for the replay tool.
+ */
+#define HID_CAPTURE_RING_SIZE (16 * 1024)
+
+static uint8_t ring[HID_CAPTURE_RING_SIZE];
+static size_t ring_head; // next byte to write
+static size_t ring_used;
+static int64_t last_record_us;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Copy len bytes starting at ring offset pos, which may wrap around */
+static void ring_read(size_t pos, uint8_t *out, size_t len) {
+    pos %= sizeof(ring);
+    const size_t first = len < sizeof(ring) - pos ? len : sizeof(ring) - pos;
+    memcpy(out, ring + pos, first);
+    memcpy(out + first, ring, len - first);
+}
+
+static void ring_drop_oldest(void) {
+    uint8_t prefix[6];
+    const size_t tail = ring_head + sizeof(ring) - ring_used;
+    const size_t n = ring_used < sizeof(prefix) ? ring_used : sizeof(prefix);
+    ring_read(tail, prefix, n);
+    size_t varint = 0;
+    while (varint < n - 1 && prefix[varint] & 0x80)
+        ++varint;
+    ring_used -= varint + 2 + prefix[varint + 1];
+}
+
+void hid_capture_record(const uint8_t *report, size_t length) {
+    uint8_t record[HID_CAPTURE_MAX_RECORD];
+    const int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&ring_lock);
+    const int64_t delta = last_record_us ? now - last_record_us : 0;
+    last_record_us = now;
+    const size_t size = hid_capture_encode(
+        record, delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta, report,
+        length);
+    while (ring_used + size > sizeof(ring))
+        ring_drop_oldest();
+    const size_t first =
+        size < sizeof(ring) - ring_head ? size : sizeof(ring) - ring_head;
+    memcpy(ring + ring_head, record, first);
+    memcpy(ring, record + first, size - first);
+    ring_head = (ring_head + size) % sizeof(ring);
+    ring_used += size;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+static void hid_capture_upload(const char *topic, const char *data, int len,
+                               int offset, int total_len) {
+    (void)topic;
+    (void)data;
+    (void)len;
+    (void)total_len;
+    if (offset)
+        return;
+
+    uint8_t *capture = malloc(HID_CAPTURE_HEADER_SIZE + sizeof(ring));
+    if (!capture) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the upload");
+        return;
+    }
+    hid_capture_write_header(capture);
+
+    portENTER_CRITICAL(&ring_lock);
+    const size_t used = ring_used;
+    ring_read(ring_head + sizeof(ring) - used,
+              capture + HID_CAPTURE_HEADER_SIZE, used);
+    ring_used = 0;
+    portEXIT_CRITICAL(&ring_lock);
+
+    ESP_LOGI(TAG, "Uploading %zu bytes of captured reports", used);
+    if (mqtt_publish_subtopic("capture", (const char *)capture,
+                              HID_CAPTURE_HEADER_SIZE + used) != ESP_OK)
+        ESP_LOGE(TAG, "Failed to publish the capture");
+    free(capture);
+}
+
+void hid_capture_start(void) {
+    mqtt_subscribe_subtopic("capture/get", hid_capture_upload);
+}
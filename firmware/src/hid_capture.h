@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void hid_capture_start(void);
+/** Append an input report to the capture ring, dropping the oldest ones */
+void hid_capture_record(const uint8_t *report, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,75 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "hid_capture_format.h"
+
+#include <string.h>
+
+void hid_capture_write_header(uint8_t header[HID_CAPTURE_HEADER_SIZE]) {
+    memset(header, 0, HID_CAPTURE_HEADER_SIZE);
+    memcpy(header, HID_CAPTURE_MAGIC, 4);
+    header[4] = HID_CAPTURE_VERSION;
+}
+
+size_t hid_capture_encode(uint8_t *out, uint32_t delta_us,
+                          const uint8_t *report, size_t length) {
+    if (length > HID_CAPTURE_MAX_REPORT)
+        length = HID_CAPTURE_MAX_REPORT;
+    size_t n = 0;
+    do {
+        out[n] = delta_us & 0x7f;
+        delta_us >>= 7;
+        if (delta_us)
+            out[n] |= 0x80;
+        ++n;
+    } while (delta_us);
+    out[n++] = length;
+    memcpy(out + n, report, length);
+    return n + length;
+}
+
+/* Decode the varint at data, returns its size or 0 if invalid */
+static size_t hid_capture_varint(const uint8_t *data, size_t available,
+                                 uint32_t *value) {
+    uint32_t v = 0;
+    for (size_t i = 0; i < available && i < 5; ++i) {
+        v |= (uint32_t)(data[i] & 0x7f) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t hid_capture_record_size(const uint8_t *data, size_t available) {
+    uint32_t delta;
+    const size_t n = hid_capture_varint(data, available, &delta);
+    if (!n || n >= available || n + 1 + data[n] > available)
+        return 0;
+    return n + 1 + data[n];
+}
+
+bool hid_capture_reader_init(hid_capture_reader_t *reader, const uint8_t *data,
+                             size_t size) {
+    if (size < HID_CAPTURE_HEADER_SIZE || memcmp(data, HID_CAPTURE_MAGIC, 4) ||
+        data[4] != HID_CAPTURE_VERSION)
+        return false;
+    reader->pos = data + HID_CAPTURE_HEADER_SIZE;
+    reader->end = data + size;
+    return true;
+}
+
+bool hid_capture_next(hid_capture_reader_t *reader, uint32_t *delta_us,
+                      const uint8_t **report, size_t *length) {
+    const size_t available = reader->end - reader->pos;
+    const size_t size = hid_capture_record_size(reader->pos, available);
+    if (!size)
+        return false;
+    const size_t n = hid_capture_varint(reader->pos, available, delta_us);
+    *length = reader->pos[n];
+    *report = reader->pos + n + 1;
+    reader->pos += size;
+    return true;
+}
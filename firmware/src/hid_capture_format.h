@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary format for captured HID input reports, shared by the firmware and
+ * the host tools. A capture is a header followed by records:
+ *
+ *   header  "H2MC" <version:u8> <reserved:3 bytes>
+ *   record  <delta:varint> <length:u8> <report:length bytes>
+ *
+ * delta is the time in microseconds since the previous record, encoded as
+ * unsigned LEB128. The first record of an upload may follow records that were
+ * dropped from the ring, so replay treats its delta as 0.
+ */
+#define HID_CAPTURE_MAGIC "H2MC"
+#define HID_CAPTURE_VERSION 1
+#define HID_CAPTURE_HEADER_SIZE 8
+#define HID_CAPTURE_MAX_REPORT 64
+#define HID_CAPTURE_MAX_RECORD (5 + 1 + HID_CAPTURE_MAX_REPORT)
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+} hid_capture_reader_t;
+
+void hid_capture_write_header(uint8_t header[HID_CAPTURE_HEADER_SIZE]);
+/** Encode a record into out, which holds HID_CAPTURE_MAX_RECORD bytes */
+size_t hid_capture_encode(uint8_t *out, uint32_t delta_us,
+                          const uint8_t *report, size_t length);
+/** Size of the record starting at data, 0 if it is incomplete */
+size_t hid_capture_record_size(const uint8_t *data, size_t available);
+
+/** Check the header, false if data is not a supported capture */
+bool hid_capture_reader_init(hid_capture_reader_t *reader, const uint8_t *data,
+                             size_t size);
+/** Read the next record, false at the end or on a truncated record */
+bool hid_capture_next(hid_capture_reader_t *reader, uint32_t *delta_us,
+                      const uint8_t **report, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,213 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "hid_event_bridge.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The batch is formatted in place as events come in. A batch without room
+ * for one more event and the closing brackets is published early, which
+ * takes a lot of button presses within one interval.
+ */
+#define HID_EVENT_MAX_LENGTH 32 // ",[65535,65535,-2147483648]"
+#define HID_EVENT_BATCH_END "]}"
+#define HID_EVENT_ARRAY_UNUSED UINT8_MAX
+
+bool hid_event_bridge_parse_config(const char *spec,
+                                   hid_event_bridge_config_t *config) {
+    if (!spec || !isdigit((unsigned char)*spec))
+        return false;
+    char *end;
+    const unsigned long interval_ms = strtoul(spec, &end, 10);
+    if (*end != ',' || !isdigit((unsigned char)end[1]))
+        return false;
+    const unsigned long deadband = strtoul(end + 1, &end, 10);
+    if (*end || interval_ms > UINT32_MAX || deadband > UINT32_MAX)
+        return false;
+    config->interval_ms = interval_ms;
+    config->deadband = deadband;
+    return true;
+}
+
+bool hid_event_bridge_init(hid_event_bridge_t *bridge,
+                           const hid_event_bridge_config_t *config,
+                           const uint8_t *report_desc, size_t length,
+                           const char *device, hid_event_publish_cb_t publish,
+                           void *arg) {
+    memset(bridge, 0, sizeof(*bridge));
+    if (!hid_report_parse(report_desc, length, &bridge->layout))
+        return false;
+    const hid_report_layout_t *layout = &bridge->layout;
+    bridge->config = *config;
+    bridge->publish = publish;
+    bridge->arg = arg;
+    snprintf(bridge->device, sizeof(bridge->device), "%s", device);
+    // Publish the first change without waiting for an interval
+    bridge->published_us = INT64_MIN / 2;
+
+    // Array fields that do not fit into the slots are ignored
+    uint32_t slot = 0;
+    for (uint8_t i = 0; i < layout->field_count; ++i) {
+        const hid_report_field_t *field = &layout->fields[i];
+        bridge->array_slot[i] = HID_EVENT_ARRAY_UNUSED;
+        if ((field->flags & HID_REPORT_FIELD_ARRAY) &&
+            slot + field->count <= HID_EVENT_ARRAY_SLOTS) {
+            bridge->array_slot[i] = slot;
+            slot += field->count;
+        }
+    }
+    return true;
+}
+
+static void batch_send(hid_event_bridge_t *bridge, int64_t now_us) {
+    if (!bridge->batch_length)
+        return;
+    memcpy(bridge->batch + bridge->batch_length, HID_EVENT_BATCH_END,
+           sizeof(HID_EVENT_BATCH_END));
+    bridge->batch_length += sizeof(HID_EVENT_BATCH_END) - 1;
+    bridge->publish(bridge->batch, bridge->batch_length, bridge->arg);
+    bridge->batch_length = 0;
+    bridge->published_us = now_us;
+}
+
+static void batch_add(hid_event_bridge_t *bridge,
+                      const hid_report_field_t *field, uint16_t usage,
+                      int32_t value, int64_t now_us) {
+    if (bridge->batch_length + HID_EVENT_MAX_LENGTH +
+            sizeof(HID_EVENT_BATCH_END) >
+        sizeof(bridge->batch))
+        batch_send(bridge, now_us);
+    char *end = bridge->batch + bridge->batch_length;
+    const size_t size = sizeof(bridge->batch) - bridge->batch_length;
+    if (bridge->batch_length)
+        bridge->batch_length += snprintf(end, size, ",");
+    else
+        bridge->batch_length +=
+            snprintf(end, size, "{\"dev\":\"%s\",\"ev\":[", bridge->device);
+    bridge->batch_length +=
+        snprintf(bridge->batch + bridge->batch_length,
+                 sizeof(bridge->batch) - bridge->batch_length,
+                 "[%u,%u,%" PRId32 "]", field->usage_page, usage, value);
+}
+
+/* Usage selected by an array element, false for none */
+static bool array_usage(const hid_report_field_t *field, int32_t value,
+                        uint16_t *usage) {
+    if (value < field->logical_min || value > field->logical_max)
+        return false;
+    const uint32_t selected =
+        field->usage + (uint32_t)(value - field->logical_min);
+    if (!selected || selected > field->usage_max)
+        return false;
+    *usage = selected;
+    return true;
+}
+
+static bool array_contains(const int32_t *elements, uint8_t count,
+                           int32_t value) {
+    for (uint8_t i = 0; i < count; ++i) {
+        if (elements[i] == value)
+            return true;
+    }
+    return false;
+}
+
+static void feed_array(hid_event_bridge_t *bridge, uint8_t index,
+                       const uint8_t *data, size_t length, int64_t now_us) {
+    const hid_report_field_t *field = &bridge->layout.fields[index];
+    if (bridge->array_slot[index] == HID_EVENT_ARRAY_UNUSED)
+        return;
+    int32_t *previous = &bridge->arrays[bridge->array_slot[index]];
+    int32_t current[HID_EVENT_ARRAY_SLOTS];
+    for (uint8_t i = 0; i < field->count; ++i) {
+        if (!hid_report_field_get(field, data, length, i, &current[i]))
+            return;
+    }
+
+    uint16_t usage;
+    for (uint8_t i = 0; i < field->count; ++i) {
+        if (array_usage(field, previous[i], &usage) &&
+            !array_contains(current, field->count, previous[i]))
+            batch_add(bridge, field, usage, 0, now_us);
+    }
+    for (uint8_t i = 0; i < field->count; ++i) {
+        if (array_usage(field, current[i], &usage) &&
+            !array_contains(previous, field->count, current[i]))
+            batch_add(bridge, field, usage, 1, now_us);
+    }
+    memcpy(previous, current, field->count * sizeof(current[0]));
+}
+
+void hid_event_bridge_feed(hid_event_bridge_t *bridge, const uint8_t *report,
+                           size_t length, int64_t now_us) {
+    uint8_t report_id = 0;
+    if (bridge->layout.report_ids) {
+        if (!length)
+            return;
+        report_id = report[0];
+        ++report;
+        --length;
+    }
+
+    for (uint8_t i = 0; i < bridge->layout.field_count; ++i) {
+        const hid_report_field_t *field = &bridge->layout.fields[i];
+        if (field->report_id != report_id)
+            continue;
+        if (field->flags & HID_REPORT_FIELD_ARRAY) {
+            feed_array(bridge, i, report, length, now_us);
+            continue;
+        }
+        int32_t value;
+        if (!hid_report_field_get(field, report, length, 0, &value))
+            continue;
+        const uint64_t bit = 1ull << i;
+        if (field->flags & HID_REPORT_FIELD_RELATIVE) {
+            if (value) {
+                bridge->values[i] += value;
+                bridge->pending |= bit;
+            }
+        } else if (field->bit_size == 1) {
+            if (value != bridge->values[i]) {
+                bridge->values[i] = value;
+                batch_add(bridge, field, field->usage, value, now_us);
+            }
+        } else {
+            bridge->latest[i] = value;
+            const int64_t delta = (int64_t)value - bridge->values[i];
+            const uint64_t distance = delta < 0 ? -delta : delta;
+            if (distance && distance >= bridge->config.deadband)
+                bridge->pending |= bit;
+            else
+                bridge->pending &= ~bit;
+        }
+    }
+}
+
+void hid_event_bridge_poll(hid_event_bridge_t *bridge, int64_t now_us) {
+    if ((!bridge->batch_length && !bridge->pending) ||
+        now_us - bridge->published_us <
+            (int64_t)bridge->config.interval_ms * 1000)
+        return;
+
+    for (uint8_t i = 0; bridge->pending; ++i) {
+        const uint64_t bit = 1ull << i;
+        if (!(bridge->pending & bit))
+            continue;
+        bridge->pending &= ~bit;
+        const hid_report_field_t *field = &bridge->layout.fields[i];
+        if (field->flags & HID_REPORT_FIELD_RELATIVE) {
+            batch_add(bridge, field, field->usage, bridge->values[i], now_us);
+            bridge->values[i] = 0;
+        } else {
+            bridge->values[i] = bridge->latest[i];
+            batch_add(bridge, field, field->usage, bridge->latest[i], now_us);
+        }
+    }
+    batch_send(bridge, now_us);
+}
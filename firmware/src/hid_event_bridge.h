@@ -0,0 +1,81 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include "hid_report_parser.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Turns the input reports of any HID device into batches of usage value
+ * changes, published as compact JSON:
+ *
+ *   {"dev":"046d:c077","ev":[[9,1,1],[1,48,-12],[1,49,3]]}
+ *
+ * Each event is [usage page, usage, value]. Buttons and array usages
+ * (pressed 1, released 0) are queued as they change, so a short press is
+ * never lost. Relative values are summed and absolute ones only keep their
+ * latest value, which must differ from the last published one by at least
+ * the deadband. Both are added when the batch is published, at most once
+ * per interval. An idle device publishes its first change right away.
+ */
+#define HID_EVENT_BATCH_SIZE 512
+#define HID_EVENT_ARRAY_SLOTS 32
+#define HID_EVENT_DEVICE_SIZE 16
+
+typedef struct {
+    uint32_t interval_ms;
+    uint32_t deadband;
+} hid_event_bridge_config_t;
+
+typedef void (*hid_event_publish_cb_t)(const char *batch, size_t length,
+                                       void *arg);
+
+typedef struct {
+    hid_report_layout_t layout;
+    hid_event_bridge_config_t config;
+    hid_event_publish_cb_t publish;
+    void *arg;
+    char device[HID_EVENT_DEVICE_SIZE];
+    // Absolute: last published value, relative: sum since then
+    int32_t values[HID_REPORT_MAX_FIELDS];
+    int32_t latest[HID_REPORT_MAX_FIELDS];
+    uint64_t pending; // fields with a change not yet in the batch
+    // Elements of array fields, from their first slot on
+    uint8_t array_slot[HID_REPORT_MAX_FIELDS];
+    int32_t arrays[HID_EVENT_ARRAY_SLOTS];
+    int64_t published_us;
+    size_t batch_length;
+    char batch[HID_EVENT_BATCH_SIZE];
+} hid_event_bridge_t;
+
+_Static_assert(HID_REPORT_MAX_FIELDS <= 64, "pending is a 64 bit mask");
+
+/**
+ * Parse "<interval ms>,<deadband>" as stored in the configuration, false if
+ * it is empty or malformed.
+ */
+bool hid_event_bridge_parse_config(const char *spec,
+                                   hid_event_bridge_config_t *config);
+/** Set up a bridge for a report descriptor, false if it is malformed */
+bool hid_event_bridge_init(hid_event_bridge_t *bridge,
+                           const hid_event_bridge_config_t *config,
+                           const uint8_t *report_desc, size_t length,
+                           const char *device, hid_event_publish_cb_t publish,
+                           void *arg);
+void hid_event_bridge_feed(hid_event_bridge_t *bridge, const uint8_t *report,
+                           size_t length, int64_t now_us);
+/** Publish the batch once the interval has passed */
+void hid_event_bridge_poll(hid_event_bridge_t *bridge, int64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,284 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "hid_report_parser.h"
+
+#include <string.h>
+
+/*
+ * Items are parsed in a single pass. Global items live in a state that Push
+ * and Pop save on a small stack, local items are collected until the next
+ * main item. Input bit offsets are counted separately for each report ID.
+ */
+#define HID_REPORT_MAX_USAGES 16
+#define HID_REPORT_STACK_DEPTH 4
+#define HID_REPORT_MAX_IDS 16
+
+// Item prefixes without the size bits
+#define ITEM_INPUT 0x80
+#define ITEM_OUTPUT 0x90
+#define ITEM_FEATURE 0xb0
+#define ITEM_COLLECTION 0xa0
+#define ITEM_END_COLLECTION 0xc0
+#define ITEM_USAGE_PAGE 0x04
+#define ITEM_LOGICAL_MIN 0x14
+#define ITEM_LOGICAL_MAX 0x24
+#define ITEM_REPORT_SIZE 0x74
+#define ITEM_REPORT_ID 0x84
+#define ITEM_REPORT_COUNT 0x94
+#define ITEM_PUSH 0xa4
+#define ITEM_POP 0xb4
+#define ITEM_USAGE 0x08
+#define ITEM_USAGE_MIN 0x18
+#define ITEM_USAGE_MAX 0x28
+#define ITEM_LONG 0xfe
+
+// Data bits of main items
+#define MAIN_CONSTANT 0x01
+#define MAIN_VARIABLE 0x02
+#define MAIN_RELATIVE 0x04
+
+typedef struct {
+    uint16_t usage_page;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint32_t logical_max_unsigned;
+    uint32_t report_size;
+    uint32_t report_count;
+    uint8_t report_id;
+} global_state_t;
+
+typedef struct {
+    // A usage with a page in the upper half overrides the usage page
+    uint32_t usages[HID_REPORT_MAX_USAGES];
+    uint8_t usage_count;
+    bool has_range;
+    uint32_t usage_min;
+    uint32_t usage_max;
+} local_state_t;
+
+typedef struct {
+    uint8_t id;
+    uint32_t bits;
+} report_offset_t;
+
+typedef struct {
+    hid_report_layout_t *layout;
+    global_state_t global;
+    global_state_t stack[HID_REPORT_STACK_DEPTH];
+    uint8_t stack_depth;
+    local_state_t local;
+    report_offset_t offsets[HID_REPORT_MAX_IDS];
+    uint8_t offset_count;
+} parser_t;
+
+static report_offset_t *report_offset(parser_t *parser, uint8_t id) {
+    for (uint8_t i = 0; i < parser->offset_count; ++i) {
+        if (parser->offsets[i].id == id)
+            return &parser->offsets[i];
+    }
+    if (parser->offset_count == HID_REPORT_MAX_IDS)
+        return NULL;
+    report_offset_t *offset = &parser->offsets[parser->offset_count++];
+    offset->id = id;
+    offset->bits = 0;
+    return offset;
+}
+
+/* Usage of element i of a variable item */
+static uint32_t local_usage(const local_state_t *local, uint32_t i) {
+    if (i < local->usage_count)
+        return local->usages[i];
+    if (local->has_range) {
+        const uint32_t usage = local->usage_min + (i - local->usage_count);
+        return usage < local->usage_max ? usage : local->usage_max;
+    }
+    return local->usage_count ? local->usages[local->usage_count - 1] : 0;
+}
+
+static void field_set_usage(hid_report_field_t *field, uint16_t usage_page,
+                            uint32_t usage) {
+    field->usage_page = usage >> 16 ? usage >> 16 : usage_page;
+    field->usage = usage & 0xffff;
+}
+
+static hid_report_field_t *field_add(parser_t *parser, uint32_t bit_offset) {
+    hid_report_layout_t *layout = parser->layout;
+    if (layout->field_count == HID_REPORT_MAX_FIELDS)
+        return NULL;
+    const global_state_t *global = &parser->global;
+    hid_report_field_t *field = &layout->fields[layout->field_count++];
+    *field = (hid_report_field_t){
+        .bit_offset = bit_offset,
+        .bit_size = global->report_size,
+        .count = 1,
+        .report_id = global->report_id,
+        .logical_min = global->logical_min,
+        .logical_max = global->logical_max,
+    };
+    // Logical Maximum 0xff with a positive minimum is meant as 255
+    if (global->logical_min >= 0 && global->logical_max < 0)
+        field->logical_max = global->logical_max_unsigned;
+    if (global->logical_min < 0)
+        field->flags |= HID_REPORT_FIELD_SIGNED;
+    return field;
+}
+
+static bool parse_input(parser_t *parser, uint32_t data) {
+    const global_state_t *global = &parser->global;
+    report_offset_t *offset = report_offset(parser, global->report_id);
+    if (!offset || global->report_size > UINT16_MAX ||
+        global->report_count > UINT16_MAX)
+        return false;
+
+    if (!(data & MAIN_CONSTANT) && global->report_count &&
+        global->report_size >= 1 && global->report_size <= 32) {
+        const local_state_t *local = &parser->local;
+        if (data & MAIN_VARIABLE) {
+            for (uint32_t i = 0; i < global->report_count; ++i) {
+                hid_report_field_t *field = field_add(
+                    parser, offset->bits + i * global->report_size);
+                if (!field)
+                    break;
+                field_set_usage(field, global->usage_page,
+                                local_usage(local, i));
+                if (data & MAIN_RELATIVE)
+                    field->flags |= HID_REPORT_FIELD_RELATIVE;
+            }
+        } else {
+            hid_report_field_t *field = field_add(parser, offset->bits);
+            if (field) {
+                const uint32_t first =
+                    local->has_range ? local->usage_min : local_usage(local, 0);
+                const uint32_t last =
+                    local->has_range ? local->usage_max
+                                     : local_usage(local, UINT8_MAX);
+                field_set_usage(field, global->usage_page, first);
+                field->usage_max = last & 0xffff;
+                field->count = global->report_count < UINT8_MAX
+                                   ? global->report_count
+                                   : UINT8_MAX;
+                field->flags |= HID_REPORT_FIELD_ARRAY;
+            }
+        }
+    }
+
+    offset->bits += global->report_size * global->report_count;
+    return offset->bits <= UINT16_MAX;
+}
+
+bool hid_report_parse(const uint8_t *desc, size_t length,
+                      hid_report_layout_t *layout) {
+    static const uint8_t data_sizes[] = {0, 1, 2, 4};
+    parser_t parser = {.layout = layout};
+    memset(layout, 0, sizeof(*layout));
+
+    size_t pos = 0;
+    while (pos < length) {
+        const uint8_t prefix = desc[pos];
+        if (prefix == ITEM_LONG) {
+            if (pos + 1 >= length)
+                return false;
+            pos += 3 + desc[pos + 1];
+            continue;
+        }
+        const uint8_t size = data_sizes[prefix & 0x03];
+        if (pos + 1 + size > length)
+            return false;
+        uint32_t data = 0;
+        for (uint8_t i = 0; i < size; ++i)
+            data |= (uint32_t)desc[pos + 1 + i] << (8 * i);
+        const int32_t signed_data = size == 1   ? (int8_t)data
+                                    : size == 2 ? (int16_t)data
+                                                : (int32_t)data;
+        pos += 1 + size;
+
+        global_state_t *global = &parser.global;
+        local_state_t *local = &parser.local;
+        switch (prefix & 0xfc) {
+        case ITEM_INPUT:
+            if (!parse_input(&parser, data))
+                return false;
+            memset(local, 0, sizeof(*local));
+            break;
+        case ITEM_OUTPUT:
+        case ITEM_FEATURE:
+        case ITEM_COLLECTION:
+        case ITEM_END_COLLECTION:
+            memset(local, 0, sizeof(*local));
+            break;
+        case ITEM_USAGE_PAGE:
+            global->usage_page = data;
+            break;
+        case ITEM_LOGICAL_MIN:
+            global->logical_min = signed_data;
+            break;
+        case ITEM_LOGICAL_MAX:
+            global->logical_max = signed_data;
+            global->logical_max_unsigned = data;
+            break;
+        case ITEM_REPORT_SIZE:
+            global->report_size = data;
+            break;
+        case ITEM_REPORT_ID:
+            if (!data || data > UINT8_MAX)
+                return false;
+            global->report_id = data;
+            layout->report_ids = true;
+            break;
+        case ITEM_REPORT_COUNT:
+            global->report_count = data;
+            break;
+        case ITEM_PUSH:
+            if (parser.stack_depth == HID_REPORT_STACK_DEPTH)
+                return false;
+            parser.stack[parser.stack_depth++] = *global;
+            break;
+        case ITEM_POP:
+            if (!parser.stack_depth)
+                return false;
+            *global = parser.stack[--parser.stack_depth];
+            break;
+        case ITEM_USAGE:
+            if (local->usage_count < HID_REPORT_MAX_USAGES)
+                local->usages[local->usage_count++] = data;
+            break;
+        case ITEM_USAGE_MIN:
+            local->usage_min = data;
+            local->has_range = true;
+            break;
+        case ITEM_USAGE_MAX:
+            local->usage_max = data;
+            local->has_range = true;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool hid_report_field_get(const hid_report_field_t *field,
+                          const uint8_t *data, size_t length, uint8_t index,
+                          int32_t *value) {
+    const uint32_t size = field->bit_size;
+    const uint32_t start = field->bit_offset + (uint32_t)index * size;
+    if (index >= field->count || start + size > length * 8)
+        return false;
+
+    // At most 32 bits starting anywhere within a byte span 5 bytes
+    uint64_t bits = 0;
+    for (uint32_t byte = (start + size - 1) / 8 + 1; byte-- > start / 8;)
+        bits = bits << 8 | data[byte];
+    uint32_t raw = bits >> (start % 8);
+    if (size < 32) {
+        const uint32_t mask = (1u << size) - 1;
+        raw &= mask;
+        if ((field->flags & HID_REPORT_FIELD_SIGNED) &&
+            (raw & (1u << (size - 1))))
+            raw |= ~mask;
+    }
+    *value = (int32_t)raw;
+    return true;
+}
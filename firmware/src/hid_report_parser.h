@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Parser for HID report descriptors (HID 1.11 section 6.2.2), reduced to
+ * what is needed to pick values out of input reports. Each variable input
+ * item becomes one field per report count, with its own usage. An array
+ * input item becomes a single field whose elements hold indices into a
+ * usage range. Constant items only advance the bit offset, output and
+ * feature items are skipped, and so are fields beyond HID_REPORT_MAX_FIELDS.
+ */
+#define HID_REPORT_MAX_FIELDS 48
+
+#define HID_REPORT_FIELD_ARRAY 0x01
+#define HID_REPORT_FIELD_RELATIVE 0x02
+#define HID_REPORT_FIELD_SIGNED 0x04
+
+typedef struct {
+    uint16_t usage_page;
+    uint16_t usage;      // of a variable, the first usage of an array
+    uint16_t usage_max;  // last usage of an array
+    uint16_t bit_offset; // following the report ID, if any
+    uint8_t bit_size;
+    uint8_t count; // array elements, 1 for a variable
+    uint8_t report_id;
+    uint8_t flags;
+    int32_t logical_min;
+    int32_t logical_max;
+} hid_report_field_t;
+
+typedef struct {
+    hid_report_field_t fields[HID_REPORT_MAX_FIELDS];
+    uint8_t field_count;
+    bool report_ids; // input reports start with a report ID
+} hid_report_layout_t;
+
+/** Parse a report descriptor, false if it is malformed */
+bool hid_report_parse(const uint8_t *desc, size_t length,
+                      hid_report_layout_t *layout);
+/**
+ * Value of element index of a field in report data, following the report
+ * ID. False if the report is too short.
+ */
+bool hid_report_field_get(const hid_report_field_t *field,
+                          const uint8_t *data, size_t length, uint8_t index,
+                          int32_t *value);
+
+#ifdef __cplusplus
+}
+#endif
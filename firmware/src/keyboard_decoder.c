@@ -0,0 +1,231 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "keyboard_decoder.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+static const char *TAG = "keyboard_decoder";
+
+/*
+ * Assume US English keyboard layout, configure the barcode scanner accordingly
+ */
+static const uint8_t keycode2ascii[100][4] = {
+    {0, 0, 0, 0},            // HID_KEY_NO_PRESS
+    {0, 0, 0, 0},            // HID_KEY_ROLLOVER
+    {0, 0, 0, 0},            // HID_KEY_POST_FAIL
+    {0, 0, 0, 0},            // HID_KEY_ERROR_UNDEFINED
+    {'a', 'A', 0x01, 0x01},  // HID_KEY_A
+    {'b', 'B', 0x02, 0x02},  // HID_KEY_B
+    {'c', 'C', 0x03, 0x03},  // HID_KEY_C
+    {'d', 'D', 0x04, 0x04},  // HID_KEY_D
+    {'e', 'E', 0x05, 0x05},  // HID_KEY_E
+    {'f', 'F', 0x06, 0x06},  // HID_KEY_F
+    {'g', 'G', 0x07, 0x07},  // HID_KEY_G
+    {'h', 'H', 0x08, 0x08},  // HID_KEY_H
+    {'i', 'I', 0x09, 0x09},  // HID_KEY_I
+    {'j', 'J', 0x0a, 0x0a},  // HID_KEY_J
+    {'k', 'K', 0x0b, 0x0b},  // HID_KEY_K
+    {'l', 'L', 0x0c, 0x0c},  // HID_KEY_L
+    {'m', 'M', 0x0d, 0x0d},  // HID_KEY_M
+    {'n', 'N', 0x0e, 0x0e},  // HID_KEY_N
+    {'o', 'O', 0x0f, 0x0f},  // HID_KEY_O
+    {'p', 'P', 0x10, 0x10},  // HID_KEY_P
+    {'q', 'Q', 0x11, 0x11},  // HID_KEY_Q
+    {'r', 'R', 0x12, 0x12},  // HID_KEY_R
+    {'s', 'S', 0x13, 0x13},  // HID_KEY_S
+    {'t', 'T', 0x14, 0x14},  // HID_KEY_T
+    {'u', 'U', 0x15, 0x15},  // HID_KEY_U
+    {'v', 'V', 0x16, 0x16},  // HID_KEY_V
+    {'w', 'W', 0x17, 0x17},  // HID_KEY_W
+    {'x', 'X', 0x18, 0x18},  // HID_KEY_X
+    {'y', 'Y', 0x19, 0x19},  // HID_KEY_Y
+    {'z', 'Z', 0x1a, 0x1a},  // HID_KEY_Z
+    {'1', '!', 0, 0},        // HID_KEY_1
+    {'2', '@', 0x00, 0x00},  // HID_KEY_2
+    {'3', '#', 0, 0},        // HID_KEY_3
+    {'4', '$', 0, 0},        // HID_KEY_4
+    {'5', '%', 0x1d, 0x1d},  // HID_KEY_5
+    {'6', '^', 0x1e, 0x1e},  // HID_KEY_6
+    {'7', '&', 0, 0},        // HID_KEY_7
+    {'8', '*', 0x7f, 0x7f},  // HID_KEY_8
+    {'9', '(', 0, 0},        // HID_KEY_9
+    {'0', ')', 0, 0},        // HID_KEY_0
+    {0x0d, 0x0d, 0, 0},      // HID_KEY_ENTER
+    {0x1b, 0x1b, 0, 0},      // HID_KEY_ESC
+    {0x08, 0x08, 0, 0},      // HID_KEY_DEL
+    {0x09, 0, 0, 0},         // HID_KEY_TAB
+    {' ', ' ', 0x00, 0x00},  // HID_KEY_SPACE
+    {'-', '_', 0x1f, 0x1f},  // HID_KEY_MINUS
+    {'=', '+', 0, 0},        // HID_KEY_EQUAL
+    {'[', '{', 0x1b, 0x1b},  // HID_KEY_OPEN_BRACKET
+    {']', '}', 0x1d, 0x1d},  // HID_KEY_CLOSE_BRACKET
+    {'\\', '|', 0x1c, 0x1c}, // HID_KEY_BACK_SLASH
+    {0, 0, 0, 0},            // HID_KEY_SHARP
+    {';', ':', 0, 0},        // HID_KEY_COLON
+    {'\'', '"', 0, 0},       // HID_KEY_QUOTE
+    {'`', '~', 0x00, 0x1e},  // HID_KEY_TILDE
+    {',', '<', 0, 0},        // HID_KEY_LESS
+    {'.', '>', 0, 0},        // HID_KEY_GREATER
+    {'/', '?', 0, 0},        // HID_KEY_SLASH
+    {0, 0, 0, 0},            // HID_KEY_CAPS_LOCK
+    {0, 0, 0, 0},            // HID_KEY_F1
+    {0, 0, 0, 0},            // HID_KEY_F2
+    {0, 0, 0, 0},            // HID_KEY_F3
+    {0, 0, 0, 0},            // HID_KEY_F4
+    {0, 0, 0, 0},            // HID_KEY_F5
+    {0, 0, 0, 0},            // HID_KEY_F6
+    {0, 0, 0, 0},            // HID_KEY_F7
+    {0, 0, 0, 0},            // HID_KEY_F8
+    {0, 0, 0, 0},            // HID_KEY_F9
+    {0, 0, 0, 0},            // HID_KEY_F10
+    {0, 0, 0, 0},            // HID_KEY_F11
+    {0, 0, 0, 0},            // HID_KEY_F12
+    {0, 0, 0, 0},            // HID_KEY_PRINT_SCREEN
+    {0, 0, 0, 0},            // HID_KEY_SCROLL_LOCK
+    {0, 0, 0, 0},            // HID_KEY_PAUSE
+    {0, 0, 0, 0},            // HID_KEY_INSERT
+    {0, 0, 0, 0},            // HID_KEY_HOME
+    {0, 0, 0, 0},            // HID_KEY_PAGEUP
+    {0x7f, 0x7f, 0, 0},      // HID_KEY_DELETE
+    {0, 0, 0, 0},            // HID_KEY_END
+    {0, 0, 0, 0},            // HID_KEY_PAGEDOWN
+    {0, 0, 0, 0},            // HID_KEY_RIGHT
+    {0, 0, 0, 0},            // HID_KEY_LEFT
+    {0, 0, 0, 0},            // HID_KEY_DOWN
+    {0, 0, 0, 0},            // HID_KEY_UP
+    {0, 0, 0, 0},            // HID_KEY_NUM_LOCK
+    {'/', '/', 0, 0},        // HID_KEY_KEYPAD_DIV
+    {'*', '*', 0, 0},        // HID_KEY_KEYPAD_MUL
+    {'-', '-', 0, 0},        // HID_KEY_KEYPAD_SUB
+    {'+', '+', 0, 0},        // HID_KEY_KEYPAD_ADD
+    {0x0d, 0x0d, 0, 0},      // HID_KEY_KEYPAD_ENTER
+    {'1', '1', 0, 0},        // HID_KEY_KEYPAD_1
+    {'2', '2', 0, 0},        // HID_KEY_KEYPAD_2
+    {'3', '3', 0, 0},        // HID_KEY_KEYPAD_3
+    {'4', '4', 0, 0},        // HID_KEY_KEYPAD_4
+    {'5', '5', 0x1d, 0x1d},  // HID_KEY_KEYPAD_5
+    {'6', '6', 0, 0},        // HID_KEY_KEYPAD_6
+    {'7', '7', 0, 0},        // HID_KEY_KEYPAD_7
+    {'8', '8', 0, 0},        // HID_KEY_KEYPAD_8
+    {'9', '9', 0, 0},        // HID_KEY_KEYPAD_9
+    {'0', '0', 0, 0},        // HID_KEY_KEYPAD_0
+    {0, 0, 0, 0},            // HID_KEY_KEYPAD_DELETE
+};
+
+/**
+ * @brief HID Keyboard get char symbol from key code
+ *
+ * @param[in] modifier  Keyboard modifier data
+ * @param[in] key_code  Keyboard key code
+ * @param[in] key_char  Pointer to key char data
+ *
+ * @return true  Key scancode converted successfully
+ * @return false Key scancode unknown
+ */
+static inline bool hid_keyboard_get_char(uint8_t modifier, uint8_t key_code,
+                                         unsigned char *key_char) {
+    uint8_t mod = 0;
+    if (modifier & (HID_LEFT_SHIFT | HID_RIGHT_SHIFT))
+        mod |= 1;
+    if (modifier & (HID_LEFT_CONTROL | HID_RIGHT_CONTROL))
+        mod |= 2;
+
+    uint8_t found = 0;
+    if (key_code < (sizeof(keycode2ascii) / sizeof(keycode2ascii[0])))
+        found = keycode2ascii[key_code][mod];
+    if (found) {
+        *key_char = found;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+/**
+ * @brief Key buffer scan code search.
+ *
+ * @param[in] src       Pointer to source buffer where to search
+ * @param[in] key       Key scancode to search
+ * @param[in] length    Size of the source buffer
+ */
+static inline bool key_found(const uint8_t *const src, uint8_t key,
+                             unsigned int length) {
+    for (unsigned int i = 0; i < length; i++) {
+        if (src[i] == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void keyboard_decoder_init(keyboard_decoder_t *decoder,
+                           keyboard_text_cb_t callback, void *arg) {
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->callback = callback;
+    decoder->arg = arg;
+    text_decoder_init(&decoder->text, NULL);
+}
+
+void keyboard_decoder_configure(keyboard_decoder_t *decoder,
+                                const text_decoder_config_t *config) {
+    text_decoder_init(&decoder->text, config);
+}
+
+/**
+ * @brief Process a keyboard input report
+ *
+ * @param[in] decoder Decoder state
+ * @param[in] data    Pointer to input report data buffer
+ * @param[in] length  Length of input report data buffer
+ */
+void keyboard_decoder_feed(keyboard_decoder_t *decoder, const uint8_t *data,
+                           size_t length) {
+    const hid_keyboard_input_report_boot_t *kb_report =
+        (const hid_keyboard_input_report_boot_t *)data;
+
+    if (length < sizeof(hid_keyboard_input_report_boot_t)) {
+        return;
+    }
+
+    const uint8_t modifier = kb_report->modifier.val;
+    bool pressed = false;
+    unsigned char key_char;
+
+    text_decoder_modifiers(&decoder->text, modifier);
+    for (int i = 0; i < HID_KEYBOARD_KEY_MAX; i++) {
+        // figure out which keys have been just pressed
+        if (kb_report->key[i] > HID_KEY_ERROR_UNDEFINED &&
+            !key_found(decoder->prev_keys, kb_report->key[i],
+                       HID_KEYBOARD_KEY_MAX)) {
+            if (!hid_keyboard_get_char(modifier, kb_report->key[i],
+                                       &key_char))
+                key_char = 0;
+            ESP_LOGD(TAG, "Key %d pressed -> ASCII %x", kb_report->key[i],
+                     key_char);
+            text_decoder_key(&decoder->text, modifier, kb_report->key[i],
+                             key_char);
+            pressed = true;
+        }
+    }
+
+    memcpy(decoder->prev_keys, &kb_report->key, HID_KEYBOARD_KEY_MAX);
+    if (pressed || decoder->text.length) {
+        decoder->callback(decoder->text.text, decoder->text.length,
+                          decoder->arg);
+        decoder->text.length = 0;
+    }
+}
+
+void keyboard_decoder_flush(keyboard_decoder_t *decoder) {
+    text_decoder_flush(&decoder->text);
+    if (decoder->text.length) {
+        decoder->callback(decoder->text.text, decoder->text.length,
+                          decoder->arg);
+        decoder->text.length = 0;
+    }
+}
@@ -0,0 +1,52 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <usb/hid_usage_keyboard.h>
+
+#include "text_decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Turns boot protocol keyboard reports into UTF-8 text. Independent of the
+ * USB host stack, so it can be built and benchmarked on the host.
+ */
+
+/*
+ * Called once per report with newly pressed keys, with the text they
+ * produced. The length is 0 for keys that produce none yet.
+ */
+typedef void (*keyboard_text_cb_t)(const char *text, size_t length,
+                                   void *arg);
+
+typedef struct {
+    keyboard_text_cb_t callback;
+    void *arg;
+    text_decoder_t text;
+    uint8_t prev_keys[HID_KEYBOARD_KEY_MAX];
+} keyboard_decoder_t;
+
+/** Unicode alt codes and the US layout until configured otherwise */
+void keyboard_decoder_init(keyboard_decoder_t *decoder,
+                           keyboard_text_cb_t callback, void *arg);
+void keyboard_decoder_configure(keyboard_decoder_t *decoder,
+                                const text_decoder_config_t *config);
+void keyboard_decoder_feed(keyboard_decoder_t *decoder, const uint8_t *data,
+                           size_t length);
+/**
+ * Pass on text still pending, such as a dead key, as with
+ * text_decoder_flush(). The callback is only called if there is any.
+ */
+void keyboard_decoder_flush(keyboard_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
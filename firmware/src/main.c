@@ -2,15 +2,23 @@
 //
 // SPDX-License-Identifier: GPL-3.0-or-later
 
-#include "config_lock.h"
+#include "aim_id.h"
+#include "app_config.h"
+#include "device_cache.h"
+#include "hid_capture.h"
+#include "metrics.h"
 #include "mqtt.h"
 #include "ota.h"
-#include "qr_provisioning.h"
+#include "ota_mqtt.h"
+#include "ota_self_test.h"
+#include "scan_arena.h"
+#include "scan_assembler.h"
+#include "scan_command.h"
+#include "scan_feedback.h"
+#include "trace.h"
 #include "usb_hid.h"
 #include "wifi.h"
 
-#include <string.h>
-
 #include <freertos/FreeRTOS.h>
 
 #include <esp_log.h>
@@ -31,71 +39,63 @@ void configure_watchdog(unsigned int timeout_ms) {
     rtc_wdt_protect_on();
 }
 
-#define KEY_TIMEOUT_MQTT_SUBMIT 50000 // 50ms
-static char collected_keys[2048] = "";
-static char *current_key = collected_keys;
-static int64_t key_timestamp = 0;
-
-void key_char_submit() {
-    if (current_key > collected_keys) {
-        if (current_key >= collected_keys + sizeof(collected_keys)) {
-            ESP_LOGW(TAG, "key_char_submit buffer full, truncating");
-            current_key = collected_keys + sizeof(collected_keys) - 1;
-        }
-        *current_key = 0;
-        ESP_LOGI(TAG, "key_char_submit with string: %s", collected_keys);
-
-        const char *aim_stripped = collected_keys;
-        if (strncmp(aim_stripped, "]Q1", 3) == 0) {
-            aim_stripped += 3;
-        }
-
-        bool publish = false;
-        if (is_config_locked()) {
-            if (strncmp(aim_stripped, "UNLOCK:", 7) == 0) {
-                ESP_LOGI(TAG, "attempting unlock config");
-                publish = config_unlock(aim_stripped + 7) != ESP_OK;
-            } else {
-                publish = true;
-            }
-        } else {
-            if (strncmp(aim_stripped, "LOCK:", 5) == 0) {
-                ESP_LOGI(TAG, "lock config");
-                config_lock(aim_stripped + 5);
-            } else if (strncmp(aim_stripped, "OTA:", 4) == 0) {
-                ESP_LOGI(TAG, "attempting OTA");
-                configure_watchdog(300000);
-                update_firmware(aim_stripped + 4);
-            } else if (strncmp(aim_stripped, "WIFI:", 5) == 0) {
-                ESP_LOGI(TAG, "provision wifi");
-                provision_wifi_qr(aim_stripped);
-            } else if (strncmp(aim_stripped, "MQTT:", 5) == 0) {
-                ESP_LOGI(TAG, "provision mqtt");
-                provision_mqtt_qr(aim_stripped);
-            } else {
-                publish = true;
-            }
-        }
-        if (publish) {
-            ESP_LOGI(TAG, "publishing to mqtt");
-            mqtt_publish(collected_keys);
-        }
-        current_key = collected_keys;
+// Scans stay in the arena from the first key until they are published
+static scan_arena_t scan_arena;
+static scan_assembler_t scan_assembler;
+static scan_feedback_t scan_feedback;
+
+static void scan_leds_callback(uint8_t leds, void *arg) {
+    (void)arg;
+    usb_hid_set_leds(leds);
+}
+
+static void scan_delivery_callback(mqtt_delivery_t delivery) {
+    switch (delivery) {
+    case MQTT_DELIVERY_ACKED:
+        scan_feedback_signal(&scan_feedback, SCAN_FEEDBACK_ACKED);
+        break;
+    case MQTT_DELIVERY_BUFFERED:
+        scan_feedback_signal(&scan_feedback, SCAN_FEEDBACK_BUFFERED);
+        break;
+    case MQTT_DELIVERY_FAILED:
+        scan_feedback_signal(&scan_feedback, SCAN_FEEDBACK_FAILED);
+        break;
     }
 }
 
-void key_char_callback(char c) {
-    if ('\t' == c) {
-        key_char_submit();
-    } else if (c) {
-        if (current_key >= collected_keys + sizeof(collected_keys) - 1) {
-            ESP_LOGW(TAG, "key_char_submit buffer full, submitting before collecting more keys");
-            key_char_submit();
-        }
-        *current_key = c;
-        ++current_key;
+static void scan_submit(const char *scan, size_t length, void *arg) {
+    (void)arg;
+    trace_record(TRACE_SCAN_SUBMIT, length, 0);
+    aim_id_t id;
+    const size_t id_length = aim_id_parse(scan, &id);
+    if (!scan_command_dispatch(scan + id_length))
+        return;
+
+    // Published straight from the arena, the outbox keeps a copy
+    char route[32];
+    if (*app_config_get()->aim_routing &&
+        aim_id_route(&id, route, sizeof(route))) {
+        ESP_LOGI(TAG, "publishing %s to mqtt", route);
+        mqtt_publish(route, scan + id_length);
+    } else {
+        ESP_LOGI(TAG, "publishing to mqtt");
+        mqtt_publish(NULL, scan);
     }
-    key_timestamp = esp_timer_get_time();
+}
+
+static void key_text_callback(const char *text, size_t length) {
+    scan_assembler_put_text(&scan_assembler, text, length,
+                            esp_timer_get_time());
+}
+
+static void key_text_flush(void *arg) {
+    (void)arg;
+    usb_hid_flush_text();
+}
+
+static void hid_event_callback(const char *batch, size_t length) {
+    if (mqtt_is_connected())
+        mqtt_publish_subtopic("events", batch, length);
 }
 
 void app_main(void) {
@@ -110,8 +110,13 @@ void app_main(void) {
     }
     ESP_ERROR_CHECK(ret);
 
+    // Runs alongside the initialization below, which it verifies
+    ota_self_test_start();
+
     rtc_wdt_feed();
-    config_lock_start();
+    app_config_start();
+    device_cache_start();
+    scan_command_start();
 
     rtc_wdt_feed();
     wifi_init_sta();
@@ -124,18 +129,29 @@ void app_main(void) {
     rtc_wdt_feed();
     mqtt_app_start();
 
+    rtc_wdt_feed();
+    ota_start();
+    ota_mqtt_start();
+    hid_capture_start();
+    trace_start();
+    metrics_start();
+
     // provision_wifi_qr("WIFI:T:WPA;S:example;P:secret;H:false;;");
     // provision_mqtt_qr("MQTT:U:mqtt://mqtt.example.com;T:hid2mqtt;;");
 
     rtc_wdt_feed();
-    usb_hid_start(key_char_callback);
+    scan_arena_init(&scan_arena);
+    scan_assembler_init(&scan_assembler, &scan_arena, scan_submit, NULL);
+    scan_assembler_set_flush(&scan_assembler, key_text_flush, NULL);
+    scan_feedback_init(&scan_feedback, scan_leds_callback, NULL);
+    mqtt_set_delivery_callback(scan_delivery_callback);
+    usb_hid_start(key_text_callback, hid_event_callback);
 
     while (true) {
         rtc_wdt_feed();
         usb_hid_handle_events();
-        if (key_timestamp + KEY_TIMEOUT_MQTT_SUBMIT < esp_timer_get_time()) {
-            key_char_submit();
-            key_timestamp = esp_timer_get_time();
-        }
+        scan_assembler_poll(&scan_assembler, esp_timer_get_time());
+        scan_feedback_poll(&scan_feedback, esp_timer_get_time());
+        trace_poll();
     }
 }
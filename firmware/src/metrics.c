@@ -0,0 +1,158 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "metrics.h"
+#include "mqtt.h"
+#include "usb_hid.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char *TAG = "metrics";
+
+/*
+ * Every METRICS_INTERVAL_MS a single JSON object is published to
+ * <topic>/metrics, e.g.
+ *
+ *   {"uptime":600,"heap":[81234,70112,65536],"queue":3,"dropped":0,
+ *    "outbox":0,"recover":[1,12,12],
+ *    "tasks":{"usb_events":[2412,1],"IDLE":[812,96],...}}
+ *
+ * heap is free, minimum ever free and largest free block in bytes, queue
+ * the peak depth of the HID event queue during the interval, outbox the
+ * bytes waiting for a broker acknowledgement, recover the number of
+ * recoveries from USB transfer errors and the time to recover of the last
+ * and the slowest one in milliseconds. Each task maps to its stack
+ * high-water mark (bytes never used) and its share of CPU time in percent
+ * over the interval. The task list needs CONFIG_FREERTOS_USE_TRACE_FACILITY
+ * and the CPU share CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS; without them
+ * the respective fields are left out.
+ */
+#define METRICS_INTERVAL_MS (60 * 1000)
+#define METRICS_MAX_TASKS 24
+#define METRICS_BUFFER_SIZE 1024
+#define METRICS_TASK_STACK_SIZE 3072
+#define METRICS_TASK_PRIORITY 1
+
+static char buffer[METRICS_BUFFER_SIZE];
+
+#if configUSE_TRACE_FACILITY
+static TaskStatus_t tasks[METRICS_MAX_TASKS];
+
+#if configGENERATE_RUN_TIME_STATS
+typedef struct {
+    TaskHandle_t handle;
+    configRUN_TIME_COUNTER_TYPE counter;
+} metrics_run_time_t;
+
+static metrics_run_time_t last_run_time[METRICS_MAX_TASKS];
+static UBaseType_t last_task_count;
+static configRUN_TIME_COUNTER_TYPE last_total_run_time;
+
+/* Run time of the task since the previous sample, 0 for new tasks */
+static configRUN_TIME_COUNTER_TYPE
+metrics_run_time_delta(const TaskStatus_t *task) {
+    for (UBaseType_t i = 0; i < last_task_count; ++i) {
+        if (last_run_time[i].handle == task->xHandle)
+            return task->ulRunTimeCounter - last_run_time[i].counter;
+    }
+    return 0;
+}
+#endif
+
+static int metrics_format_tasks(char *out, size_t size) {
+    configRUN_TIME_COUNTER_TYPE total_run_time = 0;
+    const UBaseType_t count =
+        uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, &total_run_time);
+    if (!count) {
+        ESP_LOGW(TAG, "More than %d tasks, not reporting them",
+                 METRICS_MAX_TASKS);
+        return 0;
+    }
+
+    size_t used = snprintf(out, size, ",\"tasks\":{");
+    for (UBaseType_t i = 0; i < count && used < size; ++i) {
+        used += snprintf(out + used, size - used, "%s\"%s\":[%" PRIu32,
+                         i ? "," : "", tasks[i].pcTaskName,
+                         (uint32_t)tasks[i].usStackHighWaterMark);
+#if configGENERATE_RUN_TIME_STATS
+        const configRUN_TIME_COUNTER_TYPE elapsed =
+            total_run_time - last_total_run_time;
+        if (used < size && last_task_count && elapsed)
+            used += snprintf(out + used, size - used, ",%" PRIu32,
+                             (uint32_t)((uint64_t)metrics_run_time_delta(
+                                            &tasks[i]) *
+                                        100 / elapsed));
+#endif
+        if (used < size)
+            used += snprintf(out + used, size - used, "]");
+    }
+    if (used < size)
+        used += snprintf(out + used, size - used, "}");
+
+#if configGENERATE_RUN_TIME_STATS
+    for (UBaseType_t i = 0; i < count; ++i) {
+        last_run_time[i].handle = tasks[i].xHandle;
+        last_run_time[i].counter = tasks[i].ulRunTimeCounter;
+    }
+    last_task_count = count;
+    last_total_run_time = total_run_time;
+#endif
+    return used;
+}
+#endif
+
+static void metrics_publish(void) {
+    uint32_t recover_count, recover_last_ms, recover_max_ms;
+    usb_hid_recovery_stats(&recover_count, &recover_last_ms, &recover_max_ms);
+    size_t used = snprintf(
+        buffer, sizeof(buffer),
+        "{\"uptime\":%" PRId64 ",\"heap\":[%u,%u,%u],\"queue\":%" PRIu32
+        ",\"dropped\":%" PRIu32 ",\"outbox\":%d,\"recover\":[%" PRIu32
+        ",%" PRIu32 ",%" PRIu32 "]",
+        esp_timer_get_time() / 1000000,
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+        usb_hid_queue_peak_depth(true), usb_hid_dropped_events(),
+        mqtt_get_outbox_size(), recover_count, recover_last_ms,
+        recover_max_ms);
+#if configUSE_TRACE_FACILITY
+    if (used < sizeof(buffer))
+        used += metrics_format_tasks(buffer + used, sizeof(buffer) - used);
+#endif
+    if (used + 1 >= sizeof(buffer)) {
+        ESP_LOGE(TAG, "Metrics do not fit into %d bytes", METRICS_BUFFER_SIZE);
+        return;
+    }
+    buffer[used++] = '}';
+    buffer[used] = '\0';
+
+    ESP_LOGD(TAG, "%s", buffer);
+    if (mqtt_is_connected())
+        mqtt_publish_subtopic("metrics", buffer, used);
+}
+
+static void metrics_task(void *arg) {
+    (void)arg;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (true) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(METRICS_INTERVAL_MS));
+        metrics_publish();
+    }
+}
+
+void metrics_start(void) {
+    if (xTaskCreate(metrics_task, "metrics", METRICS_TASK_STACK_SIZE, NULL,
+                    METRICS_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create metrics task");
+    }
+}
@@ -0,0 +1,16 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Periodically publish heap, stack, queue and CPU usage to <topic>/metrics */
+void metrics_start(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,23 +3,69 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "mqtt.h"
+#include "app_config.h"
+#include "trace.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include <esp_err.h>
 #include <esp_log.h>
-#include <nvs_flash.h>
 
 #include <mqtt_client.h>
 
 static const char *TAG = "mqtt";
 
-static char *mqtt_uri;
-static char *mqtt_topic;
+#define MQTT_MAX_TOPIC_LEN 128
+
+// Point into the config, which is updated in place by mqtt_set_config()
+static const char *mqtt_uri;
+static const char *mqtt_topic;
 
 static esp_mqtt_client_handle_t mqtt_client;
-static nvs_handle_t nvs;
+static volatile bool mqtt_connected;
+
+/*
+ * Subscriptions are remembered, so they can be renewed after every
+ * (re)connect. Those below the device topic are kept relative to it and
+ * resolved on each connect, so they follow a topic changed by
+ * mqtt_reload_config(), which reconnects with a clean session. Messages
+ * larger than the MQTT buffer arrive in several MQTT_EVENT_DATA events of
+ * which only the first carries the topic; the callback of that first
+ * fragment also receives the remaining ones.
+ */
+typedef struct {
+    char topic[MQTT_MAX_TOPIC_LEN]; // below the device topic if subtopic
+    bool subtopic;
+    mqtt_data_cb_t cb;
+} mqtt_subscription_t;
+
+static mqtt_subscription_t subscriptions[MQTT_MAX_SUBSCRIPTIONS];
+static SemaphoreHandle_t subscriptions_lock;
+static mqtt_data_cb_t current_data_cb;
+static char current_topic[MQTT_MAX_TOPIC_LEN];
+
+/*
+ * Scans published with mqtt_publish() are tracked by msg_id until the broker
+ * acknowledges them or they expire in the outbox, to tell them from other
+ * messages. The MQTT task may handle the ack before
+ * esp_mqtt_client_publish() returns the msg_id, so the last few acks of
+ * untracked messages are remembered. Tracking is best effort: with more
+ * scans in flight, the oldest one is no longer reported.
+ */
+#define MQTT_TRACKED_SCANS 8
+#define MQTT_EARLY_ACKS 4
+
+static portMUX_TYPE delivery_lock = portMUX_INITIALIZER_UNLOCKED;
+static int tracked_scans[MQTT_TRACKED_SCANS]; // 0 for none, QoS 2 is never 0
+static uint8_t tracked_next;
+static int early_acks[MQTT_EARLY_ACKS];
+static uint8_t early_next;
+static mqtt_delivery_cb_t delivery_cb;
 
 #ifdef LOG_TO_MQTT
 static vprintf_like_t original_vprintf = NULL;
@@ -68,6 +114,96 @@ static int mqtt_logger(const char *fmt, va_list args) {
 }
 #endif
 
+static bool subtopic_format(char *topic, size_t size, const char *subtopic) {
+    const int topic_len = snprintf(topic, size, "%s/%s", mqtt_topic, subtopic);
+    return topic_len >= 0 && topic_len < (int)size;
+}
+
+/* The topic a subscription stands for now, false if it does not fit */
+static bool subscription_topic(const mqtt_subscription_t *subscription,
+                               char *topic) {
+    if (subscription->subtopic)
+        return subtopic_format(topic, MQTT_MAX_TOPIC_LEN, subscription->topic);
+    strcpy(topic, subscription->topic);
+    return true;
+}
+
+static void mqtt_resubscribe(void) {
+    char topic[MQTT_MAX_TOPIC_LEN];
+    xSemaphoreTake(subscriptions_lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; ++i) {
+        if (subscriptions[i].cb && subscription_topic(&subscriptions[i], topic))
+            esp_mqtt_client_subscribe(mqtt_client, topic, 1);
+    }
+    xSemaphoreGive(subscriptions_lock);
+}
+
+static void mqtt_dispatch_data(esp_mqtt_event_handle_t event) {
+    if (event->current_data_offset == 0) {
+        current_data_cb = NULL;
+        if (event->topic_len <= 0 || event->topic_len >= MQTT_MAX_TOPIC_LEN)
+            return;
+
+        xSemaphoreTake(subscriptions_lock, portMAX_DELAY);
+        for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; ++i) {
+            if (subscriptions[i].cb &&
+                subscription_topic(&subscriptions[i], current_topic) &&
+                strncmp(current_topic, event->topic, event->topic_len) == 0 &&
+                current_topic[event->topic_len] == 0) {
+                current_data_cb = subscriptions[i].cb;
+                break;
+            }
+        }
+        xSemaphoreGive(subscriptions_lock);
+    }
+    if (current_data_cb)
+        current_data_cb(current_topic, event->data, event->data_len,
+                        event->current_data_offset, event->total_data_len);
+}
+
+static bool msg_id_take(int *msg_ids, size_t count, int msg_id) {
+    for (size_t i = 0; i < count; ++i) {
+        if (msg_ids[i] == msg_id) {
+            msg_ids[i] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void delivery_report(mqtt_delivery_t delivery) {
+    if (delivery_cb)
+        delivery_cb(delivery);
+}
+
+/* Called by the MQTT task for any message with QoS > 0 */
+static void delivery_done(int msg_id, bool acked) {
+    portENTER_CRITICAL(&delivery_lock);
+    const bool tracked =
+        msg_id_take(tracked_scans, MQTT_TRACKED_SCANS, msg_id);
+    if (!tracked && acked) {
+        early_acks[early_next] = msg_id;
+        early_next = (early_next + 1) % MQTT_EARLY_ACKS;
+    }
+    portEXIT_CRITICAL(&delivery_lock);
+    if (tracked)
+        delivery_report(acked ? MQTT_DELIVERY_ACKED : MQTT_DELIVERY_FAILED);
+}
+
+static void delivery_track(int msg_id) {
+    portENTER_CRITICAL(&delivery_lock);
+    const bool acked = msg_id_take(early_acks, MQTT_EARLY_ACKS, msg_id);
+    if (!acked) {
+        tracked_scans[tracked_next] = msg_id;
+        tracked_next = (tracked_next + 1) % MQTT_TRACKED_SCANS;
+    }
+    portEXIT_CRITICAL(&delivery_lock);
+    if (acked)
+        delivery_report(MQTT_DELIVERY_ACKED);
+    else if (!mqtt_connected)
+        delivery_report(MQTT_DELIVERY_BUFFERED);
+}
+
 static void mqtt_event_handler_cb(void *handler_args, esp_event_base_t base,
                                   int32_t event_id, void *event_data) {
     (void)handler_args;
@@ -77,11 +213,18 @@ static void mqtt_event_handler_cb(void *handler_args, esp_event_base_t base,
     switch (event->event_id) {
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "MQTT connected");
+        trace_record(TRACE_MQTT, 1, 0);
+        mqtt_connected = true;
+        mqtt_resubscribe();
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGW(TAG, "MQTT disconnected");
+        trace_record(TRACE_MQTT, 0, 0);
+        mqtt_connected = false;
         break;
     case MQTT_EVENT_PUBLISHED:
+        trace_record(TRACE_PUBLISH_ACK, 0, event->msg_id);
+        delivery_done(event->msg_id, true);
 #ifdef LOG_TO_MQTT
         ++suppress_mqtt_logger;
 #endif
@@ -90,6 +233,23 @@ static void mqtt_event_handler_cb(void *handler_args, esp_event_base_t base,
         --suppress_mqtt_logger;
 #endif
         break;
+    case MQTT_EVENT_DELETED:
+        delivery_done(event->msg_id, false);
+#ifdef LOG_TO_MQTT
+        ++suppress_mqtt_logger;
+#endif
+        ESP_LOGW(TAG, "Message expired in the outbox, msg_id=%d",
+                 event->msg_id);
+#ifdef LOG_TO_MQTT
+        --suppress_mqtt_logger;
+#endif
+        break;
+    case MQTT_EVENT_DATA:
+        mqtt_dispatch_data(event);
+        break;
+    case MQTT_EVENT_SUBSCRIBED:
+    case MQTT_EVENT_UNSUBSCRIBED:
+        break;
     case MQTT_EVENT_ERROR:
 #ifdef LOG_TO_MQTT
         ++suppress_mqtt_logger;
@@ -120,64 +280,162 @@ static void mqtt_event_handler_cb(void *handler_args, esp_event_base_t base,
     }
 }
 
-esp_err_t mqtt_publish(const char *msg) {
+esp_err_t mqtt_publish(const char *subtopic, const char *msg) {
+    char topic[128];
+    if (subtopic && !subtopic_format(topic, sizeof(topic), subtopic)) {
+        delivery_report(MQTT_DELIVERY_FAILED);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const int msg_id = esp_mqtt_client_publish(
+        mqtt_client, subtopic ? topic : mqtt_topic, msg, 0, 2, 0);
+    if (msg_id >= 0) {
+        trace_record(TRACE_PUBLISH, strlen(msg), msg_id);
+        delivery_track(msg_id);
+        return ESP_OK;
+    }
+    else {
+        delivery_report(MQTT_DELIVERY_FAILED);
+        return ESP_FAIL;
+    }
+}
+
+void mqtt_set_delivery_callback(mqtt_delivery_cb_t cb) {
+    delivery_cb = cb;
+}
+
+esp_err_t mqtt_publish_subtopic(const char *subtopic, const char *data,
+                                int len) {
+    char topic[128];
+    if (!subtopic_format(topic, sizeof(topic), subtopic))
+        return ESP_ERR_INVALID_SIZE;
     const int msg_id =
-        esp_mqtt_client_publish(mqtt_client, mqtt_topic, msg, 0, 2, 0);
-    if (msg_id >= 0)
+        esp_mqtt_client_publish(mqtt_client, topic, data, len, 1, 0);
+    if (msg_id >= 0) {
+        trace_record(TRACE_PUBLISH, len, msg_id);
         return ESP_OK;
+    }
     else
         return ESP_FAIL;
 }
 
-esp_err_t mqtt_set_config(const char *uri, const char *topic) {
-    char *new_uri = strdup(uri);
-    char *new_topic = strdup(topic);
+static esp_err_t subscription_add(const char *topic, bool subtopic,
+                                  mqtt_data_cb_t cb) {
+    if (strlen(topic) >= MQTT_MAX_TOPIC_LEN)
+        return ESP_ERR_INVALID_SIZE;
+
+    mqtt_subscription_t *slot = NULL;
+    char full_topic[MQTT_MAX_TOPIC_LEN];
+    bool fits = false;
+    xSemaphoreTake(subscriptions_lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; ++i) {
+        if (subscriptions[i].cb && subscriptions[i].subtopic == subtopic &&
+            strcmp(subscriptions[i].topic, topic) == 0) {
+            slot = &subscriptions[i];
+            break;
+        }
+        if (!slot && !subscriptions[i].cb)
+            slot = &subscriptions[i];
+    }
+    if (slot) {
+        strcpy(slot->topic, topic);
+        slot->subtopic = subtopic;
+        slot->cb = cb;
+        fits = subscription_topic(slot, full_topic);
+    }
+    xSemaphoreGive(subscriptions_lock);
 
-    if (!new_uri || !new_topic) {
-        free(new_uri);
-        free(new_topic);
-        ESP_LOGE(TAG, "Failed to allocate memory for URI and/or topic");
+    if (!slot) {
+        ESP_LOGE(TAG, "No free subscription slot for %s", topic);
         return ESP_ERR_NO_MEM;
     }
+    // Fails while disconnected, the subscription is renewed on connect
+    if (fits)
+        esp_mqtt_client_subscribe(mqtt_client, full_topic, 1);
+    return ESP_OK;
+}
 
-    free(mqtt_uri);
-    mqtt_uri = new_uri;
-    free(mqtt_topic);
-    mqtt_topic = new_topic;
+esp_err_t mqtt_subscribe(const char *topic, mqtt_data_cb_t cb) {
+    return subscription_add(topic, false, cb);
+}
 
-    ESP_ERROR_CHECK(nvs_set_str(nvs, "uri", mqtt_uri));
-    ESP_ERROR_CHECK(nvs_set_str(nvs, "topic", mqtt_topic));
-    ESP_ERROR_CHECK(nvs_commit(nvs));
+esp_err_t mqtt_subscribe_subtopic(const char *subtopic, mqtt_data_cb_t cb) {
+    return subscription_add(subtopic, true, cb);
+}
 
-    ESP_ERROR_CHECK(esp_mqtt_client_set_uri(mqtt_client, mqtt_uri));
-    esp_mqtt_client_disconnect(mqtt_client);
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    esp_mqtt_client_reconnect(mqtt_client);
-    return ESP_OK;
+esp_err_t mqtt_unsubscribe(const char *topic) {
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(subscriptions_lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; ++i) {
+        if (subscriptions[i].cb && !subscriptions[i].subtopic &&
+            strcmp(subscriptions[i].topic, topic) == 0) {
+            subscriptions[i].cb = NULL;
+            ret = ESP_OK;
+        }
+    }
+    xSemaphoreGive(subscriptions_lock);
+
+    if (ret == ESP_OK)
+        esp_mqtt_client_unsubscribe(mqtt_client, topic);
+    return ret;
 }
 
-void mqtt_app_start(void) {
-    ESP_ERROR_CHECK(nvs_open("mqtt", NVS_READWRITE, &nvs));
+bool mqtt_is_connected(void) {
+    return mqtt_connected;
+}
 
-    size_t required_size;
+const char *mqtt_get_topic(void) {
+    return mqtt_topic;
+}
+
+int mqtt_get_outbox_size(void) {
+    return mqtt_client ? esp_mqtt_client_get_outbox_size(mqtt_client) : 0;
+}
 
-    if (nvs_get_str(nvs, "uri", NULL, &required_size) != ESP_OK ||
-        nvs_get_str(nvs, "topic", NULL, &required_size) != ESP_OK) {
-        ESP_LOGW(TAG, "No MQTT config found in NVS, initializing");
-        ESP_ERROR_CHECK(nvs_set_str(nvs, "uri", "mqtt://127.0.0.1"));
-        ESP_ERROR_CHECK(nvs_set_str(nvs, "topic", "hid2mqtt"));
-        ESP_ERROR_CHECK(nvs_commit(nvs));
+esp_err_t mqtt_wait_outbox_empty(uint32_t timeout_ms) {
+    const TickType_t start = xTaskGetTickCount();
+    while (esp_mqtt_client_get_outbox_size(mqtt_client) > 0) {
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(timeout_ms))
+            return ESP_ERR_TIMEOUT;
+        vTaskDelay(pdMS_TO_TICKS(100));
     }
+    return ESP_OK;
+}
+
+esp_err_t mqtt_set_config(const char *uri, const char *topic) {
+    esp_err_t ret = app_config_set_str(APP_CONFIG_MQTT_URI, uri);
+    if (ret == ESP_OK)
+        ret = app_config_set_str(APP_CONFIG_MQTT_TOPIC, topic);
+    // A failed commit reverts the config by itself
+    if (ret == ESP_OK)
+        ret = app_config_commit();
+    else
+        app_config_revert();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save URI and/or topic");
+        return ret;
+    }
+
+    mqtt_reload_config();
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    mqtt_reconnect();
+    return ESP_OK;
+}
 
-    ESP_ERROR_CHECK(nvs_get_str(nvs, "uri", NULL, &required_size));
-    mqtt_uri = malloc(required_size);
-    assert(mqtt_uri);
-    ESP_ERROR_CHECK(nvs_get_str(nvs, "uri", mqtt_uri, &required_size));
+void mqtt_reload_config(void) {
+    ESP_ERROR_CHECK(esp_mqtt_client_set_uri(mqtt_client, mqtt_uri));
+    esp_mqtt_client_disconnect(mqtt_client);
+}
+
+void mqtt_reconnect(void) {
+    esp_mqtt_client_reconnect(mqtt_client);
+}
+
+void mqtt_app_start(void) {
+    subscriptions_lock = xSemaphoreCreateMutex();
+    assert(subscriptions_lock);
 
-    ESP_ERROR_CHECK(nvs_get_str(nvs, "topic", NULL, &required_size));
-    mqtt_topic = malloc(required_size);
-    assert(mqtt_topic);
-    ESP_ERROR_CHECK(nvs_get_str(nvs, "topic", mqtt_topic, &required_size));
+    mqtt_uri = app_config_get()->mqtt_uri;
+    mqtt_topic = app_config_get()->mqtt_topic;
 
     esp_mqtt_client_config_t cfg = {.broker.address.uri = mqtt_uri};
     mqtt_client = esp_mqtt_client_init(&cfg);
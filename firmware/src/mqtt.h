@@ -4,14 +4,65 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <esp_err.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-esp_err_t mqtt_publish(const char *msg);
+typedef void (*mqtt_data_cb_t)(const char *topic, const char *data, int len,
+                               int offset, int total_len);
+
+typedef enum {
+    MQTT_DELIVERY_ACKED,    // acknowledged by the broker
+    MQTT_DELIVERY_BUFFERED, // kept in the outbox while disconnected
+    MQTT_DELIVERY_FAILED,   // not queued, or expired in the outbox
+} mqtt_delivery_t;
+
+/**
+ * What became of a message published with mqtt_publish(), called from the
+ * MQTT task or the publishing one. A buffered message is reported again
+ * later, when it is acked or fails.
+ */
+typedef void (*mqtt_delivery_cb_t)(mqtt_delivery_t delivery);
+
+/**
+ * Publish a scan to the topic, or to "<topic>/<subtopic>" unless NULL. The
+ * outbox keeps a copy, msg may be reused once this returns.
+ */
+esp_err_t mqtt_publish(const char *subtopic, const char *msg);
+void mqtt_set_delivery_callback(mqtt_delivery_cb_t cb);
+esp_err_t mqtt_publish_subtopic(const char *subtopic, const char *data,
+                                int len);
+/*
+ * Topics subscribed at once. Permanently, the OTA announcements for this
+ * device and broadcast, the capture and the trace upload, besides those
+ * the chunk window of an OTA transfer.
+ */
+#define MQTT_MAX_SUBSCRIPTIONS 12
+#define MQTT_PERMANENT_SUBSCRIPTIONS 4
+
+esp_err_t mqtt_subscribe(const char *topic, mqtt_data_cb_t cb);
+/**
+ * Subscribe to "<topic>/<subtopic>", renewed under the new topic whenever
+ * it is changed
+ */
+esp_err_t mqtt_subscribe_subtopic(const char *subtopic, mqtt_data_cb_t cb);
+esp_err_t mqtt_unsubscribe(const char *topic);
+bool mqtt_is_connected(void);
+const char *mqtt_get_topic(void);
+esp_err_t mqtt_wait_outbox_empty(uint32_t timeout_ms);
+/** Bytes of messages not yet acknowledged by the broker */
+int mqtt_get_outbox_size(void);
 esp_err_t mqtt_set_config(const char *uri, const char *topic);
+/**
+ * Disconnect to pick up a changed broker URI or topic, see mqtt_reconnect()
+ */
+void mqtt_reload_config(void);
+void mqtt_reconnect(void);
 void mqtt_app_start(void);
 
 #ifdef __cplusplus
@@ -3,27 +3,453 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "ota.h"
+#include "mqtt.h"
+#include "ota_image.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include <esp_crt_bundle.h>
-#include <esp_https_ota.h>
+#include <esp_http_client.h>
 #include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <nvs_flash.h>
+#include <spi_flash_mmap.h>
 
 static const char *TAG = "ota";
 
-void update_firmware(const char *url) {
-    ESP_LOGI(TAG, "Attempting firmware update via %s", url);
+#define OTA_TASK_STACK_SIZE 8192
+#define OTA_TASK_PRIORITY 1
+#define OTA_BUFFER_SIZE 1024
+#define OTA_PROGRESS_STEP_PERCENT 10
+#define OTA_CHECKPOINT_INTERVAL (64 * 1024)
+#define OTA_MAX_ATTEMPTS 10
+#define OTA_RETRY_DELAY_MS 2000
+#define OTA_RETRY_DELAY_MAX_MS 30000
+#define OTA_REBOOT_DRAIN_TIMEOUT_MS 10000
+
+/*
+ * State of a resumable download into the passive OTA partition.
+ *
+ * The image is written to the partition with plain flash operations (see
+ * ota_image.c), so a download can be continued at any offset. Every
+ * OTA_CHECKPOINT_INTERVAL bytes the sector-aligned offset is persisted to NVS
+ * together with the URL, the image size and the ETag, which allows resuming
+ * after a reboot with a "Range:" request. Only a download with an ETag is
+ * resumed, as "If-Range:" is what tells a changed image of the same size.
+ * Packed images cannot be resumed after a reboot because the decompressor
+ * state lives in RAM; their checkpoint always points at offset zero. The
+ * image itself (checksum and appended SHA-256 digest) is verified by
+ * esp_ota_set_boot_partition() once all bytes are in place.
+ */
+typedef struct {
+    char *url;
+    const esp_partition_t *partition;
+    ota_image_t *image;
+    char etag[64];
+    uint32_t size;       // total download size, 0 while unknown
+    uint32_t offset;     // number of bytes received
+    uint32_t checkpoint; // offset persisted in NVS
+    uint32_t next_report;
+    bool fatal;          // the last error cannot be fixed by retrying
+
+    // filled from the response headers of the current request
+    uint32_t range_first;
+    uint32_t range_total;
+    char response_etag[64];
+} ota_download_t;
+
+static portMUX_TYPE ota_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool ota_in_progress;
+static nvs_handle_t nvs;
+
+/*
+ * Until the running image has passed its self-test, the passive partition
+ * holds the only image to roll back to, so it must not be overwritten.
+ * esp_ota_begin() refuses this as well, but is not used here.
+ */
+static bool ota_pending_verify(void) {
+    esp_ota_img_states_t state;
+    return esp_ota_get_state_partition(esp_ota_get_running_partition(),
+                                       &state) == ESP_OK &&
+           state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+esp_err_t ota_claim(void) {
+    if (ota_pending_verify()) {
+        ESP_LOGW(TAG, "Running image not yet verified, no update possible");
+        return ESP_ERR_OTA_ROLLBACK_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&ota_lock);
+    const bool claimed = !ota_in_progress;
+    ota_in_progress = true;
+    portEXIT_CRITICAL(&ota_lock);
+    if (!claimed) {
+        ESP_LOGW(TAG, "Firmware update already in progress");
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+void ota_release(void) {
+    portENTER_CRITICAL(&ota_lock);
+    ota_in_progress = false;
+    portEXIT_CRITICAL(&ota_lock);
+}
+
+void ota_report(const char *status) {
+    ESP_LOGI(TAG, "%s", status);
+    mqtt_publish_subtopic("ota", status, 0);
+}
+
+static void ota_report_progress(ota_download_t *dl) {
+    char status[64];
+    snprintf(status, sizeof(status), "downloading %d%% (%" PRIu32 "/%" PRIu32 ")",
+             (int)((uint64_t)dl->offset * 100 / dl->size), dl->offset,
+             dl->size);
+    ota_report(status);
+    dl->next_report = dl->offset + dl->size * OTA_PROGRESS_STEP_PERCENT / 100;
+}
+
+static void ota_checkpoint_clear(void) {
+    nvs_erase_all(nvs);
+    nvs_commit(nvs);
+}
+
+static esp_err_t ota_checkpoint_save(ota_download_t *dl) {
+    const uint32_t checkpoint = ota_image_is_resumable(dl->image)
+                                    ? dl->offset & ~(SPI_FLASH_SEC_SIZE - 1)
+                                    : 0;
+    esp_err_t ret = nvs_set_str(nvs, "url", dl->url);
+    if (ret == ESP_OK)
+        ret = nvs_set_str(nvs, "etag", dl->etag);
+    if (ret == ESP_OK)
+        ret = nvs_set_u32(nvs, "size", dl->size);
+    if (ret == ESP_OK)
+        ret = nvs_set_u32(nvs, "offset", checkpoint);
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    if (ret == ESP_OK)
+        dl->checkpoint = checkpoint;
+    else
+        ESP_LOGW(TAG, "Failed to save checkpoint: %s", esp_err_to_name(ret));
+    return ret;
+}
+
+static esp_err_t ota_download_restart(ota_download_t *dl) {
+    dl->etag[0] = 0;
+    dl->size = 0;
+    dl->offset = 0;
+    dl->checkpoint = 0;
+    dl->next_report = 0;
+    ota_image_free(dl->image);
+    dl->image = ota_image_new(dl->partition, 0);
+    return dl->image ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t ota_http_event_handler(esp_http_client_event_t *evt) {
+    ota_download_t *dl = evt->user_data;
+    if (evt->event_id != HTTP_EVENT_ON_HEADER)
+        return ESP_OK;
+    if (strcasecmp(evt->header_key, "Content-Range") == 0) {
+        unsigned long first, last, total;
+        if (sscanf(evt->header_value, "bytes %lu-%lu/%lu", &first, &last,
+                   &total) == 3) {
+            dl->range_first = first;
+            dl->range_total = total;
+        }
+    } else if (strcasecmp(evt->header_key, "ETag") == 0) {
+        strlcpy(dl->response_etag, evt->header_value,
+                sizeof(dl->response_etag));
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ota_write(ota_download_t *dl, const char *data, size_t len) {
+    if (dl->offset + len > dl->size)
+        len = dl->size - dl->offset;
+
+    esp_err_t ret = ota_image_write(dl->image, (const uint8_t *)data, len);
+    if (ret != ESP_OK)
+        return ret;
+    dl->offset += len;
+
+    if (dl->offset - dl->checkpoint >= OTA_CHECKPOINT_INTERVAL)
+        ota_checkpoint_save(dl);
+    if (dl->offset >= dl->next_report)
+        ota_report_progress(dl);
+    return ESP_OK;
+}
+
+/**
+ * Perform a single HTTP request, continuing at the current offset.
+ * Returns ESP_OK once the whole image has been written to the partition.
+ * On error, dl->fatal tells whether another attempt makes sense.
+ */
+static esp_err_t ota_download_attempt(ota_download_t *dl) {
+    if (dl->size && dl->offset >= dl->size)
+        return ESP_OK;
+    if (dl->offset && !dl->etag[0]) {
+        ESP_LOGW(TAG, "No ETag to resume against, restarting from zero");
+        if (ota_download_restart(dl) != ESP_OK) {
+            dl->fatal = true;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     esp_http_client_config_t config = {
-        .url = url,
+        .url = dl->url,
         .crt_bundle_attach = esp_crt_bundle_attach,
+        .event_handler = ota_http_event_handler,
+        .user_data = dl,
+        .keep_alive_enable = true,
     };
-    esp_https_ota_config_t ota_config = {
-        .http_config = &config,
-    };
-    esp_err_t ret = esp_https_ota(&ota_config);
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (!client)
+        return ESP_ERR_NO_MEM;
+
+    char range[24];
+    if (dl->offset) {
+        snprintf(range, sizeof(range), "bytes=%" PRIu32 "-", dl->offset);
+        esp_http_client_set_header(client, "Range", range);
+        // The server sends the full image instead if it has changed
+        if (dl->etag[0])
+            esp_http_client_set_header(client, "If-Range", dl->etag);
+    }
+    dl->range_first = 0;
+    dl->range_total = 0;
+    dl->response_etag[0] = 0;
+
+    esp_err_t ret = esp_http_client_open(client, 0);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open connection: %s", esp_err_to_name(ret));
+        goto out;
+    }
+
+    const int64_t content_length = esp_http_client_fetch_headers(client);
+    const int status = esp_http_client_get_status_code(client);
+    if (status == 206 && dl->offset) {
+        if (!dl->range_total || dl->range_total != dl->size ||
+            dl->range_first != dl->offset) {
+            ESP_LOGW(TAG, "Unexpected range, restarting from zero");
+            dl->fatal = ota_download_restart(dl) != ESP_OK;
+            ret = ESP_ERR_INVALID_RESPONSE;
+            goto out;
+        }
+        ESP_LOGI(TAG, "Resuming at %" PRIu32 "/%" PRIu32, dl->offset,
+                 dl->size);
+    } else if (status == 200) {
+        if (dl->offset) {
+            ESP_LOGW(TAG, "Server sent the full image, restarting from zero");
+            ret = ota_download_restart(dl);
+            if (ret != ESP_OK) {
+                dl->fatal = true;
+                goto out;
+            }
+        }
+        if (content_length <= 0) {
+            ESP_LOGE(TAG, "Server did not send the image size");
+            dl->fatal = true;
+            ret = ESP_ERR_INVALID_RESPONSE;
+            goto out;
+        }
+        dl->size = content_length;
+        strlcpy(dl->etag, dl->response_etag, sizeof(dl->etag));
+        if (dl->size > dl->partition->size) {
+            ESP_LOGE(TAG, "Image of %" PRIu32 " bytes exceeds partition size",
+                     dl->size);
+            dl->fatal = true;
+            ret = ESP_ERR_INVALID_SIZE;
+            goto out;
+        }
+        ota_checkpoint_save(dl);
+    } else {
+        ESP_LOGE(TAG, "Unexpected HTTP status %d", status);
+        dl->fatal = status >= 400 && status < 500;
+        ret = ESP_ERR_INVALID_RESPONSE;
+        goto out;
+    }
+
+    char buf[OTA_BUFFER_SIZE];
+    while (dl->offset < dl->size) {
+        const int len = esp_http_client_read(client, buf, sizeof(buf));
+        if (len <= 0) {
+            ESP_LOGE(TAG, "Connection lost at %" PRIu32 "/%" PRIu32,
+                     dl->offset, dl->size);
+            ret = ESP_FAIL;
+            goto out;
+        }
+        ret = ota_write(dl, buf, len);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write image: %s", esp_err_to_name(ret));
+            dl->fatal = true;
+            goto out;
+        }
+    }
+    ret = ESP_OK;
+
+out:
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return ret;
+}
+
+static void ota_task(void *arg) {
+    ota_download_t *dl = arg;
+    esp_err_t ret = ESP_FAIL;
+    uint32_t retry_delay_ms = OTA_RETRY_DELAY_MS;
+
+    ota_report(dl->offset ? "resuming" : "starting");
+    for (int attempt = 1; attempt <= OTA_MAX_ATTEMPTS; ++attempt) {
+        ret = ota_download_attempt(dl);
+        if (ret == ESP_OK || dl->fatal)
+            break;
+        ESP_LOGW(TAG, "Attempt %d failed, retrying in %" PRIu32 " ms",
+                 attempt, retry_delay_ms);
+        vTaskDelay(pdMS_TO_TICKS(retry_delay_ms));
+        retry_delay_ms *= 2;
+        if (retry_delay_ms > OTA_RETRY_DELAY_MAX_MS)
+            retry_delay_ms = OTA_RETRY_DELAY_MAX_MS;
+    }
+
+    if (ret != ESP_OK) {
+        if (dl->fatal) {
+            ota_checkpoint_clear();
+            ota_report("failed");
+        } else {
+            // Keep the checkpoint, the next attempt continues from there
+            ota_checkpoint_save(dl);
+            ota_report("failed, will resume");
+        }
+        goto out;
+    }
+
+    ota_install(dl->partition, dl->image);
+
+out:
+    ota_image_free(dl->image);
+    free(dl->url);
+    free(dl);
+    ota_release();
+    vTaskDelete(NULL);
+}
+
+static esp_err_t ota_task_start(ota_download_t *dl) {
+    if (xTaskCreate(ota_task, "ota", OTA_TASK_STACK_SIZE, dl,
+                    OTA_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create OTA task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_install(const esp_partition_t *partition, ota_image_t *image) {
+    // Validates the image including its appended SHA-256 digest
+    esp_err_t ret = ota_image_finish(image);
     if (ret == ESP_OK)
-        ESP_LOGI(TAG, "OTA successful");
-    else
-        ESP_LOGE(TAG, "OTA failed");
+        ret = esp_ota_set_boot_partition(partition);
+    // Any interrupted download has been overwritten by now
+    ota_checkpoint_clear();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Image validation failed: %s", esp_err_to_name(ret));
+        ota_report("failed to validate image");
+        return ret;
+    }
+
+    uint8_t sha256[32];
+    char status[96] = "successful, rebooting";
+    if (esp_partition_get_sha256(partition, sha256) == ESP_OK) {
+        int len = snprintf(status, sizeof(status), "successful, sha256 ");
+        for (int i = 0; i < sizeof(sha256); ++i)
+            len += snprintf(status + len, sizeof(status) - len, "%02x",
+                            sha256[i]);
+        snprintf(status + len, sizeof(status) - len, ", rebooting");
+    }
+    ota_report(status);
 
+    // Give the queued scans and status messages a chance to reach the broker
+    if (mqtt_wait_outbox_empty(OTA_REBOOT_DRAIN_TIMEOUT_MS) != ESP_OK)
+        ESP_LOGW(TAG, "MQTT outbox not drained, rebooting anyway");
     esp_restart();
 }
+
+static ota_download_t *ota_download_new(const char *url) {
+    ota_download_t *dl = calloc(1, sizeof(ota_download_t));
+    if (!dl)
+        return NULL;
+    // The URL points into the scan buffer, which is reused by the next scan
+    dl->url = strdup(url);
+    dl->partition = esp_ota_get_next_update_partition(NULL);
+    if (!dl->url || !dl->partition) {
+        free(dl->url);
+        free(dl);
+        return NULL;
+    }
+    return dl;
+}
+
+esp_err_t update_firmware(const char *url) {
+    esp_err_t ret = ota_claim();
+    if (ret != ESP_OK)
+        return ret;
+
+    ESP_LOGI(TAG, "Attempting firmware update via %s", url);
+
+    ota_download_t *dl = ota_download_new(url);
+    if (!dl) {
+        ESP_LOGE(TAG, "Failed to prepare firmware update");
+        ota_release();
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Continue an interrupted download of the same URL
+    char saved_url[256];
+    size_t saved_url_size = sizeof(saved_url);
+    if (nvs_get_str(nvs, "url", saved_url, &saved_url_size) == ESP_OK &&
+        strcmp(saved_url, url) == 0) {
+        size_t etag_size = sizeof(dl->etag);
+        if (nvs_get_u32(nvs, "size", &dl->size) == ESP_OK &&
+            nvs_get_u32(nvs, "offset", &dl->offset) == ESP_OK &&
+            nvs_get_str(nvs, "etag", dl->etag, &etag_size) == ESP_OK &&
+            dl->offset <= dl->size && dl->size <= dl->partition->size) {
+            dl->checkpoint = dl->offset;
+            dl->next_report = dl->offset;
+            ESP_LOGI(TAG, "Found checkpoint at %" PRIu32 "/%" PRIu32,
+                     dl->offset, dl->size);
+        } else {
+            dl->size = 0;
+            dl->offset = 0;
+            dl->etag[0] = 0;
+        }
+    } else {
+        ota_checkpoint_clear();
+    }
+
+    dl->image = ota_image_new(dl->partition, dl->offset);
+    ret = dl->image ? ota_task_start(dl) : ESP_ERR_NO_MEM;
+    if (ret != ESP_OK) {
+        ota_image_free(dl->image);
+        free(dl->url);
+        free(dl);
+        ota_release();
+    }
+    return ret;
+}
+
+void ota_start(void) {
+    ESP_ERROR_CHECK(nvs_open("ota", NVS_READWRITE, &nvs));
+
+    char url[256];
+    size_t url_size = sizeof(url);
+    if (nvs_get_str(nvs, "url", url, &url_size) == ESP_OK) {
+        ESP_LOGI(TAG, "Resuming interrupted firmware update");
+        update_firmware(url);
+    }
+}
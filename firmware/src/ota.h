@@ -4,11 +4,30 @@
 
 #pragma once
 
+#include <stdbool.h>
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#include "ota_image.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void update_firmware(const char *url) __attribute__((__noreturn__));
+esp_err_t update_firmware(const char *url);
+void ota_start(void);
+
+/*
+ * Shared by the HTTP and MQTT update paths, only one update runs at a time
+ * and none while the running image is still pending verification
+ */
+esp_err_t ota_claim(void);
+void ota_release(void);
+void ota_report(const char *status);
+/** Validate the image, make it the boot partition and reboot.
+ *  Only returns if the image is invalid. */
+esp_err_t ota_install(const esp_partition_t *partition, ota_image_t *image);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,307 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "ota_image.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include <esp_app_format.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <rom/miniz.h>
+#include <spi_flash_mmap.h>
+
+static const char *TAG = "ota_image";
+
+/*
+ * Besides plain application images, the OTA stream may contain an image packed
+ * by tools/ota_pack.py. A packed image starts with ota_pack_header_t, followed
+ * by a zlib stream. For OTA_PACK_COMPRESSED the zlib stream inflates to the
+ * application image. For OTA_PACK_DELTA it inflates to a sequence of
+ * operations that rebuild the image from the currently running one:
+ *
+ *   0x00 <offset:u32> <length:u32>   copy bytes from the running image
+ *   0x01 <length:u32> <data...>      insert literal bytes
+ *
+ * All integers are little endian. Either way the output is written straight
+ * into the target partition, which is erased sector by sector just ahead of
+ * the write position.
+ */
+#define OTA_PACK_MAGIC "H2MO"
+#define OTA_PACK_VERSION 1
+
+typedef enum {
+    OTA_PACK_COMPRESSED = 0,
+    OTA_PACK_DELTA = 1,
+} ota_pack_type_t;
+
+typedef enum {
+    OTA_DELTA_OP_COPY = 0,
+    OTA_DELTA_OP_ADD = 1,
+} ota_delta_op_t;
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t type;
+    uint16_t reserved;
+    uint32_t image_size;
+    uint8_t base_sha256[32]; // appended digest of the base image (delta only)
+} ota_pack_header_t;
+
+typedef enum {
+    OTA_IMAGE_DETECT = 0,
+    OTA_IMAGE_RAW,
+    OTA_IMAGE_PACKED,
+} ota_image_state_t;
+
+struct ota_image {
+    const esp_partition_t *partition;
+    const esp_partition_t *base;
+    ota_image_state_t state;
+    uint32_t written;
+    uint32_t erased;
+
+    ota_pack_header_t header;
+    size_t header_len;
+
+    tinfl_decompressor *inflator;
+    uint8_t *dict;
+    size_t dict_ofs;
+    bool inflate_done;
+
+    uint8_t op[9];
+    size_t op_len;
+    uint32_t add_remaining;
+};
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t ota_image_output(ota_image_t *image, const uint8_t *data,
+                                  size_t len) {
+    if (len > image->partition->size - image->written) {
+        ESP_LOGE(TAG, "Image exceeds partition size");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (image->erased < image->written + len) {
+        esp_err_t ret = esp_partition_erase_range(
+            image->partition, image->erased, SPI_FLASH_SEC_SIZE);
+        if (ret != ESP_OK)
+            return ret;
+        image->erased += SPI_FLASH_SEC_SIZE;
+    }
+    esp_err_t ret =
+        esp_partition_write(image->partition, image->written, data, len);
+    if (ret == ESP_OK)
+        image->written += len;
+    return ret;
+}
+
+static esp_err_t ota_image_copy_base(ota_image_t *image, uint32_t offset,
+                                     uint32_t len) {
+    if (offset > image->base->size || len > image->base->size - offset) {
+        ESP_LOGE(TAG, "Delta copies beyond the base partition");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t buf[256];
+    while (len) {
+        const size_t n = MIN(len, sizeof(buf));
+        esp_err_t ret = esp_partition_read(image->base, offset, buf, n);
+        if (ret == ESP_OK)
+            ret = ota_image_output(image, buf, n);
+        if (ret != ESP_OK)
+            return ret;
+        offset += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ota_image_delta(ota_image_t *image, const uint8_t *data,
+                                 size_t len) {
+    while (len) {
+        if (image->add_remaining) {
+            const size_t n = MIN(len, image->add_remaining);
+            esp_err_t ret = ota_image_output(image, data, n);
+            if (ret != ESP_OK)
+                return ret;
+            data += n;
+            len -= n;
+            image->add_remaining -= n;
+            continue;
+        }
+
+        image->op[image->op_len++] = *data++;
+        --len;
+        if (image->op[0] > OTA_DELTA_OP_ADD) {
+            ESP_LOGE(TAG, "Invalid delta operation %d", image->op[0]);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        const size_t op_size = image->op[0] == OTA_DELTA_OP_COPY ? 9 : 5;
+        if (image->op_len < op_size)
+            continue;
+        image->op_len = 0;
+
+        if (image->op[0] == OTA_DELTA_OP_COPY) {
+            esp_err_t ret = ota_image_copy_base(
+                image, get_le32(image->op + 1), get_le32(image->op + 5));
+            if (ret != ESP_OK)
+                return ret;
+        } else {
+            image->add_remaining = get_le32(image->op + 1);
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ota_image_inflate(ota_image_t *image, const uint8_t *data,
+                                   size_t len) {
+    while (!image->inflate_done) {
+        size_t in_bytes = len;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - image->dict_ofs;
+        const tinfl_status status = tinfl_decompress(
+            image->inflator, data, &in_bytes, image->dict,
+            image->dict + image->dict_ofs, &out_bytes,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        len -= in_bytes;
+
+        if (out_bytes) {
+            const uint8_t *out = image->dict + image->dict_ofs;
+            esp_err_t ret = image->header.type == OTA_PACK_DELTA
+                                ? ota_image_delta(image, out, out_bytes)
+                                : ota_image_output(image, out, out_bytes);
+            if (ret != ESP_OK)
+                return ret;
+            image->dict_ofs =
+                (image->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Decompression failed with status %d", status);
+            return ESP_ERR_INVALID_RESPONSE;
+        } else if (status == TINFL_STATUS_DONE) {
+            image->inflate_done = true;
+        } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && !len) {
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ota_image_start_packed(ota_image_t *image) {
+    const ota_pack_header_t *header = &image->header;
+
+    if (memcmp(header->magic, OTA_PACK_MAGIC, sizeof(header->magic)) != 0) {
+        ESP_LOGE(TAG, "Not an application image");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (header->version != OTA_PACK_VERSION ||
+        header->type > OTA_PACK_DELTA) {
+        ESP_LOGE(TAG, "Unsupported packed image version %d type %d",
+                 header->version, header->type);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (header->image_size > image->partition->size) {
+        ESP_LOGE(TAG, "Image exceeds partition size");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (header->type == OTA_PACK_DELTA) {
+        uint8_t sha256[32];
+        image->base = esp_ota_get_running_partition();
+        if (!image->base ||
+            esp_partition_get_sha256(image->base, sha256) != ESP_OK ||
+            memcmp(sha256, header->base_sha256, sizeof(sha256)) != 0) {
+            ESP_LOGE(TAG, "Delta was built for a different base image");
+            return ESP_ERR_INVALID_VERSION;
+        }
+    }
+
+    image->inflator = malloc(sizeof(tinfl_decompressor));
+    image->dict = malloc(TINFL_LZ_DICT_SIZE);
+    if (!image->inflator || !image->dict) {
+        ESP_LOGE(TAG, "Failed to allocate memory for decompression");
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(image->inflator);
+
+    ESP_LOGI(TAG, "Receiving %s image of %" PRIu32 " bytes",
+             header->type == OTA_PACK_DELTA ? "delta" : "compressed",
+             header->image_size);
+    image->state = OTA_IMAGE_PACKED;
+    return ESP_OK;
+}
+
+ota_image_t *ota_image_new(const esp_partition_t *partition, uint32_t offset) {
+    ota_image_t *image = calloc(1, sizeof(ota_image_t));
+    if (!image)
+        return NULL;
+    image->partition = partition;
+    if (offset) {
+        // Only plain images can be resumed at an offset
+        image->state = OTA_IMAGE_RAW;
+        image->written = offset;
+        image->erased = offset;
+    }
+    return image;
+}
+
+esp_err_t ota_image_write(ota_image_t *image, const uint8_t *data,
+                          size_t len) {
+    if (image->state == OTA_IMAGE_DETECT && len) {
+        if (!image->header_len && data[0] == ESP_IMAGE_HEADER_MAGIC) {
+            image->state = OTA_IMAGE_RAW;
+        } else {
+            const size_t n =
+                MIN(len, sizeof(image->header) - image->header_len);
+            memcpy((uint8_t *)&image->header + image->header_len, data, n);
+            image->header_len += n;
+            data += n;
+            len -= n;
+            if (image->header_len < sizeof(image->header))
+                return ESP_OK;
+            esp_err_t ret = ota_image_start_packed(image);
+            if (ret != ESP_OK)
+                return ret;
+        }
+    }
+
+    switch (image->state) {
+    case OTA_IMAGE_RAW:
+        return ota_image_output(image, data, len);
+    case OTA_IMAGE_PACKED:
+        return ota_image_inflate(image, data, len);
+    default:
+        return ESP_OK;
+    }
+}
+
+esp_err_t ota_image_finish(ota_image_t *image) {
+    if (image->state == OTA_IMAGE_RAW)
+        return ESP_OK;
+    if (image->state != OTA_IMAGE_PACKED || !image->inflate_done ||
+        image->op_len || image->add_remaining ||
+        image->written != image->header.image_size) {
+        ESP_LOGE(TAG, "Packed image incomplete, %" PRIu32 " bytes written",
+                 image->written);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+bool ota_image_is_resumable(const ota_image_t *image) {
+    return image->state == OTA_IMAGE_RAW || !image->header_len;
+}
+
+void ota_image_free(ota_image_t *image) {
+    if (!image)
+        return;
+    free(image->inflator);
+    free(image->dict);
+    free(image);
+}
@@ -0,0 +1,28 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ota_image ota_image_t;
+
+ota_image_t *ota_image_new(const esp_partition_t *partition, uint32_t offset);
+esp_err_t ota_image_write(ota_image_t *image, const uint8_t *data, size_t len);
+esp_err_t ota_image_finish(ota_image_t *image);
+bool ota_image_is_resumable(const ota_image_t *image);
+void ota_image_free(ota_image_t *image);
+
+#ifdef __cplusplus
+}
+#endif
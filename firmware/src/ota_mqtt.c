@@ -0,0 +1,420 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "ota_mqtt.h"
+#include "mqtt.h"
+#include "ota.h"
+#include "ota_image.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/message_buffer.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <nvs_flash.h>
+
+static const char *TAG = "ota_mqtt";
+
+/*
+ * Firmware transfer over the MQTT connection.
+ *
+ * A transfer is announced on <prefix>/begin with the payload
+ * "<size> <chunk size> <sha256>", where the SHA-256 is taken over the whole
+ * file and serves as transfer id. The file is then split into chunks published
+ * on <prefix>/<index>. The device only subscribes to a window of
+ * OTA_MQTT_WINDOW chunk topics at a time and moves it forward as the chunks are
+ * written, so the broker never has to deliver more than that at once.
+ *
+ * The prefix is either <topic>/ota for a single device, or
+ * OTA_MQTT_BROADCAST_TOPIC for all devices on the broker. The latter lies
+ * outside the default topic "hid2mqtt", so both never coincide. For single
+ * devices every completed chunk is acknowledged on <topic>/ota/ack with the
+ * index of the next expected chunk, and the sender publishes the window
+ * following that index. Broadcast chunks are published retained instead, so
+ * each device fetches them at its own pace by subscribing, and no
+ * acknowledgements are sent. When nothing arrives for OTA_MQTT_TIMEOUT_MS,
+ * the window is subscribed again (which makes the broker resend retained
+ * chunks) and the acknowledgement is repeated.
+ *
+ * The chunks are written through ota_image.c, so packed images are accepted as
+ * well. The SHA-256 of the last installed transfer is kept in NVS, so a
+ * retained broadcast is not installed a second time after the reboot.
+ */
+#define OTA_MQTT_BROADCAST_TOPIC "hid2mqtt-ota/all"
+#define OTA_MQTT_WINDOW 4
+#define OTA_MQTT_MAX_CHUNK_SIZE (64 * 1024)
+#define OTA_MQTT_TIMEOUT_MS 5000
+#define OTA_MQTT_MAX_RETRIES 12
+#define OTA_MQTT_TASK_STACK_SIZE 6144
+#define OTA_MQTT_TASK_PRIORITY 1
+#define OTA_MQTT_FRAGMENT_SIZE 512
+#define OTA_MQTT_BUFFER_SIZE (8 * (OTA_MQTT_FRAGMENT_SIZE + 16))
+#define OTA_MQTT_PROGRESS_STEP_PERCENT 10
+
+#define OTA_MQTT_BEGIN UINT32_MAX
+
+_Static_assert(MQTT_PERMANENT_SUBSCRIPTIONS + OTA_MQTT_WINDOW <=
+                   MQTT_MAX_SUBSCRIPTIONS,
+               "no room to subscribe the chunk window");
+
+/* Header of a message fragment passed from the MQTT task to the OTA task */
+typedef struct {
+    uint32_t index;  // chunk index or OTA_MQTT_BEGIN
+    uint32_t offset; // offset of the fragment within the message
+    uint32_t total;  // length of the whole message
+    bool broadcast;
+} ota_mqtt_fragment_t;
+
+typedef struct {
+    bool active;
+    bool broadcast;
+    char prefix[96];
+    uint8_t sha256[32];
+    uint32_t size;
+    uint32_t chunk_size;
+    uint32_t chunks;
+    uint32_t next;     // index of the next chunk to write
+    uint32_t received; // bytes of chunk `next` written so far
+    uint32_t window;   // chunks [next, window) are subscribed
+    uint32_t next_report;
+    int retries;
+    const esp_partition_t *partition;
+    ota_image_t *image;
+    mbedtls_sha256_context sha_ctx;
+} ota_mqtt_transfer_t;
+
+static MessageBufferHandle_t fragments;
+static ota_mqtt_transfer_t transfer;
+static uint8_t failed_sha256[32];
+static nvs_handle_t nvs;
+
+static bool ota_mqtt_parse_sha256(const char *hex, uint8_t *sha256) {
+    for (int i = 0; i < 32; ++i) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+            return false;
+        sha256[i] = byte;
+    }
+    return true;
+}
+
+static void ota_mqtt_chunk_topic(char *topic, size_t size, uint32_t index) {
+    snprintf(topic, size, "%s/%" PRIu32, transfer.prefix, index);
+}
+
+static void ota_mqtt_data(const char *topic, const char *data, int len,
+                          int offset, int total_len);
+
+static void ota_mqtt_ack(void) {
+    if (transfer.broadcast)
+        return;
+    char ack[12];
+    snprintf(ack, sizeof(ack), "%" PRIu32, transfer.next);
+    mqtt_publish_subtopic("ota/ack", ack, 0);
+}
+
+/* A chunk that cannot be subscribed would stall the transfer, so it fails */
+static esp_err_t ota_mqtt_subscribe_window(bool renew) {
+    char topic[128];
+    const uint32_t end = MIN(transfer.next + OTA_MQTT_WINDOW, transfer.chunks);
+    for (uint32_t i = renew ? transfer.next : transfer.window; i < end; ++i) {
+        ota_mqtt_chunk_topic(topic, sizeof(topic), i);
+        const esp_err_t ret = mqtt_subscribe(topic, ota_mqtt_data);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to subscribe to chunk %" PRIu32 ": %s", i,
+                     esp_err_to_name(ret));
+            return ret;
+        }
+        transfer.window = MAX(transfer.window, i + 1);
+    }
+    return ESP_OK;
+}
+
+static void ota_mqtt_finish(const char *status) {
+    char topic[128];
+    for (uint32_t i = transfer.next; i < transfer.window; ++i) {
+        ota_mqtt_chunk_topic(topic, sizeof(topic), i);
+        mqtt_unsubscribe(topic);
+    }
+    if (status) {
+        memcpy(failed_sha256, transfer.sha256, sizeof(failed_sha256));
+        ota_report(status);
+    }
+    mbedtls_sha256_free(&transfer.sha_ctx);
+    ota_image_free(transfer.image);
+    memset(&transfer, 0, sizeof(transfer));
+    ota_release();
+}
+
+static void ota_mqtt_install(void) {
+    uint8_t sha256[32];
+    mbedtls_sha256_finish(&transfer.sha_ctx, sha256);
+    if (memcmp(sha256, transfer.sha256, sizeof(sha256)) != 0) {
+        ota_mqtt_finish("failed, checksum mismatch");
+        return;
+    }
+
+    // Written before rebooting, so a retained broadcast is not installed again
+    nvs_set_blob(nvs, "installed", transfer.sha256, sizeof(transfer.sha256));
+    nvs_commit(nvs);
+    ota_install(transfer.partition, transfer.image);
+    nvs_erase_key(nvs, "installed");
+    nvs_commit(nvs);
+    ota_mqtt_finish(NULL);
+}
+
+static void ota_mqtt_begin(const char *payload, size_t len, bool broadcast) {
+    char buf[128];
+    uint8_t sha256[32];
+    unsigned long size, chunk_size;
+    char hex[65];
+
+    if (len >= sizeof(buf))
+        return;
+    memcpy(buf, payload, len);
+    buf[len] = 0;
+    // An empty payload clears a retained broadcast
+    if (!len)
+        return;
+    if (sscanf(buf, "%lu %lu %64s", &size, &chunk_size, hex) != 3 ||
+        strlen(hex) != 64 || !ota_mqtt_parse_sha256(hex, sha256) || !size ||
+        !chunk_size || chunk_size > OTA_MQTT_MAX_CHUNK_SIZE) {
+        ESP_LOGE(TAG, "Invalid transfer announcement: %s", buf);
+        return;
+    }
+
+    if (transfer.active) {
+        if (memcmp(sha256, transfer.sha256, sizeof(sha256)) == 0) {
+            // Sender restarted or broker redelivered, continue where we are
+            ota_mqtt_ack();
+            return;
+        }
+        if (broadcast && !transfer.broadcast)
+            return;
+        ESP_LOGW(TAG, "New transfer announced, aborting the current one");
+        ota_mqtt_finish("aborted");
+    }
+
+    uint8_t installed[32];
+    size_t installed_size = sizeof(installed);
+    if (nvs_get_blob(nvs, "installed", installed, &installed_size) == ESP_OK &&
+        memcmp(installed, sha256, sizeof(sha256)) == 0) {
+        if (!broadcast)
+            ota_report("already installed");
+        return;
+    }
+    if (broadcast && memcmp(failed_sha256, sha256, sizeof(sha256)) == 0)
+        return;
+
+    if (ota_claim() != ESP_OK)
+        return;
+
+    memcpy(transfer.sha256, sha256, sizeof(sha256));
+    transfer.partition = esp_ota_get_next_update_partition(NULL);
+    if (!transfer.partition || size > transfer.partition->size) {
+        ESP_LOGE(TAG, "Image of %lu bytes does not fit", size);
+        ota_mqtt_finish("failed, image too large");
+        return;
+    }
+    transfer.image = ota_image_new(transfer.partition, 0);
+    if (!transfer.image) {
+        ota_mqtt_finish("failed, out of memory");
+        return;
+    }
+
+    transfer.active = true;
+    transfer.broadcast = broadcast;
+    if (broadcast)
+        strlcpy(transfer.prefix, OTA_MQTT_BROADCAST_TOPIC,
+                sizeof(transfer.prefix));
+    else
+        snprintf(transfer.prefix, sizeof(transfer.prefix), "%s/ota",
+                 mqtt_get_topic());
+    transfer.size = size;
+    transfer.chunk_size = chunk_size;
+    transfer.chunks = (size + chunk_size - 1) / chunk_size;
+    mbedtls_sha256_init(&transfer.sha_ctx);
+    mbedtls_sha256_starts(&transfer.sha_ctx, 0);
+
+    ESP_LOGI(TAG, "Receiving %" PRIu32 " bytes in %" PRIu32 " chunks via %s",
+             transfer.size, transfer.chunks, transfer.prefix);
+    ota_report("starting");
+    if (ota_mqtt_subscribe_window(false) != ESP_OK) {
+        ota_mqtt_finish("failed, unable to subscribe");
+        return;
+    }
+    ota_mqtt_ack();
+}
+
+static void ota_mqtt_report_progress(void) {
+    const uint32_t written = transfer.next * transfer.chunk_size;
+    if (written < transfer.next_report)
+        return;
+    char status[64];
+    snprintf(status, sizeof(status), "receiving %d%% (%" PRIu32 "/%" PRIu32 ")",
+             (int)((uint64_t)written * 100 / transfer.size), written,
+             transfer.size);
+    ota_report(status);
+    transfer.next_report =
+        written + transfer.size * OTA_MQTT_PROGRESS_STEP_PERCENT / 100;
+}
+
+static void ota_mqtt_chunk(const ota_mqtt_fragment_t *fragment,
+                           const uint8_t *data, size_t len) {
+    if (!transfer.active || fragment->broadcast != transfer.broadcast ||
+        fragment->index != transfer.next)
+        return;
+
+    const uint32_t chunk_len =
+        MIN(transfer.chunk_size,
+            transfer.size - transfer.next * transfer.chunk_size);
+    if (fragment->total != chunk_len) {
+        ESP_LOGW(TAG, "Chunk %" PRIu32 " has %" PRIu32 " bytes, expected %" PRIu32,
+                 fragment->index, fragment->total, chunk_len);
+        return;
+    }
+    // Skip what has already been written, e.g. on redelivery
+    if (fragment->offset > transfer.received ||
+        fragment->offset + len <= transfer.received)
+        return;
+    const size_t skip = transfer.received - fragment->offset;
+    data += skip;
+    len -= skip;
+
+    esp_err_t ret = ota_image_write(transfer.image, data, len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write image: %s", esp_err_to_name(ret));
+        ota_mqtt_finish("failed");
+        return;
+    }
+    mbedtls_sha256_update(&transfer.sha_ctx, data, len);
+    transfer.received += len;
+    transfer.retries = 0;
+    if (transfer.received < chunk_len)
+        return;
+
+    char topic[128];
+    ota_mqtt_chunk_topic(topic, sizeof(topic), transfer.next);
+    mqtt_unsubscribe(topic);
+    ++transfer.next;
+    transfer.received = 0;
+    if (transfer.next == transfer.chunks) {
+        ota_mqtt_install();
+        return;
+    }
+    if (ota_mqtt_subscribe_window(false) != ESP_OK) {
+        ota_mqtt_finish("failed, unable to subscribe");
+        return;
+    }
+    ota_mqtt_ack();
+    ota_mqtt_report_progress();
+}
+
+static void ota_mqtt_timeout(void) {
+    if (++transfer.retries > OTA_MQTT_MAX_RETRIES) {
+        ESP_LOGE(TAG, "No data received for chunk %" PRIu32, transfer.next);
+        ota_mqtt_finish("failed, transfer stalled");
+        return;
+    }
+    ESP_LOGW(TAG, "Waiting for chunk %" PRIu32 ", requesting again",
+             transfer.next);
+    if (ota_mqtt_subscribe_window(true) != ESP_OK) {
+        ota_mqtt_finish("failed, unable to subscribe");
+        return;
+    }
+    ota_mqtt_ack();
+}
+
+static void ota_mqtt_task(void *arg) {
+    (void)arg;
+    static uint8_t buf[sizeof(ota_mqtt_fragment_t) + OTA_MQTT_FRAGMENT_SIZE];
+    const ota_mqtt_fragment_t *fragment = (const ota_mqtt_fragment_t *)buf;
+
+    while (true) {
+        const TickType_t timeout =
+            transfer.active ? pdMS_TO_TICKS(OTA_MQTT_TIMEOUT_MS)
+                            : portMAX_DELAY;
+        const size_t len =
+            xMessageBufferReceive(fragments, buf, sizeof(buf), timeout);
+        if (!len) {
+            if (transfer.active)
+                ota_mqtt_timeout();
+            continue;
+        }
+
+        const uint8_t *data = buf + sizeof(*fragment);
+        const size_t data_len = len - sizeof(*fragment);
+        if (fragment->index == OTA_MQTT_BEGIN)
+            ota_mqtt_begin((const char *)data, data_len, fragment->broadcast);
+        else
+            ota_mqtt_chunk(fragment, data, data_len);
+    }
+}
+
+/* Called in the MQTT task, hands the message over in small fragments */
+static void ota_mqtt_data(const char *topic, const char *data, int len,
+                          int offset, int total_len) {
+    const char *suffix = strrchr(topic, '/');
+    if (!suffix)
+        return;
+    ++suffix;
+
+    // Only <broadcast>/<suffix>, a device topic may still start alike
+    ota_mqtt_fragment_t fragment = {
+        .broadcast = suffix == topic + sizeof(OTA_MQTT_BROADCAST_TOPIC) &&
+                     strncmp(topic, OTA_MQTT_BROADCAST_TOPIC "/",
+                             sizeof(OTA_MQTT_BROADCAST_TOPIC)) == 0,
+        .offset = offset,
+        .total = total_len,
+    };
+    if (strcmp(suffix, "begin") == 0) {
+        if (len != total_len || len > OTA_MQTT_FRAGMENT_SIZE)
+            return;
+        fragment.index = OTA_MQTT_BEGIN;
+    } else {
+        char *end;
+        fragment.index = strtoul(suffix, &end, 10);
+        if (end == suffix || *end)
+            return;
+    }
+
+    uint8_t buf[sizeof(fragment) + OTA_MQTT_FRAGMENT_SIZE];
+    do {
+        const size_t n = MIN(len, OTA_MQTT_FRAGMENT_SIZE);
+        memcpy(buf, &fragment, sizeof(fragment));
+        memcpy(buf + sizeof(fragment), data, n);
+        // Dropped fragments are requested again after the timeout
+        if (xMessageBufferSend(fragments, buf, sizeof(fragment) + n,
+                               pdMS_TO_TICKS(100)) == 0)
+            ESP_LOGW(TAG, "Dropped fragment of chunk %" PRIu32,
+                     fragment.index);
+        fragment.offset += n;
+        data += n;
+        len -= n;
+    } while (len > 0);
+}
+
+void ota_mqtt_start(void) {
+    ESP_ERROR_CHECK(nvs_open("ota_mqtt", NVS_READWRITE, &nvs));
+
+    fragments = xMessageBufferCreate(OTA_MQTT_BUFFER_SIZE);
+    assert(fragments);
+    if (xTaskCreate(ota_mqtt_task, "ota_mqtt", OTA_MQTT_TASK_STACK_SIZE, NULL,
+                    OTA_MQTT_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create MQTT OTA task");
+        return;
+    }
+
+    mqtt_subscribe_subtopic("ota/begin", ota_mqtt_data);
+    mqtt_subscribe(OTA_MQTT_BROADCAST_TOPIC "/begin", ota_mqtt_data);
+}
@@ -0,0 +1,87 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "ota_self_test.h"
+#include "mqtt.h"
+#include "ota.h"
+#include "usb_hid.h"
+
+#include <inttypes.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_timer.h>
+
+static const char *TAG = "ota_self_test";
+
+/*
+ * After an update the bootloader starts the new image in the pending-verify
+ * state (CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE). It is only marked valid once
+ * a HID device is enumerated, the broker is connected and a heartbeat has
+ * been acknowledged by the broker, all within OTA_SELF_TEST_DEADLINE_MS after
+ * boot. Otherwise, or if the image resets before that, the bootloader returns
+ * to the previous image.
+ */
+#define OTA_SELF_TEST_DEADLINE_MS (3 * 60 * 1000)
+#define OTA_SELF_TEST_POLL_MS 500
+#define OTA_SELF_TEST_HEARTBEAT_TIMEOUT_MS 10000
+#define OTA_SELF_TEST_TASK_STACK_SIZE 4096
+#define OTA_SELF_TEST_TASK_PRIORITY 1
+
+static bool ota_self_test_passed(int64_t deadline_us) {
+    while (esp_timer_get_time() < deadline_us) {
+        if (usb_hid_is_connected() && mqtt_is_connected()) {
+            // The heartbeat is published at QoS 1 and leaves the outbox once
+            // the broker has acknowledged it
+            if (mqtt_publish_subtopic("ota", "self-test heartbeat", 0) ==
+                    ESP_OK &&
+                mqtt_wait_outbox_empty(OTA_SELF_TEST_HEARTBEAT_TIMEOUT_MS) ==
+                    ESP_OK)
+                return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(OTA_SELF_TEST_POLL_MS));
+    }
+    ESP_LOGE(TAG, "Self-test failed: HID %s, MQTT %s",
+             usb_hid_is_connected() ? "ok" : "missing",
+             mqtt_is_connected() ? "ok" : "disconnected");
+    return false;
+}
+
+static void ota_self_test_task(void *arg) {
+    const int64_t deadline_us = (int64_t)OTA_SELF_TEST_DEADLINE_MS * 1000;
+
+    if (ota_self_test_passed(deadline_us)) {
+        esp_err_t ret = esp_ota_mark_app_valid_cancel_rollback();
+        if (ret == ESP_OK)
+            ota_report("self-test passed, image confirmed");
+        else
+            ESP_LOGE(TAG, "Failed to confirm image: %s", esp_err_to_name(ret));
+    } else {
+        ota_report("self-test failed, rolling back");
+        mqtt_wait_outbox_empty(OTA_SELF_TEST_HEARTBEAT_TIMEOUT_MS);
+        // Only returns if there is no previous image to go back to
+        esp_err_t ret = esp_ota_mark_app_invalid_rollback_and_reboot();
+        ESP_LOGE(TAG, "Rollback failed: %s", esp_err_to_name(ret));
+    }
+    vTaskDelete(NULL);
+}
+
+void ota_self_test_start(void) {
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) !=
+            ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY)
+        return;
+
+    ESP_LOGW(TAG, "New image pending verification, starting self-test");
+    if (xTaskCreate(ota_self_test_task, "ota_self_test",
+                    OTA_SELF_TEST_TASK_STACK_SIZE, NULL,
+                    OTA_SELF_TEST_TASK_PRIORITY, NULL) != pdPASS) {
+        // Without self-test the image stays pending and reverts on next reset
+        ESP_LOGE(TAG, "Failed to create self-test task");
+    }
+}
@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "qr_fields.h"
+
+#include <ctype.h>
+#include <string.h>
+
+void qr_fields_init(qr_fields_t *fields, const char *payload) {
+    fields->pos = payload;
+}
+
+bool qr_fields_next(qr_fields_t *fields, qr_field_t *field) {
+    const char *p = fields->pos;
+    if (!*p || *p == ';')
+        return false;
+
+    field->key = p;
+    while (*p && *p != ':' && *p != ';')
+        ++p;
+    field->key_len = p - field->key;
+    if (*p == ':')
+        ++p;
+
+    field->value = p;
+    while (*p && *p != ';') {
+        if (*p == '\\' && p[1])
+            ++p;
+        ++p;
+    }
+    field->value_len = p - field->value;
+
+    fields->pos = *p ? p + 1 : p;
+    return true;
+}
+
+bool qr_field_is(const qr_field_t *field, const char *key) {
+    return strlen(key) == field->key_len &&
+           memcmp(field->key, key, field->key_len) == 0;
+}
+
+/* Unescape into dest, keeping room for the terminator if needed */
+static bool qr_field_unescape(const qr_field_t *field, char *dest,
+                              size_t size, bool terminated) {
+    const char *p = field->value;
+    const char *end = p + field->value_len;
+    const size_t room = terminated ? size - 1 : size;
+    size_t len = 0;
+    if (!size)
+        return false;
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end)
+            ++p;
+        if (len >= room)
+            return false;
+        dest[len++] = *p++;
+    }
+    if (len < size)
+        dest[len] = 0;
+    return true;
+}
+
+bool qr_field_copy(const qr_field_t *field, char *dest, size_t size) {
+    return qr_field_unescape(field, dest, size, true);
+}
+
+bool qr_field_copy_fixed(const qr_field_t *field, char *dest, size_t size) {
+    return qr_field_unescape(field, dest, size, false);
+}
+
+bool qr_field_equals(const qr_field_t *field, const char *value) {
+    const char *p = field->value;
+    const char *end = p + field->value_len;
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end)
+            ++p;
+        if (!*value ||
+            tolower((unsigned char)*p) != tolower((unsigned char)*value))
+            return false;
+        ++p;
+        ++value;
+    }
+    return !*value;
+}
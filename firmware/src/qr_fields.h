@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Scanner for the "K:value;K:value;;" payloads of provisioning QR codes, as
+ * used by the WIFI: format. Within values, '\' escapes the next character, so
+ * "\;", "\:", "\," and "\\" stand for the literal characters. A field ends at
+ * the first unescaped ';', the payload at an empty field or the end of the
+ * string.
+ *
+ * The scanner works on the payload in place and never allocates. Fields only
+ * refer to their position in the payload, qr_field_copy() unescapes a value
+ * straight into its destination buffer.
+ */
+
+typedef struct {
+    const char *key;
+    size_t key_len;
+    const char *value; // still escaped
+    size_t value_len;
+} qr_field_t;
+
+typedef struct {
+    const char *pos;
+} qr_fields_t;
+
+void qr_fields_init(qr_fields_t *fields, const char *payload);
+bool qr_fields_next(qr_fields_t *fields, qr_field_t *field);
+bool qr_field_is(const qr_field_t *field, const char *key);
+/** Unescape the value into dest, false if it does not fit. */
+bool qr_field_copy(const qr_field_t *field, char *dest, size_t size);
+/**
+ * Unescape the value into a fixed-size field such as the SSID of
+ * wifi_config_t, which a value may fill without terminator. Shorter values
+ * are terminated. False if it does not fit.
+ */
+bool qr_field_copy_fixed(const qr_field_t *field, char *dest, size_t size);
+/** Compare the unescaped value case-insensitively. */
+bool qr_field_equals(const qr_field_t *field, const char *value);
+
+#ifdef __cplusplus
+}
+#endif
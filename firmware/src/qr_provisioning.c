@@ -3,20 +3,76 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "qr_provisioning.h"
+#include "app_config.h"
 #include "mqtt.h"
+#include "qr_fields.h"
 
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <strings.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include <esp_check.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 
 static const char *TAG = "qr_provisioning";
 
+#define HID_EVENTS_DEFAULT_INTERVAL_MS 50
+
+static const wifi_config_t wifi_config_default = {
+    .sta = {.btm_enabled = 1,
+            .rm_enabled = 1,
+            .mbo_enabled = 1,
+            .ft_enabled = 1}};
+
+/**
+ * Apply one field of the WIFI: format to conf. Fields with unknown keys are
+ * ignored.
+ */
+static esp_err_t parse_wifi_field(wifi_config_t *conf,
+                                  const qr_field_t *field) {
+    if (qr_field_is(field, "T")) {
+        if (qr_field_equals(field, "WPA") ||
+            qr_field_equals(field, "WPA/WPA2")) {
+            conf->sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+        } else if (qr_field_equals(field, "WEP")) {
+            conf->sta.threshold.authmode = WIFI_AUTH_WEP;
+        } else if (qr_field_equals(field, "nopass")) {
+            conf->sta.threshold.authmode = WIFI_AUTH_OPEN;
+        } else {
+            ESP_LOGW(TAG, "Unknown auth mode '%.*s', defaulting to OPEN",
+                     (int)field->value_len, field->value);
+            conf->sta.threshold.authmode = WIFI_AUTH_OPEN;
+        }
+    } else if (qr_field_is(field, "S")) {
+        ESP_RETURN_ON_FALSE(qr_field_copy_fixed(field, (char *)conf->sta.ssid,
+                                                sizeof(conf->sta.ssid)),
+                            ESP_ERR_INVALID_SIZE, TAG, "SSID too long");
+    } else if (qr_field_is(field, "P")) {
+        ESP_RETURN_ON_FALSE(qr_field_copy_fixed(field,
+                                                (char *)conf->sta.password,
+                                                sizeof(conf->sta.password)),
+                            ESP_ERR_INVALID_SIZE, TAG, "password too long");
+    } else if (qr_field_is(field, "H")) {
+        conf->sta.bssid_set = false;
+        if (qr_field_equals(field, "true")) {
+            conf->sta.scan_method = WIFI_FAST_SCAN;
+            conf->sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+        }
+    }
+    return ESP_OK;
+}
+
 /**
  * Parse a Wi-Fi QR code string of the form:
  *   WIFI:T:<auth>;S:<ssid>;P:<pass>;H:<hidden>;;
+ * where ';', ':', ',' and '\' in values are escaped with '\',
  * and store it to NVS
  * Returns ESP_OK on success, error code otherwise.
  */
@@ -25,52 +81,14 @@ esp_err_t provision_wifi_qr(const char *qr) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    wifi_config_t conf = {.sta = {.btm_enabled = 1,
-                                  .rm_enabled = 1,
-                                  .mbo_enabled = 1,
-                                  .ft_enabled = 1}};
+    wifi_config_t conf = wifi_config_default;
 
-    // Skip "WIFI:" and duplicate the rest for destructive tokenization
-    char *payload = strdup(qr + 5);
-    if (!payload)
-        return ESP_ERR_NO_MEM;
-
-    char *token = strtok(payload, ";");
-    while (token) {
-        if (strncmp(token, "T:", 2) == 0) {
-            const char *auth = token + 2;
-            if (strcasecmp(auth, "WPA") == 0 ||
-                strcasecmp(auth, "WPA/WPA2") == 0) {
-                conf.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-            } else if (strcasecmp(auth, "WEP") == 0) {
-                conf.sta.threshold.authmode = WIFI_AUTH_WEP;
-            } else if (strcasecmp(auth, "nopass") == 0) {
-                conf.sta.threshold.authmode = WIFI_AUTH_OPEN;
-            } else {
-                ESP_LOGW(TAG, "Unknown auth mode '%s', defaulting to OPEN",
-                         auth);
-                conf.sta.threshold.authmode = WIFI_AUTH_OPEN;
-            }
-        } else if (strncmp(token, "S:", 2) == 0) {
-            strncpy((char *)conf.sta.ssid, token + 2,
-                    sizeof(conf.sta.ssid) - 1);
-            conf.sta.ssid[sizeof(conf.sta.ssid) - 1] = '\0';
-        } else if (strncmp(token, "P:", 2) == 0) {
-            strncpy((char *)conf.sta.password, token + 2,
-                    sizeof(conf.sta.password) - 1);
-            conf.sta.password[sizeof(conf.sta.password) - 1] = '\0';
-        } else if (strncmp(token, "H:", 2) == 0) {
-            const char *hidden = token + 2;
-            conf.sta.bssid_set = false;
-            if (strcasecmp(hidden, "true") == 0) {
-                conf.sta.scan_method = WIFI_FAST_SCAN;
-                conf.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
-            }
-        }
-        token = strtok(NULL, ";");
-    }
-
-    free(payload);
+    qr_fields_t fields;
+    qr_field_t field;
+    qr_fields_init(&fields, qr + 5);
+    while (qr_fields_next(&fields, &field))
+        ESP_RETURN_ON_ERROR(parse_wifi_field(&conf, &field), TAG,
+                            "invalid wifi field");
 
     ESP_RETURN_ON_ERROR(esp_wifi_set_config(WIFI_IF_STA, &conf), TAG,
                         "failed to set wifi config");
@@ -85,35 +103,332 @@ esp_err_t provision_wifi_qr(const char *qr) {
 /**
  * Parse a MQTT QR code string of the form:
  *   MQTT:U:<uri>;T:<topic>;;
- * and store it to NVS
+ * with the same escaping as the Wi-Fi format, and store it to NVS
  * Returns ESP_OK on success, error code otherwise.
  */
 esp_err_t provision_mqtt_qr(const char *qr) {
     if (!qr || strncmp(qr, "MQTT:", 5) != 0)
         return ESP_ERR_INVALID_ARG;
 
-    // Skip "MQTT:" and duplicate the rest for destructive tokenization
-    char *payload = strdup(qr + 5);
-    if (!payload)
-        return ESP_ERR_NO_MEM;
+    char uri[sizeof(app_config_get()->mqtt_uri)] = "";
+    char topic[sizeof(app_config_get()->mqtt_topic)] = "";
 
-    const char *uri = NULL;
-    const char *topic = NULL;
+    qr_fields_t fields;
+    qr_field_t field;
+    qr_fields_init(&fields, qr + 5);
+    while (qr_fields_next(&fields, &field)) {
+        if (qr_field_is(&field, "U"))
+            ESP_RETURN_ON_FALSE(qr_field_copy(&field, uri, sizeof(uri)),
+                                ESP_ERR_INVALID_SIZE, TAG, "URI too long");
+        else if (qr_field_is(&field, "T"))
+            ESP_RETURN_ON_FALSE(qr_field_copy(&field, topic, sizeof(topic)),
+                                ESP_ERR_INVALID_SIZE, TAG, "topic too long");
+    }
 
-    char *token = strtok(payload, ";");
-    while (token) {
-        if (strncmp(token, "U:", 2) == 0)
-            uri = token + 2;
-        else if (strncmp(token, "T:", 2) == 0)
-            topic = token + 2;
-        token = strtok(NULL, ";");
+    if (!*uri || !*topic)
+        return ESP_ERR_INVALID_ARG;
+    return mqtt_set_config(uri, topic);
+}
+
+/* Unescape a numeric field value, false if it is not a decimal number */
+static bool qr_field_uint(const qr_field_t *field, uint32_t *value) {
+    char buf[12];
+    if (!qr_field_copy(field, buf, sizeof(buf)) || !isdigit((uint8_t)*buf))
+        return false;
+    char *end;
+    const unsigned long parsed = strtoul(buf, &end, 10);
+    if (*end || parsed > UINT32_MAX)
+        return false;
+    *value = parsed;
+    return true;
+}
+
+/**
+ * Parse a HID QR code string of the form:
+ *   HID:E:<true|false>;R:<interval ms>;D:<deadband>;;
+ * which switches the bridging of HID devices other than boot keyboards on
+ * or off, and store it to NVS. All fields are optional, by default bridging
+ * is enabled with HID_EVENTS_DEFAULT_INTERVAL_MS and no deadband. Devices
+ * connected afterwards use the new settings.
+ * Returns ESP_OK on success, error code otherwise.
+ */
+esp_err_t provision_hid_qr(const char *qr) {
+    if (!qr || strncmp(qr, "HID:", 4) != 0)
+        return ESP_ERR_INVALID_ARG;
+
+    bool enabled = true;
+    uint32_t interval_ms = HID_EVENTS_DEFAULT_INTERVAL_MS;
+    uint32_t deadband = 0;
+
+    qr_fields_t fields;
+    qr_field_t field;
+    qr_fields_init(&fields, qr + 4);
+    while (qr_fields_next(&fields, &field)) {
+        if (qr_field_is(&field, "E"))
+            enabled = !qr_field_equals(&field, "false");
+        else if (qr_field_is(&field, "R"))
+            ESP_RETURN_ON_FALSE(qr_field_uint(&field, &interval_ms),
+                                ESP_ERR_INVALID_ARG, TAG, "invalid interval");
+        else if (qr_field_is(&field, "D"))
+            ESP_RETURN_ON_FALSE(qr_field_uint(&field, &deadband),
+                                ESP_ERR_INVALID_ARG, TAG, "invalid deadband");
     }
 
-    esp_err_t ret = ESP_ERR_INVALID_ARG;
-    if (uri && topic)
-        ret = mqtt_set_config(uri, topic);
+    char spec[sizeof(app_config_get()->hid_events)] = "";
+    if (enabled)
+        snprintf(spec, sizeof(spec), "%" PRIu32 ",%" PRIu32, interval_ms,
+                 deadband);
+    ESP_RETURN_ON_ERROR(app_config_set_str(APP_CONFIG_HID_EVENTS, spec), TAG,
+                        "invalid HID settings");
+    ESP_RETURN_ON_ERROR(app_config_commit(), TAG, "failed to save config");
+    ESP_LOGI(TAG, "Provisioned generic HID events %s",
+             enabled ? spec : "off");
+    return ESP_OK;
+}
+
+/**
+ * Parse a keyboard QR code string of the form:
+ *   KBD:A:<unicode|windows>;L:<us|intl>;;
+ * which selects how alt codes and the keyboard layout of the scanners are
+ * interpreted, and store it to NVS. Omitted fields fall back to the
+ * defaults, Unicode alt codes and the US layout. Keyboards connected
+ * afterwards use the new settings.
+ * Returns ESP_OK on success, error code otherwise.
+ */
+esp_err_t provision_keyboard_qr(const char *qr) {
+    if (!qr || strncmp(qr, "KBD:", 4) != 0)
+        return ESP_ERR_INVALID_ARG;
+
+    const char *alt_codes = "unicode";
+    const char *layout = "us";
 
-    free(payload);
+    qr_fields_t fields;
+    qr_field_t field;
+    qr_fields_init(&fields, qr + 4);
+    while (qr_fields_next(&fields, &field)) {
+        if (qr_field_is(&field, "A")) {
+            if (qr_field_equals(&field, "windows"))
+                alt_codes = "windows";
+            else
+                ESP_RETURN_ON_FALSE(qr_field_equals(&field, "unicode"),
+                                    ESP_ERR_INVALID_ARG, TAG,
+                                    "invalid alt codes");
+        } else if (qr_field_is(&field, "L")) {
+            if (qr_field_equals(&field, "intl"))
+                layout = "intl";
+            else
+                ESP_RETURN_ON_FALSE(qr_field_equals(&field, "us"),
+                                    ESP_ERR_INVALID_ARG, TAG,
+                                    "invalid layout");
+        }
+    }
 
+    char spec[sizeof(app_config_get()->keyboard)];
+    snprintf(spec, sizeof(spec), "%s,%s", alt_codes, layout);
+    ESP_RETURN_ON_ERROR(app_config_set_str(APP_CONFIG_KEYBOARD, spec), TAG,
+                        "invalid keyboard settings");
+    ESP_RETURN_ON_ERROR(app_config_commit(), TAG, "failed to save config");
+    ESP_LOGI(TAG, "Provisioned keyboard %s", spec);
+    return ESP_OK;
+}
+
+/**
+ * Parse an AIM QR code string of the form:
+ *   AIM:R:<true|false>;;
+ * which switches the routing of scans by their AIM symbology identifier on
+ * or off, and store it to NVS. Routing is enabled if R is omitted.
+ * Returns ESP_OK on success, error code otherwise.
+ */
+esp_err_t provision_aim_qr(const char *qr) {
+    if (!qr || strncmp(qr, "AIM:", 4) != 0)
+        return ESP_ERR_INVALID_ARG;
+
+    bool enabled = true;
+    qr_fields_t fields;
+    qr_field_t field;
+    qr_fields_init(&fields, qr + 4);
+    while (qr_fields_next(&fields, &field)) {
+        if (qr_field_is(&field, "R"))
+            enabled = !qr_field_equals(&field, "false");
+    }
+
+    ESP_RETURN_ON_ERROR(
+        app_config_set_str(APP_CONFIG_AIM_ROUTING, enabled ? "on" : ""), TAG,
+        "invalid AIM settings");
+    ESP_RETURN_ON_ERROR(app_config_commit(), TAG, "failed to save config");
+    ESP_LOGI(TAG, "Provisioned AIM routing %s", enabled ? "on" : "off");
+    return ESP_OK;
+}
+
+/*
+ * Combined provisioning payloads may be split across several codes, which
+ * are collected here until all parts have been scanned, in any order.
+ */
+#define PROV_MAX_PARTS 8
+#define PROV_MAX_SIZE 4096
+#define PROV_PART_TIMEOUT_US (120 * 1000000LL)
+
+static struct {
+    int count;
+    char *parts[PROV_MAX_PARTS];
+    int64_t started;
+} prov_parts;
+
+static void prov_parts_clear(void) {
+    for (int i = 0; i < PROV_MAX_PARTS; ++i) {
+        free(prov_parts.parts[i]);
+        prov_parts.parts[i] = NULL;
+    }
+    prov_parts.count = 0;
+}
+
+/**
+ * Apply all settings of a combined payload as one transaction: everything is
+ * validated before anything is changed, the config is saved with a single
+ * commit and Wi-Fi and MQTT go through one reconnect cycle together.
+ */
+static esp_err_t provision_combined(const char *payload) {
+    wifi_config_t wifi_conf = wifi_config_default;
+    bool has_wifi = false;
+    char uri[sizeof(app_config_get()->mqtt_uri)] = "";
+    char topic[sizeof(app_config_get()->mqtt_topic)] = "";
+    char lock_key[sizeof(app_config_get()->lock_key)] = "";
+    bool has_lock = false;
+
+    qr_fields_t fields;
+    qr_field_t field;
+    qr_fields_init(&fields, payload);
+    while (qr_fields_next(&fields, &field)) {
+        if (qr_field_is(&field, "WT") || qr_field_is(&field, "WS") ||
+            qr_field_is(&field, "WP") || qr_field_is(&field, "WH")) {
+            // The fields of the WIFI: format
+            qr_field_t wifi_field = field;
+            ++wifi_field.key;
+            --wifi_field.key_len;
+            ESP_RETURN_ON_ERROR(parse_wifi_field(&wifi_conf, &wifi_field), TAG,
+                                "invalid wifi field");
+            has_wifi = true;
+        } else if (qr_field_is(&field, "MU")) {
+            ESP_RETURN_ON_FALSE(qr_field_copy(&field, uri, sizeof(uri)),
+                                ESP_ERR_INVALID_SIZE, TAG, "URI too long");
+        } else if (qr_field_is(&field, "MT")) {
+            ESP_RETURN_ON_FALSE(qr_field_copy(&field, topic, sizeof(topic)),
+                                ESP_ERR_INVALID_SIZE, TAG, "topic too long");
+        } else if (qr_field_is(&field, "L")) {
+            ESP_RETURN_ON_FALSE(
+                qr_field_copy(&field, lock_key, sizeof(lock_key)),
+                ESP_ERR_INVALID_SIZE, TAG, "lock key too long");
+            has_lock = true;
+        } else {
+            ESP_LOGW(TAG, "Ignoring unknown field '%.*s'", (int)field.key_len,
+                     field.key);
+        }
+    }
+
+    const bool has_mqtt = *uri || *topic;
+    ESP_RETURN_ON_FALSE(!has_mqtt || (*uri && *topic), ESP_ERR_INVALID_ARG,
+                        TAG, "MQTT needs both URI and topic");
+    ESP_RETURN_ON_FALSE(has_wifi || has_mqtt || has_lock, ESP_ERR_INVALID_ARG,
+                        TAG, "nothing to provision");
+
+    esp_err_t ret = ESP_OK;
+    if (has_mqtt) {
+        ret = app_config_set_str(APP_CONFIG_MQTT_URI, uri);
+        if (ret == ESP_OK)
+            ret = app_config_set_str(APP_CONFIG_MQTT_TOPIC, topic);
+    }
+    if (ret == ESP_OK && has_lock)
+        ret = app_config_set_str(APP_CONFIG_LOCK_KEY, lock_key);
+    if (ret != ESP_OK) {
+        app_config_revert();
+        ESP_LOGE(TAG, "failed to set config");
+        return ret;
+    }
+    // A failed commit reverts the config, so it changes nothing
+    ESP_RETURN_ON_ERROR(app_config_commit(), TAG, "failed to save config");
+    // Only once the rest is saved, for the same reason
+    if (has_wifi)
+        ESP_RETURN_ON_ERROR(esp_wifi_set_config(WIFI_IF_STA, &wifi_conf), TAG,
+                            "failed to set wifi config");
+
+    ESP_LOGI(TAG, "Provisioned%s%s%s", has_wifi ? " wifi" : "",
+             has_mqtt ? " mqtt" : "",
+             has_lock ? (*lock_key ? " lock" : " unlock") : "");
+    if (has_wifi || has_mqtt) {
+        if (has_mqtt)
+            mqtt_reload_config();
+        if (has_wifi)
+            esp_wifi_disconnect();
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (has_wifi)
+            esp_wifi_connect();
+        if (has_mqtt)
+            mqtt_reconnect();
+    }
+    return ESP_OK;
+}
+
+/**
+ * Parse a combined provisioning QR code string of the form:
+ *   PROV:WT:<auth>;WS:<ssid>;WP:<pass>;WH:<hidden>;MU:<uri>;MT:<topic>;L:<key>;;
+ * where every field is optional, or one part of such a payload:
+ *   PROV<i>/<n>:<part i of n>
+ * with single digits i and n. Anything else starting with PROV is not a
+ * provisioning code.
+ * Returns ESP_OK on success or when more parts are expected,
+ * ESP_ERR_NOT_FOUND if it is not a provisioning code, error code otherwise.
+ */
+esp_err_t provision_combined_qr(const char *qr) {
+    if (!qr || strncmp(qr, "PROV", 4) != 0)
+        return ESP_ERR_INVALID_ARG;
+    if (qr[4] == ':')
+        return provision_combined(qr + 5);
+
+    if (!isdigit((unsigned char)qr[4]) || qr[5] != '/' ||
+        !isdigit((unsigned char)qr[6]) || qr[7] != ':')
+        return ESP_ERR_NOT_FOUND;
+    const int index = qr[4] - '0', count = qr[6] - '0', prefix_len = 4;
+    if (count < 1 || count > PROV_MAX_PARTS || index < 1 || index > count) {
+        ESP_LOGE(TAG, "Invalid provisioning part header");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const int64_t now = esp_timer_get_time();
+    if (prov_parts.count &&
+        (prov_parts.count != count ||
+         now - prov_parts.started > PROV_PART_TIMEOUT_US)) {
+        ESP_LOGW(TAG, "Discarding incomplete provisioning parts");
+        prov_parts_clear();
+    }
+    if (!prov_parts.count) {
+        prov_parts.count = count;
+        prov_parts.started = now;
+    }
+
+    char *part = strdup(qr + 4 + prefix_len);
+    if (!part)
+        return ESP_ERR_NO_MEM;
+    free(prov_parts.parts[index - 1]);
+    prov_parts.parts[index - 1] = part;
+
+    size_t size = 1;
+    for (int i = 0; i < count; ++i) {
+        if (!prov_parts.parts[i]) {
+            ESP_LOGI(TAG, "Got provisioning part %d of %d", index, count);
+            return ESP_OK;
+        }
+        size += strlen(prov_parts.parts[i]);
+    }
+
+    esp_err_t ret = ESP_ERR_INVALID_SIZE;
+    char *payload = size <= PROV_MAX_SIZE ? malloc(size) : NULL;
+    if (payload) {
+        *payload = 0;
+        for (int i = 0; i < count; ++i)
+            strcat(payload, prov_parts.parts[i]);
+        ret = provision_combined(payload);
+        free(payload);
+    }
+    prov_parts_clear();
     return ret;
 }
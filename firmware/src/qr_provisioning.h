@@ -12,6 +12,10 @@ extern "C" {
 
 esp_err_t provision_wifi_qr(const char *qr);
 esp_err_t provision_mqtt_qr(const char *qr);
+esp_err_t provision_combined_qr(const char *qr);
+esp_err_t provision_hid_qr(const char *qr);
+esp_err_t provision_keyboard_qr(const char *qr);
+esp_err_t provision_aim_qr(const char *qr);
 
 #ifdef __cplusplus
 }
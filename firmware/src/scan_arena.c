@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "scan_arena.h"
+
+#include <string.h>
+
+static size_t chunks_for(size_t size) {
+    return (size + SCAN_ARENA_CHUNK_SIZE - 1) / SCAN_ARENA_CHUNK_SIZE;
+}
+
+static size_t chunk_index(const scan_arena_t *arena, const char *run) {
+    return (run - arena->data[0]) / SCAN_ARENA_CHUNK_SIZE;
+}
+
+static bool chunks_free(const scan_arena_t *arena, size_t first,
+                        size_t count) {
+    for (size_t i = first; i < first + count; ++i)
+        if (__atomic_load_n(&arena->used[i], __ATOMIC_ACQUIRE))
+            return false;
+    return true;
+}
+
+static void chunks_take(scan_arena_t *arena, size_t first, size_t count) {
+    for (size_t i = first; i < first + count; ++i)
+        arena->used[i] = true;
+    arena->run[first] = count;
+    arena->next = (first + count) % SCAN_ARENA_CHUNK_COUNT;
+}
+
+void scan_arena_init(scan_arena_t *arena) {
+    memset(arena->used, 0, sizeof(arena->used));
+    memset(arena->run, 0, sizeof(arena->run));
+    arena->next = 0;
+}
+
+char *scan_arena_alloc(scan_arena_t *arena, size_t size) {
+    const size_t count = chunks_for(size ? size : 1);
+    if (count > SCAN_ARENA_CHUNK_COUNT)
+        return NULL;
+    // From the cursor to the end of the pool, then from its start
+    for (size_t n = 0; n < SCAN_ARENA_CHUNK_COUNT; ++n) {
+        const size_t first = (arena->next + n) % SCAN_ARENA_CHUNK_COUNT;
+        if (first + count <= SCAN_ARENA_CHUNK_COUNT &&
+            chunks_free(arena, first, count)) {
+            chunks_take(arena, first, count);
+            return arena->data[first];
+        }
+    }
+    return NULL;
+}
+
+char *scan_arena_grow(scan_arena_t *arena, char *run, size_t used,
+                      size_t size) {
+    const size_t first = chunk_index(arena, run);
+    const size_t count = arena->run[first];
+    const size_t wanted = chunks_for(size);
+    if (wanted <= count)
+        return run;
+    if (first + wanted <= SCAN_ARENA_CHUNK_COUNT &&
+        chunks_free(arena, first + count, wanted - count)) {
+        chunks_take(arena, first, wanted);
+        return run;
+    }
+    char *moved = scan_arena_alloc(arena, size);
+    if (!moved)
+        return NULL;
+    memcpy(moved, run, used);
+    scan_arena_release(arena, run);
+    return moved;
+}
+
+size_t scan_arena_capacity(const scan_arena_t *arena, const char *run) {
+    return arena->run[chunk_index(arena, run)] * SCAN_ARENA_CHUNK_SIZE;
+}
+
+void scan_arena_release(scan_arena_t *arena, const char *run) {
+    const size_t first = chunk_index(arena, run);
+    const size_t count = arena->run[first];
+    // The first chunk last: once it is free, the app task may take it and
+    // overwrite run[first]
+    for (size_t i = first + 1; i < first + count; ++i)
+        __atomic_store_n(&arena->used[i], false, __ATOMIC_RELEASE);
+    __atomic_store_n(&arena->used[first], false, __ATOMIC_RELEASE);
+}
+
+size_t scan_arena_free_chunks(const scan_arena_t *arena) {
+    size_t count = 0;
+    for (size_t i = 0; i < SCAN_ARENA_CHUNK_COUNT; ++i)
+        count += !__atomic_load_n(&arena->used[i], __ATOMIC_ACQUIRE);
+    return count;
+}
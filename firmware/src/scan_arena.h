@@ -0,0 +1,60 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Memory for scans, from their first key until whoever they are handed to
+ * is done with them. The pool is split into fixed-size chunks and a scan
+ * takes a run of consecutive chunks, so it is seen as a plain string.
+ *
+ * Runs are handed out from a cursor that moves on and wraps around the
+ * pool. Scans are mostly released in the order they were taken, so the
+ * chunks behind the scan being collected are usually free and it grows
+ * into them. Otherwise it moves to a larger run elsewhere.
+ *
+ * Chunks are taken by the app task only, and released from any task.
+ */
+#ifndef SCAN_ARENA_CHUNK_SIZE
+#define SCAN_ARENA_CHUNK_SIZE 256
+#endif
+#ifndef SCAN_ARENA_CHUNK_COUNT
+#define SCAN_ARENA_CHUNK_COUNT 64 // 16 KB
+#endif
+
+typedef struct {
+    char data[SCAN_ARENA_CHUNK_COUNT][SCAN_ARENA_CHUNK_SIZE];
+    bool used[SCAN_ARENA_CHUNK_COUNT];
+    uint16_t run[SCAN_ARENA_CHUNK_COUNT]; // chunks of the run starting here
+    uint16_t next;                        // where to look for the next run
+} scan_arena_t;
+
+void scan_arena_init(scan_arena_t *arena);
+/** A run of at least size bytes, NULL if there is no such run free */
+char *scan_arena_alloc(scan_arena_t *arena, size_t size);
+/**
+ * Grow a run to at least size bytes, in place or by moving its first used
+ * bytes to a new run. Returns the run, or NULL if it could not grow and is
+ * left as it was.
+ */
+char *scan_arena_grow(scan_arena_t *arena, char *run, size_t used,
+                      size_t size);
+/** Bytes a run holds */
+size_t scan_arena_capacity(const scan_arena_t *arena, const char *run);
+/** Return a run to the pool, safe to call from any task */
+void scan_arena_release(scan_arena_t *arena, const char *run);
+/** Chunks not taken by any run */
+size_t scan_arena_free_chunks(const scan_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,121 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "scan_assembler.h"
+#include "text_decoder.h"
+
+#include <string.h>
+
+#include <esp_log.h>
+
+static const char *TAG = "scan_assembler";
+
+_Static_assert(SCAN_ASSEMBLER_MAX_SCAN_SIZE <=
+                   SCAN_ARENA_CHUNK_SIZE * SCAN_ARENA_CHUNK_COUNT,
+               "scans larger than the arena");
+
+void scan_assembler_init(scan_assembler_t *assembler, scan_arena_t *arena,
+                         scan_cb_t callback, void *arg) {
+    assembler->arena = arena;
+    assembler->callback = callback;
+    assembler->arg = arg;
+    assembler->flush = NULL;
+    assembler->flush_arg = NULL;
+    assembler->scan = NULL;
+    assembler->length = 0;
+    assembler->capacity = 0;
+    assembler->last_key_us = 0;
+}
+
+void scan_assembler_set_flush(scan_assembler_t *assembler,
+                              scan_flush_cb_t flush, void *arg) {
+    assembler->flush = flush;
+    assembler->flush_arg = arg;
+}
+
+void scan_assembler_submit(scan_assembler_t *assembler) {
+    if (!assembler->length)
+        return;
+    assembler->scan[assembler->length] = 0;
+    ESP_LOGI(TAG, "submitting scan: %s", assembler->scan);
+    assembler->callback(assembler->scan, assembler->length, assembler->arg);
+    scan_arena_release(assembler->arena, assembler->scan);
+    assembler->scan = NULL;
+    assembler->length = 0;
+    assembler->capacity = 0;
+}
+
+void scan_assembler_put(scan_assembler_t *assembler, char c, int64_t now_us) {
+    scan_assembler_put_text(assembler, &c, c ? 1 : 0, now_us);
+}
+
+/* Make room for size bytes as far as the arena and the limit allow */
+static void scan_assembler_reserve(scan_assembler_t *assembler, size_t size) {
+    if (size > SCAN_ASSEMBLER_MAX_SCAN_SIZE)
+        size = SCAN_ASSEMBLER_MAX_SCAN_SIZE;
+    if (size <= assembler->capacity)
+        return;
+    char *scan = assembler->scan
+                     ? scan_arena_grow(assembler->arena, assembler->scan,
+                                       assembler->length, size)
+                     : scan_arena_alloc(assembler->arena, size);
+    if (!scan && !assembler->scan)
+        scan = scan_arena_alloc(assembler->arena, 1);
+    if (scan) {
+        assembler->scan = scan;
+        assembler->capacity = scan_arena_capacity(assembler->arena, scan);
+        if (assembler->capacity > SCAN_ASSEMBLER_MAX_SCAN_SIZE)
+            assembler->capacity = SCAN_ASSEMBLER_MAX_SCAN_SIZE;
+    }
+}
+
+/* Copy text without tabs, submitting at a character boundary when full */
+static void scan_assembler_append(scan_assembler_t *assembler,
+                                  const char *text, size_t length) {
+    while (length) {
+        scan_assembler_reserve(assembler, assembler->length + length + 1);
+        if (!assembler->capacity) {
+            ESP_LOGE(TAG, "no memory for scans, %zu bytes dropped", length);
+            return;
+        }
+        const size_t n = utf8_truncate(
+            text, length, assembler->capacity - 1 - assembler->length);
+        memcpy(assembler->scan + assembler->length, text, n);
+        assembler->length += n;
+        text += n;
+        length -= n;
+        if (length) {
+            ESP_LOGW(TAG, "scan too long, submitting before collecting "
+                          "more keys");
+            scan_assembler_submit(assembler);
+        }
+    }
+}
+
+void scan_assembler_put_text(scan_assembler_t *assembler, const char *text,
+                             size_t length, int64_t now_us) {
+    if (!utf8_valid(text, length)) {
+        ESP_LOGW(TAG, "invalid UTF-8 from keyboard, replaced");
+        text = "\xef\xbf\xbd"; // U+FFFD
+        length = 3;
+    }
+    const char *tab;
+    while ((tab = memchr(text, '\t', length))) {
+        scan_assembler_append(assembler, text, tab - text);
+        scan_assembler_submit(assembler);
+        length -= tab + 1 - text;
+        text = tab + 1;
+    }
+    scan_assembler_append(assembler, text, length);
+    assembler->last_key_us = now_us;
+}
+
+void scan_assembler_poll(scan_assembler_t *assembler, int64_t now_us) {
+    if (assembler->last_key_us + SCAN_ASSEMBLER_TIMEOUT_US < now_us) {
+        if (assembler->flush)
+            assembler->flush(assembler->flush_arg);
+        scan_assembler_submit(assembler);
+        assembler->last_key_us = now_us;
+    }
+}
@@ -0,0 +1,74 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scan_arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Collects UTF-8 text into scans. A scan ends with a tab or when no key has
+ * been pressed for SCAN_ASSEMBLER_TIMEOUT_US. Time is passed in by the
+ * caller, so this runs on the host as well.
+ */
+#define SCAN_ASSEMBLER_TIMEOUT_US 50000 // 50ms
+
+/*
+ * Scans are collected in the arena and grow chunk by chunk up to
+ * SCAN_ASSEMBLER_MAX_SCAN_SIZE bytes including the terminator. Longer ones,
+ * and scans the arena has no room for, are split.
+ */
+#ifndef SCAN_ASSEMBLER_MAX_SCAN_SIZE
+#define SCAN_ASSEMBLER_MAX_SCAN_SIZE 8192
+#endif
+
+/**
+ * A complete scan, terminated. Its chunks are released once this returns,
+ * so anything kept must be copied.
+ */
+typedef void (*scan_cb_t)(const char *scan, size_t length, void *arg);
+/**
+ * Called before a scan is submitted on timeout, to pass on text the source
+ * of the keys still holds back
+ */
+typedef void (*scan_flush_cb_t)(void *arg);
+
+typedef struct {
+    scan_arena_t *arena;
+    scan_cb_t callback;
+    void *arg;
+    scan_flush_cb_t flush;
+    void *flush_arg;
+    char *scan; // being collected, NULL if none
+    size_t length;
+    size_t capacity;
+    int64_t last_key_us;
+} scan_assembler_t;
+
+void scan_assembler_init(scan_assembler_t *assembler, scan_arena_t *arena,
+                         scan_cb_t callback, void *arg);
+void scan_assembler_set_flush(scan_assembler_t *assembler,
+                              scan_flush_cb_t flush, void *arg);
+/** Add a character, 0 only counts as key activity */
+void scan_assembler_put(scan_assembler_t *assembler, char c, int64_t now_us);
+/**
+ * Add the text of a keyboard report, an empty one only counts as key
+ * activity. Text that is not valid UTF-8 is replaced by U+FFFD.
+ */
+void scan_assembler_put_text(scan_assembler_t *assembler, const char *text,
+                             size_t length, int64_t now_us);
+/** Submit the pending scan once the timeout has passed */
+void scan_assembler_poll(scan_assembler_t *assembler, int64_t now_us);
+void scan_assembler_submit(scan_assembler_t *assembler);
+
+#ifdef __cplusplus
+}
+#endif
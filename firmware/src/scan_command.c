@@ -0,0 +1,167 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "scan_command.h"
+#include "config_lock.h"
+#include "ota.h"
+#include "qr_provisioning.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+static const char *TAG = "scan_command";
+
+typedef enum {
+    SCAN_COMMAND_UNLOCKED, // only while the config is unlocked
+    SCAN_COMMAND_LOCKED,   // only while the config is locked
+    SCAN_COMMAND_ALWAYS,
+} scan_command_lock_t;
+
+/*
+ * When a scan that ran a command is still published as a regular barcode.
+ * A handler returns ESP_ERR_NOT_FOUND for a scan that only shares the prefix.
+ */
+typedef enum {
+    SCAN_COMMAND_PUBLISH_NEVER,
+    SCAN_COMMAND_PUBLISH_FAILED,    // the command failed
+    SCAN_COMMAND_PUBLISH_NOT_FOUND, // not a command after all, see below
+} scan_command_publish_t;
+
+/**
+ * Handlers get the whole scan and the part following the prefix.
+ */
+typedef esp_err_t (*scan_command_handler_t)(const char *scan, const char *arg);
+
+typedef struct {
+    const char *prefix;
+    size_t prefix_len;
+    scan_command_lock_t lock;
+    scan_command_publish_t publish;
+    scan_command_handler_t handler;
+} scan_command_t;
+
+#define SCAN_COMMAND(prefix, lock, publish, handler)                           \
+    {prefix, sizeof(prefix) - 1, lock, publish, handler}
+
+static esp_err_t unlock_command(const char *scan, const char *arg) {
+    (void)scan;
+    return config_unlock(arg);
+}
+
+static esp_err_t lock_command(const char *scan, const char *arg) {
+    (void)scan;
+    return config_lock(arg);
+}
+
+static esp_err_t ota_command(const char *scan, const char *arg) {
+    (void)scan;
+    return update_firmware(arg);
+}
+
+static esp_err_t wifi_command(const char *scan, const char *arg) {
+    (void)arg;
+    return provision_wifi_qr(scan);
+}
+
+static esp_err_t mqtt_command(const char *scan, const char *arg) {
+    (void)arg;
+    return provision_mqtt_qr(scan);
+}
+
+static esp_err_t prov_command(const char *scan, const char *arg) {
+    (void)arg;
+    return provision_combined_qr(scan);
+}
+
+static esp_err_t hid_command(const char *scan, const char *arg) {
+    (void)arg;
+    return provision_hid_qr(scan);
+}
+
+static esp_err_t keyboard_command(const char *scan, const char *arg) {
+    (void)arg;
+    return provision_keyboard_qr(scan);
+}
+
+static esp_err_t aim_command(const char *scan, const char *arg) {
+    (void)arg;
+    return provision_aim_qr(scan);
+}
+
+/*
+ * Commands sharing a first byte are tried in table order, so a prefix must
+ * come before any shorter prefix it starts with.
+ */
+static const scan_command_t commands[] = {
+    // A failed unlock attempt is published like any other barcode
+    SCAN_COMMAND("UNLOCK:", SCAN_COMMAND_LOCKED, SCAN_COMMAND_PUBLISH_FAILED,
+                 unlock_command),
+    SCAN_COMMAND("LOCK:", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NEVER,
+                 lock_command),
+    SCAN_COMMAND("OTA:", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NEVER,
+                 ota_command),
+    SCAN_COMMAND("WIFI:", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NEVER,
+                 wifi_command),
+    SCAN_COMMAND("MQTT:", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NEVER,
+                 mqtt_command),
+    // Other barcodes starting with PROV are published, but never a failed
+    // provisioning code, which carries passwords
+    SCAN_COMMAND("PROV", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NOT_FOUND,
+                 prov_command),
+    SCAN_COMMAND("HID:", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NEVER,
+                 hid_command),
+    SCAN_COMMAND("KBD:", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NEVER,
+                 keyboard_command),
+    SCAN_COMMAND("AIM:", SCAN_COMMAND_UNLOCKED, SCAN_COMMAND_PUBLISH_NEVER,
+                 aim_command),
+};
+
+#define SCAN_COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+_Static_assert(SCAN_COMMAND_COUNT < UINT8_MAX, "too many scan commands");
+
+/*
+ * The first byte of a scan selects the chain of commands starting with that
+ * byte, most scans hit an empty slot and are done after a single table load.
+ * Entries are 1-based indices into commands[], 0 terminates a chain.
+ */
+static uint8_t first_byte_index[256];
+static uint8_t next_index[SCAN_COMMAND_COUNT];
+
+void scan_command_start(void) {
+    for (int i = SCAN_COMMAND_COUNT - 1; i >= 0; --i) {
+        const uint8_t first = commands[i].prefix[0];
+        next_index[i] = first_byte_index[first];
+        first_byte_index[first] = i + 1;
+    }
+}
+
+bool scan_command_dispatch(const char *scan) {
+    for (uint8_t i = first_byte_index[(uint8_t)scan[0]]; i;
+         i = next_index[i - 1]) {
+        const scan_command_t *command = &commands[i - 1];
+        if (strncmp(scan + 1, command->prefix + 1, command->prefix_len - 1))
+            continue;
+
+        const bool locked = is_config_locked();
+        if ((locked && command->lock == SCAN_COMMAND_UNLOCKED) ||
+            (!locked && command->lock == SCAN_COMMAND_LOCKED))
+            return true;
+
+        ESP_LOGI(TAG, "running command %s", command->prefix);
+        const esp_err_t ret =
+            command->handler(scan, scan + command->prefix_len);
+        if (ret == ESP_ERR_NOT_FOUND &&
+            command->publish == SCAN_COMMAND_PUBLISH_NOT_FOUND)
+            return true;
+        if (ret != ESP_OK)
+            ESP_LOGW(TAG, "command %s failed: %s", command->prefix,
+                     esp_err_to_name(ret));
+        return ret != ESP_OK && command->publish == SCAN_COMMAND_PUBLISH_FAILED;
+    }
+    return true;
+}
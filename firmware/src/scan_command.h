@@ -0,0 +1,22 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void scan_command_start(void);
+/**
+ * Run the command contained in a scan, if any.
+ * Returns true if the scan should be published as a regular barcode.
+ */
+bool scan_command_dispatch(const char *scan);
+
+#ifdef __cplusplus
+}
+#endif
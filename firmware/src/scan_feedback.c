@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "scan_feedback.h"
+
+#include <stddef.h>
+
+/*
+ * Each pattern ends with the LED off for a moment, so patterns following
+ * each other stay apart.
+ */
+#define LED_ON SCAN_FEEDBACK_LED_SCROLL_LOCK
+
+static const scan_feedback_step_t acked_pattern[] = {
+    {LED_ON, 150},
+    {0, 350},
+    {0, 0},
+};
+
+static const scan_feedback_step_t buffered_pattern[] = {
+    {LED_ON, 500},
+    {0, 300},
+    {LED_ON, 500},
+    {0, 500},
+    {0, 0},
+};
+
+static const scan_feedback_step_t failed_pattern[] = {
+    {LED_ON, 80},
+    {0, 80},
+    {LED_ON, 80},
+    {0, 80},
+    {LED_ON, 80},
+    {0, 80},
+    {LED_ON, 80},
+    {0, 500},
+    {0, 0},
+};
+
+static const scan_feedback_step_t *const patterns[] = {
+    [SCAN_FEEDBACK_ACKED] = acked_pattern,
+    [SCAN_FEEDBACK_BUFFERED] = buffered_pattern,
+    [SCAN_FEEDBACK_FAILED] = failed_pattern,
+};
+
+void scan_feedback_init(scan_feedback_t *feedback,
+                        scan_feedback_leds_cb_t set_leds, void *arg) {
+    feedback->set_leds = set_leds;
+    feedback->arg = arg;
+    feedback->signaled = 0;
+    feedback->step = NULL;
+    feedback->step_until_us = 0;
+}
+
+void scan_feedback_signal(scan_feedback_t *feedback,
+                          scan_feedback_outcome_t outcome) {
+    __atomic_fetch_or(&feedback->signaled, 1u << outcome, __ATOMIC_RELEASE);
+}
+
+static void step_start(scan_feedback_t *feedback, int64_t now_us) {
+    feedback->set_leds(feedback->step->leds, feedback->arg);
+    feedback->step_until_us = now_us + feedback->step->ms * 1000LL;
+}
+
+void scan_feedback_poll(scan_feedback_t *feedback, int64_t now_us) {
+    if (feedback->step) {
+        if (now_us < feedback->step_until_us)
+            return;
+        if ((++feedback->step)->ms) {
+            step_start(feedback, now_us);
+            return;
+        }
+        feedback->step = NULL;
+    }
+
+    uint32_t signaled =
+        __atomic_exchange_n(&feedback->signaled, 0, __ATOMIC_ACQUIRE);
+    if (!signaled)
+        return;
+    scan_feedback_outcome_t outcome = SCAN_FEEDBACK_FAILED;
+    while (!(signaled & 1u << outcome))
+        --outcome;
+    // The others follow once this one is shown
+    signaled &= ~(1u << outcome);
+    if (signaled)
+        __atomic_fetch_or(&feedback->signaled, signaled, __ATOMIC_RELAXED);
+    feedback->step = patterns[outcome];
+    step_start(feedback, now_us);
+}
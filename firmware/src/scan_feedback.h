@@ -0,0 +1,63 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shows the operator what became of a scan, as a blink pattern on the
+ * Scroll Lock LED of the keyboards. The scanner's own beep only confirms the
+ * decode:
+ *
+ *   acknowledged by the broker   one short blink
+ *   buffered while offline       two long blinks
+ *   failed, rescan               four fast blinks
+ *
+ * Caps Lock and Num Lock are left alone, as scanners that follow the host's
+ * lock state would change what they type.
+ *
+ * Outcomes can be signaled from any task and are shown by the app task,
+ * which polls. Outcomes signaled while a pattern is shown are coalesced and
+ * follow it, the most severe first.
+ */
+#define SCAN_FEEDBACK_LED_SCROLL_LOCK 0x04
+
+// In order of severity
+typedef enum {
+    SCAN_FEEDBACK_ACKED = 0,
+    SCAN_FEEDBACK_BUFFERED,
+    SCAN_FEEDBACK_FAILED,
+} scan_feedback_outcome_t;
+
+typedef struct {
+    uint8_t leds;
+    uint16_t ms; // 0 ends the pattern
+} scan_feedback_step_t;
+
+/** Set the LEDs of the boot keyboard output report on all keyboards */
+typedef void (*scan_feedback_leds_cb_t)(uint8_t leds, void *arg);
+
+typedef struct {
+    scan_feedback_leds_cb_t set_leds;
+    void *arg;
+    uint32_t signaled; // outcomes not yet shown, a bit each
+    const scan_feedback_step_t *step; // being shown, NULL if idle
+    int64_t step_until_us;
+} scan_feedback_t;
+
+void scan_feedback_init(scan_feedback_t *feedback,
+                        scan_feedback_leds_cb_t set_leds, void *arg);
+/** Queue the pattern of an outcome, safe to call from any task */
+void scan_feedback_signal(scan_feedback_t *feedback,
+                          scan_feedback_outcome_t outcome);
+void scan_feedback_poll(scan_feedback_t *feedback, int64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
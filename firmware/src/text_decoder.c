@@ -0,0 +1,348 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "text_decoder.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <usb/hid_usage_keyboard.h>
+
+static const char *TAG = "text_decoder";
+
+#define MOD_ALT (HID_LEFT_ALT | HID_RIGHT_ALT)
+#define MOD_CONTROL (HID_LEFT_CONTROL | HID_RIGHT_CONTROL)
+#define MOD_SHIFT (HID_LEFT_SHIFT | HID_RIGHT_SHIFT)
+#define MOD_GUI (HID_LEFT_GUI | HID_RIGHT_GUI)
+
+#define HEX_MAX_DIGITS 6
+#define CODEPOINT_MAX 0x10ffff
+#define CODEPOINT_REPLACEMENT 0xfffd
+
+// Code page 437, 0x80 to 0xff
+static const uint16_t oem_code_page[128] = {
+    0x00c7, 0x00fc, 0x00e9, 0x00e2, 0x00e4, 0x00e0, 0x00e5, 0x00e7,
+    0x00ea, 0x00eb, 0x00e8, 0x00ef, 0x00ee, 0x00ec, 0x00c4, 0x00c5,
+    0x00c9, 0x00e6, 0x00c6, 0x00f4, 0x00f6, 0x00f2, 0x00fb, 0x00f9,
+    0x00ff, 0x00d6, 0x00dc, 0x00a2, 0x00a3, 0x00a5, 0x20a7, 0x0192,
+    0x00e1, 0x00ed, 0x00f3, 0x00fa, 0x00f1, 0x00d1, 0x00aa, 0x00ba,
+    0x00bf, 0x2310, 0x00ac, 0x00bd, 0x00bc, 0x00a1, 0x00ab, 0x00bb,
+    0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+    0x2555, 0x2563, 0x2551, 0x2557, 0x255d, 0x255c, 0x255b, 0x2510,
+    0x2514, 0x2534, 0x252c, 0x251c, 0x2500, 0x253c, 0x255e, 0x255f,
+    0x255a, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256c, 0x2567,
+    0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256b,
+    0x256a, 0x2518, 0x250c, 0x2588, 0x2584, 0x258c, 0x2590, 0x2580,
+    0x03b1, 0x00df, 0x0393, 0x03c0, 0x03a3, 0x03c3, 0x00b5, 0x03c4,
+    0x03a6, 0x0398, 0x03a9, 0x03b4, 0x221e, 0x03c6, 0x03b5, 0x2229,
+    0x2261, 0x00b1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00f7, 0x2248,
+    0x00b0, 0x2219, 0x00b7, 0x221a, 0x207f, 0x00b2, 0x25a0, 0x00a0,
+};
+
+// Windows-1252, 0x80 to 0x9f, the rest is Latin-1. Unassigned codes are kept.
+static const uint16_t ansi_code_page[32] = {
+    0x20ac, 0x0081, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+    0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008d, 0x017d, 0x008f,
+    0x0090, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+    0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x009d, 0x017e, 0x0178,
+};
+
+// Letters a dead key of the US International layout combines with
+typedef struct {
+    char accent;
+    const char *bases;
+    uint8_t composed[14];
+} dead_key_t;
+
+static const dead_key_t dead_keys[] = {
+    {'\'', "aeiouycAEIOUYC",
+     {0xe1, 0xe9, 0xed, 0xf3, 0xfa, 0xfd, 0xe7, 0xc1, 0xc9, 0xcd, 0xd3, 0xda,
+      0xdd, 0xc7}},
+    {'"', "aeiouyAEIOU",
+     {0xe4, 0xeb, 0xef, 0xf6, 0xfc, 0xff, 0xc4, 0xcb, 0xcf, 0xd6, 0xdc}},
+    {'`', "aeiouAEIOU",
+     {0xe0, 0xe8, 0xec, 0xf2, 0xf9, 0xc0, 0xc8, 0xcc, 0xd2, 0xd9}},
+    {'~', "aonAON", {0xe3, 0xf5, 0xf1, 0xc3, 0xd5, 0xd1}},
+    {'^', "aeiouAEIOU",
+     {0xe2, 0xea, 0xee, 0xf4, 0xfb, 0xc2, 0xca, 0xce, 0xd4, 0xdb}},
+};
+
+bool text_decoder_parse_config(const char *spec,
+                               text_decoder_config_t *config) {
+    *config = (text_decoder_config_t){.alt_codes = TEXT_ALT_CODES_UNICODE,
+                                      .layout = TEXT_LAYOUT_US};
+    if (!spec || !*spec)
+        return true;
+    const char *layout = strchr(spec, ',');
+    if (!layout)
+        return false;
+    const size_t alt_codes_len = layout++ - spec;
+    if (alt_codes_len == 7 && strncmp(spec, "windows", 7) == 0)
+        config->alt_codes = TEXT_ALT_CODES_WINDOWS;
+    else if (alt_codes_len != 7 || strncmp(spec, "unicode", 7) != 0)
+        return false;
+    if (strcmp(layout, "intl") == 0)
+        config->layout = TEXT_LAYOUT_US_INTL;
+    else if (strcmp(layout, "us") != 0)
+        return false;
+    return true;
+}
+
+void text_decoder_init(text_decoder_t *decoder,
+                       const text_decoder_config_t *config) {
+    memset(decoder, 0, sizeof(*decoder));
+    if (config)
+        decoder->config = *config;
+}
+
+static void put_codepoint(text_decoder_t *decoder, uint32_t codepoint) {
+    if (!codepoint)
+        return;
+    if (codepoint > CODEPOINT_MAX ||
+        (codepoint >= 0xd800 && codepoint <= 0xdfff))
+        codepoint = CODEPOINT_REPLACEMENT;
+
+    char utf8[4];
+    size_t length;
+    if (codepoint <= 0x7f) {
+        utf8[0] = codepoint;
+        length = 1;
+    } else if (codepoint <= 0x7ff) {
+        utf8[0] = 0xc0 | codepoint >> 6;
+        utf8[1] = 0x80 | (codepoint & 0x3f);
+        length = 2;
+    } else if (codepoint <= 0xffff) {
+        utf8[0] = 0xe0 | codepoint >> 12;
+        utf8[1] = 0x80 | (codepoint >> 6 & 0x3f);
+        utf8[2] = 0x80 | (codepoint & 0x3f);
+        length = 3;
+    } else {
+        utf8[0] = 0xf0 | codepoint >> 18;
+        utf8[1] = 0x80 | (codepoint >> 12 & 0x3f);
+        utf8[2] = 0x80 | (codepoint >> 6 & 0x3f);
+        utf8[3] = 0x80 | (codepoint & 0x3f);
+        length = 4;
+    }
+    if (decoder->length + length > sizeof(decoder->text)) {
+        ESP_LOGW(TAG, "Text of a report too long, U+%04" PRIx32 " dropped",
+                 codepoint);
+        return;
+    }
+    memcpy(decoder->text + decoder->length, utf8, length);
+    decoder->length += length;
+}
+
+static void dead_key_flush(text_decoder_t *decoder) {
+    put_codepoint(decoder, (uint8_t)decoder->dead_key);
+    decoder->dead_key = 0;
+}
+
+/* The accent followed by key_char, combined if possible */
+static void dead_key_compose(text_decoder_t *decoder, char key_char) {
+    const char accent = decoder->dead_key;
+    decoder->dead_key = 0;
+    if (key_char == ' ') {
+        put_codepoint(decoder, (uint8_t)accent);
+        return;
+    }
+    for (size_t i = 0; i < sizeof(dead_keys) / sizeof(dead_keys[0]); ++i) {
+        const char *base;
+        if (dead_keys[i].accent == accent &&
+            (base = strchr(dead_keys[i].bases, key_char))) {
+            put_codepoint(decoder,
+                          dead_keys[i].composed[base - dead_keys[i].bases]);
+            return;
+        }
+    }
+    put_codepoint(decoder, (uint8_t)accent);
+    put_codepoint(decoder, (uint8_t)key_char);
+}
+
+static void alt_code_finish(text_decoder_t *decoder) {
+    uint32_t codepoint = decoder->alt_code;
+    ESP_LOGI(TAG, "Alt-Code: Code %" PRIu32 " (0x%" PRIx32 ") completed",
+             codepoint, codepoint);
+    if (decoder->config.alt_codes == TEXT_ALT_CODES_WINDOWS &&
+        codepoint >= 0x80 && codepoint <= 0xff) {
+        if (!decoder->alt_leading_zero)
+            codepoint = oem_code_page[codepoint - 0x80];
+        else if (codepoint < 0xa0)
+            codepoint = ansi_code_page[codepoint - 0x80];
+    }
+    put_codepoint(decoder, codepoint);
+    decoder->alt_code = 0;
+    decoder->alt_digits = 0;
+    decoder->alt_leading_zero = false;
+}
+
+static void hex_entry_finish(text_decoder_t *decoder, bool commit) {
+    if (commit && decoder->hex_digits) {
+        ESP_LOGI(TAG, "Hex entry: U+%04" PRIx32 " completed",
+                 decoder->hex_code);
+        put_codepoint(decoder, decoder->hex_code);
+    }
+    decoder->hex_entry = false;
+    decoder->hex_held = false;
+    decoder->hex_digits = 0;
+    decoder->hex_code = 0;
+}
+
+/* Value of a hex digit key, -1 for other keys */
+static int key_hex_digit(uint8_t key) {
+    if (key >= HID_KEY_A && key <= HID_KEY_F)
+        return 10 + key - HID_KEY_A;
+    if (key >= HID_KEY_1 && key <= HID_KEY_9)
+        return 1 + key - HID_KEY_1;
+    if (key >= HID_KEY_KEYPAD_1 && key <= HID_KEY_KEYPAD_9)
+        return 1 + key - HID_KEY_KEYPAD_1;
+    if (key == HID_KEY_0 || key == HID_KEY_KEYPAD_0)
+        return 0;
+    return -1;
+}
+
+static bool is_ctrl_shift(uint8_t modifier) {
+    return (modifier & MOD_CONTROL) && (modifier & MOD_SHIFT) &&
+           !(modifier & (MOD_ALT | MOD_GUI));
+}
+
+static bool is_alt_only(uint8_t modifier) {
+    return modifier && !(modifier & ~MOD_ALT);
+}
+
+void text_decoder_modifiers(text_decoder_t *decoder, uint8_t modifier) {
+    if (decoder->alt_digits && !is_alt_only(modifier))
+        alt_code_finish(decoder);
+    if (decoder->hex_held && !is_ctrl_shift(modifier))
+        hex_entry_finish(decoder, true);
+}
+
+/* Returns whether the key was taken by a pending hex entry */
+static bool hex_entry_key(text_decoder_t *decoder, uint8_t modifier,
+                          uint8_t key) {
+    const int digit = key_hex_digit(key);
+    if (digit >= 0) {
+        if (decoder->hex_digits < HEX_MAX_DIGITS) {
+            decoder->hex_code = decoder->hex_code << 4 | digit;
+            ++decoder->hex_digits;
+            decoder->hex_held |= is_ctrl_shift(modifier);
+        }
+        return true;
+    }
+    const bool commit = key == HID_KEY_SPACE || key == HID_KEY_ENTER ||
+                        key == HID_KEY_KEYPAD_ENTER;
+    hex_entry_finish(decoder, commit);
+    return commit || key == HID_KEY_ESC;
+}
+
+void text_decoder_flush(text_decoder_t *decoder) {
+    dead_key_flush(decoder);
+    if (decoder->alt_digits)
+        alt_code_finish(decoder);
+    hex_entry_finish(decoder, false);
+}
+
+void text_decoder_key(text_decoder_t *decoder, uint8_t modifier, uint8_t key,
+                      char key_char) {
+    // A tab ends the scan, nothing pending may carry over into the next
+    if (key_char == '\t') {
+        text_decoder_flush(decoder);
+        put_codepoint(decoder, '\t');
+        return;
+    }
+    if (is_alt_only(modifier)) {
+        if (key_char < '0' || key_char > '9') {
+            ESP_LOGW(TAG, "Alt-Code: Key %d ignored", key);
+            return;
+        }
+        dead_key_flush(decoder);
+        if (!decoder->alt_digits)
+            decoder->alt_leading_zero = key_char == '0';
+        if (decoder->alt_code <= CODEPOINT_MAX)
+            decoder->alt_code = 10 * decoder->alt_code + (key_char - '0');
+        ++decoder->alt_digits;
+        return;
+    }
+    if (is_ctrl_shift(modifier) && key == HID_KEY_U) {
+        dead_key_flush(decoder);
+        hex_entry_finish(decoder, false);
+        decoder->hex_entry = true;
+        return;
+    }
+    if (decoder->hex_entry && hex_entry_key(decoder, modifier, key))
+        return;
+    if (!key_char)
+        return;
+
+    if (decoder->config.layout == TEXT_LAYOUT_US_INTL &&
+        !(modifier & (MOD_CONTROL | MOD_ALT | MOD_GUI)) &&
+        strchr("'\"`~^", key_char)) {
+        // A second dead key stands for itself, as does the first
+        if (decoder->dead_key) {
+            dead_key_flush(decoder);
+            put_codepoint(decoder, (uint8_t)key_char);
+        } else {
+            decoder->dead_key = key_char;
+        }
+        return;
+    }
+    if (decoder->dead_key)
+        dead_key_compose(decoder, key_char);
+    else
+        put_codepoint(decoder, (uint8_t)key_char);
+}
+
+bool utf8_valid(const char *text, size_t length) {
+    const uint8_t *s = (const uint8_t *)text;
+    const uint8_t *end = s + length;
+    while (s < end) {
+        // Skip runs of ASCII a word at a time
+        while (end - s >= 4) {
+            uint32_t word;
+            memcpy(&word, s, sizeof(word));
+            if (word & 0x80808080)
+                break;
+            s += 4;
+        }
+        if (s == end)
+            break;
+        const uint8_t lead = *s;
+        if (lead < 0x80) {
+            ++s;
+            continue;
+        }
+        size_t n;
+        uint32_t codepoint, min;
+        if (lead >= 0xc2 && lead <= 0xdf)
+            n = 2, codepoint = lead & 0x1f, min = 0x80;
+        else if ((lead & 0xf0) == 0xe0)
+            n = 3, codepoint = lead & 0x0f, min = 0x800;
+        else if (lead >= 0xf0 && lead <= 0xf4)
+            n = 4, codepoint = lead & 0x07, min = 0x10000;
+        else
+            return false;
+        if ((size_t)(end - s) < n)
+            return false;
+        for (size_t i = 1; i < n; ++i) {
+            if ((s[i] & 0xc0) != 0x80)
+                return false;
+            codepoint = codepoint << 6 | (s[i] & 0x3f);
+        }
+        if (codepoint < min || codepoint > CODEPOINT_MAX ||
+            (codepoint >= 0xd800 && codepoint <= 0xdfff))
+            return false;
+        s += n;
+    }
+    return true;
+}
+
+size_t utf8_truncate(const char *text, size_t length, size_t max) {
+    if (length <= max)
+        return length;
+    // Back up over continuation bytes to the start of the cut sequence
+    size_t cut = max;
+    while (cut && ((uint8_t)text[cut] & 0xc0) == 0x80)
+        --cut;
+    return cut;
+}
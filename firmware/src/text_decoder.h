@@ -0,0 +1,98 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Turns key presses into UTF-8 text, with the ways keyboards in a barcode
+ * scanner enter characters their layout lacks:
+ *
+ * - Alt codes, decimal digits typed while only Alt is held. By default the
+ *   number is the Unicode code point. With Windows alt codes, numbers up to
+ *   255 select a character of the ANSI code page (Windows-1252) if they
+ *   start with 0, and of the OEM code page (437) otherwise. ASCII stays
+ *   ASCII in both, so control characters such as GS come through, and
+ *   larger numbers are code points.
+ * - Ctrl+Shift+U followed by up to six hex digits, committed by Space or
+ *   Enter, or by releasing Ctrl+Shift if they were held for the digits.
+ *   Escape or any other key cancels.
+ * - Dead keys of the US International layout: ' " ` ~ ^ combine with the
+ *   following letter, or stand alone when followed by Space.
+ *
+ * Text is collected in text until the caller takes it, at most one
+ * keyboard report's worth.
+ */
+#define TEXT_DECODER_TEXT_SIZE 64
+
+typedef enum {
+    TEXT_ALT_CODES_UNICODE,
+    TEXT_ALT_CODES_WINDOWS,
+} text_alt_codes_t;
+
+typedef enum {
+    TEXT_LAYOUT_US,
+    TEXT_LAYOUT_US_INTL,
+} text_layout_t;
+
+typedef struct {
+    text_alt_codes_t alt_codes;
+    text_layout_t layout;
+} text_decoder_config_t;
+
+typedef struct {
+    text_decoder_config_t config;
+    uint32_t alt_code;
+    uint8_t alt_digits;
+    bool alt_leading_zero;
+    bool hex_entry; // after Ctrl+Shift+U
+    bool hex_held;  // digits typed with Ctrl+Shift held
+    uint8_t hex_digits;
+    uint32_t hex_code;
+    char dead_key; // pending accent, 0 for none
+    size_t length;
+    char text[TEXT_DECODER_TEXT_SIZE];
+} text_decoder_t;
+
+/**
+ * Parse "<unicode|windows>,<us|intl>" as stored in the configuration. An
+ * empty spec selects the defaults, Unicode alt codes and the US layout.
+ */
+bool text_decoder_parse_config(const char *spec,
+                               text_decoder_config_t *config);
+void text_decoder_init(text_decoder_t *decoder,
+                       const text_decoder_config_t *config);
+/** Modifier state of a report, before its key presses */
+void text_decoder_modifiers(text_decoder_t *decoder, uint8_t modifier);
+/**
+ * A newly pressed key with the modifiers held, and the character it maps to
+ * in the US layout, 0 for none
+ */
+void text_decoder_key(text_decoder_t *decoder, uint8_t modifier, uint8_t key,
+                      char key_char);
+/**
+ * End of the input, as when a scan ends: a pending dead key stands for
+ * itself, a pending alt code is completed and a hex entry without Space or
+ * Enter is cancelled. A tab does the same before it is added.
+ */
+void text_decoder_flush(text_decoder_t *decoder);
+
+/** Whether text is well-formed UTF-8, without overlongs and surrogates */
+bool utf8_valid(const char *text, size_t length);
+/**
+ * Length of the longest prefix of text, at most max bytes, that does not
+ * end within a UTF-8 sequence
+ */
+size_t utf8_truncate(const char *text, size_t length, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,100 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "trace.h"
+#include "mqtt.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_cpu.h>
+#include <esp_log.h>
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+
+static const char *TAG = "trace";
+
+/*
+ * Events go into a RAM ring that keeps the most recent TRACE_RING_EVENTS.
+ * A writer claims a slot with a single atomic increment and fills it
+ * without taking a lock, so recording costs a few dozen cycles. An upload
+ * may catch a slot while it is written; that event is garbled, the rest of
+ * the trace is not. A message on <topic>/trace/get publishes the ring to
+ * <topic>/trace and empties it.
+ */
+#define TRACE_RING_EVENTS 1024 // power of two
+#define TRACE_HEADER_SIZE 12
+#define TRACE_SYNC_INTERVAL_US 1000000
+
+typedef struct __attribute__((packed)) {
+    uint32_t cycles;
+    uint16_t id;
+    uint16_t arg16;
+    uint32_t arg32;
+} trace_entry_t;
+
+static trace_entry_t ring[TRACE_RING_EVENTS];
+static uint32_t ring_head;  // total number of events claimed
+static uint32_t ring_start; // first event not yet uploaded
+static int64_t last_sync_us;
+
+void trace_record(trace_event_t event, uint16_t arg16, uint32_t arg32) {
+    const uint32_t slot = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+    trace_entry_t *entry = &ring[slot % TRACE_RING_EVENTS];
+    entry->cycles = esp_cpu_get_cycle_count();
+    entry->id = event;
+    entry->arg16 = arg16;
+    entry->arg32 = arg32;
+}
+
+void trace_poll(void) {
+    const int64_t now = esp_timer_get_time();
+    if (now - last_sync_us < TRACE_SYNC_INTERVAL_US)
+        return;
+    last_sync_us = now;
+    trace_record(TRACE_SYNC, 0, now / 1000);
+}
+
+static void trace_upload(const char *topic, const char *data, int len,
+                         int offset, int total_len) {
+    (void)topic;
+    (void)data;
+    (void)len;
+    (void)total_len;
+    if (offset)
+        return;
+
+    uint8_t *trace = malloc(TRACE_HEADER_SIZE + sizeof(ring));
+    if (!trace) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the upload");
+        return;
+    }
+    const uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    memcpy(trace, TRACE_MAGIC, 4);
+    trace[4] = TRACE_VERSION;
+    memset(trace + 5, 0, 3);
+    memcpy(trace + 8, &ticks_per_us, sizeof(ticks_per_us));
+
+    const uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    uint32_t count = head - ring_start;
+    if (count > TRACE_RING_EVENTS)
+        count = TRACE_RING_EVENTS;
+    uint8_t *out = trace + TRACE_HEADER_SIZE;
+    for (uint32_t i = head - count; i != head; ++i) {
+        memcpy(out, &ring[i % TRACE_RING_EVENTS], sizeof(trace_entry_t));
+        out += sizeof(trace_entry_t);
+    }
+    ring_start = head;
+
+    ESP_LOGI(TAG, "Uploading %" PRIu32 " trace events", count);
+    if (mqtt_publish_subtopic("trace", (const char *)trace,
+                              out - trace) != ESP_OK)
+        ESP_LOGE(TAG, "Failed to publish the trace");
+    free(trace);
+}
+
+void trace_start(void) {
+    mqtt_subscribe_subtopic("trace/get", trace_upload);
+}
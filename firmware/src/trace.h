@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A trace upload on <topic>/trace is a header followed by the recorded
+ * events, oldest first. All integers are little endian:
+ *
+ *   header: "H2MT" <version u8> <3 reserved> <cpu ticks per us u32>
+ *   event:  <cpu cycle count u32> <id u16> <arg16 u16> <arg32 u32>
+ *
+ * The cycle counter wraps every few seconds. TRACE_SYNC is recorded at
+ * least once a second, so events are never further apart than that.
+ * tools/trace_to_perfetto.py converts an upload to Chrome trace format.
+ */
+#define TRACE_MAGIC "H2MT"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_SYNC = 0,     // arg32: esp_timer time in ms
+    TRACE_REPORT,       // input report queued, arg16: length
+    TRACE_KEY,          // keys decoded, arg16: first byte, arg32: length
+    TRACE_SCAN_SUBMIT,  // arg16: scan length
+    TRACE_PUBLISH,      // arg16: payload length, arg32: message id
+    TRACE_PUBLISH_ACK,  // arg32: message id
+    TRACE_WIFI,         // arg16: trace_wifi_t, arg32: disconnect reason
+    TRACE_MQTT,         // arg16: 1 connected, 0 disconnected
+    TRACE_QUEUE_DEPTH,  // arg16: trace_queue_t, arg32: messages waiting
+    TRACE_EVENT_COUNT,
+} trace_event_t;
+
+typedef enum {
+    TRACE_WIFI_START,
+    TRACE_WIFI_DISCONNECTED,
+    TRACE_WIFI_GOT_IP,
+} trace_wifi_t;
+
+typedef enum {
+    TRACE_QUEUE_APP_EVENT,
+} trace_queue_t;
+
+/** Record an event, callable from any task or ISR */
+void trace_record(trace_event_t event, uint16_t arg16, uint32_t arg32);
+/** Record TRACE_SYNC if due, called regularly from the main loop */
+void trace_poll(void);
+void trace_start(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,9 +3,17 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "usb_hid.h"
+#include "app_config.h"
+#include "device_cache.h"
+#include "hid_capture.h"
+#include "hid_event_bridge.h"
+#include "keyboard_decoder.h"
+#include "trace.h"
 
 #include <stdbool.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 
 #include <freertos/FreeRTOS.h>
@@ -14,6 +22,7 @@
 
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include <usb/hid_host.h>
 #include <usb/hid_usage_keyboard.h>
@@ -21,13 +30,34 @@
 
 static const char *TAG = "usb_hid";
 
+/*
+ * Events reach the app task through app_event_queue. Input reports may be
+ * dropped when it falls behind, the other events may not, as a lost
+ * DISCONNECTED leaks the device. Keyboard reports leave APP_EVENT_RESERVED
+ * entries to them, and they wait for space unless sent by the app task
+ * itself. Generic devices can report at the full polling rate, so their
+ * reports have a queue of their own.
+ */
+#define APP_EVENT_QUEUE_SIZE 10
+#define APP_EVENT_RESERVED 4
+#define GENERIC_REPORT_QUEUE_SIZE 32
+
 static QueueHandle_t app_event_queue = NULL;
+static QueueHandle_t generic_report_queue = NULL;
+static TaskHandle_t app_task = NULL;
 
-static key_char_cb_t key_char_callback = NULL;
+static key_text_cb_t key_text_callback = NULL;
+static hid_event_cb_t hid_event_callback = NULL;
+static keyboard_decoder_t keyboard_decoder;
+static volatile int started_devices = 0;
+static volatile uint32_t dropped_events = 0;
+static volatile uint32_t app_event_peak_depth = 0;
 
 typedef enum {
     APP_EVENT_HID_HOST_DEVICE = 0,
-    APP_EVENT_HID_HOST_INTERFACE
+    APP_EVENT_HID_HOST_INTERFACE,
+    APP_EVENT_RECOVERY,
+    APP_EVENT_DEVICE_STARTED
 } app_event_group_t;
 
 typedef struct {
@@ -36,247 +66,401 @@ typedef struct {
     hid_host_driver_event_t driver_event;
     hid_host_interface_event_t interface_event;
     void *arg;
+    esp_err_t status;
+    // Copied before the transfer is resubmitted, which overwrites its buffer
+    uint8_t report[64];
+    size_t report_length;
 } app_event_queue_t;
 
-/*
- * Assume US English keyboard layout, configure the barcode scanner accordingly
- */
-const uint8_t keycode2ascii[100][4] = {
-    {0, 0, 0, 0},            // HID_KEY_NO_PRESS
-    {0, 0, 0, 0},            // HID_KEY_ROLLOVER
-    {0, 0, 0, 0},            // HID_KEY_POST_FAIL
-    {0, 0, 0, 0},            // HID_KEY_ERROR_UNDEFINED
-    {'a', 'A', 0x01, 0x01},  // HID_KEY_A
-    {'b', 'B', 0x02, 0x02},  // HID_KEY_B
-    {'c', 'C', 0x03, 0x03},  // HID_KEY_C
-    {'d', 'D', 0x04, 0x04},  // HID_KEY_D
-    {'e', 'E', 0x05, 0x05},  // HID_KEY_E
-    {'f', 'F', 0x06, 0x06},  // HID_KEY_F
-    {'g', 'G', 0x07, 0x07},  // HID_KEY_G
-    {'h', 'H', 0x08, 0x08},  // HID_KEY_H
-    {'i', 'I', 0x09, 0x09},  // HID_KEY_I
-    {'j', 'J', 0x0a, 0x0a},  // HID_KEY_J
-    {'k', 'K', 0x0b, 0x0b},  // HID_KEY_K
-    {'l', 'L', 0x0c, 0x0c},  // HID_KEY_L
-    {'m', 'M', 0x0d, 0x0d},  // HID_KEY_M
-    {'n', 'N', 0x0e, 0x0e},  // HID_KEY_N
-    {'o', 'O', 0x0f, 0x0f},  // HID_KEY_O
-    {'p', 'P', 0x10, 0x10},  // HID_KEY_P
-    {'q', 'Q', 0x11, 0x11},  // HID_KEY_Q
-    {'r', 'R', 0x12, 0x12},  // HID_KEY_R
-    {'s', 'S', 0x13, 0x13},  // HID_KEY_S
-    {'t', 'T', 0x14, 0x14},  // HID_KEY_T
-    {'u', 'U', 0x15, 0x15},  // HID_KEY_U
-    {'v', 'V', 0x16, 0x16},  // HID_KEY_V
-    {'w', 'W', 0x17, 0x17},  // HID_KEY_W
-    {'x', 'X', 0x18, 0x18},  // HID_KEY_X
-    {'y', 'Y', 0x19, 0x19},  // HID_KEY_Y
-    {'z', 'Z', 0x1a, 0x1a},  // HID_KEY_Z
-    {'1', '!', 0, 0},        // HID_KEY_1
-    {'2', '@', 0x00, 0x00},  // HID_KEY_2
-    {'3', '#', 0, 0},        // HID_KEY_3
-    {'4', '$', 0, 0},        // HID_KEY_4
-    {'5', '%', 0x1d, 0x1d},  // HID_KEY_5
-    {'6', '^', 0x1e, 0x1e},  // HID_KEY_6
-    {'7', '&', 0, 0},        // HID_KEY_7
-    {'8', '*', 0x7f, 0x7f},  // HID_KEY_8
-    {'9', '(', 0, 0},        // HID_KEY_9
-    {'0', ')', 0, 0},        // HID_KEY_0
-    {0x0d, 0x0d, 0, 0},      // HID_KEY_ENTER
-    {0x1b, 0x1b, 0, 0},      // HID_KEY_ESC
-    {0x08, 0x08, 0, 0},      // HID_KEY_DEL
-    {0x09, 0, 0, 0},         // HID_KEY_TAB
-    {' ', ' ', 0x00, 0x00},  // HID_KEY_SPACE
-    {'-', '_', 0x1f, 0x1f},  // HID_KEY_MINUS
-    {'=', '+', 0, 0},        // HID_KEY_EQUAL
-    {'[', '{', 0x1b, 0x1b},  // HID_KEY_OPEN_BRACKET
-    {']', '}', 0x1d, 0x1d},  // HID_KEY_CLOSE_BRACKET
-    {'\\', '|', 0x1c, 0x1c}, // HID_KEY_BACK_SLASH
-    {0, 0, 0, 0},            // HID_KEY_SHARP
-    {';', ':', 0, 0},        // HID_KEY_COLON
-    {'\'', '"', 0, 0},       // HID_KEY_QUOTE
-    {'`', '~', 0x00, 0x1e},  // HID_KEY_TILDE
-    {',', '<', 0, 0},        // HID_KEY_LESS
-    {'.', '>', 0, 0},        // HID_KEY_GREATER
-    {'/', '?', 0, 0},        // HID_KEY_SLASH
-    {0, 0, 0, 0},            // HID_KEY_CAPS_LOCK
-    {0, 0, 0, 0},            // HID_KEY_F1
-    {0, 0, 0, 0},            // HID_KEY_F2
-    {0, 0, 0, 0},            // HID_KEY_F3
-    {0, 0, 0, 0},            // HID_KEY_F4
-    {0, 0, 0, 0},            // HID_KEY_F5
-    {0, 0, 0, 0},            // HID_KEY_F6
-    {0, 0, 0, 0},            // HID_KEY_F7
-    {0, 0, 0, 0},            // HID_KEY_F8
-    {0, 0, 0, 0},            // HID_KEY_F9
-    {0, 0, 0, 0},            // HID_KEY_F10
-    {0, 0, 0, 0},            // HID_KEY_F11
-    {0, 0, 0, 0},            // HID_KEY_F12
-    {0, 0, 0, 0},            // HID_KEY_PRINT_SCREEN
-    {0, 0, 0, 0},            // HID_KEY_SCROLL_LOCK
-    {0, 0, 0, 0},            // HID_KEY_PAUSE
-    {0, 0, 0, 0},            // HID_KEY_INSERT
-    {0, 0, 0, 0},            // HID_KEY_HOME
-    {0, 0, 0, 0},            // HID_KEY_PAGEUP
-    {0x7f, 0x7f, 0, 0},      // HID_KEY_DELETE
-    {0, 0, 0, 0},            // HID_KEY_END
-    {0, 0, 0, 0},            // HID_KEY_PAGEDOWN
-    {0, 0, 0, 0},            // HID_KEY_RIGHT
-    {0, 0, 0, 0},            // HID_KEY_LEFT
-    {0, 0, 0, 0},            // HID_KEY_DOWN
-    {0, 0, 0, 0},            // HID_KEY_UP
-    {0, 0, 0, 0},            // HID_KEY_NUM_LOCK
-    {'/', '/', 0, 0},        // HID_KEY_KEYPAD_DIV
-    {'*', '*', 0, 0},        // HID_KEY_KEYPAD_MUL
-    {'-', '-', 0, 0},        // HID_KEY_KEYPAD_SUB
-    {'+', '+', 0, 0},        // HID_KEY_KEYPAD_ADD
-    {0x0d, 0x0d, 0, 0},      // HID_KEY_KEYPAD_ENTER
-    {'1', '1', 0, 0},        // HID_KEY_KEYPAD_1
-    {'2', '2', 0, 0},        // HID_KEY_KEYPAD_2
-    {'3', '3', 0, 0},        // HID_KEY_KEYPAD_3
-    {'4', '4', 0, 0},        // HID_KEY_KEYPAD_4
-    {'5', '5', 0x1d, 0x1d},  // HID_KEY_KEYPAD_5
-    {'6', '6', 0, 0},        // HID_KEY_KEYPAD_6
-    {'7', '7', 0, 0},        // HID_KEY_KEYPAD_7
-    {'8', '8', 0, 0},        // HID_KEY_KEYPAD_8
-    {'9', '9', 0, 0},        // HID_KEY_KEYPAD_9
-    {'0', '0', 0, 0},        // HID_KEY_KEYPAD_0
-    {0, 0, 0, 0},            // HID_KEY_KEYPAD_DELETE
-};
+static void app_event_send(const app_event_queue_t *evt_queue) {
+    if (!app_event_queue)
+        return;
+    const bool report =
+        evt_queue->event_group == APP_EVENT_HID_HOST_INTERFACE &&
+        evt_queue->interface_event == HID_HOST_INTERFACE_EVENT_INPUT_REPORT;
+    if (report && evt_queue->arg) {
+        if (xQueueSend(generic_report_queue, evt_queue, 0) != pdTRUE)
+            ++dropped_events;
+        return;
+    }
+    bool sent;
+    if (report) {
+        sent = uxQueueSpacesAvailable(app_event_queue) > APP_EVENT_RESERVED &&
+               xQueueSend(app_event_queue, evt_queue, 0) == pdTRUE;
+    } else {
+        // The app task would wait for itself
+        const TickType_t wait =
+            xTaskGetCurrentTaskHandle() == app_task ? 0 : portMAX_DELAY;
+        sent = xQueueSend(app_event_queue, evt_queue, wait) == pdTRUE;
+    }
+    if (!sent) {
+        ++dropped_events;
+        return;
+    }
+    const uint32_t depth = uxQueueMessagesWaiting(app_event_queue);
+    if (depth > app_event_peak_depth)
+        app_event_peak_depth = depth;
+}
 
-/**
- * @brief HID Keyboard get char symbol from key code
- *
- * @param[in] modifier  Keyboard modifier data
- * @param[in] key_code  Keyboard key code
- * @param[in] key_char  Pointer to key char data
+/*
+ * A transfer error stops the polling of a device. Recovery first clears
+ * the endpoint halt and resubmits the transfer, which is enough after a
+ * glitch on the bus. After RECOVERY_CLEAR_ATTEMPTS the root port is power
+ * cycled, which re-enumerates everything behind it. The USB host library
+ * has no port reset for clients, and on the single root port of the ESP32-S2
+ * a power cycle has the same effect. Attempts after the first are spaced by
+ * an exponential backoff, so a device that keeps failing does not keep the
+ * bus busy.
  *
- * @return true  Key scancode converted successfully
- * @return false Key scancode unknown
+ * An incident ends RECOVERY_STABLE_MS after polling resumed. A new error
+ * before that continues the incident with the next attempt, so a flapping
+ * device escalates instead of being cleared forever. The time from the first
+ * error to the last successful attempt is the time to recover. There is one
+ * incident at a time, errors of other devices meanwhile are left to the
+ * power cycle.
  */
-static inline bool hid_keyboard_get_char(uint8_t modifier, uint8_t key_code,
-                                         unsigned char *key_char) {
-    uint8_t mod = 0;
-    if (modifier & (HID_LEFT_SHIFT | HID_RIGHT_SHIFT))
-        mod |= 1;
-    if (modifier & (HID_LEFT_CONTROL | HID_RIGHT_CONTROL))
-        mod |= 2;
-
-    uint8_t found = 0;
-    if (key_code < (sizeof(keycode2ascii) / sizeof(keycode2ascii[0])))
-        found = keycode2ascii[key_code][mod];
-    if (found) {
-        *key_char = found;
-        return true;
+#define RECOVERY_CLEAR_ATTEMPTS 3
+#define RECOVERY_BACKOFF_MIN_MS 50
+#define RECOVERY_BACKOFF_MAX_MS (60 * 1000)
+#define RECOVERY_POWER_OFF_MS 100
+#define RECOVERY_ENUMERATION_MS 2000
+#define RECOVERY_STABLE_MS 5000
+
+typedef enum {
+    RECOVERY_IDLE,
+    RECOVERY_PENDING,     // next attempt at next_attempt_us
+    RECOVERY_CLEARING,    // waiting for hid_host_device_recover_async()
+    RECOVERY_POWER_OFF,   // root port off until next_attempt_us
+    RECOVERY_ENUMERATING, // waiting for the device to start again
+    RECOVERY_STABLE,      // polling resumed at recovered_us
+} recovery_state_t;
+
+static struct {
+    recovery_state_t state;
+    hid_host_device_handle_t handle;
+    uint32_t attempts;
+    int64_t first_error_us;
+    int64_t next_attempt_us;
+    int64_t recovered_us;
+} recovery;
+
+static volatile uint32_t recovery_count = 0;
+static volatile uint32_t recovery_last_ms = 0;
+static volatile uint32_t recovery_max_ms = 0;
+
+static int64_t recovery_backoff_us(uint32_t attempts) {
+    int64_t backoff_ms = RECOVERY_BACKOFF_MIN_MS;
+    for (uint32_t i = 1; i < attempts && backoff_ms < RECOVERY_BACKOFF_MAX_MS;
+         ++i)
+        backoff_ms *= 2;
+    return (backoff_ms < RECOVERY_BACKOFF_MAX_MS ? backoff_ms
+                                                 : RECOVERY_BACKOFF_MAX_MS) *
+           1000;
+}
+
+static void recovery_finish(void) {
+    const uint32_t ms =
+        (recovery.recovered_us - recovery.first_error_us) / 1000;
+    recovery_last_ms = ms;
+    if (ms > recovery_max_ms)
+        recovery_max_ms = ms;
+    ++recovery_count;
+    ESP_LOGI(TAG, "Recovered from transfer error in %" PRIu32
+                  " ms after %" PRIu32 " attempts",
+             ms, recovery.attempts);
+    recovery.state = RECOVERY_IDLE;
+}
+
+static void recovery_resumed(void) {
+    recovery.recovered_us = esp_timer_get_time();
+    recovery.state = RECOVERY_STABLE;
+}
+
+static void recovery_failed(void) {
+    recovery.next_attempt_us =
+        esp_timer_get_time() + recovery_backoff_us(recovery.attempts);
+    recovery.state = RECOVERY_PENDING;
+}
+
+/* Runs in the HID host task, hands the result to the app task */
+static void recovery_callback(hid_host_device_handle_t hid_device_handle,
+                              esp_err_t status, void *arg) {
+    const app_event_queue_t evt_queue = {.event_group = APP_EVENT_RECOVERY,
+                                         .device_handle = hid_device_handle,
+                                         .status = status,
+                                         .arg = arg};
+    app_event_send(&evt_queue);
+}
+
+static void
+recovery_transfer_error(hid_host_device_handle_t hid_device_handle) {
+    switch (recovery.state) {
+    case RECOVERY_IDLE:
+        recovery.handle = hid_device_handle;
+        recovery.attempts = 0;
+        recovery.first_error_us = esp_timer_get_time();
+        recovery.next_attempt_us = recovery.first_error_us;
+        recovery.state = RECOVERY_PENDING;
+        break;
+    case RECOVERY_STABLE:
+        recovery.handle = hid_device_handle;
+        recovery_failed();
+        break;
+    default:
+        break;
+    }
+}
+
+static void recovery_clear_done(hid_host_device_handle_t hid_device_handle,
+                                esp_err_t status) {
+    if (recovery.state != RECOVERY_CLEARING ||
+        hid_device_handle != recovery.handle)
+        return;
+    if (status == ESP_OK) {
+        recovery_resumed();
     } else {
-        return false;
+        ESP_LOGW(TAG, "Clearing endpoint halt failed: %s",
+                 esp_err_to_name(status));
+        recovery_failed();
     }
 }
 
-/**
- * @brief Key buffer scan code search.
- *
- * @param[in] src       Pointer to source buffer where to search
- * @param[in] key       Key scancode to search
- * @param[in] length    Size of the source buffer
- */
-static inline bool key_found(const uint8_t *const src, uint8_t key,
-                             unsigned int length) {
-    for (unsigned int i = 0; i < length; i++) {
-        if (src[i] == key) {
-            return true;
-        }
+static void recovery_disconnected(hid_host_device_handle_t hid_device_handle) {
+    if (hid_device_handle != recovery.handle)
+        return;
+    switch (recovery.state) {
+    case RECOVERY_PENDING:
+    case RECOVERY_CLEARING:
+        // Unplugged, a new device is brought up from scratch
+        ESP_LOGI(TAG, "Device gone, recovery abandoned");
+        recovery.state = RECOVERY_IDLE;
+        break;
+    case RECOVERY_STABLE:
+        recovery_finish();
+        break;
+    default:
+        break;
     }
-    return false;
 }
 
-/**
- * @brief USB HID Host Keyboard Interface report callback handler
- *
- * @param[in] data    Pointer to input report data buffer
- * @param[in] length  Length of input report data buffer
- */
-static void hid_host_keyboard_report_callback(const uint8_t *const data,
-                                              const int length) {
-    hid_keyboard_input_report_boot_t *kb_report =
-        (hid_keyboard_input_report_boot_t *)data;
+static void recovery_device_started(void) {
+    if (recovery.state == RECOVERY_ENUMERATING)
+        recovery_resumed();
+}
 
-    if (length < sizeof(hid_keyboard_input_report_boot_t)) {
+static void recovery_poll(void) {
+    if (recovery.state == RECOVERY_IDLE ||
+        recovery.state == RECOVERY_CLEARING)
+        return;
+    const int64_t now = esp_timer_get_time();
+    if (recovery.state == RECOVERY_STABLE) {
+        if (now - recovery.recovered_us >= RECOVERY_STABLE_MS * 1000LL)
+            recovery_finish();
         return;
     }
+    if (now < recovery.next_attempt_us)
+        return;
 
-    const bool alt_pressed =
-        kb_report->modifier.val &&
-        kb_report->modifier.val ==
-            (kb_report->modifier.val & (HID_LEFT_ALT | HID_RIGHT_ALT));
-    static uint32_t alt_code = 0;
-    static uint8_t prev_keys[HID_KEYBOARD_KEY_MAX] = {0};
-    unsigned char key_char;
-
-    if (alt_code && !alt_pressed) {
-        ESP_LOGI(TAG, "Alt-Code: Code %"PRIu32" (0x%"PRIx32") completed", alt_code, alt_code);
-        if (key_char_callback) {
-            // convert the alt code unicode code point into utf8 bytes
-            if (alt_code <= 0x7f) {
-                // 1-byte sequence: 0xxxxxxx
-                key_char_callback((char)alt_code);
-            } else if (alt_code <= 0x7ff) {
-                // 2-byte sequence: 110xxxxx 10xxxxxx
-                key_char_callback((char)(0xc0 | ((alt_code >>  6) & 0x1f)));
-                key_char_callback((char)(0x80 | ( alt_code        & 0x3f)));
-            } else if (alt_code <= 0xffff) {
-                // 3-byte sequence: 1110xxxx 10xxxxxx 10xxxxxx
-                key_char_callback((char)(0xe0 | ((alt_code >> 12) & 0x0f)));
-                key_char_callback((char)(0x80 | ((alt_code >>  6) & 0x3f)));
-                key_char_callback((char)(0x80 | ( alt_code        & 0x3f)));
-            } else if (alt_code <= 0x10ffff) {
-                // 4-byte sequence: 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-                key_char_callback((char)(0xf0 | ((alt_code >> 18) & 0x07)));
-                key_char_callback((char)(0x80 | ((alt_code >> 12) & 0x3f)));
-                key_char_callback((char)(0x80 | ((alt_code >>  6) & 0x3f)));
-                key_char_callback((char)(0x80 | ( alt_code        & 0x3f)));
+    switch (recovery.state) {
+    case RECOVERY_PENDING:
+        ++recovery.attempts;
+        if (recovery.attempts <= RECOVERY_CLEAR_ATTEMPTS) {
+            const esp_err_t err = hid_host_device_recover_async(
+                recovery.handle, recovery_callback, NULL);
+            if (err == ESP_OK) {
+                recovery.state = RECOVERY_CLEARING;
             } else {
-                // Invalid code point, emit replacement character U+FFFD
-                key_char_callback((char)0xef);
-                key_char_callback((char)0xbf);
-                key_char_callback((char)0xbd);
+                ESP_LOGW(TAG, "Unable to clear endpoint halt: %s",
+                         esp_err_to_name(err));
+                recovery_failed();
             }
+        } else {
+            ESP_LOGW(TAG, "Power cycling the USB port, attempt %" PRIu32,
+                     recovery.attempts);
+            usb_host_lib_set_root_port_power(false);
+            recovery.next_attempt_us = now + RECOVERY_POWER_OFF_MS * 1000LL;
+            recovery.state = RECOVERY_POWER_OFF;
         }
-        alt_code = 0;
+        break;
+    case RECOVERY_POWER_OFF: {
+        usb_host_lib_set_root_port_power(true);
+        const int64_t backoff_us = recovery_backoff_us(recovery.attempts);
+        recovery.next_attempt_us =
+            now + (backoff_us > RECOVERY_ENUMERATION_MS * 1000LL
+                       ? backoff_us
+                       : RECOVERY_ENUMERATION_MS * 1000LL);
+        recovery.state = RECOVERY_ENUMERATING;
+        break;
     }
-    for (int i = 0; i < HID_KEYBOARD_KEY_MAX; i++) {
-        // figure out which keys have been just pressed
-        if (kb_report->key[i] > HID_KEY_ERROR_UNDEFINED &&
-            !key_found(prev_keys, kb_report->key[i], HID_KEYBOARD_KEY_MAX)) {
-            if (hid_keyboard_get_char(kb_report->modifier.val,
-                                      kb_report->key[i], &key_char)) {
-                if (alt_pressed) {
-                    if (key_char >= '0' && key_char <= '9') {
-                        ESP_LOGI(TAG, "Alt-Code: Key %d pressed -> ASCII %x",
-                                 kb_report->key[i], key_char);
-                        alt_code = 10 * alt_code + (key_char - '0');
-                    } else {
-                        ESP_LOGW(
-                            TAG,
-                            "Alt-Code: Key %d pressed -> ASCII %x (ignoring)",
-                            kb_report->key[i], key_char);
-                    }
-                    if (key_char_callback)
-                        key_char_callback(0);
-                } else {
-                    ESP_LOGI(TAG, "Key %d pressed -> ASCII %x",
-                             kb_report->key[i], key_char);
-                    if (key_char_callback)
-                        key_char_callback(key_char);
-                }
-            } else {
-                ESP_LOGI(TAG, "Key %d pressed -> no matching ASCII",
-                         kb_report->key[i]);
-            }
+    case RECOVERY_ENUMERATING:
+        ESP_LOGW(TAG, "No device after power cycling the USB port");
+        recovery.state = RECOVERY_PENDING;
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * With generic mode configured, HID interfaces other than boot keyboards are
+ * bridged to MQTT by hid_event_bridge.c. The device is started once its
+ * report descriptor has been read and parsed by the HID host task, which
+ * then sets ready. Devices are only added and removed by the app task, on
+ * CONNECTED and DISCONNECTED, and polled by it once they are ready. Like the
+ * interface slots of the HID host, their slots are taken from a static pool.
+ */
+#define GENERIC_MAX_DEVICES CONFIG_USB_HOST_HID_MAX_INTERFACES
+
+typedef struct {
+    hid_event_bridge_t bridge;
+    hid_event_bridge_config_t config;
+    char name[HID_EVENT_DEVICE_SIZE];
+    bool in_use;
+    bool ready;
+} generic_device_t;
+
+static generic_device_t generic_devices[GENERIC_MAX_DEVICES];
+
+static void generic_publish(const char *batch, size_t length, void *arg) {
+    (void)arg;
+    if (hid_event_callback)
+        hid_event_callback(batch, length);
+}
+
+static void generic_device_remove(generic_device_t *generic) {
+    __atomic_store_n(&generic->ready, false, __ATOMIC_RELAXED);
+    generic->in_use = false;
+}
+
+void hid_host_interface_event(hid_host_device_handle_t hid_device_handle,
+                              const hid_host_interface_event_t event,
+                              const uint8_t *data, size_t data_length,
+                              void *arg);
+
+static void generic_reports_handle(void) {
+    app_event_queue_t evt_queue;
+    while (xQueueReceive(generic_report_queue, &evt_queue, 0))
+        hid_host_interface_event(evt_queue.device_handle,
+                                 evt_queue.interface_event, evt_queue.report,
+                                 evt_queue.report_length, evt_queue.arg);
+}
+
+static void generic_devices_poll(void) {
+    const int64_t now = esp_timer_get_time();
+    for (int i = 0; i < GENERIC_MAX_DEVICES; ++i) {
+        generic_device_t *generic = &generic_devices[i];
+        if (generic->in_use &&
+            __atomic_load_n(&generic->ready, __ATOMIC_ACQUIRE))
+            hid_event_bridge_poll(&generic->bridge, now);
+    }
+}
+
+/*
+ * Keyboards are remembered for the LED output reports of usb_hid_set_leds().
+ * The HID host task reads the report when the request gets its turn on the
+ * control endpoint, so each keyboard has its own buffer. Only one request per
+ * keyboard is in flight: a state asked for meanwhile is kept in wanted and
+ * sent by keyboard_leds_done(), so the last step of a pattern is never lost.
+ * Whoever sets busy sends, and busy is released before wanted is checked
+ * again, so one of both tasks always sees the latest state. A slot is not
+ * reused before its request completed.
+ */
+#define KEYBOARD_MAX_DEVICES 4
+
+typedef struct {
+    hid_host_device_handle_t handle;
+    uint8_t leds;   // the state sent
+    uint8_t wanted; // the latest state asked for
+    bool busy;
+} keyboard_t;
+
+static keyboard_t keyboards[KEYBOARD_MAX_DEVICES];
+
+static void keyboard_add(hid_host_device_handle_t hid_device_handle) {
+    for (int i = 0; i < KEYBOARD_MAX_DEVICES; ++i) {
+        keyboard_t *keyboard = &keyboards[i];
+        if (!keyboard->handle &&
+            !__atomic_load_n(&keyboard->busy, __ATOMIC_ACQUIRE)) {
+            keyboard->leds = 0;
+            keyboard->wanted = 0;
+            keyboard->handle = hid_device_handle;
+            return;
         }
     }
+}
+
+static void keyboard_remove(hid_host_device_handle_t hid_device_handle) {
+    for (int i = 0; i < KEYBOARD_MAX_DEVICES; ++i) {
+        if (keyboards[i].handle == hid_device_handle)
+            keyboards[i].handle = NULL;
+    }
+}
 
-    memcpy(prev_keys, &kb_report->key, HID_KEYBOARD_KEY_MAX);
+static bool keyboard_leds_claim(keyboard_t *keyboard) {
+    bool idle = false;
+    return __atomic_compare_exchange_n(&keyboard->busy, &idle, true, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static void keyboard_leds_done(hid_host_device_handle_t hid_device_handle,
+                               esp_err_t status, void *arg);
+
+/* Called by whoever claimed the keyboard */
+static void keyboard_leds_send(hid_host_device_handle_t hid_device_handle,
+                               keyboard_t *keyboard) {
+    keyboard->leds = __atomic_load_n(&keyboard->wanted, __ATOMIC_SEQ_CST);
+    if (hid_class_request_set_report_async(
+            hid_device_handle, HID_REPORT_TYPE_OUTPUT, 0, &keyboard->leds,
+            sizeof(keyboard->leds), keyboard_leds_done, keyboard) != ESP_OK)
+        __atomic_store_n(&keyboard->busy, false, __ATOMIC_SEQ_CST);
+}
+
+/* Runs in the HID host task */
+static void keyboard_leds_done(hid_host_device_handle_t hid_device_handle,
+                               esp_err_t status, void *arg) {
+    keyboard_t *keyboard = arg;
+    if (status != ESP_OK && status != ESP_ERR_INVALID_STATE)
+        ESP_LOGD(TAG, "SET_REPORT failed: %s", esp_err_to_name(status));
+    __atomic_store_n(&keyboard->busy, false, __ATOMIC_SEQ_CST);
+    // The keyboard is gone on ESP_ERR_INVALID_STATE
+    const uint8_t wanted = __atomic_load_n(&keyboard->wanted, __ATOMIC_SEQ_CST);
+    if (status != ESP_ERR_INVALID_STATE && wanted != keyboard->leds &&
+        keyboard_leds_claim(keyboard))
+        keyboard_leds_send(hid_device_handle, keyboard);
+}
+
+void usb_hid_set_leds(uint8_t leds) {
+    for (int i = 0; i < KEYBOARD_MAX_DEVICES; ++i) {
+        keyboard_t *keyboard = &keyboards[i];
+        if (!keyboard->handle)
+            continue;
+        __atomic_store_n(&keyboard->wanted, leds, __ATOMIC_SEQ_CST);
+        if (keyboard_leds_claim(keyboard))
+            keyboard_leds_send(keyboard->handle, keyboard);
+    }
+}
+
+static void keyboard_text_callback(const char *text, size_t length,
+                                   void *arg) {
+    (void)arg;
+    trace_record(TRACE_KEY, length ? (uint8_t)text[0] : 0, length);
+    if (key_text_callback)
+        key_text_callback(text, length);
+}
+
+void usb_hid_flush_text(void) {
+    keyboard_decoder_flush(&keyboard_decoder);
+}
+
+/* Settings saved since the last keyboard connected apply from now on */
+static void keyboard_configure(void) {
+    text_decoder_config_t config;
+    if (!text_decoder_parse_config(app_config_get()->keyboard, &config)) {
+        ESP_LOGW(TAG, "Invalid keyboard setting \"%s\", using defaults",
+                 app_config_get()->keyboard);
+        text_decoder_parse_config("", &config);
+    }
+    keyboard_decoder_configure(&keyboard_decoder, &config);
 }
 
 /**
@@ -284,28 +468,44 @@ static void hid_host_keyboard_report_callback(const uint8_t *const data,
  *
  * @param[in] hid_device_handle  HID Device handle
  * @param[in] event              HID Host interface event
- * @param[in] arg                Pointer to arguments, does not used
+ * @param[in] data               Input report data
+ * @param[in] data_length        Input report length
+ * @param[in] arg                Generic device, NULL for a keyboard
  */
 void hid_host_interface_event(hid_host_device_handle_t hid_device_handle,
                               const hid_host_interface_event_t event,
+                              const uint8_t *data, size_t data_length,
                               void *arg) {
-    uint8_t data[64] = {0};
-    size_t data_length = 0;
     hid_host_dev_params_t dev_params;
     ESP_ERROR_CHECK(hid_host_device_get_params(hid_device_handle, &dev_params));
+    generic_device_t *generic = arg;
 
     switch (event) {
     case HID_HOST_INTERFACE_EVENT_INPUT_REPORT:
-        ESP_ERROR_CHECK(hid_host_device_get_raw_input_report_data(
-            hid_device_handle, data, sizeof(data), &data_length));
-        hid_host_keyboard_report_callback(data, data_length);
+        if (generic) {
+            hid_event_bridge_feed(&generic->bridge, data, data_length,
+                                  esp_timer_get_time());
+            break;
+        }
+        hid_capture_record(data, data_length);
+        keyboard_decoder_feed(&keyboard_decoder, data, data_length);
         break;
     case HID_HOST_INTERFACE_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "HID Device DISCONNECTED");
+        // Its last reports were queued before, and need the device
+        if (generic)
+            generic_reports_handle();
         ESP_ERROR_CHECK(hid_host_device_close(hid_device_handle));
+        __atomic_fetch_sub(&started_devices, 1, __ATOMIC_RELAXED);
+        recovery_disconnected(hid_device_handle);
+        if (generic)
+            generic_device_remove(generic);
+        else
+            keyboard_remove(hid_device_handle);
         break;
     case HID_HOST_INTERFACE_EVENT_TRANSFER_ERROR:
         ESP_LOGI(TAG, "HID Device TRANSFER_ERROR");
+        recovery_transfer_error(hid_device_handle);
         break;
     default:
         ESP_LOGE(TAG, "HID Device Unhandled event");
@@ -316,15 +516,206 @@ void hid_host_interface_event(hid_host_device_handle_t hid_device_handle,
 void hid_host_interface_callback(hid_host_device_handle_t hid_device_handle,
                                  const hid_host_interface_event_t event,
                                  void *arg) {
-    const app_event_queue_t evt_queue = {.event_group =
-                                             APP_EVENT_HID_HOST_INTERFACE,
-                                         .device_handle = hid_device_handle,
-                                         .interface_event = event,
-                                         .arg = arg};
+    app_event_queue_t evt_queue = {.event_group = APP_EVENT_HID_HOST_INTERFACE,
+                                   .device_handle = hid_device_handle,
+                                   .interface_event = event,
+                                   .arg = arg};
+    if (event == HID_HOST_INTERFACE_EVENT_INPUT_REPORT) {
+        hid_host_device_get_raw_input_report_data(
+            hid_device_handle, evt_queue.report, sizeof(evt_queue.report),
+            &evt_queue.report_length);
+        trace_record(TRACE_REPORT, evt_queue.report_length, 0);
+    }
+
+    app_event_send(&evt_queue);
+}
+
+/*
+ * Bring-up of a new keyboard is a chain of class requests on the control
+ * endpoint. Each step is submitted from the completion of the previous one,
+ * so neither the app task nor the HID host task waits for the device, and a
+ * slow device does not hold back input reports of the others.
+ *
+ * A device model found in the device cache is started before the chain, which
+ * then only validates and refreshes the cached profile. The chain still sets
+ * boot protocol and idle, so a stale entry costs at most the first reports.
+ *
+ * The state of a chain lives in a static slot, taken by the app task and
+ * given back by whichever task ends the chain.
+ */
+#define BRING_UP_MAX_DEVICES CONFIG_USB_HOST_HID_MAX_INTERFACES
+
+typedef struct {
+    device_cache_key_t key;
+    bool cached;
+    bool report_desc;
+    uint8_t flags;
+    bool in_use;
+} bring_up_t;
+
+static bring_up_t bring_ups[BRING_UP_MAX_DEVICES];
+
+static bring_up_t *bring_up_take(void) {
+    for (int i = 0; i < BRING_UP_MAX_DEVICES; ++i) {
+        bring_up_t *bring_up = &bring_ups[i];
+        if (!__atomic_load_n(&bring_up->in_use, __ATOMIC_ACQUIRE)) {
+            *bring_up = (bring_up_t){.in_use = true};
+            return bring_up;
+        }
+    }
+    return NULL;
+}
+
+static void bring_up_release(bring_up_t *bring_up) {
+    if (bring_up)
+        __atomic_store_n(&bring_up->in_use, false, __ATOMIC_RELEASE);
+}
 
-    if (app_event_queue) {
-        xQueueSend(app_event_queue, &evt_queue, 0);
+/*
+ * Closing an open device raises DISCONNECTED, which does the rest. A request
+ * failing with ESP_ERR_INVALID_STATE was dropped because the device is gone,
+ * and its DISCONNECTED is already on the way.
+ */
+static void bring_up_fail(hid_host_device_handle_t hid_device_handle,
+                          bring_up_t *bring_up, esp_err_t status) {
+    if (status != ESP_ERR_INVALID_STATE)
+        hid_host_device_close(hid_device_handle);
+    bring_up_release(bring_up);
+}
+
+static void bring_up_idle_done(hid_host_device_handle_t hid_device_handle,
+                               esp_err_t status, void *arg) {
+    bring_up_t *bring_up = arg;
+    if (status == ESP_OK)
+        bring_up->flags |= DEVICE_PROFILE_IDLE;
+    else
+        ESP_LOGW(TAG, "SET_IDLE failed: %s", esp_err_to_name(status));
+
+    if (!bring_up->cached) {
+        const esp_err_t err = hid_host_device_start(hid_device_handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to start HID Device: %s",
+                     esp_err_to_name(err));
+            bring_up_fail(hid_device_handle, bring_up, err);
+            return;
+        }
+        // Recovery state belongs to the app task
+        const app_event_queue_t evt_queue = {
+            .event_group = APP_EVENT_DEVICE_STARTED,
+            .device_handle = hid_device_handle};
+        app_event_send(&evt_queue);
     }
+
+    // Without a descriptor there is nothing to validate against
+    size_t length = 0;
+    const uint8_t *report_desc =
+        bring_up->report_desc
+            ? hid_host_get_report_descriptor(hid_device_handle, &length)
+            : NULL;
+    if (report_desc &&
+        device_cache_update(&bring_up->key, report_desc, length,
+                            bring_up->flags) &&
+        bring_up->cached)
+        ESP_LOGW(TAG, "Cached profile of %04x:%04x was outdated",
+                 bring_up->key.vid, bring_up->key.pid);
+    bring_up_release(bring_up);
+}
+
+static void bring_up_protocol_done(hid_host_device_handle_t hid_device_handle,
+                                   esp_err_t status, void *arg) {
+    if (status == ESP_OK)
+        status = hid_class_request_set_idle_async(hid_device_handle, 0, 0,
+                                                  bring_up_idle_done, arg);
+    if (status != ESP_OK) {
+        ESP_LOGE(TAG, "SET_PROTOCOL failed: %s", esp_err_to_name(status));
+        bring_up_fail(hid_device_handle, arg, status);
+    }
+}
+
+static void bring_up_report_descriptor_done(
+    hid_host_device_handle_t hid_device_handle, esp_err_t status, void *arg) {
+    bring_up_t *bring_up = arg;
+    // Bring-up does not depend on the descriptor, a failure only skips the
+    // cache update
+    bring_up->report_desc = status == ESP_OK;
+    status = hid_class_request_set_protocol_async(
+        hid_device_handle, HID_REPORT_PROTOCOL_BOOT, bring_up_protocol_done,
+        bring_up);
+    if (status != ESP_OK) {
+        ESP_LOGE(TAG, "SET_PROTOCOL failed: %s", esp_err_to_name(status));
+        bring_up_fail(hid_device_handle, bring_up, status);
+    }
+}
+
+static void generic_report_descriptor_done(
+    hid_host_device_handle_t hid_device_handle, esp_err_t status, void *arg) {
+    generic_device_t *generic = arg;
+    // The device is gone and freed on DISCONNECTED
+    if (status == ESP_ERR_INVALID_STATE)
+        return;
+
+    size_t length = 0;
+    const uint8_t *report_desc =
+        status == ESP_OK
+            ? hid_host_get_report_descriptor(hid_device_handle, &length)
+            : NULL;
+    if (!report_desc ||
+        !hid_event_bridge_init(&generic->bridge, &generic->config,
+                               report_desc, length, generic->name,
+                               generic_publish, NULL)) {
+        ESP_LOGE(TAG, "No usable report descriptor for %s", generic->name);
+        hid_host_device_close(hid_device_handle);
+        return;
+    }
+    status = hid_host_device_start(hid_device_handle);
+    if (status != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to start HID Device: %s",
+                 esp_err_to_name(status));
+        hid_host_device_close(hid_device_handle);
+        return;
+    }
+    ESP_LOGI(TAG, "Bridging events of %s, %d fields", generic->name,
+             generic->bridge.layout.field_count);
+    __atomic_store_n(&generic->ready, true, __ATOMIC_RELEASE);
+    // A power cycle by recovery waits for any device behind the port
+    const app_event_queue_t evt_queue = {
+        .event_group = APP_EVENT_DEVICE_STARTED,
+        .device_handle = hid_device_handle};
+    app_event_send(&evt_queue);
+}
+
+static void generic_device_connect(hid_host_device_handle_t hid_device_handle) {
+    hid_event_bridge_config_t config;
+    if (!hid_event_bridge_parse_config(app_config_get()->hid_events,
+                                       &config)) {
+        ESP_LOGE(TAG, "Error: can only support boot keyboards, unless "
+                      "generic HID events are enabled");
+        return;
+    }
+    int slot = 0;
+    while (slot < GENERIC_MAX_DEVICES && generic_devices[slot].in_use)
+        ++slot;
+    hid_host_dev_info_t dev_info;
+    if (slot == GENERIC_MAX_DEVICES ||
+        hid_host_get_device_info(hid_device_handle, &dev_info) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to bring up generic HID Device");
+        return;
+    }
+    generic_device_t *generic = &generic_devices[slot];
+    generic->config = config;
+    snprintf(generic->name, sizeof(generic->name), "%04x:%04x", dev_info.VID,
+             dev_info.PID);
+
+    const hid_host_device_config_t dev_config = {
+        .callback = hid_host_interface_callback, .callback_arg = generic};
+    ESP_ERROR_CHECK(hid_host_device_open(hid_device_handle, &dev_config));
+    __atomic_fetch_add(&started_devices, 1, __ATOMIC_RELAXED);
+    generic->in_use = true;
+
+    if (hid_host_get_report_descriptor_async(hid_device_handle,
+                                             generic_report_descriptor_done,
+                                             generic) != ESP_OK)
+        hid_host_device_close(hid_device_handle);
 }
 
 /**
@@ -336,19 +727,16 @@ void hid_host_interface_callback(hid_host_device_handle_t hid_device_handle,
  */
 void hid_host_device_event(hid_host_device_handle_t hid_device_handle,
                            const hid_host_driver_event_t event, void *arg) {
+    (void)arg;
     hid_host_dev_params_t dev_params;
     ESP_ERROR_CHECK(hid_host_device_get_params(hid_device_handle, &dev_params));
 
     switch (event) {
     case HID_HOST_DRIVER_EVENT_CONNECTED:
         ESP_LOGI(TAG, "HID Device, protocol %d CONNECTED", dev_params.proto);
-        if (dev_params.proto != HID_PROTOCOL_KEYBOARD) {
-            ESP_LOGE(TAG, "Error: can only support HID_PROTOCOL_KEYBOARD");
-            break;
-        }
-        if (dev_params.sub_class != HID_SUBCLASS_BOOT_INTERFACE) {
-            ESP_LOGE(TAG,
-                     "Error: can only support HID_SUBCLASS_BOOT_INTERFACE");
+        if (dev_params.proto != HID_PROTOCOL_KEYBOARD ||
+            dev_params.sub_class != HID_SUBCLASS_BOOT_INTERFACE) {
+            generic_device_connect(hid_device_handle);
             break;
         }
 
@@ -356,16 +744,38 @@ void hid_host_device_event(hid_host_device_handle_t hid_device_handle,
             .callback = hid_host_interface_callback, .callback_arg = NULL};
 
         ESP_ERROR_CHECK(hid_host_device_open(hid_device_handle, &dev_config));
+        __atomic_fetch_add(&started_devices, 1, __ATOMIC_RELAXED);
+        keyboard_add(hid_device_handle);
+        keyboard_configure();
+
+        bring_up_t *bring_up = bring_up_take();
+        hid_host_dev_info_t dev_info;
+        if (!bring_up ||
+            hid_host_get_device_info(hid_device_handle, &dev_info) != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to bring up HID Device");
+            bring_up_fail(hid_device_handle, bring_up, ESP_FAIL);
+            break;
+        }
+        bring_up->key = (device_cache_key_t){.vid = dev_info.VID,
+                                             .pid = dev_info.PID,
+                                             .bcd_device = dev_info.bcdDevice};
+
+        device_profile_t profile;
+        if (device_cache_lookup(&bring_up->key, &profile) == ESP_OK &&
+            hid_host_device_start(hid_device_handle) == ESP_OK) {
+            ESP_LOGI(TAG, "Known device %04x:%04x, started from cache",
+                     bring_up->key.vid, bring_up->key.pid);
+            bring_up->cached = true;
+            recovery_device_started();
+        }
 
-        // At least the Tera HW0007 barcode reader needs this call to
+        // At least the Tera HW0007 barcode reader needs this request to
         // actually report any keypresses later
-        size_t dummy = 0;
-        hid_host_get_report_descriptor(hid_device_handle, &dummy);
-
-        ESP_ERROR_CHECK(hid_class_request_set_protocol(
-            hid_device_handle, HID_REPORT_PROTOCOL_BOOT));
-        ESP_ERROR_CHECK(hid_class_request_set_idle(hid_device_handle, 0, 0));
-        ESP_ERROR_CHECK(hid_host_device_start(hid_device_handle));
+        if (hid_host_get_report_descriptor_async(
+                hid_device_handle, bring_up_report_descriptor_done,
+                bring_up) != ESP_OK)
+            bring_up_report_descriptor_done(hid_device_handle, ESP_FAIL,
+                                            bring_up);
         break;
     default:
         break;
@@ -409,16 +819,16 @@ void hid_host_device_callback(hid_host_device_handle_t hid_device_handle,
                                          .driver_event = event,
                                          .arg = arg};
 
-    if (app_event_queue) {
-        xQueueSend(app_event_queue, &evt_queue, 0);
-    }
+    app_event_send(&evt_queue);
 }
 
-void usb_hid_start(key_char_cb_t key_char_cb) {
+void usb_hid_start(key_text_cb_t key_text_cb, hid_event_cb_t hid_event_cb) {
     BaseType_t task_created;
     ESP_LOGI(TAG, "Keyboard HID Host");
 
-    key_char_callback = key_char_cb;
+    key_text_callback = key_text_cb;
+    hid_event_callback = hid_event_cb;
+    keyboard_decoder_init(&keyboard_decoder, keyboard_text_callback, NULL);
 
     /*
      * Create usb_lib_task to:
@@ -429,11 +839,16 @@ void usb_hid_start(key_char_cb_t key_char_cb) {
         xTaskCreatePinnedToCore(usb_lib_task, "usb_events", 4096,
                                 xTaskGetCurrentTaskHandle(), 2, NULL, 0);
     assert(task_created == pdTRUE);
+    (void)task_created;
 
     // Wait for notification from usb_lib_task to proceed
     ulTaskNotifyTake(false, 1000);
 
-    app_event_queue = xQueueCreate(10, sizeof(app_event_queue_t));
+    app_task = xTaskGetCurrentTaskHandle();
+    app_event_queue =
+        xQueueCreate(APP_EVENT_QUEUE_SIZE, sizeof(app_event_queue_t));
+    generic_report_queue =
+        xQueueCreate(GENERIC_REPORT_QUEUE_SIZE, sizeof(app_event_queue_t));
 
     /*
      * HID host driver configuration
@@ -453,15 +868,49 @@ void usb_hid_start(key_char_cb_t key_char_cb) {
     ESP_ERROR_CHECK(hid_host_install(&hid_host_driver_config));
 }
 
+bool usb_hid_is_connected(void) {
+    return started_devices > 0;
+}
+
+uint32_t usb_hid_dropped_events(void) {
+    return dropped_events;
+}
+
+void usb_hid_recovery_stats(uint32_t *count, uint32_t *last_ms,
+                            uint32_t *max_ms) {
+    *count = recovery_count;
+    *last_ms = recovery_last_ms;
+    *max_ms = recovery_max_ms;
+}
+
+uint32_t usb_hid_queue_peak_depth(bool reset) {
+    const uint32_t peak = app_event_peak_depth;
+    if (reset)
+        app_event_peak_depth = 0;
+    return peak;
+}
+
 void usb_hid_handle_events(void) {
+    // At most one wait for app events late, the bridge batches them anyway
+    generic_reports_handle();
     app_event_queue_t evt_queue;
     if (xQueueReceive(app_event_queue, &evt_queue, pdMS_TO_TICKS(10))) {
+        trace_record(TRACE_QUEUE_DEPTH, TRACE_QUEUE_APP_EVENT,
+                     uxQueueMessagesWaiting(app_event_queue));
         if (APP_EVENT_HID_HOST_DEVICE == evt_queue.event_group) {
             hid_host_device_event(evt_queue.device_handle,
                                   evt_queue.driver_event, evt_queue.arg);
         } else if (APP_EVENT_HID_HOST_INTERFACE == evt_queue.event_group) {
             hid_host_interface_event(evt_queue.device_handle,
-                                     evt_queue.interface_event, evt_queue.arg);
+                                     evt_queue.interface_event,
+                                     evt_queue.report, evt_queue.report_length,
+                                     evt_queue.arg);
+        } else if (APP_EVENT_RECOVERY == evt_queue.event_group) {
+            recovery_clear_done(evt_queue.device_handle, evt_queue.status);
+        } else if (APP_EVENT_DEVICE_STARTED == evt_queue.event_group) {
+            recovery_device_started();
         }
     }
+    recovery_poll();
+    generic_devices_poll();
 }
@@ -4,13 +4,38 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef void (*key_char_cb_t)(char);
-void usb_hid_start(key_char_cb_t);
+/** UTF-8 text typed on a keyboard, with length 0 for keys typing none yet */
+typedef void (*key_text_cb_t)(const char *text, size_t length);
+/** A batch of usage value changes of a generic HID device, as JSON */
+typedef void (*hid_event_cb_t)(const char *batch, size_t length);
+void usb_hid_start(key_text_cb_t, hid_event_cb_t);
 void usb_hid_handle_events(void);
+/** Pass on text the keyboards hold back, such as a dead key, app task only */
+void usb_hid_flush_text(void);
+bool usb_hid_is_connected(void);
+/** HID events lost because the app task did not keep up */
+uint32_t usb_hid_dropped_events(void);
+/** Highest number of HID events waiting for the app task, optionally reset */
+uint32_t usb_hid_queue_peak_depth(bool reset);
+/**
+ * Set the LEDs of all keyboards, bits as in the boot keyboard output report.
+ * Returns right away, from the app task only.
+ */
+void usb_hid_set_leds(uint8_t leds);
+/**
+ * Recoveries from transfer errors, and the time to recover of the last and
+ * the slowest one
+ */
+void usb_hid_recovery_stats(uint32_t *count, uint32_t *last_ms,
+                            uint32_t *max_ms);
 
 #ifdef __cplusplus
 }
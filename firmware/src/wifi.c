@@ -3,8 +3,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "wifi.h"
-
-#include <string.h>
+#include "trace.h"
 
 #include <esp_log.h>
 #include <esp_wifi.h>
@@ -14,10 +13,12 @@ static const char *TAG = "wifi";
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data) {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        trace_record(TRACE_WIFI, TRACE_WIFI_START, 0);
         esp_wifi_connect();
     } else if (event_base == WIFI_EVENT &&
                event_id == WIFI_EVENT_STA_DISCONNECTED) {
         wifi_event_sta_disconnected_t *disconn = event_data;
+        trace_record(TRACE_WIFI, TRACE_WIFI_DISCONNECTED, disconn->reason);
         if (disconn->reason == WIFI_REASON_ROAMING) {
             ESP_LOGI(TAG, "station disconnected during roaming");
         } else {
@@ -27,6 +28,7 @@ static void event_handler(void *arg, esp_event_base_t event_base,
         }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        trace_record(TRACE_WIFI, TRACE_WIFI_GOT_IP, 0);
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
     }
 }
@@ -44,7 +46,7 @@ void wifi_init_sta(void) {
 
     wifi_config_t conf;
     ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &conf));
-    if (!strlen((char *)conf.sta.ssid))
+    if (!conf.sta.ssid[0])
         ESP_LOGW(TAG, "No wifi config found in NVS");
 
     esp_event_handler_instance_t instance_any_id;
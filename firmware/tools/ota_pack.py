@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+# SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+"""Pack application images for OTA updates.
+
+Produces the packed image formats understood by src/ota_image.c:
+
+  compress IMAGE        zlib-compressed full application image
+  delta BASE IMAGE      zlib-compressed delta that rebuilds IMAGE on a device
+                        currently running BASE
+  unpack PACKED         reverse either format, for verification
+
+See src/ota_image.c for a description of the format.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+MAGIC = b"H2MO"
+VERSION = 1
+TYPE_COMPRESSED = 0
+TYPE_DELTA = 1
+HEADER = struct.Struct("<4sBBHI32s")
+
+OP_COPY = 0
+OP_ADD = 1
+
+BLOCK_SIZE = 16  # granularity of the base image index
+MIN_COPY = 24  # shorter matches are cheaper as literals
+
+
+def image_digest(image):
+    """Return the appended SHA-256 digest of an application image.
+
+    This is what esp_partition_get_sha256() reports for the running app.
+    """
+    if len(image) < 32 or hashlib.sha256(image[:-32]).digest() != image[-32:]:
+        sys.exit("base image has no appended SHA-256 digest")
+    return image[-32:]
+
+
+def delta_ops(base, image):
+    """Yield (op, arg, data) tuples that rebuild image from base."""
+    index = {}
+    for pos in range(0, len(base) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        index.setdefault(base[pos : pos + BLOCK_SIZE], pos)
+
+    literal_start = 0
+    pos = 0
+    while pos + BLOCK_SIZE <= len(image):
+        src = index.get(image[pos : pos + BLOCK_SIZE])
+        if src is None:
+            pos += 1
+            continue
+        # Extend the match in both directions
+        start, src_start = pos, src
+        while (
+            start > literal_start
+            and src_start > 0
+            and image[start - 1] == base[src_start - 1]
+        ):
+            start -= 1
+            src_start -= 1
+        end, src_end = pos + BLOCK_SIZE, src + BLOCK_SIZE
+        while end < len(image) and src_end < len(base) and image[end] == base[src_end]:
+            end += 1
+            src_end += 1
+        if end - start < MIN_COPY:
+            pos += 1
+            continue
+        if start > literal_start:
+            yield OP_ADD, start - literal_start, image[literal_start:start]
+        yield OP_COPY, src_start, end - start
+        literal_start = pos = end
+    if literal_start < len(image):
+        yield OP_ADD, len(image) - literal_start, image[literal_start:]
+
+
+def encode_delta(base, image):
+    out = bytearray()
+    for op, arg, data in delta_ops(base, image):
+        if op == OP_COPY:
+            out += struct.pack("<BII", OP_COPY, arg, data)
+        else:
+            out += struct.pack("<BI", OP_ADD, arg) + data
+    return bytes(out)
+
+
+def decode_delta(base, ops):
+    image = bytearray()
+    pos = 0
+    while pos < len(ops):
+        if ops[pos] == OP_COPY:
+            src, length = struct.unpack_from("<II", ops, pos + 1)
+            image += base[src : src + length]
+            pos += 9
+        elif ops[pos] == OP_ADD:
+            (length,) = struct.unpack_from("<I", ops, pos + 1)
+            image += ops[pos + 5 : pos + 5 + length]
+            pos += 5 + length
+        else:
+            sys.exit(f"invalid delta operation {ops[pos]} at {pos}")
+    return bytes(image)
+
+
+def pack(kind, image, payload, base_digest=bytes(32)):
+    header = HEADER.pack(MAGIC, VERSION, kind, 0, len(image), base_digest)
+    return header + zlib.compress(payload, 9)
+
+
+def cmd_compress(args):
+    image = args.image.read()
+    return pack(TYPE_COMPRESSED, image, image)
+
+
+def cmd_delta(args):
+    base = args.base.read()
+    image = args.image.read()
+    packed = pack(TYPE_DELTA, image, encode_delta(base, image), image_digest(base))
+    if decode_delta(base, zlib.decompress(packed[HEADER.size :])) != image:
+        sys.exit("delta does not reproduce the image")
+    return packed
+
+
+def cmd_unpack(args):
+    packed = args.packed.read()
+    magic, version, kind, _, size, base_digest = HEADER.unpack_from(packed)
+    if magic != MAGIC or version != VERSION:
+        sys.exit("not a packed image")
+    payload = zlib.decompress(packed[HEADER.size :])
+    if kind == TYPE_DELTA:
+        if not args.base:
+            sys.exit("delta image needs --base")
+        base = args.base.read()
+        if image_digest(base) != base_digest:
+            sys.exit("delta was built for a different base image")
+        payload = decode_delta(base, payload)
+    if len(payload) != size:
+        sys.exit("unpacked image has the wrong size")
+    return payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("compress", help="compress a full image")
+    p.add_argument("image", type=argparse.FileType("rb"))
+    p.set_defaults(func=cmd_compress)
+
+    p = sub.add_parser("delta", help="create a delta against a base image")
+    p.add_argument("base", type=argparse.FileType("rb"))
+    p.add_argument("image", type=argparse.FileType("rb"))
+    p.set_defaults(func=cmd_delta)
+
+    p = sub.add_parser("unpack", help="restore the image from a packed one")
+    p.add_argument("packed", type=argparse.FileType("rb"))
+    p.add_argument("--base", type=argparse.FileType("rb"))
+    p.set_defaults(func=cmd_unpack)
+
+    for p in sub.choices.values():
+        p.add_argument("-o", "--output", type=argparse.FileType("wb"), required=True)
+
+    args = parser.parse_args()
+    out = args.func(args)
+    args.output.write(out)
+    if args.command != "unpack":
+        print(f"{args.output.name}: {len(out)} bytes", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
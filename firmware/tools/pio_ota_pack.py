@@ -0,0 +1,29 @@
+# SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+# PlatformIO post-build hook emitting packed OTA images next to firmware.bin:
+#   firmware.ota        compressed full image
+#   firmware.delta.ota  delta against custom_ota_delta_base, if configured
+
+Import("env")
+
+import os
+
+TOOL = os.path.join(env.subst("$PROJECT_DIR"), "tools", "ota_pack.py")
+
+
+def ota_pack(source, target, env):
+    image = str(target[0])
+    stem = os.path.splitext(image)[0]
+    env.Execute(f'"$PYTHONEXE" "{TOOL}" compress "{image}" -o "{stem}.ota"')
+
+    base = env.GetProjectOption("custom_ota_delta_base", "")
+    if base:
+        base = os.path.join(env.subst("$PROJECT_DIR"), base)
+        env.Execute(
+            f'"$PYTHONEXE" "{TOOL}" delta "{base}" "{image}" -o "{stem}.delta.ota"'
+        )
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", ota_pack)
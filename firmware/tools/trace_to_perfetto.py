@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# SPDX-FileCopyrightText: © 2025 Stefan Siegel <ssiegel@sdas.net>
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+"""Convert a trace upload to Chrome trace format.
+
+  mosquitto_sub -h broker -t hid2mqtt/trace -C 1 > device.h2mt &
+  mosquitto_pub -h broker -t hid2mqtt/trace/get -n
+  trace_to_perfetto.py device.h2mt device.json
+
+Open the result in https://ui.perfetto.dev or chrome://tracing. Times are
+device uptime once the trace contains a sync event. See src/trace.h for
+the format.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b"H2MT"
+VERSION = 1
+HEADER = struct.Struct("<4sB3xI")
+EVENT = struct.Struct("<IHHI")
+
+(SYNC, REPORT, KEY, SCAN_SUBMIT, PUBLISH, PUBLISH_ACK, WIFI, MQTT,
+ QUEUE_DEPTH) = range(9)
+WIFI_EVENTS = ["start", "disconnected", "got ip"]
+QUEUES = ["app_event_queue"]
+
+# Tracks in the viewer
+USB, APP, NETWORK = 1, 2, 3
+THREAD_NAMES = {USB: "usb", APP: "app", NETWORK: "network"}
+
+
+def read_events(data):
+    if len(data) < HEADER.size:
+        sys.exit("trace too short")
+    magic, version, ticks_per_us = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        sys.exit("not a trace of a supported version")
+    count = (len(data) - HEADER.size) // EVENT.size
+    events = [
+        EVENT.unpack_from(data, HEADER.size + i * EVENT.size) for i in range(count)
+    ]
+
+    # Unwrap the 32 bit cycle counter, events are less than a wrap apart
+    cycles = 0
+    previous = events[0][0] if events else 0
+    for cycle_count, event, arg16, arg32 in events:
+        cycles += (cycle_count - previous) & 0xFFFFFFFF
+        previous = cycle_count
+        yield cycles / ticks_per_us, event, arg16, arg32
+
+
+def convert(events):
+    out = [
+        {"ph": "M", "pid": 1, "tid": tid, "name": "thread_name", "args": {"name": name}}
+        for tid, name in THREAD_NAMES.items()
+    ]
+    offset = None
+    scan_start = None
+
+    def instant(ts, tid, name, **args):
+        out.append(
+            {"ph": "i", "s": "t", "pid": 1, "tid": tid, "ts": ts, "name": name,
+             "args": args}
+        )
+
+    events = list(events)
+    # Align to the first sync, which carries the uptime in ms
+    for ts, event, arg16, arg32 in events:
+        if event == SYNC:
+            offset = arg32 * 1000 - ts
+            break
+    offset = offset or 0
+
+    for ts, event, arg16, arg32 in events:
+        ts += offset
+        if event == SYNC:
+            continue
+        elif event == REPORT:
+            instant(ts, USB, "report", length=arg16)
+        elif event == KEY:
+            if scan_start is None:
+                scan_start = ts
+            instant(ts, APP, "key", char=chr(arg16) if 32 <= arg16 < 127 else arg16,
+                    length=arg32)
+        elif event == SCAN_SUBMIT:
+            start = scan_start if scan_start is not None else ts
+            out.append({"ph": "X", "pid": 1, "tid": APP, "ts": start, "dur": ts - start,
+                        "name": "scan", "args": {"length": arg16}})
+            scan_start = None
+        elif event == PUBLISH:
+            out.append({"ph": "b", "cat": "mqtt", "id": arg32, "pid": 1, "tid": NETWORK,
+                        "ts": ts, "name": "publish", "args": {"length": arg16}})
+        elif event == PUBLISH_ACK:
+            out.append({"ph": "e", "cat": "mqtt", "id": arg32, "pid": 1, "tid": NETWORK,
+                        "ts": ts, "name": "publish"})
+        elif event == WIFI:
+            name = WIFI_EVENTS[arg16] if arg16 < len(WIFI_EVENTS) else f"wifi {arg16}"
+            instant(ts, NETWORK, f"wifi {name}", reason=arg32)
+        elif event == MQTT:
+            instant(ts, NETWORK, "mqtt connected" if arg16 else "mqtt disconnected")
+        elif event == QUEUE_DEPTH:
+            name = QUEUES[arg16] if arg16 < len(QUEUES) else f"queue {arg16}"
+            out.append(
+                {"ph": "C", "pid": 1, "ts": ts, "name": name, "args": {"depth": arg32}}
+            )
+        else:
+            instant(ts, APP, f"event {event}", arg16=arg16, arg32=arg32)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace", type=argparse.FileType("rb"))
+    parser.add_argument(
+        "output", type=argparse.FileType("w"), nargs="?", default=sys.stdout
+    )
+    args = parser.parse_args()
+    json.dump(convert(read_events(args.trace.read())), args.output)
+
+
+if __name__ == "__main__":
+    main()